@@ -0,0 +1,51 @@
+#ifndef AIRTIME_H
+#define AIRTIME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tx_sched.h"
+
+// time on air of every frame this node sends, from the payload length and the module's
+// AT+PARAMETER (spreading factor, bandwidth, coding rate, preamble), against a rolling
+// duty cycle budget. the window is split into AIRTIME_BUCKETS slices that age out one at
+// a time. urgent frames may use all of the budget, the other classes stop short of it so
+// acks still get out when the node has been talking a lot.
+//
+// SYS+DUTY=<permille>[,<window s>] changes the budget, 0 permille turns it off
+
+#ifndef AIRTIME_DUTY_PERMILLE
+#define AIRTIME_DUTY_PERMILLE   (100)       // 10%. EU868 sub bands need 10 (1%) over an hour
+#endif
+#define AIRTIME_WINDOW_S        (600)
+#define AIRTIME_BUCKETS         (60)
+#define AIRTIME_URGENT_RESERVE  (10)        // percent of the budget only urgent frames use
+
+// RYLR998 defaults until the module answers AT+PARAMETER?
+#define AIRTIME_DEFAULT_SF       (9)
+#define AIRTIME_DEFAULT_BW       (7)        // 125 kHz, 8 = 250, 9 = 500
+#define AIRTIME_DEFAULT_CR       (1)        // 4/5
+#define AIRTIME_DEFAULT_PREAMBLE (12)
+
+typedef struct {
+    uint32_t class_ms[TX_CLASS_COUNT];      // on air since boot, per class
+    uint32_t window_used_ms;
+    uint32_t window_budget_ms;              // 0 without a budget
+    uint32_t held;                          // times a frame had to wait for budget
+} AirtimeStats;
+
+void airtime_init(void);
+// "+PARAMETER=<sf>,<bw>,<cr>,<preamble>" or "AT+PARAMETER=...", false if it is neither
+bool airtime_parse_parameters(const char *line);
+// 0 (or 1000 and up) for no limit
+void airtime_set_duty(uint32_t permille, uint32_t window_s);
+uint32_t airtime_frame_ms(size_t payload_len);
+// how long until a frame of that class and airtime fits the budget, 0 if it does now
+uint32_t airtime_wait_ms(TxClass tx_class, uint32_t frame_ms);
+void airtime_charge(TxClass tx_class, uint32_t frame_ms);
+void airtime_note_held(void);
+void airtime_stats(AirtimeStats *out);
+int format_airtime_as_json(char *out, int buff_size);
+
+#endif // AIRTIME_H
@@ -0,0 +1,45 @@
+#ifndef AT_ENGINE_H
+#define AT_ENGINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "data_table.h"
+#include "line_ring.h"
+
+// commands written to the module that have not been answered yet. the module works through
+// its input in order, so the next AT+SEND can already sit in its buffer while it is on air
+#ifndef AT_MAX_IN_FLIGHT
+#define AT_MAX_IN_FLIGHT (2)
+#endif
+
+#define AT_RESPONSE_LEN  (40)
+// per command, counted from when it is next in line. an AT+SEND gets its frame's airtime
+// on top (at_send_timeout_ms), at SF11/SF12 a full frame alone is longer than this
+#define AT_TIMEOUT_MS    (2000)
+
+// runs on the engine task once the module answered, response is "" on timeout. answers
+// only say which command they belong to by their order, so once one timed out whatever
+// else was in flight fails with it and the answers still coming are thrown away, nothing
+// new is written until they are in or have had the time to be
+typedef void (*AtCallback)(MessageSendingStatus status, const char *response, void *ctx);
+
+// responses is the queue of LineSlice the uart reader fills with everything that is not +RCV
+void at_engine_init(QueueHandle_t responses, LineRing *ring);
+// writes cmd to the module, waits up to `wait` for an in flight slot. false if none came free.
+// timeout_ms is how long the module may take to answer it, 0 for AT_TIMEOUT_MS
+bool at_submit(const char *cmd, size_t len, uint32_t timeout_ms, AtCallback callback, void *ctx, TickType_t wait);
+// for an AT+SEND of payload_len bytes
+uint32_t at_send_timeout_ms(size_t payload_len);
+// waits up to `wait` for an in flight slot without taking it, and for late answers after
+// a timeout to be done with, so the caller can decide what goes into it only once at_submit
+// would write it. only holds while nobody else submits meanwhile
+bool at_engine_wait_slot(TickType_t wait);
+// nothing written and unanswered, the radio is not busy because of us
+bool at_engine_idle(void);
+
+#endif // AT_ENGINE_H
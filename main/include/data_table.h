@@ -1,9 +1,13 @@
 #ifndef DATA_TABLE_H
 #define DATA_TABLE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 
 #include "node_globals.h"
+#include "json_writer.h"
 
 typedef enum {
     MSG_AT_SOURCE,      // originated here
@@ -18,7 +22,8 @@ typedef enum {
     CRITICAL,
     MAINTENANCE,
     PING,
-    COMMAND
+    COMMAND,
+    FRAGMENT            // piece of a message too long for one frame (fragment.h)
 } MessageType;
 
 typedef enum {
@@ -52,11 +57,63 @@ typedef struct data_entry_struct {
 
 } DataEntry;
 
+#define MSG_TYPE_COUNT (FRAGMENT + 1)
+
+// what the table keeps before it starts dropping messages. every type is guaranteed its
+// quota of entries, anything above that is borrowed and goes first when space runs out
+typedef struct {
+    int max_entries;
+    size_t max_bytes;           // content block bytes
+    uint32_t max_age_s;         // 0 keeps messages until space runs out
+    uint16_t quota[MSG_TYPE_COUNT];
+} RetentionPolicy;
+
 ID create_command(char *content);
 ID create_data_object(int id, MessageType type, char *content, int src, int dst, int origin, int steps, int rssi, int snr, ID ack_for);
+// entry for content longer than a frame (up to MSG_STORE_BLOB_MAX) with room for `room`
+// bytes, starting out with the first len. the rest is filled in through msg_write_content()
+// later. one of ours to send goes in as QUEUED so nothing drops it before it is out
+ID create_blob_object(int id, MessageType type, const char *content, size_t len, size_t room, int src, int dst, int origin, MessageSendingStatus status);
 void free_data_object(DataEntry **ptr);
 void msg_table_init(void);
-int format_data_as_json(DataEntry *, char *, int);
+void write_data_json(JsonWriter *w, const DataEntry *data);
+// room for the content of any entry, blobs (MSG_STORE_BLOB_MAX) included, and the NUL
+#define MSG_COPY_MAX (2048 + 1)
+// what /api/messages asks for. peer and type are looked up in indexes of their own, stage
+// is checked on whatever those give
+typedef struct {
+    ID peer;                    // sent from here to peer or from peer to here, NO_ID for any
+    int type;                   // MessageType, 0 for any
+    int stage;                  // MessageRouteStage, -1 for any
+    ID since;                   // only ones newer than it, all of them when it is gone
+} MsgQuery;
+// walks the messages that match q newest first without holding the table between calls,
+// copying each one out with its content. NO_ID for the newest match, then the id it
+// returned; any id in the table works, the ones older than it come next. NO_ID after the
+// last match or when `newer` was dropped in the mean time
+ID msg_query_next(const MsgQuery *q, ID newer, DataEntry *out, char *content, size_t cap);
+// false when it is no longer in the table
+bool msg_copy(ID id, DataEntry *out, char *content, size_t cap);
+// goes up with every entry added or dropped and every msg_changed()
+uint32_t msg_table_version(void);
+// call after changing an entry's status, ack or content in place
+void msg_changed(ID id);
+// the pointer stays the entry's only as long as nothing drops it, the store recycles
+// slots. anything that waits in between or writes goes through the id instead
 DataEntry *msg_find(int key);
+// these find id again under the table lock, false (-1) when it is no longer there.
+// src_node is read at the same time, for sending the ack on. msg_changed() included
+bool msg_set_ack(ID id, int ack_status, ID *src_node);
+int msg_ack_status(ID id);
+bool msg_set_status(ID id, MessageSendingStatus status);
+// n bytes at off into content, false as well when they don't fit the entry's block
+bool msg_write_content(ID id, size_t off, const void *buf, size_t n);
+// the first len bytes of content are filled in, it ends there. false when it is gone or
+// was that long already. no msg_changed(), the caller has more to change
+bool msg_content_ready(ID id, size_t len);
+void msg_table_get_policy(RetentionPolicy *out);
+// limits above what the store can hold are clamped to it
+void msg_table_set_policy(const RetentionPolicy *policy);
+int format_msg_stats_as_json(char *out, int buff_size);
 
 #endif // DATA_TABLE_H
@@ -0,0 +1,53 @@
+#ifndef EVENT_BUS_H
+#define EVENT_BUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "node_globals.h"
+
+// what changed, for the web page to pick up without polling (GET /api/events). an event
+// only says which message or node it was, whoever sends it on looks the thing up then and
+// sends it as it is by that time, so a message that changed three times before it went
+// out is sent once as it ends up.
+//
+// every event gets the next seq. the last EVENT_HISTORY are kept so a client that comes
+// back with the last seq it saw gets what it missed. each client has a queue of its own
+// of EVENT_CLIENT_QUEUE, one that falls further behind than that (or asks for more than
+// is kept) gets an EVENT_RESET instead and starts over from the full lists
+//
+// publish from any task, it never blocks on a client
+
+typedef enum {
+    EVENT_MESSAGE = 1,      // new entry in the table
+    EVENT_STATUS,           // transfer or ack status of an entry changed, or more of it arrived
+    EVENT_NODE,             // node added, heard from, or its status or name changed
+    EVENT_RESET,            // events were lost, fetch everything again
+} EventKind;
+
+typedef struct {
+    uint32_t seq;
+    ID key;                 // message id or node address
+    uint8_t kind;
+} BusEvent;
+
+#ifndef EVENT_HISTORY
+#define EVENT_HISTORY       (64)
+#endif
+#ifndef EVENT_CLIENTS_MAX
+#define EVENT_CLIENTS_MAX   (4)         // each holds one of the web server's 7 sockets
+#endif
+#ifndef EVENT_CLIENT_QUEUE
+#define EVENT_CLIENT_QUEUE  (32)
+#endif
+
+void event_bus_init(void);
+void event_publish(EventKind kind, ID key);
+// a client for events after last_seq, 0 when it has seen none (it fetches the lists
+// itself). -1 when EVENT_CLIENTS_MAX are taken
+int event_subscribe(uint32_t last_seq);
+// next event for the client, false when none came within wait_ms
+bool event_next(int client, BusEvent *out, uint32_t wait_ms);
+void event_unsubscribe(int client);
+
+#endif // EVENT_BUS_H
@@ -0,0 +1,75 @@
+#ifndef FRAGMENT_H
+#define FRAGMENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "node_globals.h"
+#include "data_table.h"
+
+// messages too long for one frame, up to FRAG_MAX_BYTES, to a single destination. the
+// whole message stays in the sender's table as one entry (a blob, see msg_store.h) and goes
+// out as FRAGMENT frames, FRAG_WINDOW at a time and one after the other, each with its own
+// id so relays and the seen cache treat it like any other frame. content is text end to end:
+//
+//   "f<msg id>,<index>/<count>,<total>:<piece>"    a fragment
+//   "p<msg id>,<index>/<count>,<total>:<piece>"    a fragment that asks for a report
+//   "r<msg id>,<hex bitmap>"                       report, fragments the destination holds
+//
+// every fragment but the last carries ceil(total / count) bytes, so where a piece goes
+// follows from its index. the destination keeps the message under the sender's id and
+// fills it in place, its length always covers what arrived without a gap so far, the rest
+// shows up in the table as it comes. a report makes the sender send the first
+// FRAG_WINDOW missing fragments again (the lost ones, then new ones), and no report in
+// time makes it send the first missing one alone, as a poll
+//
+// FRAG_RX_MAX messages are put together at once, FRAG_RX_BYTES between them, and one
+// nothing came for in FRAG_RX_TIMEOUT_MS is dropped
+
+#define FRAG_MAX_BYTES      (2048)      // MSG_STORE_BLOB_MAX
+#define FRAG_CHUNK_MAX      (176)       // with its header still fits a legacy ascii frame
+#define FRAG_MAX_COUNT      ((FRAG_MAX_BYTES + FRAG_CHUNK_MAX - 1) / FRAG_CHUNK_MAX)
+#define FRAG_WINDOW         (4)
+#define FRAG_DATA           'f'
+#define FRAG_POLL           'p'
+#define FRAG_REPORT         'r'
+
+#ifndef FRAG_TX_MAX
+#define FRAG_TX_MAX         (4)         // messages being sent in fragments at once
+#endif
+#ifndef FRAG_RX_MAX
+#define FRAG_RX_MAX         (4)
+#endif
+#define FRAG_RX_BYTES       (2 * FRAG_MAX_BYTES)
+// wait for a report twice as long as the last one took, FRAG_REPORT_MS before the first,
+// doubled for every poll
+#define FRAG_REPORT_MS      (20000)
+#define FRAG_REPORT_MIN_MS  (5000)
+#define FRAG_REPORT_MAX_MS  (60000)
+#define FRAG_MAX_POLLS      (4)
+// outlasts a sender that is still polling
+#define FRAG_RX_TIMEOUT_MS  (FRAG_REPORT_MAX_MS * (FRAG_MAX_POLLS + 1))
+
+typedef struct {
+    uint32_t sent;              // messages that went out in fragments
+    uint32_t delivered;         // the destination reported all of it
+    uint32_t given_up;
+    uint32_t fragments_sent;
+    uint32_t fragments_resent;  // again after a report or a poll timeout
+    uint32_t received;          // put together here
+    uint32_t refused;           // no slot, or over FRAG_RX_BYTES
+    uint32_t timed_out;         // never finished here, dropped
+} FragStats;
+
+void frag_init(void);
+// content is a message too long for one frame. the id of its entry in the table, NO_ID
+// when it is too long, for a broadcast, or FRAG_TX_MAX are still going
+ID frag_send(ID dst, const char *content, size_t len);
+// a FRAGMENT frame for this node is in the table
+void frag_received(ID msg_id);
+void frag_stats(FragStats *out);
+int format_frag_stats_as_json(char *out, int buff_size);
+void frag_task(void *arg);
+
+#endif // FRAGMENT_H
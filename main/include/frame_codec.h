@@ -0,0 +1,119 @@
+#ifndef FRAME_CODEC_H
+#define FRAME_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "node_globals.h"
+
+// max bytes the RYLR module accepts in one AT+SEND payload
+#define LORA_MAX_PAYLOAD (240)
+
+// wire versions a node can speak. legacy is the original comma separated ascii frame,
+// from hop acks on they are the same packed frames but the node answers unicasts with a
+// hop ack (hop_ack.h), from bundle on it also splits bundles, from acks on it strips ack
+// trailers, from fragment on it hop acks FRAGMENT frames, and from compress on it reads
+// compressed content. 7 is taken, it is FRAME_BUNDLE's low bits
+#define WIRE_VERSION_LEGACY   (0)
+#define WIRE_VERSION_BINARY   (1)
+#define WIRE_VERSION_HOP_ACKS (2)
+#define WIRE_VERSION_BUNDLE   (3)
+#define WIRE_VERSION_ACKS     (4)
+#define WIRE_VERSION_FRAGMENT (5)
+#define WIRE_VERSION_COMPRESS (6)
+#define WIRE_VERSION          (WIRE_VERSION_COMPRESS)
+
+// first byte of a packed frame is 0xF8 | version. 0xF8..0xFF never appear in
+// valid utf-8 so a legacy frame (which starts with text content) can't be confused with one
+#define FRAME_MAGIC          (0xF8)
+#define FRAME_MAGIC_MASK     (0xF8)
+#define FRAME_VERSION_MASK   (0x07)
+#define FRAME_HEADER_LEN     (12)
+
+// several packed frames for the same next hop in one transmission: FRAME_BUNDLE, then
+// <len><frame> for each, every frame as it would be on its own before escaping. a node
+// before WIRE_VERSION_BUNDLE reads the first byte as a version it doesn't know
+#define FRAME_BUNDLE         (0xFF)
+#define FRAME_BUNDLE_MIN     (FRAME_HEADER_LEN + 1)
+#define FRAME_BUNDLE_MAX     ((LORA_MAX_PAYLOAD - 1) / (FRAME_HEADER_LEN + 1))    // frames in one
+
+// FrameHeader.flags
+#define FRAME_FLAG_ACKS      (0x01)     // content ends in the hop acks the frame carries
+#define FRAME_ACKS_MAX       (8)
+// content on air is squashed against the codebook (squash.h), or it is frame_text_pack()ed
+// text going as the bytes it stands for. the encoder picks whichever is shortest from
+// WIRE_VERSION_COMPRESS on and the decoder undoes it, callers only ever see the content
+#define FRAME_FLAG_SQUASHED  (0x02)
+#define FRAME_FLAG_PACKED    (0x04)
+
+// escape byte used to keep \0 \r \n out of the AT+SEND payload
+#define FRAME_ESC            (0x7F)
+#define FRAME_ESC_XOR        (0x40)
+
+typedef struct {
+    uint8_t version;    // wire version the frame was decoded from / should be encoded as
+    ID origin;
+    ID dest;
+    ID id;
+    ID ack_for;
+    uint8_t steps;
+    uint8_t msg_type;
+    uint8_t flags;
+} FrameHeader;
+
+// a parsed "+RCV=<from>,<len>,<data>,<rssi>,<snr>" line, payload points into the line
+typedef struct {
+    ID from;
+    int rssi;
+    int snr;
+    const char *payload;
+    size_t payload_len;
+} RcvLine;
+
+bool frame_parse_rcv(const char *line, size_t line_len, RcvLine *out);
+
+int frame_encode(const FrameHeader *hdr, const char *content, size_t content_len, char *out, size_t out_cap);
+bool frame_decode(const char *payload, size_t payload_len, FrameHeader *hdr, char *content, size_t content_cap, size_t *content_len);
+
+typedef struct {
+    uint8_t raw[LORA_MAX_PAYLOAD];
+    size_t len;
+    size_t escaped_len;     // what it takes on air
+    int count;
+} FrameBundle;
+
+void frame_bundle_init(FrameBundle *bundle);
+// false when the frame would take the bundle past LORA_MAX_PAYLOAD, the bundle is unchanged
+bool frame_bundle_add(FrameBundle *bundle, const FrameHeader *hdr, const char *content, size_t content_len);
+// escaped payload for AT+SEND, -1 if it doesn't fit out
+int frame_bundle_finish(const FrameBundle *bundle, char *out, size_t out_cap);
+bool frame_is_bundle(const char *payload, size_t payload_len);
+// unescapes a received bundle into raw, returns its length, 0 if it is not a good one
+size_t frame_bundle_open(const char *payload, size_t payload_len, uint8_t *raw, size_t raw_cap);
+// the frame at *offset in an opened bundle (start with 0), moves *offset past it. false at
+// the end or on a frame that doesn't decode
+bool frame_bundle_next(const uint8_t *raw, size_t raw_len, size_t *offset, FrameHeader *hdr, char *content, size_t content_cap, size_t *content_len);
+
+// ack trailer: <id>... <count>, ids big endian. append returns the new content length, 0
+// when it doesn't fit cap. strip takes the trailer off content (which stays terminated) and
+// returns how many ids were in it, -1 for a bad trailer
+size_t frame_acks_append(char *content, size_t content_len, size_t cap, const ID *ids, int count);
+int frame_acks_strip(char *content, size_t *content_len, ID *ids, int max);
+
+// content as it goes on air: its length in out and the flag saying how, 0 when it goes as
+// it is (out is untouched then)
+size_t frame_compress(const char *content, size_t content_len, uint8_t *out, size_t out_cap, uint8_t *flag);
+// content back from what came with flags, 0 when it doesn't undo or fit out_cap
+size_t frame_decompress(uint8_t flags, const uint8_t *in, size_t in_len, char *out, size_t out_cap);
+
+size_t frame_escape(const uint8_t *in, size_t in_len, char *out, size_t out_cap);
+size_t frame_unescape(const char *in, size_t in_len, uint8_t *out, size_t out_cap);
+
+// binary packed into message content, which is text end to end (msg table, json, legacy
+// frames): 3 bytes per 4 chars of A-Z a-z 0-9 + /, no padding. 0 when it doesn't fit / is bad
+#define FRAME_TEXT_LEN(bytes) (((bytes) * 4 + 2) / 3)
+size_t frame_text_pack(const uint8_t *in, size_t in_len, char *out, size_t out_cap);
+size_t frame_text_unpack(const char *in, size_t in_len, uint8_t *out, size_t out_cap);
+
+#endif // FRAME_CODEC_H
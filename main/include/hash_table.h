@@ -1,21 +1,53 @@
 #ifndef _HASH_TABLE_H_
 #define _HASH_TABLE_H_
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
-typedef struct entry_struct Entry;
+// open addressing with robin hood probing. removal shifts the rest of the run back
+// instead of leaving tombstones, and growing moves a few slots per insert into the
+// bigger array rather than rehashing everything at once
+
+typedef struct {
+        int key;
+        uint16_t dib;       // distance from the home slot + 1, 0 when empty
+        void *value;
+} HashSlot;
 
 typedef struct hash_table_struct {
-        size_t size;
-        int entries;
-        Entry **table;
+        size_t size;        // slots in table, power of two
+        int entries;        // keys in table and old together
+        HashSlot *table;
+        HashSlot *old;      // drained into table while growing, NULL otherwise
+        size_t old_size;
+        size_t old_cursor;  // slots of old below this are empty
+        size_t capacity;    // fixed tables never hold more keys, 0 grows as needed
 } HashTable;
 
+// walks every key once, in slot order. removing the key just returned is fine,
+// inserting while iterating is not
+typedef struct {
+        const HashTable *table;
+        const HashSlot *slots;
+        size_t size;
+        size_t start;
+        size_t step;
+        int key;            // last one returned, to notice it was removed
+        bool have_key;
+        bool in_old;
+} HashIter;
+
 HashTable *create_hashtable(size_t size);
+// never holds more than capacity keys and never allocates after this
+HashTable *create_hashtable_fixed(size_t capacity);
 void delete_hashtable(HashTable **ptr);
+// 1 for a new key, 0 when the key was there and got the new value, -1 when full
 int hash_insert(HashTable *table, int key, void *value);
 void *hash_find(HashTable *table, int key);
 void *hash_remove(HashTable *table, int key);
+void hash_iter_init(HashIter *it, const HashTable *table);
+bool hash_iter_next(HashIter *it, int *key, void **value);
 void **sort_hash_to_array(HashTable *table, int (*cmp)(const void *, const void *));
 
 #endif // _HASH_TABLE_H_
@@ -0,0 +1,83 @@
+#ifndef HOP_ACK_H
+#define HOP_ACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "node_globals.h"
+#include "data_table.h"
+
+// per hop delivery for NORMAL, CRITICAL and FRAGMENT frames. the module's +OK only means
+// the frame went on air, so the next hop answers every one it hears with a small ACK frame
+// (ack_for = the frame's id, content HOP_ACK_CONTENT) straight back over the link. only
+// between neighbors from WIRE_VERSION_HOP_ACKS on, an older one never answers and reads
+// the ack as the end to end one for whatever it has under that id. a
+// frame nobody acked in time goes out again to the same neighbor, after HOP_MAX_TRIES the
+// neighbor is given up on through router_bad_intermediate() and the frame goes to the
+// next best one, up to HOP_MAX_FALLOVERS times.
+//
+// the timeout is per neighbor, srtt + 4 * rttvar from the acks that came back (only for
+// frames sent once, a retransmitted one can't tell which copy was acked), doubled on
+// each retry. a frame longer than HOP_RTO_LONG_FRAME waits its own airtime more, and the
+// radio keeps quiet for hop_listen_ms() after it so the ack isn't sent into a transmission
+//
+// when a frame the neighbor will hear anyway (one to it, or a broadcast) is already
+// queued and the neighbor reads WIRE_VERSION_ACKS, the ack rides in that frame's trailer
+// instead. it waits up to HOP_ACK_DELAY_MS for it, then goes out as its own frame
+#ifndef HOP_PENDING_MAX
+#define HOP_PENDING_MAX     (16)    // frames waiting for an ack, the send queue holds 16
+#endif
+#define HOP_MAX_TRIES       (4)
+#define HOP_MAX_FALLOVERS   (2)
+#define HOP_RTO_INITIAL_MS  (2000)  // until the neighbor has acked something
+#define HOP_RTO_MIN_MS      (500)
+#define HOP_RTO_MAX_MS      (16000)
+#define HOP_RTO_LONG_FRAME  (120)   // content bytes, longer frames wait one airtime more
+#define HOP_LISTEN_SLACK_MS (100)   // for the neighbor to turn an ack around
+#define HOP_ACK_CONTENT     "hop"
+#define HOP_OWED_MAX        (16)    // acks waiting for a frame to ride on
+#ifndef HOP_ACK_DELAY_MS
+#define HOP_ACK_DELAY_MS    (250)
+#endif
+
+typedef struct {
+    uint32_t tracked;           // frames sent that wanted an ack
+    uint32_t acked;
+    uint32_t retransmits;
+    uint32_t fallovers;         // gave up on a next hop and tried another
+    uint32_t given_up;          // no next hop left, or out of fall overs
+    uint32_t acks_sent;         // acks we sent as frames of their own
+    uint32_t acks_carried;      // acks we sent in another frame's trailer
+} HopAckStats;
+
+void hop_ack_init(void);
+// frames of this type to this target want a hop ack
+static inline bool hop_ack_wanted(MessageType type, ID target) {
+    return (type == NORMAL || type == CRITICAL || type == FRAGMENT) && target != BROADCAST_ID;
+}
+// neighbor answers hop acks and can be sent one
+bool hop_ack_speaks(ID neighbor);
+// queue_send is handing msg_id to next_hop. true when it wasn't tracked before
+bool hop_track(ID msg_id, ID next_hop);
+// the scheduler turned down a message hop_track() had just started on
+void hop_untrack(ID msg_id);
+// the module answered the AT+SEND for msg_id, the timeout starts now
+void hop_on_air(ID msg_id, bool sent);
+// how long the radio stays quiet after a long frame that wants an ack went off the air, so
+// it isn't talking over the ack
+uint32_t hop_listen_ms(void);
+// answers frame `id` that just came in from `from` as wire `version`, now or with the
+// next frame it hears. nothing if from doesn't speak hop acks
+void hop_ack_owe(ID from, ID id, uint8_t version);
+// acks a frame to target could carry, oldest first. everyone owed hears a broadcast
+int hop_acks_peek(ID target, ID *out, int max);
+// the ones from hop_acks_peek() that went into a frame to target
+void hop_acks_taken(ID target, const ID *ids, int count);
+// an ack came back from `from`, true if it was for a frame we were waiting on
+bool hop_ack_received(ID msg_id, ID from);
+// how long to wait for a neighbor to answer before trying again
+uint32_t hop_rto_ms(ID neighbor);
+void hop_ack_stats(HopAckStats *out);
+void hop_retry_task(void *arg);
+
+#endif // HOP_ACK_H
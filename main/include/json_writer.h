@@ -0,0 +1,62 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// JSON written straight into a fixed buffer that is handed to flush every time it fills up,
+// for an http response in chunks about a TCP segment long. strings are escaped, commas and
+// colons go in by themselves, keys are names from the code and go in as they are:
+//
+//   json_object_begin(w);
+//   json_key(w, "name"); json_string(w, node->name);
+//   json_key(w, "messages"); json_int(w, node->messages);
+//   json_object_end(w);
+//
+// one writer per response, no locking, no FreeRTOS in here so it builds on the host as is
+
+// fits one TCP segment (CONFIG_LWIP_TCP_MSS 1440) with the chunk size line around it
+#define JSON_CHUNK_BYTES    (1400)
+#define JSON_MAX_DEPTH      (16)
+
+// false when the data couldn't go out, nothing is written after that
+typedef bool (*JsonFlush)(void *ctx, const char *data, size_t len);
+
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t len;
+    JsonFlush flush;
+    void *ctx;
+    uint16_t depth;
+    uint16_t after_key;             // a key was written, its value is next
+    uint32_t filled;                // bit per depth, the container has something in it already
+    bool failed;                    // flush failed, or the nesting was wrong
+    uint32_t chunks;                // flushed
+    size_t total;                   // bytes written, flushed or still in buf
+} JsonWriter;
+
+void json_writer_init(JsonWriter *w, char *buf, size_t cap, JsonFlush flush, void *ctx);
+// flushes what is left. false when anything didn't go out
+bool json_writer_finish(JsonWriter *w);
+
+void json_object_begin(JsonWriter *w);
+void json_object_end(JsonWriter *w);
+void json_array_begin(JsonWriter *w);
+void json_array_end(JsonWriter *w);
+void json_key(JsonWriter *w, const char *key);
+void json_string(JsonWriter *w, const char *s);
+void json_string_len(JsonWriter *w, const char *s, size_t len);
+void json_int(JsonWriter *w, int64_t v);
+void json_uint(JsonWriter *w, uint64_t v);
+// fixed point with that many decimals, null for nan and infinity
+void json_double(JsonWriter *w, double v, int decimals);
+void json_bool(JsonWriter *w, bool v);
+void json_null(JsonWriter *w);
+// a value that is JSON already (another formatter's output), taken as it is
+void json_value_raw(JsonWriter *w, const char *json, size_t len);
+// bytes outside the JSON structure, e.g. the lines around an event
+void json_write_raw(JsonWriter *w, const char *data, size_t len);
+
+#endif // JSON_WRITER_H
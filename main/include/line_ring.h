@@ -0,0 +1,58 @@
+#ifndef LINE_RING_H
+#define LINE_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lora_uart.h"
+
+// receive side of the module uart. the reader task bulk reads straight into the ring,
+// lines are split in place and handed out as slices into the ring instead of copies.
+//
+// single producer (the reader task owns every index), any number of consumers that only
+// ever flip the released flag of the slices they were given. a line is never split across
+// the end of the buffer: when the tail end gets short the partial line is moved to the front.
+// no FreeRTOS in here so it builds on the host as is.
+
+#define LINE_RING_SIZE  (4096)
+#define LINE_RING_SLOTS (64)    // lines handed out and not yet released
+
+typedef struct {
+    const char *data;   // NUL terminated in place, "\r\n" stripped
+    uint16_t len;
+    uint16_t slot;
+} LineSlice;
+
+typedef struct {
+    size_t start;
+    atomic_bool released;
+} LineSlot;
+
+typedef struct {
+    char buf[LINE_RING_SIZE];
+    size_t head;        // next byte the uart driver writes
+    size_t line_start;  // first byte of the line being received
+    size_t scan;        // next byte to look at for a terminator
+    bool discarding;    // line got longer than UART_LINE_LEN, drop it up to its '\n'
+
+    LineSlot slots[LINE_RING_SLOTS];
+    uint16_t slot_head;
+    uint16_t slot_tail;
+
+    uint32_t dropped_lines;
+} LineRing;
+
+void line_ring_init(LineRing *ring);
+// contiguous space at the write position, 0 when consumers still hold everything
+size_t line_ring_reserve(LineRing *ring, char **dst);
+// n bytes were written at the pointer reserve handed out
+void line_ring_commit(LineRing *ring, size_t n);
+// next complete line, false when there is none (or no free slot to hand it out in)
+bool line_ring_next(LineRing *ring, LineSlice *out);
+void line_ring_release(LineRing *ring, const LineSlice *slice);
+// drop the partial line, used after the driver lost bytes
+void line_ring_reset_line(LineRing *ring);
+
+#endif // LINE_RING_H
@@ -16,11 +16,18 @@
 
 #define UART_READ_BUFF  (2048)
 #define UART_WRITE_BUFF (0)
+#define UART_EVENT_QUEUE_LEN (20)
 #define UART_PORT       (UART_NUM_2)
 #define BAUD            (9600) //115200
 
+// longest line to/from the module: "+RCV=65535,240,<240 byte payload>,-120,-20"
+#define UART_LINE_LEN   (320)
+
 void uart_init(void);
-void queue_send(ID msg_id, ID target, bool use_router);
+// false when there is no route to target or the send queue for its type is full
+bool queue_send(ID msg_id, ID target, bool use_router);
+// a frame that neighbor will hear is waiting to go out, to it or to everyone
+bool queue_has_frame_for(ID neighbor);
 void message_sending_task(void *);
 
 #endif // LORA_UART_H
@@ -0,0 +1,67 @@
+#ifndef MSG_STORE_H
+#define MSG_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "data_table.h"
+
+// fixed home for every DataEntry and its content. entry slots and content blocks are
+// carved out of static slabs at link time and handed out from free lists, so allocation
+// is O(1), nothing fragments the heap and the ceiling shows up in `idf.py size`.
+// content is at most one LoRa payload; it goes in the smallest block class that fits,
+// or the next one up if that class is used up. the blob class is only for content that
+// came in (or goes out) in fragments, up to MSG_STORE_BLOB_MAX, nothing spills into it.
+//
+// not thread safe, data_table.c calls in with g_dtb_mutex held
+
+#ifndef MSG_STORE_ENTRIES
+#define MSG_STORE_ENTRIES (256)
+#endif
+
+#define MSG_STORE_CONTENT_MAX (240)
+#define MSG_STORE_BLOB_MAX    (2048)
+
+// block counts per content class, sizes include the NUL
+#ifndef MSG_STORE_TINY_BLOCKS
+#define MSG_STORE_TINY_BLOCKS   (256)   // 16 B: ping, gbcast, names, AT replies
+#endif
+#ifndef MSG_STORE_SMALL_BLOCKS
+#define MSG_STORE_SMALL_BLOCKS  (128)   // 48 B: chat, short rquery answers
+#endif
+#ifndef MSG_STORE_MEDIUM_BLOCKS
+#define MSG_STORE_MEDIUM_BLOCKS (64)    // 112 B
+#endif
+#ifndef MSG_STORE_LARGE_BLOCKS
+#define MSG_STORE_LARGE_BLOCKS  (32)    // a full payload
+#endif
+#ifndef MSG_STORE_BLOB_BLOCKS
+#define MSG_STORE_BLOB_BLOCKS   (4)     // reassembled messages and ones being fragmented
+#endif
+
+void msg_store_init(void);
+// entry with room for len bytes of content plus the NUL, NULL when slots or blocks ran out
+DataEntry *msg_store_alloc(size_t len);
+// whether msg_store_alloc(len) would find a content block, slots aside
+bool msg_store_block_free(size_t len);
+// whether msg_store_alloc(len) could use entry's block once it is freed
+bool msg_store_block_fits(const DataEntry *entry, size_t len);
+void msg_store_free(DataEntry *entry);
+// allocated longest ago, NULL when empty
+DataEntry *msg_store_oldest(void);
+DataEntry *msg_store_newest(void);
+// next one back in allocation order, NULL for the oldest
+DataEntry *msg_store_older(const DataEntry *entry);
+// slot numbers are 0..MSG_STORE_ENTRIES-1, for keeping per entry state next to the store
+int msg_store_slot(const DataEntry *entry);
+DataEntry *msg_store_entry(int slot);
+int msg_store_used(void);
+// content block bytes held by entry / by everything / available in total
+size_t msg_store_entry_bytes(const DataEntry *entry);
+size_t msg_store_bytes_used(void);
+size_t msg_store_bytes_capacity(void);
+// static footprint in bytes
+size_t msg_store_footprint(void);
+void msg_store_log_usage(void);
+
+#endif // MSG_STORE_H
@@ -8,6 +8,15 @@
 
 #include "node_globals.h"
 #include "lora_uart.h"
+#include "json_writer.h"
+
+// nodes live in one static array in the order they were first heard and are never
+// removed, so a NodeEntry pointer stays valid for good. address -> slot goes through
+// an open addressed index. lookups and walks don't lock, a node only becomes visible
+// once it is filled in; adding one takes g_ntb_mutex
+#ifndef NODE_TABLE_CAPACITY
+#define NODE_TABLE_CAPACITY (64)
+#endif
 
 typedef enum {
         ALIVE,
@@ -27,22 +36,49 @@ typedef struct node_table_entry {
         ID ping_id;
         TaskHandle_t ping_task;
         bool link_enabled;
-        uint32_t last_rquery;
-        struct node_table_entry *next;
+        uint32_t last_rquery;           // our advert seq when we last answered its old text rquery
+        uint16_t advert_epoch;          // how far we got with its route adverts, sent back in
+        uint16_t advert_seq;            // our requests so it only sends what is new to us
+        ID answer_for;                  // its rquery we still owe an answer, NO_ID if none
+        uint16_t answer_since;          // the seq it had our routes up to
+        TickType_t answer_at;           // answers are spread out so neighbors don't collide
+        uint8_t wire_version;           // highest frame format this node has shown it can read
+        uint8_t wire_asks;              // wire= we sent it since, when it missed the first
+        float link_delivery;            // avg share of our rquery probes it answered directly
+        int link_samples;               // probes counted into link_delivery
+        bool rquery_asked;              // was a neighbor when the last rquery went out
+        bool rquery_answered;           // and has answered it since
+        uint32_t srtt_ms;               // smoothed time for it to ack a frame, 0 until it has
+        uint32_t rttvar_ms;             // and how much that varies
 } NodeEntry;
 
-extern NodeEntry *g_node_table;
-
 NodeEntry *get_node_ptr(int);
+// for walking the table: for (int i = 0; i < node_table_count(); i++) node_table_at(i)
+int node_table_count(void);
+NodeEntry *node_table_at(int index);
+// goes up with every node added and every node_changed()
+uint32_t node_table_version(void);
+// call after changing what the page shows of a node (status, name, link, metrics)
+void node_changed(ID address);
 void node_table_init(void);
 NodeEntry *create_node_object(ID);
 void update_metrics(NodeEntry *node, int rssi, int snr);
-int format_node_as_json(NodeEntry *, char *, int);
+// one rquery round with a neighbor, answered or not. feeds the etx route metric
+void node_link_result(NodeEntry *node, bool answered);
+void write_node_json(JsonWriter *w, const NodeEntry *node);
 int nodes_update(ID msg_id);
+// a frame came straight from node
+void node_heard(NodeEntry *node, int rssi, int snr);
 NodeEntry *node_create_if_needed(ID addr);
 void attempt_to_reach_node(ID addr);
 void node_status_task(void *args);
 void ping_suspect_node(void *args);
 void send_ping_response(ID origin, ID target, ID ack_for_msg);
+uint8_t node_wire_version(ID target);
+// what addr announced with wire=, the only thing that lowers it
+void node_set_wire_version(ID addr, uint8_t version);
+// addr sent a frame in this format. frames can be older than what it reads (broadcasts go
+// out in the neighborhood's lowest, unicasts in what it thinks we read) so this only raises
+void node_saw_wire_version(ID addr, uint8_t version);
 
 #endif // NODE_TABLE_H
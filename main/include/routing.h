@@ -5,6 +5,45 @@
 #include "node_globals.h"
 
 #define MAX_ROUTING_ENTRIES (4)
+// destinations the router keeps routes for, lookups go through a hashed index
+#ifndef ROUTER_MAX_DESTINATIONS
+#define ROUTER_MAX_DESTINATIONS (128)
+#endif
+
+// what a route costs. HOPS counts steps like the router always did, ETX weighs every hop
+// by how many sends it takes to get a frame across and back, SNR by how close to the noise
+// floor the neighbor is heard. costs are in 1/ROUTE_COST_UNIT of a perfect hop
+typedef enum {
+	METRIC_HOPS,
+	METRIC_ETX,
+	METRIC_SNR,
+	METRIC_COUNT
+} RouteMetric;
+
+#define ROUTE_COST_UNIT (16)
+#define ROUTE_COST_MAX  (0xFFFF)
+#ifndef ROUTER_DEFAULT_METRIC
+#define ROUTER_DEFAULT_METRIC METRIC_SNR
+#endif
+
+// route adverts. every change worth telling neighbors about (a route appearing or going,
+// its next hop or steps changing, its cost moving a quarter hop) gets the next advert seq.
+// an advert carries the routes that changed after some seq, oldest change first, packed
+// into message content as ROUTE_ADVERT_PREFIX + text. neighbors keep how far they got
+// with us and send it back in their requests, so only what they haven't seen goes out
+#define ROUTE_ADVERT_PREFIX "ra2"
+#define ADVERT_MAX_ROUTES   (20)    // what fits in one frame, ~200 chars of content
+
+typedef struct {
+	uint16_t epoch;         // changes when the sender reboots and starts its seqs over
+	uint16_t from_seq;      // the routes changed after this one, 0 when it is everything
+	uint16_t upto_seq;      // and the sender had nothing newer that didn't fit
+} RouteAdvert;
+
+// serial number order, seqs wrap
+static inline bool route_seq_after(uint16_t a, uint16_t b) {
+	return (int16_t)(a - b) > 0;
+}
 
 typedef struct node_table_entry NodeEntry;
 typedef struct router_struct Router;
@@ -17,7 +56,19 @@ void router_bad_intermediate(Router *router, ID intermediate_node);
 void router_link_node(Router *router, ID node);
 void router_unlink_node(Router *router, ID bad_node);
 int router_answer_rquery(Router *router, NodeEntry *node_obj, int count, char *buffer, size_t buffer_size);
-void router_parse_rquery(Router *router, ID from_node, char *buffer);
 void router_print(Router *router);
+// link quality to a neighbor, snr and delivery ratio are running averages. delivery
+// only counts once there are a few samples, until then etx goes by snr
+void router_observe_link(Router *router, ID neighbor, float avg_snr, float delivery, int samples);
+void router_set_metric(Router *router, RouteMetric metric);
+RouteMetric router_get_metric(Router *router);
+const char *route_metric_name(RouteMetric metric);
+uint16_t router_advert_seq(Router *router);
+// routes that changed after since_seq (0 for all of them), as much as fits in out
+int router_write_advert(Router *router, uint16_t epoch, uint16_t since_seq, char *out, size_t out_cap, uint16_t *upto_seq);
+// takes in the routes of an advert from a neighbor, false if it isn't one
+bool router_read_advert(Router *router, ID from_node, const char *content, RouteAdvert *advert);
+// METRIC_COUNT when the name is not one of hops, etx, snr
+RouteMetric route_metric_from_name(const char *name);
 
 #endif
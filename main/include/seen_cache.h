@@ -0,0 +1,26 @@
+#ifndef SEEN_CACHE_H
+#define SEEN_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "node_globals.h"
+
+// frames this node already heard, keyed by (origin, id). two generations of open
+// addressed slots: new keys go into the current one, lookups check both, and the older
+// one is wiped when the current fills up or the window passes. a key is remembered for
+// one to two windows, long enough for every copy of a flood to die down.
+//
+// only the rcv handler task uses it, no locking
+
+#ifndef SEEN_CACHE_SLOTS
+#define SEEN_CACHE_SLOTS (512)      // per generation, power of two
+#endif
+#define SEEN_WINDOW_MS   (60000)
+
+void seen_cache_init(void);
+// true if (origin, id) was heard within the window, remembers it otherwise
+bool seen_cache_check(ID origin, ID id);
+uint32_t seen_cache_suppressed(void);
+
+#endif // SEEN_CACHE_H
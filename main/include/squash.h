@@ -0,0 +1,25 @@
+#ifndef SQUASH_H
+#define SQUASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// short text against a static codebook, smaz style. every output byte below SQUASH_CODES
+// stands for one codebook entry (words the mesh sends all the time, common english pieces,
+// every lowercase letter, digit and the usual punctuation), SQUASH_VERBATIM is followed
+// by one byte as it is and SQUASH_RUN by a length and that many bytes. the encoder takes
+// the longest entry at each point. both sides share the codebook, changing it is a new
+// wire version.
+//
+// no FreeRTOS in here so it builds on the host as is
+
+#define SQUASH_CODES    (254)
+#define SQUASH_VERBATIM (0xFE)
+#define SQUASH_RUN      (0xFF)
+
+// length of the squashed text, 0 when it is no shorter than len or doesn't fit cap
+size_t squash(const uint8_t *in, size_t len, uint8_t *out, size_t cap);
+// length of the text, 0 on a bad code or when it doesn't fit cap
+size_t unsquash(const uint8_t *in, size_t len, uint8_t *out, size_t cap);
+
+#endif // SQUASH_H
@@ -0,0 +1,75 @@
+#ifndef TX_SCHED_H
+#define TX_SCHED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "node_globals.h"
+#include "data_table.h"
+
+// what the message sender takes off next. every frame waits in the queue of its class:
+// acks, CRITICAL and module commands go first whenever there are any, NORMAL/BROADCAST
+// user traffic and MAINTENANCE/PING share what is left by deficit round robin, weighted
+// by bytes so a run of long route adverts counts for what it costs on air. a class that
+// is full turns new frames away instead of blocking the caller. frames the airtime budget
+// (airtime.h) has no room for stay queued until it does, module commands never go on air
+// and are never held.
+//
+// push and pop may come from any task
+
+typedef enum {
+    TX_CLASS_URGENT,        // ACK, CRITICAL, COMMAND
+    TX_CLASS_NORMAL,        // NORMAL, BROADCAST
+    TX_CLASS_MAINTENANCE,   // MAINTENANCE, PING
+    TX_CLASS_COUNT
+} TxClass;
+
+#ifndef TX_QUEUE_DEPTH
+#define TX_QUEUE_DEPTH (16)         // per class
+#endif
+// bytes a class may send per round while both of the shared ones have frames waiting
+#define TX_WEIGHT_NORMAL        (2)
+#define TX_WEIGHT_MAINTENANCE   (1)
+#define TX_QUANTUM_BYTES        (240)
+// longest a frame is held back, while the radio is busy anyway, for others to the same next
+// hop to share its transmission with
+#ifndef TX_BUNDLE_LINGER_MS
+#define TX_BUNDLE_LINGER_MS     (100)
+#endif
+
+// histogram buckets: queue depth found on arrival 0, 1, 2-3, 4-7, 8-15, 16+ and time spent
+// waiting below 50, 100, 250, 500 ms, 1, 2.5, 5, 10 s and above
+#define TX_DEPTH_BUCKETS (6)
+#define TX_WAIT_BUCKETS  (9)
+
+typedef struct {
+    uint32_t queued;
+    uint32_t sent;
+    uint32_t rejected;              // class was full
+    uint16_t high_water;
+    uint32_t depth[TX_DEPTH_BUCKETS];
+    uint32_t wait[TX_WAIT_BUCKETS];
+} TxClassStats;
+
+void tx_sched_init(void);
+TxClass tx_class_of(MessageType type);
+// false when the class queue is full, the frame was not queued
+bool tx_sched_push(ID msg_id, MessageType type, size_t bytes);
+// next frame to send, NO_ID if nothing came within wait
+ID tx_sched_pop(TickType_t wait);
+// takes every queued frame match() says yes to out of the queues, urgent class first and
+// oldest first within each, returns how many. match runs with the scheduler locked and must
+// not queue anything
+int tx_sched_take(bool (*match)(ID msg_id, void *ctx), void *ctx);
+// whether match() says yes to any queued frame, which all stay queued
+bool tx_sched_any(bool (*match)(ID msg_id, void *ctx), void *ctx);
+void tx_sched_stats(TxClassStats out[TX_CLASS_COUNT]);
+const char *tx_class_name(TxClass tx_class);
+// upper bound in ms of wait bucket i, 0 for the last one
+uint32_t tx_wait_bucket_ms(int bucket);
+int format_tx_stats_as_json(char *out, int buff_size);
+
+#endif // TX_SCHED_H
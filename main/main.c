@@ -12,6 +12,10 @@
 #include "esp_log.h"
 #include "maintenance.h"
 #include "routing.h"
+#include "frame_codec.h"
+#include "hop_ack.h"
+#include "fragment.h"
+#include "event_bus.h"
 
 static const char *TAG = "Main";
 
@@ -20,6 +24,8 @@ void app_main(void)
 {
     // INIT DRIVERS
 
+    // the tables publish into it from the first entry on
+    event_bus_init();
     msg_table_init();
     node_table_init();
     ID address = (ID) wifi_start_softap();
@@ -33,6 +39,10 @@ void app_main(void)
     ID query_baud = create_command("AT+IPR?");
     queue_send(query_baud, NO_ID, false);
 
+    // radio settings, for the airtime model
+    ID query_parameter = create_command("AT+PARAMETER?");
+    queue_send(query_parameter, NO_ID, false);
+
     // SET ADDRESS
 
     ESP_LOGI(TAG, "Setting node address to %d", address);
@@ -49,10 +59,18 @@ void app_main(void)
     xTaskCreate(message_sending_task, "message sender",      4096, NULL, 5, NULL);
     xTaskCreate(node_status_task,     "node status checker", 4096, NULL, 5, NULL);
     xTaskCreate(rquery_task,          "rquery_task",         4096, NULL, 5, NULL);
+    xTaskCreate(hop_retry_task,       "hop retry",           4096, NULL, 5, NULL);
+    xTaskCreate(frag_task,            "fragments",           4096, NULL, 5, NULL);
 
     // INIT NEIGHBOR SEARCH
  
     ID neighbor_msg_id = create_data_object(NO_ID, MAINTENANCE, "gbcast", address, 0, address, 0, 0, 0, NO_ID);
     queue_send(neighbor_msg_id, 0, false);
 
+    // ANNOUNCE FRAME FORMAT
+    char wire_buffer[16];
+    sprintf(wire_buffer, "wire=%d", WIRE_VERSION);
+    ID wire_msg_id = create_data_object(NO_ID, MAINTENANCE, wire_buffer, address, 0, address, 0, 0, 0, NO_ID);
+    queue_send(wire_msg_id, BROADCAST_ID, false);
+
 }
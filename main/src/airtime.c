@@ -0,0 +1,168 @@
+#include "airtime.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+static const char *TAG = "AIRTIME";
+
+static int s_sf, s_bw, s_cr, s_preamble;
+
+static uint32_t s_buckets[AIRTIME_BUCKETS];    // ms on air per slice of the window
+static int s_current;
+static TickType_t s_bucket_start;
+static TickType_t s_bucket_ticks;
+static uint32_t s_budget_ms;                    // per window, 0 for no limit
+static AirtimeStats s_stats;
+static SemaphoreHandle_t s_lock;
+
+void airtime_init(void) {
+    s_sf = AIRTIME_DEFAULT_SF;
+    s_bw = AIRTIME_DEFAULT_BW;
+    s_cr = AIRTIME_DEFAULT_CR;
+    s_preamble = AIRTIME_DEFAULT_PREAMBLE;
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_lock = xSemaphoreCreateMutex();
+    airtime_set_duty(AIRTIME_DUTY_PERMILLE, AIRTIME_WINDOW_S);
+}
+
+void airtime_set_duty(uint32_t permille, uint32_t window_s) {
+    if (window_s < AIRTIME_BUCKETS) window_s = AIRTIME_BUCKETS;
+    if (permille >= 1000) permille = 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    memset(s_buckets, 0, sizeof(s_buckets));
+    s_current = 0;
+    s_bucket_start = xTaskGetTickCount();
+    s_bucket_ticks = pdMS_TO_TICKS(window_s * 1000 / AIRTIME_BUCKETS);
+    s_budget_ms = window_s * permille;      // s * 1000 ms * permille / 1000
+    xSemaphoreGive(s_lock);
+    if (permille) {
+        ESP_LOGI(TAG, "duty cycle %u permille over %u s", (unsigned) permille, (unsigned) window_s);
+    } else {
+        ESP_LOGI(TAG, "no duty cycle limit");
+    }
+}
+
+bool airtime_parse_parameters(const char *line) {
+    int sf, bw, cr, preamble;
+    if (sscanf(line, "+PARAMETER=%d,%d,%d,%d", &sf, &bw, &cr, &preamble) != 4 &&
+        sscanf(line, "AT+PARAMETER=%d,%d,%d,%d", &sf, &bw, &cr, &preamble) != 4) {
+        return false;
+    }
+    if (sf < 5 || sf > 12 || bw < 7 || bw > 9 || cr < 1 || cr > 4 || preamble < 4) return false;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_sf = sf;
+    s_bw = bw;
+    s_cr = cr;
+    s_preamble = preamble;
+    xSemaphoreGive(s_lock);
+    ESP_LOGI(TAG, "module on sf %d, bw %d, cr %d, preamble %d", sf, bw, cr, preamble);
+    return true;
+}
+
+// semtech time on air (AN1200.13), explicit header, crc on
+uint32_t airtime_frame_ms(size_t payload_len) {
+    double bw_hz = s_bw == 9 ? 500000.0 : s_bw == 8 ? 250000.0 : 125000.0;
+    double t_sym = (double)(1 << s_sf) / bw_hz * 1000.0;
+    int de = t_sym > 16.0 ? 1 : 0;
+    double t_preamble = (s_preamble + 4.25) * t_sym;
+    double num = 8.0 * payload_len - 4.0 * s_sf + 28 + 16;
+    double den = 4.0 * (s_sf - 2 * de);
+    double symbols = 8 + fmax(ceil(num / den) * (s_cr + 4), 0);
+    return (uint32_t) ceil(t_preamble + symbols * t_sym);
+}
+
+// ages out the slices that left the window
+static void advance(TickType_t now) {
+    if (now - s_bucket_start >= s_bucket_ticks * AIRTIME_BUCKETS) {
+        memset(s_buckets, 0, sizeof(s_buckets));
+        s_bucket_start = now;
+        return;
+    }
+    while (now - s_bucket_start >= s_bucket_ticks) {
+        s_current = (s_current + 1) % AIRTIME_BUCKETS;
+        s_buckets[s_current] = 0;
+        s_bucket_start += s_bucket_ticks;
+    }
+}
+
+static uint32_t window_used(void) {
+    uint32_t used = 0;
+    for (int i = 0; i < AIRTIME_BUCKETS; i++) used += s_buckets[i];
+    return used;
+}
+
+uint32_t airtime_wait_ms(TxClass tx_class, uint32_t frame_ms) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    TickType_t now = xTaskGetTickCount();
+    advance(now);
+    uint32_t used = window_used();
+    uint32_t limit = tx_class == TX_CLASS_URGENT ? s_budget_ms : s_budget_ms / 100 * (100 - AIRTIME_URGENT_RESERVE);
+
+    uint32_t wait_ms = 0;
+    // a frame longer than the whole budget still goes out, on its own
+    if (s_budget_ms && used && used + frame_ms > limit) {
+        uint32_t excess = used + frame_ms - limit;
+        uint32_t freed = 0;
+        TickType_t until = s_bucket_start + s_bucket_ticks * AIRTIME_BUCKETS;
+        for (int k = 1; k <= AIRTIME_BUCKETS; k++) {
+            freed += s_buckets[(s_current + k) % AIRTIME_BUCKETS];
+            if (freed >= excess) {
+                until = s_bucket_start + s_bucket_ticks * k;
+                break;
+            }
+        }
+        wait_ms = (until - now) * portTICK_PERIOD_MS;
+        if (wait_ms == 0) wait_ms = 1;
+    }
+    xSemaphoreGive(s_lock);
+    return wait_ms;
+}
+
+void airtime_charge(TxClass tx_class, uint32_t frame_ms) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    advance(xTaskGetTickCount());
+    s_buckets[s_current] += frame_ms;
+    if (tx_class < TX_CLASS_COUNT) s_stats.class_ms[tx_class] += frame_ms;
+    xSemaphoreGive(s_lock);
+}
+
+void airtime_note_held(void) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_stats.held++;
+    xSemaphoreGive(s_lock);
+}
+
+void airtime_stats(AirtimeStats *out) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    advance(xTaskGetTickCount());
+    s_stats.window_used_ms = window_used();
+    s_stats.window_budget_ms = s_budget_ms;
+    *out = s_stats;
+    xSemaphoreGive(s_lock);
+}
+
+int format_airtime_as_json(char *out, int buff_size) {
+    AirtimeStats stats;
+    airtime_stats(&stats);
+
+    int n = snprintf(out, buff_size,
+        "{\"sf\" : %d, \"bw\" : %d, \"cr\" : %d, \"preamble\" : %d, \"window_s\" : %u, "
+        "\"window_used_ms\" : %u, \"window_budget_ms\" : %u, \"held\" : %u, \"class_ms\" : [",
+        s_sf, s_bw, s_cr, s_preamble, (unsigned)(s_bucket_ticks * portTICK_PERIOD_MS * AIRTIME_BUCKETS / 1000),
+        (unsigned) stats.window_used_ms, (unsigned) stats.window_budget_ms, (unsigned) stats.held);
+    for (int c = 0; c < TX_CLASS_COUNT && n < buff_size; c++) {
+        n += snprintf(out + n, buff_size - n, "%s%u", c ? ", " : "", (unsigned) stats.class_ms[c]);
+    }
+    if (n < buff_size) n += snprintf(out + n, buff_size - n, "]}");
+
+    out[buff_size - 1] = '\0';
+    return n;
+}
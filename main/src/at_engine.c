@@ -0,0 +1,247 @@
+#include "at_engine.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "driver/uart.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "lora_uart.h"
+#include "airtime.h"
+
+typedef struct {
+    AtCallback callback;
+    void *ctx;
+    uint32_t timeout_ms;
+} AtRequest;
+
+static const char *TAG = "AT";
+
+static QueueHandle_t s_responses;
+static LineRing *s_ring;
+
+// written and unanswered, oldest first. the module answers in the same order
+static AtRequest s_in_flight[AT_MAX_IN_FLIGHT];
+static int s_head;
+static int s_count;
+static TickType_t s_head_deadline;
+// after a timeout: answers still owed by commands already failed, and until when they may
+// come. their slots are held and at_submit waits them out, nothing new is written meanwhile
+static int s_discard;
+static TickType_t s_discard_deadline;
+
+static SemaphoreHandle_t s_mutex;       // s_in_flight
+static SemaphoreHandle_t s_write_mutex; // keeps uart write order == s_in_flight order
+static SemaphoreHandle_t s_slots;
+
+static void at_engine_task(void *arg);
+
+void at_engine_init(QueueHandle_t responses, LineRing *ring) {
+    s_responses = responses;
+    s_ring = ring;
+    s_mutex = xSemaphoreCreateMutex();
+    s_write_mutex = xSemaphoreCreateMutex();
+    s_slots = xSemaphoreCreateCounting(AT_MAX_IN_FLIGHT, AT_MAX_IN_FLIGHT);
+
+    xTaskCreate(at_engine_task, "at_engine_task", 4096, NULL, 10, NULL);
+}
+
+uint32_t at_send_timeout_ms(size_t payload_len) {
+    return airtime_frame_ms(payload_len) + AT_TIMEOUT_MS;
+}
+
+// answers still owed by failed commands would be taken for a new one's, so nothing is
+// written until they are in. returns with s_mutex held, false (not held) if wait ran out
+static bool take_caught_up(TickType_t start, TickType_t wait) {
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    while (s_discard > 0) {
+        xSemaphoreGive(s_mutex);
+        if (wait != portMAX_DELAY && xTaskGetTickCount() - start >= wait) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+        xSemaphoreTake(s_mutex, portMAX_DELAY);
+    }
+    return true;
+}
+
+bool at_submit(const char *cmd, size_t len, uint32_t timeout_ms, AtCallback callback, void *ctx, TickType_t wait) {
+    TickType_t start = xTaskGetTickCount();
+    if (xSemaphoreTake(s_slots, wait) != pdTRUE) {
+        return false;
+    }
+    if (!timeout_ms) timeout_ms = AT_TIMEOUT_MS;
+
+    xSemaphoreTake(s_write_mutex, portMAX_DELAY);
+
+    if (!take_caught_up(start, wait)) {
+        xSemaphoreGive(s_write_mutex);
+        xSemaphoreGive(s_slots);
+        return false;
+    }
+    if (s_count == 0) {
+        s_head_deadline = xTaskGetTickCount() + pdMS_TO_TICKS(timeout_ms);
+    }
+    s_in_flight[(s_head + s_count) % AT_MAX_IN_FLIGHT] = (AtRequest) {
+        .callback = callback, .ctx = ctx, .timeout_ms = timeout_ms,
+    };
+    s_count++;
+    xSemaphoreGive(s_mutex);
+
+    // the answer can't come back before the command went out so writing outside s_mutex is fine
+    uart_write_bytes(UART_PORT, cmd, len);
+
+    xSemaphoreGive(s_write_mutex);
+    return true;
+}
+
+bool at_engine_wait_slot(TickType_t wait) {
+    TickType_t start = xTaskGetTickCount();
+    if (xSemaphoreTake(s_slots, wait) != pdTRUE) {
+        return false;
+    }
+    xSemaphoreGive(s_slots);
+    if (!take_caught_up(start, wait)) {
+        return false;
+    }
+    xSemaphoreGive(s_mutex);
+    return true;
+}
+
+bool at_engine_idle(void) {
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    bool idle = s_count == 0 && s_discard == 0;
+    xSemaphoreGive(s_mutex);
+    return idle;
+}
+
+// take the oldest request off, the next one starts its clock now
+static bool pop_head(AtRequest *out) {
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    bool had = s_count > 0;
+    if (had) {
+        *out = s_in_flight[s_head];
+        s_head = (s_head + 1) % AT_MAX_IN_FLIGHT;
+        s_count--;
+        if (s_count) {
+            s_head_deadline = xTaskGetTickCount() + pdMS_TO_TICKS(s_in_flight[s_head].timeout_ms);
+        }
+    }
+    xSemaphoreGive(s_mutex);
+    if (had) {
+        xSemaphoreGive(s_slots);
+    }
+    return had;
+}
+
+// the head never answered. everything in flight fails, one answer each is thrown away when
+// it comes, the head's may still. at_submit holds off until then. returns how many are in failed
+static int fail_in_flight(AtRequest *failed) {
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    int count = s_count;
+    uint32_t wait_ms = 0;
+    for (int i = 0; i < count; i++) {
+        failed[i] = s_in_flight[(s_head + i) % AT_MAX_IN_FLIGHT];
+        // the module works through them one after the other
+        wait_ms += failed[i].timeout_ms;
+    }
+    s_head = 0;
+    s_count = 0;
+    s_discard = count;
+    s_discard_deadline = xTaskGetTickCount() + pdMS_TO_TICKS(wait_ms);
+    xSemaphoreGive(s_mutex);
+    return count;
+}
+
+// all the owed answers came, or had their time. the slots are free for new commands
+static void end_discard(void) {
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    int held = s_discard;
+    s_discard = 0;
+    xSemaphoreGive(s_mutex);
+    for (int i = 0; i < held; i++) {
+        xSemaphoreGive(s_slots);
+    }
+}
+
+static MessageSendingStatus parse_status(const char *line) {
+    // 998-style: +ERR=code
+    if (!strncmp(line, "+ERR", 4)) {
+        int err;
+        return sscanf(line, "+ERR=%d", &err) == 1 ? err : ERR;
+    }
+    // 993-style: AT_FOO_ERROR
+    if (!strncmp(line, "AT_", 3) && strstr(line, "_ERROR") != NULL) {
+        return ERR;
+    }
+    // +OK, or the answer to a query like +ADDRESS=12
+    return OK;
+}
+
+static void at_engine_task(void *arg) {
+    ESP_LOGI(TAG, "AT ENGINE INIT");
+    LineSlice slice;
+    AtRequest req;
+
+    for (;;) {
+        // wake up now and then so a command that never gets an answer times out
+        if (xQueueReceive(s_responses, &slice, pdMS_TO_TICKS(100)) != pdTRUE) {
+            TickType_t now = xTaskGetTickCount();
+            xSemaphoreTake(s_mutex, portMAX_DELAY);
+            bool expired = s_count > 0 && (int32_t)(now - s_head_deadline) >= 0;
+            bool discard_over = s_discard > 0 && (int32_t)(now - s_discard_deadline) >= 0;
+            xSemaphoreGive(s_mutex);
+            if (discard_over) {
+                ESP_LOGW(TAG, "Gave up on the last answers, taking commands again");
+                end_discard();
+            }
+            if (expired) {
+                AtRequest failed[AT_MAX_IN_FLIGHT];
+                int count = fail_in_flight(failed);
+                ESP_LOGW(TAG, "No response from module in time, failing %d commands", count);
+                for (int i = 0; i < count; i++) {
+                    failed[i].callback(NO_STATUS, "", failed[i].ctx);
+                }
+            }
+            continue;
+        }
+
+        ESP_LOGD(TAG, "Response line: \"%s\"", slice.data);
+
+        // comes after +RESET, or on its own when the module browns out. nobody is waiting for it
+        if (!strcmp(slice.data, "+READY")) {
+            ESP_LOGI(TAG, "Module ready");
+            line_ring_release(s_ring, &slice);
+            continue;
+        }
+
+        char response[AT_RESPONSE_LEN];
+        strlcpy(response, slice.data, sizeof(response));
+        MessageSendingStatus status = parse_status(slice.data);
+        line_ring_release(s_ring, &slice);
+
+        xSemaphoreTake(s_mutex, portMAX_DELAY);
+        bool discard = s_discard > 0;
+        if (discard) s_discard--;
+        bool discard_done = discard && s_discard == 0;
+        xSemaphoreGive(s_mutex);
+        if (discard) {
+            // a late answer to a command that failed already
+            ESP_LOGW(TAG, "Late response \"%s\" thrown away", response);
+            xSemaphoreGive(s_slots);
+            if (discard_done) ESP_LOGI(TAG, "Caught up with the module");
+            continue;
+        }
+
+        if (!pop_head(&req)) {
+            ESP_LOGW(TAG, "Response \"%s\" with nothing in flight", response);
+            continue;
+        }
+        req.callback(status, response, req.ctx);
+    }
+}
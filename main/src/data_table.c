@@ -1,5 +1,6 @@
 #include "data_table.h"
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -11,52 +12,410 @@
 #include "esp_log.h"
 
 #include "hash_table.h"
+#include "msg_store.h"
 #include "node_globals.h"
 #include "node_table.h"
+#include "event_bus.h"
+#include "json_writer.h"
 
 
-#define TABLE_SIZE (100)
+#define NO_SLOT (0xFFFF)
+#define ANY_BLOCK (-1)      // a victim for its slot or bytes, whatever block it holds
+
+_Static_assert(MSG_COPY_MAX == MSG_STORE_BLOB_MAX + 1, "a copy has to hold any entry");
+
+#ifndef RETAIN_MAX_AGE_S
+#define RETAIN_MAX_AGE_S (24 * 60 * 60)
+#endif
+
+#ifndef MSG_PEER_BUCKETS
+#define MSG_PEER_BUCKETS (32)
+#endif
+
+// per type least recently used lists, threaded through the store slots
+typedef struct {
+    uint16_t head;      // used longest ago, evicted first
+    uint16_t tail;
+    uint16_t count;
+} LruList;
+
+typedef struct {
+    uint16_t prev;
+    uint16_t next;
+    uint8_t list;
+} LruLink;
+
+// newest first lists for msg_query_next, threaded through the store slots too. one per
+// type and one per bucket of peers, peers sharing a bucket are told apart entry by entry
+typedef struct {
+    uint16_t older;
+    uint16_t newer;
+} IndexLink;
+
+typedef struct {
+    uint32_t inserted;
+    uint32_t evicted_space;     // made room for a newer message
+    uint32_t evicted_age;
+    uint32_t rejected;          // nothing could be evicted
+    uint32_t evicted[MSG_TYPE_COUNT];
+    uint16_t high_water_type[MSG_TYPE_COUNT];
+    uint16_t high_water_entries;
+    size_t high_water_bytes;
+} MsgTableStats;
 
 static const char *TAG = "MSG TABLE";
 static SemaphoreHandle_t g_dtb_mutex; 
 
+static LruList s_lru[MSG_TYPE_COUNT];
+static LruLink s_links[MSG_STORE_ENTRIES];
+static uint16_t s_type_newest[MSG_TYPE_COUNT];
+static IndexLink s_type_links[MSG_STORE_ENTRIES];
+static uint16_t s_peer_newest[MSG_PEER_BUCKETS];
+static IndexLink s_peer_links[MSG_STORE_ENTRIES];
+static uint32_t s_arrival[MSG_STORE_ENTRIES];      // insert count when it came in, for since
+static uint32_t s_arrivals;
+static RetentionPolicy s_policy;
+static MsgTableStats s_stats;
+// bumped on every change the page could see, the ETag of /api/messages
+static atomic_uint s_version;
+
 void msg_table_init(void) {
     ESP_LOGI(TAG, "MSG TABLE INIT");
     g_dtb_mutex = xSemaphoreCreateMutex();
-    g_msg_table = create_hashtable(TABLE_SIZE);
+    msg_store_init();
+    g_msg_table = create_hashtable_fixed(MSG_STORE_ENTRIES);
+    msg_store_log_usage();
+
+    for (int t = 0; t < MSG_TYPE_COUNT; t++) {
+        s_lru[t] = (LruList) { .head = NO_SLOT, .tail = NO_SLOT, .count = 0 };
+        s_type_newest[t] = NO_SLOT;
+    }
+    for (int b = 0; b < MSG_PEER_BUCKETS; b++) {
+        s_peer_newest[b] = NO_SLOT;
+    }
+    s_arrivals = 0;
+    memset(&s_stats, 0, sizeof(s_stats));
+
+    // shares in 1/32 of the table, user traffic gets the most. the last 1/32 is first come
+    s_policy = (RetentionPolicy) {
+        .max_entries = MSG_STORE_ENTRIES,
+        .max_bytes = msg_store_bytes_capacity(),
+        .max_age_s = RETAIN_MAX_AGE_S,
+    };
+    s_policy.quota[BROADCAST]   = MSG_STORE_ENTRIES * 6 / 32;
+    s_policy.quota[NORMAL]      = MSG_STORE_ENTRIES * 10 / 32;
+    s_policy.quota[ACK]         = MSG_STORE_ENTRIES * 2 / 32;
+    s_policy.quota[CRITICAL]    = MSG_STORE_ENTRIES * 4 / 32;
+    s_policy.quota[MAINTENANCE] = MSG_STORE_ENTRIES * 4 / 32;
+    s_policy.quota[PING]        = MSG_STORE_ENTRIES * 1 / 32;
+    s_policy.quota[COMMAND]     = MSG_STORE_ENTRIES * 2 / 32;
+    s_policy.quota[FRAGMENT]    = MSG_STORE_ENTRIES * 2 / 32;
+}
+
+static int type_list(MessageType type) {
+    // anything unknown shares list 0, which has no quota
+    return (type > 0 && type < MSG_TYPE_COUNT) ? (int) type : 0;
+}
+
+static void lru_unlink(int slot) {
+    LruLink *link = &s_links[slot];
+    LruList *list = &s_lru[link->list];
+
+    if (link->prev != NO_SLOT) s_links[link->prev].next = link->next;
+    else list->head = link->next;
+    if (link->next != NO_SLOT) s_links[link->next].prev = link->prev;
+    else list->tail = link->prev;
+    list->count--;
+}
+
+static void lru_append(int slot, int t) {
+    LruLink *link = &s_links[slot];
+    LruList *list = &s_lru[t];
+
+    link->list = (uint8_t) t;
+    link->next = NO_SLOT;
+    link->prev = list->tail;
+    if (list->tail != NO_SLOT) s_links[list->tail].next = (uint16_t) slot;
+    else list->head = (uint16_t) slot;
+    list->tail = (uint16_t) slot;
+    list->count++;
+}
+
+static void lru_touch(int slot) {
+    int t = s_links[slot].list;
+    if (s_lru[t].tail != slot) {
+        lru_unlink(slot);
+        lru_append(slot, t);
+    }
+}
+
+// the other end of a conversation this node is in, false for relayed ones and broadcasts
+static bool entry_peer(const DataEntry *entry, ID *peer) {
+    if (entry->stage == MSG_AT_SOURCE && entry->dst_node != BROADCAST_ID) {
+        *peer = entry->dst_node;
+    } else if (entry->stage == MSG_AT_DESTINATION) {
+        *peer = entry->origin_node;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void index_push(uint16_t *newest, IndexLink *links, int slot) {
+    links[slot].older = *newest;
+    links[slot].newer = NO_SLOT;
+    if (*newest != NO_SLOT) links[*newest].newer = (uint16_t) slot;
+    *newest = (uint16_t) slot;
+}
+
+static void index_unlink(uint16_t *newest, IndexLink *links, int slot) {
+    IndexLink *link = &links[slot];
+    if (link->newer != NO_SLOT) links[link->newer].older = link->older;
+    else *newest = link->older;
+    if (link->older != NO_SLOT) links[link->older].newer = link->newer;
+}
+
+// after lru_append, the type list is the lru one
+static void index_add_locked(const DataEntry *entry) {
+    int slot = msg_store_slot(entry);
+    ID peer;
+    s_arrival[slot] = ++s_arrivals;
+    index_push(&s_type_newest[s_links[slot].list], s_type_links, slot);
+    if (entry_peer(entry, &peer)) {
+        index_push(&s_peer_newest[peer % MSG_PEER_BUCKETS], s_peer_links, slot);
+    }
+}
+
+static void index_remove_locked(const DataEntry *entry) {
+    int slot = msg_store_slot(entry);
+    ID peer;
+    index_unlink(&s_type_newest[s_links[slot].list], s_type_links, slot);
+    if (entry_peer(entry, &peer)) {
+        index_unlink(&s_peer_newest[peer % MSG_PEER_BUCKETS], s_peer_links, slot);
+    }
+}
+
+// caller holds g_dtb_mutex
+static void drop_locked(DataEntry *entry) {
+    atomic_fetch_add(&s_version, 1);
+    int slot = msg_store_slot(entry);
+    s_stats.evicted[s_links[slot].list]++;
+    index_remove_locked(entry);
+    lru_unlink(slot);
+    hash_remove(g_msg_table, entry->id);
+    msg_store_free(entry);
+}
+
+// least recently used entry of list t the send path is done with, NULL if there is none.
+// with a room other than ANY_BLOCK only one whose block room bytes could go in
+static DataEntry *lru_victim(int t, int room) {
+    for (uint16_t slot = s_lru[t].head; slot != NO_SLOT; slot = s_links[slot].next) {
+        DataEntry *entry = msg_store_entry(slot);
+        // still waiting on the module
+        if (entry->transfer_status == QUEUED) continue;
+        if (room != ANY_BLOCK && !msg_store_block_fits(entry, (size_t) room)) continue;
+        return entry;
+    }
+    return NULL;
 }
 
+// who pays for a new message of list t: the type furthest over its quota, so chatter that
+// borrowed space gives it back first, then the newcomer's own type, then whoever fills
+// its share the most (only happens when bytes or a block class ran out, not entries).
+// when the new message's block class ran out only entries holding a block it fits in are
+// any use, dropping the others would empty the table and free nothing it can take
+static DataEntry *pick_victim(int t, int room) {
+    int worst = -1;
+    int worst_over = 0;
+    for (int i = 0; i < MSG_TYPE_COUNT; i++) {
+        int over = s_lru[i].count - s_policy.quota[i];
+        if (over > worst_over) {
+            worst = i;
+            worst_over = over;
+        }
+    }
+
+    DataEntry *victim = NULL;
+    if (worst >= 0) victim = lru_victim(worst, room);
+    if (!victim) victim = lru_victim(t, room);
+    if (!victim) {
+        uint32_t fullest_fill = 0;
+        for (int i = 0; i < MSG_TYPE_COUNT; i++) {
+            uint32_t fill = s_lru[i].count * 1024u / (s_policy.quota[i] ? s_policy.quota[i] : 1);
+            if (!s_lru[i].count || (victim && fill < fullest_fill)) continue;
+            DataEntry *candidate = lru_victim(i, room);
+            if (candidate) {
+                victim = candidate;
+                fullest_fill = fill;
+            }
+        }
+    }
+    return victim;
+}
+
+// the store hands out slots in arrival order, so the expired ones are all at the front
+static void expire_locked(time_t now) {
+    if (!s_policy.max_age_s) {
+        return;
+    }
+    DataEntry *oldest;
+    while ((oldest = msg_store_oldest()) &&
+           now - oldest->timestamp > (time_t) s_policy.max_age_s &&
+           oldest->transfer_status != QUEUED) {
+        ESP_LOGD(TAG, "msg %d expired", oldest->id);
+        drop_locked(oldest);
+        s_stats.evicted_age++;
+    }
+}
+
+static void note_insert_locked(int t) {
+    s_stats.inserted++;
+    if (s_lru[t].count > s_stats.high_water_type[t]) {
+        s_stats.high_water_type[t] = s_lru[t].count;
+    }
+    if (msg_store_used() > s_stats.high_water_entries) {
+        s_stats.high_water_entries = (uint16_t) msg_store_used();
+    }
+    if (msg_store_bytes_used() > s_stats.high_water_bytes) {
+        s_stats.high_water_bytes = msg_store_bytes_used();
+    }
+}
 
 DataEntry *msg_find(int key) {
     xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
 
     DataEntry *entry = hash_find(g_msg_table, key);
+    if (entry) {
+        lru_touch(msg_store_slot(entry));
+    }
 
     xSemaphoreGive(g_dtb_mutex);
     return entry;
 }
 
+bool msg_set_ack(ID id, int ack_status, ID *src_node) {
+    xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
+    DataEntry *entry = hash_find(g_msg_table, id);
+    if (entry) {
+        entry->ack_status = ack_status;
+        if (src_node) *src_node = entry->src_node;
+    }
+    xSemaphoreGive(g_dtb_mutex);
+
+    if (entry) msg_changed(id);
+    return entry != NULL;
+}
+
+int msg_ack_status(ID id) {
+    xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
+    DataEntry *entry = hash_find(g_msg_table, id);
+    int ack_status = entry ? entry->ack_status : -1;
+    xSemaphoreGive(g_dtb_mutex);
+    return ack_status;
+}
+
+bool msg_set_status(ID id, MessageSendingStatus status) {
+    xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
+    DataEntry *entry = hash_find(g_msg_table, id);
+    if (entry) entry->transfer_status = status;
+    xSemaphoreGive(g_dtb_mutex);
+
+    if (entry) msg_changed(id);
+    return entry != NULL;
+}
+
+bool msg_write_content(ID id, size_t off, const void *buf, size_t n) {
+    xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
+    DataEntry *entry = hash_find(g_msg_table, id);
+    // the NUL after it has to fit too
+    bool fits = entry && off + n < msg_store_entry_bytes(entry);
+    if (fits) memcpy(entry->content + off, buf, n);
+    xSemaphoreGive(g_dtb_mutex);
+    return fits;
+}
+
+bool msg_content_ready(ID id, size_t len) {
+    xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
+    DataEntry *entry = hash_find(g_msg_table, id);
+    bool grew = entry && (int) len > entry->length && len < msg_store_entry_bytes(entry);
+    if (grew) {
+        entry->content[len] = '\0';
+        entry->length = (int) len;
+    }
+    xSemaphoreGive(g_dtb_mutex);
+    return grew;
+}
+
+void msg_table_get_policy(RetentionPolicy *out) {
+    xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
+    *out = s_policy;
+    xSemaphoreGive(g_dtb_mutex);
+}
+
+void msg_table_set_policy(const RetentionPolicy *policy) {
+    xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
+    s_policy = *policy;
+    if (s_policy.max_entries <= 0 || s_policy.max_entries > MSG_STORE_ENTRIES) {
+        s_policy.max_entries = MSG_STORE_ENTRIES;
+    }
+    if (s_policy.max_bytes == 0 || s_policy.max_bytes > msg_store_bytes_capacity()) {
+        s_policy.max_bytes = msg_store_bytes_capacity();
+    }
+    // anything over the new limits goes on the next insert
+    xSemaphoreGive(g_dtb_mutex);
+
+    ESP_LOGI(TAG, "Retention: %d entries, %u bytes, %u s",
+        s_policy.max_entries, (unsigned) s_policy.max_bytes, (unsigned) s_policy.max_age_s);
+}
+
 ID create_command(char *content) {
     return create_data_object(NO_ID, COMMAND, content, g_my_address, g_my_address, g_my_address, 0, 0, 0, NO_ID);
 }
 
-ID create_data_object(int id, MessageType type, char *content, int src, int dst, int origin, int steps, int rssi, int snr, ID ack_for)
+// caller checked len fits the store, room is at least len
+static ID insert_entry(int id, MessageType type, const char *content, size_t len, size_t room, int src, int dst, int origin, int steps, int rssi, int snr, ID ack_for, MessageSendingStatus status)
 {
-    DataEntry *new_entry = malloc(sizeof(DataEntry));
-    if (!new_entry) {
-        return 0;
+    xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
+
+    if (id != NO_ID && hash_find(g_msg_table, id)) {
+        // ids stay unique in the table so dropping one by id never takes the wrong entry
+        xSemaphoreGive(g_dtb_mutex);
+        ESP_LOGW(TAG, "msg id=%d already in table", id);
+        return id;
     }
 
-    size_t len = strlen(content);
-    char *content_ptr = calloc(len + 1, sizeof(char));
-    if (!content_ptr) {
-        free(new_entry);
+    int t = type_list(type);
+    expire_locked(time(NULL));
+
+    DataEntry *new_entry = NULL;
+    while (msg_store_used() >= s_policy.max_entries || !(new_entry = msg_store_alloc(room))) {
+        DataEntry *victim = pick_victim(t, msg_store_block_free(room) ? ANY_BLOCK : (int) room);
+        if (!victim) break;
+        drop_locked(victim);
+        s_stats.evicted_space++;
+    }
+    // the new entry is in no list yet so it can't pick itself
+    while (new_entry && msg_store_bytes_used() > s_policy.max_bytes) {
+        DataEntry *victim = pick_victim(t, ANY_BLOCK);
+        if (!victim) {
+            msg_store_free(new_entry);
+            new_entry = NULL;
+            break;
+        }
+        drop_locked(victim);
+        s_stats.evicted_space++;
+    }
+    if (!new_entry) {
+        // everything left is waiting on the module
+        s_stats.rejected++;
+        xSemaphoreGive(g_dtb_mutex);
+        ESP_LOGW(TAG, "No room for a type %d message", type);
         return 0;
     }
-    memcpy(content_ptr, content, len);
-    content_ptr[len] = '\0';
 
-    new_entry->content = content_ptr;
+    memcpy(new_entry->content, content, len);
+    new_entry->content[len] = '\0';
+
     new_entry->src_node = src;
     new_entry->dst_node = dst;
     new_entry->origin_node = origin;
@@ -64,7 +423,7 @@ ID create_data_object(int id, MessageType type, char *content, int src, int dst,
     new_entry->target_node = 0;
     new_entry->ack_for = ack_for;
     new_entry->message_type = type;
-    new_entry->transfer_status = NO_STATUS;
+    new_entry->transfer_status = status;
     new_entry->ack_status = 0;
     time(&new_entry->timestamp);
     new_entry->rssi = rssi;
@@ -73,7 +432,7 @@ ID create_data_object(int id, MessageType type, char *content, int src, int dst,
     if (id == NO_ID) {
         do {
             new_entry->id = rand_msg_id();
-        } while (msg_find(new_entry->id));
+        } while (hash_find(g_msg_table, new_entry->id));
     } else {
         new_entry->id = id;
     }
@@ -86,17 +445,41 @@ ID create_data_object(int id, MessageType type, char *content, int src, int dst,
         new_entry->stage = MSG_RELAYED;
     }
 
-
-    xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
-
     hash_insert(g_msg_table, new_entry->id, (void *) new_entry);
+    lru_append(msg_store_slot(new_entry), t);
+    index_add_locked(new_entry);
+    note_insert_locked(t);
+    atomic_fetch_add(&s_version, 1);
+    ID new_id = new_entry->id;
 
     xSemaphoreGive(g_dtb_mutex);
 
 
-    ESP_LOGI(TAG, "Table entry for \"%s\" created ID = %d", new_entry->content, new_entry->id);
+    ESP_LOGI(TAG, "Table entry for \"%s\" created ID = %d", new_entry->content, new_id);
+    event_publish(EVENT_MESSAGE, new_id);
+
+    return new_id;
+}
+
+ID create_data_object(int id, MessageType type, char *content, int src, int dst, int origin, int steps, int rssi, int snr, ID ack_for)
+{
+    size_t len = strlen(content);
+    if (len > MSG_STORE_CONTENT_MAX) {
+        // nothing longer fits in a frame anyway
+        ESP_LOGW(TAG, "Content of %d bytes cut to %d", (int) len, MSG_STORE_CONTENT_MAX);
+        len = MSG_STORE_CONTENT_MAX;
+    }
+    return insert_entry(id, type, content, len, len, src, dst, origin, steps, rssi, snr, ack_for, NO_STATUS);
+}
 
-    return new_entry->id;
+ID create_blob_object(int id, MessageType type, const char *content, size_t len, size_t room, int src, int dst, int origin, MessageSendingStatus status)
+{
+    if (room < len) room = len;
+    if (room > MSG_STORE_BLOB_MAX) {
+        ESP_LOGW(TAG, "No room for %d bytes of content, %d at most", (int) room, MSG_STORE_BLOB_MAX);
+        return NO_ID;
+    }
+    return insert_entry(id, type, content, len, room, src, dst, origin, 0, 0, 0, NO_ID, status);
 }
 
 void free_data_object(DataEntry **ptr)
@@ -105,28 +488,166 @@ void free_data_object(DataEntry **ptr)
         return;
     }
     DataEntry *root = *ptr;
-    free(root->content);
-    free(root);
+
+    xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
+    if (hash_find(g_msg_table, root->id) == root) {
+        hash_remove(g_msg_table, root->id);
+        index_remove_locked(root);
+        lru_unlink(msg_store_slot(root));
+        atomic_fetch_add(&s_version, 1);
+    }
+    msg_store_free(root);
+    xSemaphoreGive(g_dtb_mutex);
+
     *ptr = NULL;
 }
 
-int format_data_as_json(DataEntry *data, char *out, int buff_size) {
-    // content, source, destination, origin, steps, timestamp, id, length, rssi, snr, stage
-
+void write_data_json(JsonWriter *w, const DataEntry *data) {
     char time_buff[32];
     struct tm tm;
     gmtime_r(&data->timestamp, &tm);
     strftime(time_buff, 32, "%Y-%m-%dT%H:%M:%SZ", &tm);
 
-    int n = sprintf(
-        out,
-        "{\"content\" : \"%s\", \"source\" : %d, \"destination\" : %d, \"origin\" : %d, \"steps\" : %d, \"timestamp\" : \"%s\", \"id\" : %d, \"length\" : %d, \"rssi\" : %d, \"snr\" : %d, \"stage\" : %d, \"transfer_status\" : %d, \"ack_status\" : %d, \"message_type\" : %d, \"ack_for\" : %d}",
-        data->content, data->src_node, data->dst_node, data->origin_node, data->steps,
-        time_buff, data->id, data->length, data->rssi, data->snr, data->stage, data->transfer_status, data->ack_status, data->message_type, data->ack_for
-    );
-    out[buff_size - 1] = '\0';
-    return n;
+    json_object_begin(w);
+    json_key(w, "content");         json_string_len(w, data->content, data->length);
+    json_key(w, "source");          json_int(w, data->src_node);
+    json_key(w, "destination");     json_int(w, data->dst_node);
+    json_key(w, "origin");          json_int(w, data->origin_node);
+    json_key(w, "steps");           json_int(w, data->steps);
+    json_key(w, "timestamp");       json_string(w, time_buff);
+    json_key(w, "id");              json_int(w, data->id);
+    json_key(w, "length");          json_int(w, data->length);
+    json_key(w, "rssi");            json_int(w, data->rssi);
+    json_key(w, "snr");             json_int(w, data->snr);
+    json_key(w, "stage");           json_int(w, data->stage);
+    json_key(w, "transfer_status"); json_int(w, data->transfer_status);
+    json_key(w, "ack_status");      json_int(w, data->ack_status);
+    json_key(w, "message_type");    json_int(w, data->message_type);
+    json_key(w, "ack_for");         json_int(w, data->ack_for);
+    json_object_end(w);
+}
+
+uint32_t msg_table_version(void) {
+    return atomic_load(&s_version);
+}
+
+void msg_changed(ID id) {
+    atomic_fetch_add(&s_version, 1);
+    event_publish(EVENT_STATUS, id);
+}
+
+// the caller's copy points at its own content buffer, cut to cap
+static void copy_locked(const DataEntry *entry, DataEntry *out, char *content, size_t cap) {
+    *out = *entry;
+    size_t len = (size_t) entry->length < cap ? (size_t) entry->length : cap - 1;
+    memcpy(content, entry->content, len);
+    content[len] = '\0';
+    out->content = content;
+    out->length = (int) len;
+}
+
+static bool query_match(const MsgQuery *q, const DataEntry *entry) {
+    ID peer;
+    if (q->peer != NO_ID && (!entry_peer(entry, &peer) || peer != q->peer)) return false;
+    if (q->type && (int) entry->message_type != q->type) return false;
+    if (q->stage >= 0 && (int) entry->stage != q->stage) return false;
+    return true;
+}
+
+// the list a query walks: its peer's bucket, its type's, or every entry in the order the
+// store handed them out
+static bool in_query_list(const MsgQuery *q, const DataEntry *entry) {
+    ID peer;
+    if (q->peer != NO_ID) {
+        return entry_peer(entry, &peer) && peer % MSG_PEER_BUCKETS == q->peer % MSG_PEER_BUCKETS;
+    }
+    if (q->type) return type_list(entry->message_type) == type_list(q->type);
+    return true;
+}
+
+static int query_newest_locked(const MsgQuery *q) {
+    if (q->peer != NO_ID) return s_peer_newest[q->peer % MSG_PEER_BUCKETS];
+    if (q->type) return s_type_newest[type_list(q->type)];
+    DataEntry *newest = msg_store_newest();
+    return newest ? msg_store_slot(newest) : NO_SLOT;
+}
+
+static int query_older_locked(const MsgQuery *q, int slot) {
+    if (q->peer != NO_ID) return s_peer_links[slot].older;
+    if (q->type) return s_type_links[slot].older;
+    DataEntry *older = msg_store_older(msg_store_entry(slot));
+    return older ? msg_store_slot(older) : NO_SLOT;
+}
+
+ID msg_query_next(const MsgQuery *q, ID newer, DataEntry *out, char *content, size_t cap) {
+    xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
+
+    uint32_t since = 0;
+    DataEntry *since_entry = q->since != NO_ID ? hash_find(g_msg_table, q->since) : NULL;
+    if (since_entry) since = s_arrival[msg_store_slot(since_entry)];
+
+    int slot = NO_SLOT;
+    if (newer == NO_ID) {
+        slot = query_newest_locked(q);
+    } else {
+        DataEntry *last = hash_find(g_msg_table, newer);
+        if (last && in_query_list(q, last)) {
+            slot = query_older_locked(q, msg_store_slot(last));
+        } else if (last) {
+            // a page cursor the query doesn't list, start at the first one older than it
+            uint32_t below = s_arrival[msg_store_slot(last)];
+            slot = query_newest_locked(q);
+            while (slot != NO_SLOT && s_arrival[slot] >= below) slot = query_older_locked(q, slot);
+        }
+    }
+
+    ID id = NO_ID;
+    for (; slot != NO_SLOT && s_arrival[slot] > since; slot = query_older_locked(q, slot)) {
+        DataEntry *entry = msg_store_entry(slot);
+        if (query_match(q, entry)) {
+            copy_locked(entry, out, content, cap);
+            id = entry->id;
+            break;
+        }
+    }
+
+    xSemaphoreGive(g_dtb_mutex);
+    return id;
+}
+
+bool msg_copy(ID id, DataEntry *out, char *content, size_t cap) {
+    xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
+    DataEntry *entry = hash_find(g_msg_table, id);
+    if (entry) copy_locked(entry, out, content, cap);
+    xSemaphoreGive(g_dtb_mutex);
+    return entry != NULL;
 }
 
+int format_msg_stats_as_json(char *out, int buff_size) {
+    xSemaphoreTake(g_dtb_mutex, portMAX_DELAY);
 
+    int n = snprintf(out, buff_size,
+        "{\"entries\" : %d, \"bytes\" : %u, \"capacity_entries\" : %d, \"capacity_bytes\" : %u, "
+        "\"high_water_entries\" : %u, \"high_water_bytes\" : %u, \"inserted\" : %u, "
+        "\"evicted_space\" : %u, \"evicted_age\" : %u, \"rejected\" : %u, "
+        "\"max_entries\" : %d, \"max_bytes\" : %u, \"max_age_s\" : %u, \"types\" : [",
+        msg_store_used(), (unsigned) msg_store_bytes_used(), MSG_STORE_ENTRIES, (unsigned) msg_store_bytes_capacity(),
+        s_stats.high_water_entries, (unsigned) s_stats.high_water_bytes, (unsigned) s_stats.inserted,
+        (unsigned) s_stats.evicted_space, (unsigned) s_stats.evicted_age, (unsigned) s_stats.rejected,
+        s_policy.max_entries, (unsigned) s_policy.max_bytes, (unsigned) s_policy.max_age_s
+    );
+    for (int t = BROADCAST; t < MSG_TYPE_COUNT && n < buff_size; t++) {
+        n += snprintf(out + n, buff_size - n,
+            "%s{\"message_type\" : %d, \"entries\" : %u, \"quota\" : %u, \"high_water\" : %u, \"evicted\" : %u}",
+            (t == BROADCAST) ? "" : ", ", t, s_lru[t].count, s_policy.quota[t],
+            s_stats.high_water_type[t], (unsigned) s_stats.evicted[t]
+        );
+    }
+    if (n < buff_size) {
+        n += snprintf(out + n, buff_size - n, "]}");
+    }
 
+    xSemaphoreGive(g_dtb_mutex);
+    out[buff_size - 1] = '\0';
+    return n;
+}
@@ -0,0 +1,136 @@
+#include "event_bus.h"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+typedef struct {
+    bool used;
+    bool lost;                      // fell behind, gets a reset before anything else
+    uint8_t head;
+    uint8_t count;
+    BusEvent items[EVENT_CLIENT_QUEUE];
+    SemaphoreHandle_t ready;        // given on every event for it
+} EventClient;
+
+static const char *TAG = "EVENT BUS";
+
+static BusEvent s_history[EVENT_HISTORY];
+static uint32_t s_seq;              // the last one handed out
+static EventClient s_clients[EVENT_CLIENTS_MAX];
+static SemaphoreHandle_t s_lock;
+
+void event_bus_init(void) {
+    memset(s_history, 0, sizeof(s_history));
+    s_seq = 0;
+    for (int i = 0; i < EVENT_CLIENTS_MAX; i++) {
+        s_clients[i].used = false;
+        s_clients[i].ready = xSemaphoreCreateBinary();
+    }
+    s_lock = xSemaphoreCreateMutex();
+}
+
+static void push_locked(EventClient *client, const BusEvent *event) {
+    if (client->lost) return;
+    if (client->count == EVENT_CLIENT_QUEUE) {
+        // whatever is queued is no use to it now, it fetches everything again
+        client->lost = true;
+        client->count = 0;
+        return;
+    }
+    client->items[(client->head + client->count) % EVENT_CLIENT_QUEUE] = *event;
+    client->count++;
+}
+
+void event_publish(EventKind kind, ID key) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    BusEvent event = { .seq = ++s_seq, .key = key, .kind = (uint8_t) kind };
+    s_history[event.seq % EVENT_HISTORY] = event;
+    for (int i = 0; i < EVENT_CLIENTS_MAX; i++) {
+        EventClient *client = &s_clients[i];
+        if (!client->used) continue;
+        push_locked(client, &event);
+        xSemaphoreGive(client->ready);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+int event_subscribe(uint32_t last_seq) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int slot = -1;
+    for (int i = 0; i < EVENT_CLIENTS_MAX && slot < 0; i++) {
+        if (!s_clients[i].used) slot = i;
+    }
+    if (slot < 0) {
+        xSemaphoreGive(s_lock);
+        ESP_LOGW(TAG, "%d clients already", EVENT_CLIENTS_MAX);
+        return -1;
+    }
+
+    EventClient *client = &s_clients[slot];
+    client->used = true;
+    client->lost = false;
+    client->head = 0;
+    client->count = 0;
+    xSemaphoreTake(client->ready, 0);
+
+    if (last_seq) {
+        uint32_t oldest = s_seq > EVENT_HISTORY ? s_seq - EVENT_HISTORY + 1 : 1;
+        if (last_seq > s_seq || last_seq + 1 < oldest) {
+            // from before a restart, or gone from the history
+            client->lost = true;
+        } else {
+            for (uint32_t seq = last_seq + 1; seq <= s_seq; seq++) {
+                push_locked(client, &s_history[seq % EVENT_HISTORY]);
+            }
+        }
+        if (client->lost || client->count) xSemaphoreGive(client->ready);
+    }
+    xSemaphoreGive(s_lock);
+
+    ESP_LOGI(TAG, "Client %d from seq %u", slot, (unsigned) last_seq);
+    return slot;
+}
+
+bool event_next(int client_id, BusEvent *out, uint32_t wait_ms) {
+    EventClient *client = &s_clients[client_id];
+    TickType_t start = xTaskGetTickCount();
+    TickType_t wait = pdMS_TO_TICKS(wait_ms);
+
+    for (;;) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        if (client->lost) {
+            // the lists it fetches now are at least as new as this
+            client->lost = false;
+            client->count = 0;
+            *out = (BusEvent) { .seq = s_seq, .key = NO_ID, .kind = EVENT_RESET };
+            xSemaphoreGive(s_lock);
+            return true;
+        }
+        if (client->count) {
+            *out = client->items[client->head];
+            client->head = (client->head + 1) % EVENT_CLIENT_QUEUE;
+            client->count--;
+            xSemaphoreGive(s_lock);
+            return true;
+        }
+        xSemaphoreGive(s_lock);
+
+        // the semaphore can be left over from an event taken already, wait out the rest
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= wait || xSemaphoreTake(client->ready, wait - waited) != pdTRUE) {
+            return false;
+        }
+    }
+}
+
+void event_unsubscribe(int client_id) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_clients[client_id].used = false;
+    s_clients[client_id].count = 0;
+    xSemaphoreGive(s_lock);
+    ESP_LOGI(TAG, "Client %d gone", client_id);
+}
@@ -0,0 +1,460 @@
+#include "fragment.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "msg_store.h"
+#include "frame_codec.h"
+#include "airtime.h"
+#include "lora_uart.h"
+
+_Static_assert(FRAG_MAX_BYTES <= MSG_STORE_BLOB_MAX, "a whole message has to fit a blob block");
+_Static_assert(FRAG_MAX_COUNT <= 32, "one bit per fragment in a report");
+
+#define FRAG_TICK_MS (100)
+// after a fragment went on air the next waits this many of its airtimes, so the next hop
+// has passed it on and acked it before this radio talks again and can't hear
+#define FRAG_GAP_FRAMES (2)
+
+typedef struct {
+    ID xfer;                    // id of the whole message, NO_ID for a free slot
+    ID dst;
+    uint8_t count;
+    uint8_t polls;              // since the last report that moved it along
+    uint32_t have;              // fragments the destination said it holds
+    uint32_t sent;              // went out at least once
+    uint32_t to_send;           // picked to go out next, lowest first
+    ID last_fragment;           // queued last and not seen on air yet, the next waits for it
+    TickType_t gap;             // and then this long after
+    TickType_t next_at;
+    uint32_t rtt_ms;            // from asking for a report to getting it
+    TickType_t asked_at;
+    TickType_t deadline;        // no report by then, poll. only once to_send is empty
+} FragTx;
+
+typedef struct {
+    ID origin;                  // NO_ID for a free slot
+    ID xfer;
+    uint8_t count;
+    uint16_t total;
+    uint32_t have;
+    TickType_t heard;           // last fragment
+} FragRx;
+
+static const char *TAG = "FRAG";
+
+static FragTx s_tx[FRAG_TX_MAX];
+static FragRx s_rx[FRAG_RX_MAX];
+static FragStats s_stats;
+static SemaphoreHandle_t s_lock;
+
+void frag_init(void) {
+    memset(s_tx, 0, sizeof(s_tx));
+    memset(s_rx, 0, sizeof(s_rx));
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_lock = xSemaphoreCreateMutex();
+}
+
+static int fragment_count(size_t total) {
+    return (int)((total + FRAG_CHUNK_MAX - 1) / FRAG_CHUNK_MAX);
+}
+
+// every fragment but the last carries this much
+static size_t fragment_chunk(size_t total, int count) {
+    return (total + count - 1) / count;
+}
+
+static uint32_t all_of(int count) {
+    return count >= 32 ? UINT32_MAX : (1u << count) - 1;
+}
+
+static TickType_t report_wait(const FragTx *tx) {
+    uint32_t wait_ms = tx->rtt_ms ? 2 * tx->rtt_ms : FRAG_REPORT_MS;
+    if (wait_ms < FRAG_REPORT_MIN_MS) wait_ms = FRAG_REPORT_MIN_MS;
+    wait_ms <<= tx->polls;
+    return pdMS_TO_TICKS(wait_ms < FRAG_REPORT_MAX_MS ? wait_ms : FRAG_REPORT_MAX_MS);
+}
+
+// ---------------------------------------------------------------- sending
+
+// id of the fragment in the table, NO_ID if it couldn't be queued
+static ID send_fragment(ID xfer, ID dst, int index, int count, bool poll) {
+    DataEntry *whole = msg_find(xfer);
+    if (!whole) return NO_ID;
+    size_t total = (size_t) whole->length;
+    size_t chunk = fragment_chunk(total, count);
+    size_t offset = index * chunk;
+    size_t len = total - offset < chunk ? total - offset : chunk;
+
+    char content[MSG_STORE_CONTENT_MAX + 1];
+    int n = snprintf(content, sizeof(content), "%c%hu,%d/%d,%u:",
+        poll ? FRAG_POLL : FRAG_DATA, xfer, index, count, (unsigned) total);
+    memcpy(content + n, whole->content + offset, len);
+    content[n + len] = '\0';
+
+    ID id = create_data_object(NO_ID, FRAGMENT, content, g_my_address, dst, g_my_address, 0, 0, 0, NO_ID);
+    return id != NO_ID && queue_send(id, dst, true) ? id : NO_ID;
+}
+
+// the first `max` fragments the destination doesn't have go out next. caller holds s_lock
+static void pick_missing(FragTx *tx, int max) {
+    tx->to_send = 0;
+    for (int i = 0; i < tx->count && max > 0; i++) {
+        if (tx->have & (1u << i)) continue;
+        tx->to_send |= 1u << i;
+        max--;
+    }
+}
+
+ID frag_send(ID dst, const char *content, size_t len) {
+    if (dst == BROADCAST_ID || dst == g_my_address || len == 0 || len > FRAG_MAX_BYTES) {
+        return NO_ID;
+    }
+
+    // kept in the table until the destination has all of it
+    ID xfer = create_blob_object(NO_ID, NORMAL, content, len, len, g_my_address, dst, g_my_address, QUEUED);
+    DataEntry *whole = msg_find(xfer);
+    if (!whole) return NO_ID;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    FragTx *tx = NULL;
+    for (int i = 0; i < FRAG_TX_MAX && !tx; i++) {
+        if (s_tx[i].xfer == NO_ID) tx = &s_tx[i];
+    }
+    if (tx) {
+        *tx = (FragTx) { .xfer = xfer, .dst = dst, .count = (uint8_t) fragment_count(len), .next_at = xTaskGetTickCount() };
+        pick_missing(tx, FRAG_WINDOW);
+        s_stats.sent++;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (!tx) {
+        ESP_LOGW(TAG, "%d messages going out in fragments already, %u bytes to %hu not sent",
+            FRAG_TX_MAX, (unsigned) len, dst);
+        free_data_object(&whole);
+        return NO_ID;
+    }
+
+    printf("FRAG: msg %hu to %hu, %u bytes in %d fragments\n", xfer, dst, (unsigned) len, fragment_count(len));
+    return xfer;
+}
+
+static void report_received(ID from, ID xfer, uint32_t have) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    FragTx *tx = NULL;
+    for (int i = 0; i < FRAG_TX_MAX && !tx; i++) {
+        if (s_tx[i].xfer == xfer && s_tx[i].dst == from) tx = &s_tx[i];
+    }
+    if (!tx) {
+        // finished or given up on already
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    // taken as it is, not added up. a destination that timed out and started over holds
+    // less than it said before
+    have &= all_of(tx->count);
+    if (have & ~tx->have) tx->polls = 0;
+    tx->have = have;
+    tx->rtt_ms = (xTaskGetTickCount() - tx->asked_at) * portTICK_PERIOD_MS;
+    bool done = tx->have == all_of(tx->count);
+    if (done) {
+        tx->xfer = NO_ID;
+        s_stats.delivered++;
+    } else {
+        // the lost ones again, then on to new ones
+        pick_missing(tx, FRAG_WINDOW);
+    }
+    xSemaphoreGive(s_lock);
+
+    if (!done) return;
+    msg_set_ack(xfer, 1, NULL);
+    msg_set_status(xfer, OK);
+    printf("FRAG: msg %hu all at %hu\n", xfer, from);
+}
+
+// ---------------------------------------------------------------- receiving
+
+static void send_report(ID origin, ID xfer, uint32_t have) {
+    char content[24];
+    snprintf(content, sizeof(content), "%c%hu,%lx", FRAG_REPORT, xfer, (unsigned long) have);
+    ID id = create_data_object(NO_ID, FRAGMENT, content, g_my_address, origin, g_my_address, 0, 0, 0, NO_ID);
+    if (id != NO_ID) queue_send(id, origin, true);
+}
+
+static FragRx *find_rx(ID origin, ID xfer) {
+    for (int i = 0; i < FRAG_RX_MAX; i++) {
+        if (s_rx[i].origin == origin && s_rx[i].xfer == xfer) return &s_rx[i];
+    }
+    return NULL;
+}
+
+// a slot and the table entry the message is put together in, NULL when it is refused
+static FragRx *start_rx(const DataEntry *frag, ID xfer, int count, size_t total) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    FragRx *rx = NULL;
+    size_t reserved = 0;
+    for (int i = 0; i < FRAG_RX_MAX; i++) {
+        if (s_rx[i].origin == NO_ID) {
+            if (!rx) rx = &s_rx[i];
+        } else {
+            reserved += s_rx[i].total;
+        }
+    }
+    if (rx && reserved + total <= FRAG_RX_BYTES) {
+        *rx = (FragRx) {
+            .origin = frag->origin_node, .xfer = xfer, .count = (uint8_t) count,
+            .total = (uint16_t) total, .heard = xTaskGetTickCount(),
+        };
+    } else {
+        rx = NULL;
+        s_stats.refused++;
+    }
+    xSemaphoreGive(s_lock);
+    if (!rx) {
+        ESP_LOGW(TAG, "no room to put msg %hu from %hu together (%u bytes)", xfer, frag->origin_node, (unsigned) total);
+        return NULL;
+    }
+
+    DataEntry *whole = NULL;
+    if (create_blob_object(xfer, NORMAL, "", 0, total, frag->src_node, g_my_address, frag->origin_node, NO_STATUS) == xfer) {
+        whole = msg_find(xfer);
+    }
+    if (!whole || whole->origin_node != frag->origin_node || whole->length != 0) {
+        // the table is full of queued frames, or the id is taken by someone else's message
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        rx->origin = NO_ID;
+        s_stats.refused++;
+        xSemaphoreGive(s_lock);
+        return NULL;
+    }
+    // not evicted half done, it goes when it times out
+    msg_set_status(xfer, QUEUED);
+    return rx;
+}
+
+static void fragment_in(const DataEntry *frag, char kind, ID xfer, int index, int count, size_t total, const char *piece, size_t len) {
+    ID origin = frag->origin_node;
+    size_t chunk = fragment_chunk(total, count);
+    size_t offset = index * chunk;
+    if ((count - 1) * chunk >= total || len != (total - offset < chunk ? total - offset : chunk)) {
+        printf("FRAG: bad fragment %d/%d of msg %hu from %hu\n", index, count, xfer, origin);
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    FragRx *rx = find_rx(origin, xfer);
+    xSemaphoreGive(s_lock);
+
+    DataEntry *whole = msg_find(xfer);
+    if (!rx) {
+        if (whole && whole->origin_node == origin && whole->length == (int) total) {
+            // had all of it already, the report saying so went missing
+            if (kind == FRAG_POLL) send_report(origin, xfer, all_of(count));
+            return;
+        }
+        rx = start_rx(frag, xfer, count, total);
+        if (!rx) return;
+        whole = msg_find(xfer);
+    }
+    if (!whole || whole->origin_node != origin || rx->count != count || rx->total != total) {
+        // dropped from the table meanwhile, or a different message under the same id
+        printf("FRAG: msg %hu from %hu can't be put together\n", xfer, origin);
+        if (!whole || whole->origin_node != origin) {
+            xSemaphoreTake(s_lock, portMAX_DELAY);
+            rx->origin = NO_ID;
+            xSemaphoreGive(s_lock);
+        }
+        return;
+    }
+
+    // by id, the entry may have gone since it was looked at
+    if (!msg_write_content(xfer, offset, piece, len)) {
+        printf("FRAG: msg %hu from %hu dropped while put together\n", xfer, origin);
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        rx->origin = NO_ID;
+        xSemaphoreGive(s_lock);
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    rx->have |= 1u << index;
+    rx->heard = xTaskGetTickCount();
+    uint32_t have = rx->have;
+    bool done = have == all_of(count);
+    if (done) {
+        rx->origin = NO_ID;
+        s_stats.received++;
+    }
+    xSemaphoreGive(s_lock);
+
+    // everything up to the first gap can be read already. the byte after it belongs to a
+    // fragment still missing, so the terminator doesn't cut into one that came early
+    int first_gap = __builtin_ctz(~have);
+    size_t ready = (size_t) first_gap * chunk < total ? (size_t) first_gap * chunk : total;
+    bool grew = msg_content_ready(xfer, ready);
+    if (done) {
+        msg_set_status(xfer, NO_STATUS);
+        printf("FRAG: msg %hu from %hu put together, %u bytes in %d fragments\n", xfer, origin, (unsigned) total, count);
+    }
+    // msg_set_status() told the page already
+    if (grew && !done) msg_changed(xfer);
+    if (done || kind == FRAG_POLL) send_report(origin, xfer, have);
+}
+
+void frag_received(ID msg_id) {
+    DataEntry *frag = msg_find(msg_id);
+    if (!frag) return;
+
+    char kind = frag->content[0];
+    unsigned int xfer, total;
+    int index, count, start = 0;
+    if (kind == FRAG_REPORT) {
+        unsigned long have;
+        if (sscanf(frag->content + 1, "%u,%lx", &xfer, &have) == 2) {
+            report_received(frag->origin_node, (ID) xfer, (uint32_t) have);
+        }
+        return;
+    }
+    if ((kind != FRAG_DATA && kind != FRAG_POLL) ||
+        sscanf(frag->content + 1, "%u,%d/%d,%u:%n", &xfer, &index, &count, &total, &start) != 4 || !start ||
+        xfer == NO_ID || count < 1 || count > FRAG_MAX_COUNT || index < 0 || index >= count ||
+        total == 0 || total > FRAG_MAX_BYTES) {
+        printf("FRAG: can't read \"%s\"\n", frag->content);
+        return;
+    }
+    const char *piece = frag->content + 1 + start;
+    fragment_in(frag, kind, (ID) xfer, index, count, total, piece, frag->length - 1 - start);
+}
+
+// ---------------------------------------------------------------- timeouts
+
+void frag_stats(FragStats *out) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *out = s_stats;
+    xSemaphoreGive(s_lock);
+}
+
+int format_frag_stats_as_json(char *out, int buff_size) {
+    FragStats stats;
+    frag_stats(&stats);
+
+    int n = snprintf(out, buff_size,
+        "{\"sent\" : %u, \"delivered\" : %u, \"given_up\" : %u, \"fragments_sent\" : %u, "
+        "\"fragments_resent\" : %u, \"received\" : %u, \"refused\" : %u, \"timed_out\" : %u}",
+        (unsigned) stats.sent, (unsigned) stats.delivered, (unsigned) stats.given_up,
+        (unsigned) stats.fragments_sent, (unsigned) stats.fragments_resent, (unsigned) stats.received,
+        (unsigned) stats.refused, (unsigned) stats.timed_out);
+
+    out[buff_size - 1] = '\0';
+    return n;
+}
+
+// the next fragment of tx once the one before it went on air and the gap after it is
+// over
+static void send_next(const FragTx *tx, TickType_t now) {
+    if (tx->last_fragment != NO_ID) {
+        DataEntry *last = msg_find(tx->last_fragment);
+        if (last && last->transfer_status == QUEUED) return;
+        // off the air about now, the gap starts
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        for (int i = 0; i < FRAG_TX_MAX; i++) {
+            if (s_tx[i].xfer != tx->xfer || s_tx[i].last_fragment != tx->last_fragment) continue;
+            s_tx[i].last_fragment = NO_ID;
+            s_tx[i].next_at = now + tx->gap;
+        }
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    if ((int32_t)(now - tx->next_at) < 0) return;
+
+    int index = __builtin_ctz(tx->to_send);
+    bool poll = (tx->to_send & (tx->to_send - 1)) == 0;
+    ID id = send_fragment(tx->xfer, tx->dst, index, tx->count, poll);
+    DataEntry *frag = id != NO_ID ? msg_find(id) : NULL;
+    uint32_t frame_ms = airtime_frame_ms(FRAME_HEADER_LEN + (frag ? frag->length : FRAG_CHUNK_MAX));
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    FragTx *slot = NULL;
+    for (int i = 0; i < FRAG_TX_MAX && !slot; i++) {
+        if (s_tx[i].xfer == tx->xfer) slot = &s_tx[i];
+    }
+    if (id != NO_ID) {
+        s_stats.fragments_sent++;
+        if (tx->sent & (1u << index)) s_stats.fragments_resent++;
+    }
+    if (slot) {
+        // one that didn't make it into the queue shows up missing in the next report
+        slot->sent |= 1u << index;
+        slot->to_send &= ~(1u << index);
+        slot->last_fragment = id;
+        slot->gap = pdMS_TO_TICKS(FRAG_GAP_FRAMES * frame_ms);
+        slot->next_at = now + slot->gap;
+        if (poll) {
+            slot->asked_at = now;
+            slot->deadline = now + report_wait(slot);
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void frag_task(void *arg) {
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(FRAG_TICK_MS));
+        TickType_t now = xTaskGetTickCount();
+
+        // copied out so the table and the send queue are used without the lock
+        FragTx sending[FRAG_TX_MAX];
+        int sending_count = 0;
+        FragTx failed[FRAG_TX_MAX];
+        int failed_count = 0;
+        FragRx stale[FRAG_RX_MAX];
+        int stale_count = 0;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        for (int i = 0; i < FRAG_TX_MAX; i++) {
+            FragTx *tx = &s_tx[i];
+            if (tx->xfer == NO_ID) continue;
+            if (!tx->to_send && (int32_t)(now - tx->deadline) >= 0) {
+                if (tx->polls == FRAG_MAX_POLLS) {
+                    failed[failed_count++] = *tx;
+                    tx->xfer = NO_ID;
+                    s_stats.given_up++;
+                    continue;
+                }
+                // the report or the fragment asking for it got lost, ask again with the
+                // first one still missing
+                tx->polls++;
+                pick_missing(tx, 1);
+                printf("FRAG: no report for msg %hu from %hu, poll %d\n", tx->xfer, tx->dst, tx->polls);
+            }
+            if (tx->to_send) sending[sending_count++] = *tx;
+        }
+        for (int i = 0; i < FRAG_RX_MAX; i++) {
+            FragRx *rx = &s_rx[i];
+            if (rx->origin == NO_ID || now - rx->heard < pdMS_TO_TICKS(FRAG_RX_TIMEOUT_MS)) continue;
+            stale[stale_count++] = *rx;
+            rx->origin = NO_ID;
+            s_stats.timed_out++;
+        }
+        xSemaphoreGive(s_lock);
+
+        for (int i = 0; i < sending_count; i++) {
+            send_next(&sending[i], now);
+        }
+        for (int i = 0; i < failed_count; i++) {
+            ESP_LOGW(TAG, "msg %hu to %hu given up, %d of %d fragments reported", failed[i].xfer, failed[i].dst,
+                __builtin_popcount(failed[i].have), failed[i].count);
+            msg_set_status(failed[i].xfer, ERR);
+        }
+        for (int i = 0; i < stale_count; i++) {
+            ESP_LOGW(TAG, "msg %hu from %hu never finished, %d of %d fragments", stale[i].xfer, stale[i].origin,
+                __builtin_popcount(stale[i].have), stale[i].count);
+            DataEntry *whole = msg_find(stale[i].xfer);
+            if (whole && whole->origin_node == stale[i].origin) free_data_object(&whole);
+        }
+    }
+}
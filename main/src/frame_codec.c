@@ -0,0 +1,420 @@
+#include "frame_codec.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "squash.h"
+
+// legacy frame: "<content>,<origin>,<dest>,<steps>,<msg_type>,<id>,<ack_for>"
+#define LEGACY_TRAILING_FIELDS (6)
+
+static bool parse_long(const char *s, const char *end, long *out) {
+    if (s >= end) return false;
+
+    bool neg = false;
+    if (*s == '-' || *s == '+') {
+        neg = (*s == '-');
+        s++;
+        if (s >= end) return false;
+    }
+
+    long v = 0;
+    for (; s < end; s++) {
+        if (*s < '0' || *s > '9') return false;
+        v = v * 10 + (*s - '0');
+        if (v > 0xFFFFFF) return false; // nothing on the wire is this large
+    }
+    *out = neg ? -v : v;
+    return true;
+}
+
+static inline void put_u16(uint8_t *p, ID v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)(v & 0xFF);
+}
+
+static inline ID get_u16(const uint8_t *p) {
+    return (ID)((p[0] << 8) | p[1]);
+}
+
+static inline bool needs_escape(uint8_t b) {
+    return b == 0x00 || b == '\r' || b == '\n' || b == FRAME_ESC;
+}
+
+size_t frame_escape(const uint8_t *in, size_t in_len, char *out, size_t out_cap) {
+    size_t len = 0;
+    for (size_t i = 0; i < in_len; i++) {
+        uint8_t b = in[i];
+        if (needs_escape(b)) {
+            if (len + 2 > out_cap) return 0;
+            out[len++] = (char)FRAME_ESC;
+            out[len++] = (char)(b ^ FRAME_ESC_XOR);
+        } else {
+            if (len + 1 > out_cap) return 0;
+            out[len++] = (char)b;
+        }
+    }
+    return len;
+}
+
+size_t frame_unescape(const char *in, size_t in_len, uint8_t *out, size_t out_cap) {
+    size_t len = 0;
+    for (size_t i = 0; i < in_len; i++) {
+        uint8_t b = (uint8_t)in[i];
+        if (b == FRAME_ESC) {
+            if (++i >= in_len) return 0; // dangling escape
+            b = (uint8_t)in[i] ^ FRAME_ESC_XOR;
+        }
+        if (len >= out_cap) return 0;
+        out[len++] = b;
+    }
+    return len;
+}
+
+static const char TEXT_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static int text_value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+size_t frame_text_pack(const uint8_t *in, size_t in_len, char *out, size_t out_cap) {
+    size_t len = FRAME_TEXT_LEN(in_len);
+    if (len + 1 > out_cap) return 0;
+
+    size_t o = 0;
+    uint32_t bits = 0;
+    int held = 0;
+    for (size_t i = 0; i < in_len; i++) {
+        bits = (bits << 8) | in[i];
+        held += 8;
+        while (held >= 6) {
+            held -= 6;
+            out[o++] = TEXT_ALPHABET[(bits >> held) & 0x3F];
+        }
+    }
+    if (held) out[o++] = TEXT_ALPHABET[(bits << (6 - held)) & 0x3F];
+    out[o] = '\0';
+    return o;
+}
+
+size_t frame_text_unpack(const char *in, size_t in_len, uint8_t *out, size_t out_cap) {
+    size_t len = 0;
+    uint32_t bits = 0;
+    int held = 0;
+    for (size_t i = 0; i < in_len; i++) {
+        int v = text_value(in[i]);
+        if (v < 0) return 0;
+        bits = (bits << 6) | (uint32_t) v;
+        held += 6;
+        if (held >= 8) {
+            held -= 8;
+            if (len >= out_cap) return 0;
+            out[len++] = (uint8_t)(bits >> held);
+        }
+    }
+    return len;
+}
+
+// text that came out of frame_text_pack(), unpacked into out. 0 for anything else,
+// including text that wouldn't pack back the same
+static size_t text_repack(const char *in, size_t in_len, uint8_t *out, size_t out_cap) {
+    size_t len = frame_text_unpack(in, in_len, out, out_cap);
+    if (!len || FRAME_TEXT_LEN(len) != in_len) return 0;
+    char again[LORA_MAX_PAYLOAD + 1];
+    if (frame_text_pack(out, len, again, sizeof(again)) != in_len || memcmp(again, in, in_len) != 0) return 0;
+    return len;
+}
+
+size_t frame_compress(const char *content, size_t content_len, uint8_t *out, size_t out_cap, uint8_t *flag) {
+    *flag = 0;
+    if (content_len > LORA_MAX_PAYLOAD) return 0;
+
+    uint8_t packed[LORA_MAX_PAYLOAD];
+    size_t packed_len = text_repack(content, content_len, packed, sizeof(packed));
+    size_t best = content_len;
+    if (packed_len && packed_len < best && packed_len <= out_cap) {
+        memcpy(out, packed, packed_len);
+        best = packed_len;
+        *flag = FRAME_FLAG_PACKED;
+    }
+    uint8_t squashed[LORA_MAX_PAYLOAD];
+    size_t squashed_len = squash((const uint8_t *) content, content_len, squashed, best < out_cap ? best : out_cap);
+    if (squashed_len && squashed_len < best) {
+        memcpy(out, squashed, squashed_len);
+        best = squashed_len;
+        *flag = FRAME_FLAG_SQUASHED;
+    }
+    return *flag ? best : 0;
+}
+
+size_t frame_decompress(uint8_t flags, const uint8_t *in, size_t in_len, char *out, size_t out_cap) {
+    if (flags & FRAME_FLAG_PACKED) return frame_text_pack(in, in_len, out, out_cap);
+    if (flags & FRAME_FLAG_SQUASHED) return unsquash(in, in_len, (uint8_t *) out, out_cap);
+    return 0;
+}
+
+bool frame_parse_rcv(const char *line, size_t line_len, RcvLine *out) {
+    //  +RCV=<from>,<len>,<data>,<rssi>,<snr>
+    // data may contain commas (and escaped binary) so it is sliced by <len> not by searching
+    const char *end = line + line_len;
+    if (line_len < 5 || strncmp(line, "+RCV=", 5) != 0) return false;
+
+    const char *p = line + 5;
+    const char *comma = memchr(p, ',', end - p);
+    long from, len;
+    if (!comma || !parse_long(p, comma, &from)) return false;
+
+    p = comma + 1;
+    comma = memchr(p, ',', end - p);
+    if (!comma || !parse_long(p, comma, &len)) return false;
+    if (len < 0 || len > end - (comma + 1)) return false;
+
+    out->from = (ID)from;
+    out->payload = comma + 1;
+    out->payload_len = (size_t)len;
+
+    p = out->payload + len;
+    if (p >= end || *p != ',') return false;
+    p++;
+
+    comma = memchr(p, ',', end - p);
+    long rssi, snr;
+    if (!comma || !parse_long(p, comma, &rssi)) return false;
+    if (!parse_long(comma + 1, end, &snr)) return false;
+
+    out->rssi = (int)rssi;
+    out->snr = (int)snr;
+    return true;
+}
+
+static int encode_legacy(const FrameHeader *hdr, const char *content, size_t content_len, char *out, size_t out_cap) {
+    int n = snprintf(out, out_cap, "%.*s,%u,%u,%d,%d,%u,%u",
+                     (int)content_len, content, hdr->origin, hdr->dest, hdr->steps, hdr->msg_type, hdr->id, hdr->ack_for);
+    if (n < 0 || (size_t)n >= out_cap) return -1;
+    return n;
+}
+
+static void put_header(const FrameHeader *hdr, uint8_t *raw) {
+    raw[0] = FRAME_MAGIC | (hdr->version & FRAME_VERSION_MASK);
+    put_u16(raw + 1, hdr->origin);
+    put_u16(raw + 3, hdr->dest);
+    put_u16(raw + 5, hdr->id);
+    put_u16(raw + 7, hdr->ack_for);
+    raw[9] = hdr->steps;
+    raw[10] = hdr->msg_type;
+    raw[11] = hdr->flags;
+}
+
+// header and content as they go on air, compressed when the next hop reads it and it saves
+// something. the length, 0 when it doesn't fit cap
+static size_t pack_frame(const FrameHeader *hdr, const char *content, size_t content_len, uint8_t *raw, size_t cap) {
+    if (cap < FRAME_HEADER_LEN) return 0;
+    FrameHeader sent = *hdr;
+    size_t body = 0;
+    if (hdr->version >= WIRE_VERSION_COMPRESS) {
+        uint8_t flag;
+        body = frame_compress(content, content_len, raw + FRAME_HEADER_LEN, cap - FRAME_HEADER_LEN, &flag);
+        sent.flags |= flag;
+    }
+    if (!body) {
+        if (content_len > cap - FRAME_HEADER_LEN) return 0;
+        memcpy(raw + FRAME_HEADER_LEN, content, content_len);
+        body = content_len;
+    }
+    put_header(&sent, raw);
+    return FRAME_HEADER_LEN + body;
+}
+
+static int encode_binary(const FrameHeader *hdr, const char *content, size_t content_len, char *out, size_t out_cap) {
+    uint8_t raw[FRAME_HEADER_LEN + LORA_MAX_PAYLOAD];
+    size_t raw_len = pack_frame(hdr, content, content_len, raw, sizeof(raw));
+    if (!raw_len) return -1;
+
+    // leave room to terminate so the command can still be logged as a string
+    size_t len = frame_escape(raw, raw_len, out, out_cap - 1);
+    if (!len) return -1;
+    out[len] = '\0';
+    return (int)len;
+}
+
+int frame_encode(const FrameHeader *hdr, const char *content, size_t content_len, char *out, size_t out_cap) {
+    // cap at what the radio will take, the caller decides what to do with oversized content
+    if (out_cap > LORA_MAX_PAYLOAD + 1) out_cap = LORA_MAX_PAYLOAD + 1;
+
+    if (hdr->version == WIRE_VERSION_LEGACY) {
+        return encode_legacy(hdr, content, content_len, out, out_cap);
+    }
+    return encode_binary(hdr, content, content_len, out, out_cap);
+}
+
+static bool decode_legacy(const char *payload, size_t payload_len, FrameHeader *hdr, char *content, size_t content_cap, size_t *content_len) {
+    // content can hold commas, so walk the fixed numeric fields in from the right
+    const char *end = payload + payload_len;
+    const char *fields[LEGACY_TRAILING_FIELDS + 1];
+    const char *p = end;
+
+    for (int i = LEGACY_TRAILING_FIELDS - 1; i >= 0; i--) {
+        while (p > payload && p[-1] != ',') p--;
+        if (p == payload) return false;
+        fields[i] = p;
+        p--; // step over the comma
+    }
+    fields[LEGACY_TRAILING_FIELDS] = end + 1;
+
+    long v[LEGACY_TRAILING_FIELDS];
+    for (int i = 0; i < LEGACY_TRAILING_FIELDS; i++) {
+        if (!parse_long(fields[i], fields[i + 1] - 1, &v[i])) return false;
+    }
+
+    size_t len = (size_t)(p - payload);
+    if (len >= content_cap) len = content_cap - 1;
+    memcpy(content, payload, len);
+    content[len] = '\0';
+    *content_len = len;
+
+    hdr->version = WIRE_VERSION_LEGACY;
+    hdr->origin = (ID)v[0];
+    hdr->dest = (ID)v[1];
+    hdr->steps = (uint8_t)v[2];
+    hdr->msg_type = (uint8_t)v[3];
+    hdr->id = (ID)v[4];
+    hdr->ack_for = (ID)v[5];
+    hdr->flags = 0;
+    return true;
+}
+
+// one packed frame, already unescaped
+static bool decode_raw(const uint8_t *raw, size_t len, FrameHeader *hdr, char *content, size_t content_cap, size_t *content_len) {
+    if (len < FRAME_HEADER_LEN) return false;
+    if ((raw[0] & FRAME_MAGIC_MASK) != FRAME_MAGIC) return false;
+
+    hdr->version = raw[0] & FRAME_VERSION_MASK;
+    if (hdr->version > WIRE_VERSION) return false; // newer than we understand
+
+    hdr->origin = get_u16(raw + 1);
+    hdr->dest = get_u16(raw + 3);
+    hdr->id = get_u16(raw + 5);
+    hdr->ack_for = get_u16(raw + 7);
+    hdr->steps = raw[9];
+    hdr->msg_type = raw[10];
+    hdr->flags = raw[11];
+
+    size_t body = len - FRAME_HEADER_LEN;
+    if (hdr->flags & (FRAME_FLAG_SQUASHED | FRAME_FLAG_PACKED)) {
+        if (hdr->version < WIRE_VERSION_COMPRESS) return false;
+        body = frame_decompress(hdr->flags, raw + FRAME_HEADER_LEN, body, content, content_cap - 1);
+        if (!body) return false;
+        hdr->flags &= ~(FRAME_FLAG_SQUASHED | FRAME_FLAG_PACKED);
+    } else {
+        if (body >= content_cap) body = content_cap - 1;
+        memcpy(content, raw + FRAME_HEADER_LEN, body);
+    }
+    content[body] = '\0';
+    *content_len = body;
+    return true;
+}
+
+static bool decode_binary(const char *payload, size_t payload_len, FrameHeader *hdr, char *content, size_t content_cap, size_t *content_len) {
+    uint8_t raw[FRAME_HEADER_LEN + LORA_MAX_PAYLOAD];
+    size_t len = frame_unescape(payload, payload_len, raw, sizeof(raw));
+    return decode_raw(raw, len, hdr, content, content_cap, content_len);
+}
+
+size_t frame_acks_append(char *content, size_t content_len, size_t cap, const ID *ids, int count) {
+    if (count <= 0 || count > FRAME_ACKS_MAX || content_len + 2 * count + 1 > cap) return 0;
+
+    uint8_t *p = (uint8_t *) content + content_len;
+    for (int i = 0; i < count; i++, p += 2) put_u16(p, ids[i]);
+    *p = (uint8_t) count;
+    return content_len + 2 * count + 1;
+}
+
+int frame_acks_strip(char *content, size_t *content_len, ID *ids, int max) {
+    size_t len = *content_len;
+    if (len < 1) return -1;
+    int count = (uint8_t) content[len - 1];
+    if (count > FRAME_ACKS_MAX || count > max || len < (size_t)(2 * count + 1)) return -1;
+
+    const uint8_t *p = (const uint8_t *) content + len - 1 - 2 * count;
+    for (int i = 0; i < count; i++, p += 2) ids[i] = get_u16(p);
+    len -= 2 * count + 1;
+    content[len] = '\0';
+    *content_len = len;
+    return count;
+}
+
+void frame_bundle_init(FrameBundle *bundle) {
+    bundle->raw[0] = FRAME_BUNDLE;
+    bundle->len = 1;
+    bundle->escaped_len = 1;
+    bundle->count = 0;
+}
+
+static size_t escaped_size(const uint8_t *in, size_t len) {
+    size_t n = len;
+    for (size_t i = 0; i < len; i++) {
+        if (needs_escape(in[i])) n++;
+    }
+    return n;
+}
+
+bool frame_bundle_add(FrameBundle *bundle, const FrameHeader *hdr, const char *content, size_t content_len) {
+    if (bundle->len + 1 >= sizeof(bundle->raw)) return false;
+    uint8_t *p = bundle->raw + bundle->len;
+    size_t frame_len = pack_frame(hdr, content, content_len, p + 1, sizeof(bundle->raw) - bundle->len - 1);
+    if (!frame_len || frame_len > 0xFF) return false;
+    p[0] = (uint8_t) frame_len;
+
+    size_t escaped = escaped_size(p, 1 + frame_len);
+    if (bundle->escaped_len + escaped > LORA_MAX_PAYLOAD) return false;
+
+    bundle->len += 1 + frame_len;
+    bundle->escaped_len += escaped;
+    bundle->count++;
+    return true;
+}
+
+int frame_bundle_finish(const FrameBundle *bundle, char *out, size_t out_cap) {
+    if (out_cap < bundle->escaped_len + 1) return -1;
+    size_t len = frame_escape(bundle->raw, bundle->len, out, out_cap - 1);
+    if (!len) return -1;
+    out[len] = '\0';
+    return (int) len;
+}
+
+bool frame_is_bundle(const char *payload, size_t payload_len) {
+    // FRAME_BUNDLE is never escaped, it is not one of the bytes that need it
+    return payload_len > FRAME_BUNDLE_MIN && (uint8_t) payload[0] == FRAME_BUNDLE;
+}
+
+size_t frame_bundle_open(const char *payload, size_t payload_len, uint8_t *raw, size_t raw_cap) {
+    if (!frame_is_bundle(payload, payload_len)) return 0;
+    return frame_unescape(payload, payload_len, raw, raw_cap);
+}
+
+bool frame_bundle_next(const uint8_t *raw, size_t raw_len, size_t *offset, FrameHeader *hdr, char *content, size_t content_cap, size_t *content_len) {
+    size_t at = *offset ? *offset : 1;     // past FRAME_BUNDLE
+    if (at >= raw_len) return false;
+
+    size_t frame_len = raw[at];
+    if (at + 1 + frame_len > raw_len) return false;
+    *offset = at + 1 + frame_len;
+    return decode_raw(raw + at + 1, frame_len, hdr, content, content_cap, content_len);
+}
+
+bool frame_decode(const char *payload, size_t payload_len, FrameHeader *hdr, char *content, size_t content_cap, size_t *content_len) {
+    if (!payload_len || !content_cap) return false;
+
+    if ((uint8_t)payload[0] == FRAME_BUNDLE) return false;  // frame_bundle_next() takes those
+    if (((uint8_t)payload[0] & FRAME_MAGIC_MASK) == FRAME_MAGIC) {
+        return decode_binary(payload, payload_len, hdr, content, content_cap, content_len);
+    }
+    return decode_legacy(payload, payload_len, hdr, content, content_cap, content_len);
+}
@@ -4,12 +4,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-
-typedef struct entry_struct {
-        int key;
-        void *value;
-        struct entry_struct *next;
-} Entry;
+#define MIN_SLOTS (8)
+// slots of the old array moved over per insert while growing. with the new array twice
+// as big this finishes long before the new one fills up
+#define MIGRATE_STEP (8)
 
 static inline uint32_t mix32(uint32_t x){
     x ^= x >> 16;
@@ -20,108 +18,251 @@ static inline uint32_t mix32(uint32_t x){
     return x;
 }
 
-static int isPrime(int n) {
-    if (n <= 1) return 0;
-    if (n <= 3) return 1;
-    if (n % 2 == 0 || n % 3 == 0) return 0;
-    for (int i = 5; i * i <= n; i = i + 6)
-        if (n % i == 0 || n % (i + 2) == 0) return 0;
-    return 1;
+// keep the load under 7/8, past that the probe runs get long
+static inline size_t max_load(size_t size) {
+	return size - size / 8;
 }
 
+static size_t slots_for(size_t keys) {
+	size_t n = MIN_SLOTS;
+	while (max_load(n) < keys) {
+		n <<= 1;
+	}
+	return n;
+}
 
-// create hash table
-HashTable *create_hashtable(size_t size) {
-	// move to next prime
-	size_t n = size;
-	while (!isPrime(n)) {
-		n++;
+static inline size_t home_of(int key, size_t size) {
+	return (size_t) mix32((uint32_t) key) & (size - 1);
+}
+
+static size_t slots_find(const HashSlot *slots, size_t size, int key) {
+	size_t mask = size - 1;
+	size_t i = home_of(key, size);
+	for (uint16_t dib = 1; ; dib++, i = (i + 1) & mask) {
+		// anything that far from home would have taken this slot, so the key isn't here
+		if (slots[i].dib < dib) return SIZE_MAX;
+		if (slots[i].key == key) return i;
+	}
+}
+
+// 1 when key went in, 0 when it was there already and only the value changed
+static int slots_put(HashSlot *slots, size_t size, int key, void *value) {
+	size_t mask = size - 1;
+	size_t i = home_of(key, size);
+	HashSlot carry = { .key = key, .dib = 1, .value = value };
+	int swapped = 0;
+
+	for (;; i = (i + 1) & mask, carry.dib++) {
+		HashSlot *slot = &slots[i];
+		if (!slot->dib) {
+			*slot = carry;
+			return 1;
+		}
+		// an existing key always sits before the first slot we would steal
+		if (!swapped && slot->key == key) {
+			slot->value = value;
+			return 0;
+		}
+		if (slot->dib < carry.dib) {
+			// robin hood, whoever is closer to home moves on
+			HashSlot tmp = *slot;
+			*slot = carry;
+			carry = tmp;
+			swapped = 1;
+		}
 	}
+}
+
+// pull the rest of the run back one slot so lookups never need a tombstone
+static void slots_delete(HashSlot *slots, size_t size, size_t i) {
+	size_t mask = size - 1;
+	for (;;) {
+		size_t next = (i + 1) & mask;
+		if (slots[next].dib <= 1) {
+			slots[i].dib = 0;
+			return;
+		}
+		slots[i] = slots[next];
+		slots[i].dib--;
+		i = next;
+	}
+}
+
+static void migrate(HashTable *table, size_t budget) {
+	while (table->old) {
+		if (table->old_cursor == table->old_size) {
+			free(table->old);
+			table->old = NULL;
+			break;
+		}
+		HashSlot *slot = &table->old[table->old_cursor];
+		// whole runs move at once, so nothing left in old sits behind a slot we emptied
+		// and the slots can just be cleared instead of deleted
+		if (budget == 0 && slot->dib <= 1) break;
+		if (slot->dib) {
+			slots_put(table->table, table->size, slot->key, slot->value);
+			slot->dib = 0;
+		}
+		table->old_cursor++;
+		if (budget) budget--;
+	}
+}
+
+static HashTable *table_alloc(size_t slots, size_t capacity) {
 	HashTable *new_table = malloc(sizeof(HashTable));
-	new_table->size = n;
+	if (!new_table) return NULL;
+	new_table->size = slots;
 	new_table->entries = 0;
-	new_table->table = calloc(n, sizeof(Entry *));
-
+	new_table->table = calloc(slots, sizeof(HashSlot));
+	new_table->old = NULL;
+	new_table->old_size = 0;
+	new_table->old_cursor = 0;
+	new_table->capacity = capacity;
+	if (!new_table->table) {
+		free(new_table);
+		return NULL;
+	}
 	return new_table;
 }
 
+// create hash table, size is how many keys to expect before the first resize
+HashTable *create_hashtable(size_t size) {
+	return table_alloc(slots_for(size), 0);
+}
+
+HashTable *create_hashtable_fixed(size_t capacity) {
+	return table_alloc(slots_for(capacity), capacity);
+}
+
 void delete_hashtable(HashTable **ptr) {
 	if (!ptr || !*ptr) return;
 	HashTable *table = *ptr;
-	for (int i = 0; i < table->size; i++) {
-		Entry *temp;
-		Entry *head = table->table[i];
-		while (head) {
-			temp = head->next;
-			free(head);
-			head = temp;
-		}
-	}
+	free(table->old);
 	free(table->table);
 	free(table);
 	*ptr = NULL;
 }
 
+// start moving into an array twice the size, false if there is no memory for it
+static int grow(HashTable *table) {
+	// a resize still going would be left behind, finish it first
+	migrate(table, SIZE_MAX);
+
+	HashSlot *bigger = calloc(table->size * 2, sizeof(HashSlot));
+	if (!bigger) return 0;
+	table->old = table->table;
+	table->old_size = table->size;
+	table->old_cursor = 0;
+	table->table = bigger;
+	table->size *= 2;
+	return 1;
+}
 
 int hash_insert(HashTable *table, int key, void *value) {
-	size_t idx = (size_t) mix32((uint32_t) key) % table->size;
-
-	Entry *new_entry = malloc(sizeof(Entry));
-	new_entry->key = key;
-	new_entry->value = value;
-	new_entry->next = NULL;
-	table->entries++;
-
-	// if slot is empty
-	if (!table->table[idx]) {
-		table->table[idx] = new_entry;
-		return 1;
+	if (table->old) {
+		size_t i = slots_find(table->old, table->old_size, key);
+		if (i != SIZE_MAX) {
+			table->old[i].value = value;
+			return 0;
+		}
+		migrate(table, MIGRATE_STEP);
 	}
 
-	new_entry->next = table->table[idx];
-	table->table[idx] = new_entry;
+	if (table->capacity) {
+		if ((size_t) table->entries >= table->capacity && slots_find(table->table, table->size, key) == SIZE_MAX) {
+			return -1;
+		}
+	} else if ((size_t) table->entries >= max_load(table->size) && slots_find(table->table, table->size, key) == SIZE_MAX) {
+		// out of memory keeps the current array as long as a slot is left
+		if (!grow(table) && (size_t) table->entries + 1 >= table->size) {
+			return -1;
+		}
+	}
 
-	return 0;
+	int added = slots_put(table->table, table->size, key, value);
+	table->entries += added;
+	return added;
 }
 
 void *hash_find(HashTable *table, int key) {
-	size_t idx = (size_t ) mix32((uint32_t) key) % table->size;
+	size_t i = slots_find(table->table, table->size, key);
+	if (i != SIZE_MAX) return table->table[i].value;
 
-	Entry *walk = table->table[idx];
-
-	while (walk) {
-		if (walk->key == key) return walk->value;
-		walk = walk->next;
+	if (table->old) {
+		i = slots_find(table->old, table->old_size, key);
+		if (i != SIZE_MAX) return table->old[i].value;
 	}
 
 	return NULL;
 }
 
 void *hash_remove(HashTable *table, int key) {
-    if (!table || table->size == 0) return NULL;
+	if (!table) return NULL;
 
-    size_t idx = (size_t)(mix32((uint32_t)key) % (uint32_t)table->size);
+	HashSlot *slots = table->table;
+	size_t size = table->size;
+	size_t i = slots_find(slots, size, key);
+	if (i == SIZE_MAX && table->old) {
+		slots = table->old;
+		size = table->old_size;
+		i = slots_find(slots, size, key);
+	}
+	if (i == SIZE_MAX) return NULL;  // not found
 
-    Entry *cur  = table->table[idx];
-    Entry *prev = NULL;
+	void *val = slots[i].value;
+	slots_delete(slots, size, i);
+	table->entries--;
+	return val;
+}
 
-    while (cur) {
-        if (cur->key == key) {
-            void *val = cur->value;
+static void iter_start(HashIter *it, const HashSlot *slots, size_t size) {
+	it->slots = slots;
+	it->size = size;
+	it->step = 0;
+	it->have_key = false;
+	// begin at an empty slot so no run is split across the end of the walk
+	it->start = 0;
+	while (slots[it->start].dib) {
+		it->start++;
+	}
+}
 
-            // unlink
-            if (prev) prev->next = cur->next;
-            else      table->table[idx] = cur->next;
+void hash_iter_init(HashIter *it, const HashTable *table) {
+	it->table = table;
+	it->in_old = table->old != NULL;
+	if (it->in_old) {
+		iter_start(it, table->old, table->old_size);
+	} else {
+		iter_start(it, table->table, table->size);
+	}
+}
 
-            free(cur);
-            table->entries--;
-            printf("table.size = %d\n",table->entries);
-            return val;
-        }
-        prev = cur;
-        cur  = cur->next;
-    }
-    return NULL;  // not found
+bool hash_iter_next(HashIter *it, int *key, void **value) {
+	for (;;) {
+		while (it->step < it->size) {
+			const HashSlot *slot = &it->slots[(it->start + it->step) & (it->size - 1)];
+			if (it->have_key) {
+				it->have_key = false;
+				if (slot->dib && slot->key == it->key) {
+					it->step++;
+					continue;
+				}
+				// it was removed, whatever moved up into its slot is new to us
+			}
+			if (!slot->dib) {
+				it->step++;
+				continue;
+			}
+			it->key = slot->key;
+			it->have_key = true;
+			if (key) *key = slot->key;
+			if (value) *value = slot->value;
+			return true;
+		}
+		if (!it->in_old) return false;
+		it->in_old = false;
+		iter_start(it, it->table->table, it->table->size);
+	}
 }
 
 void** sort_hash_to_array(HashTable *table, int (*cmp)(const void *, const void *)) {
@@ -130,17 +271,17 @@ void** sort_hash_to_array(HashTable *table, int (*cmp)(const void *, const void
 
 	// create 1d array
 	void **entries = calloc(table->entries, sizeof(void *));
+	if (!entries) return NULL;
 
 	int c = 0;
-	for (int i = 0; i < table->size; i++) {
-		Entry *walk = table->table[i];
-		while (walk) {
-			entries[c++] = walk->value;
-			walk = walk->next;
-		}
+	HashIter it;
+	void *value;
+	hash_iter_init(&it, table);
+	while (hash_iter_next(&it, NULL, &value)) {
+		entries[c++] = value;
 	}
 
 	qsort(entries, table->entries, sizeof(void *), cmp);
 
 	return entries;
-}
\ No newline at end of file
+}
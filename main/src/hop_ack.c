@@ -0,0 +1,342 @@
+#include "hop_ack.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "node_table.h"
+#include "routing.h"
+#include "lora_uart.h"
+#include "frame_codec.h"
+#include "airtime.h"
+
+#define HOP_TICK_MS     (100)
+// queued but never went on air (send queue full, didn't fit in a frame), forget it
+#define HOP_STALE_MS    (30000)
+
+typedef struct {
+    ID msg_id;                  // NO_ID for a free slot
+    ID next_hop;
+    uint8_t tries;              // sends to next_hop so far, minus one
+    uint8_t fallovers;
+    bool on_air;
+    TickType_t sent_at;         // queued at until it is on air
+    TickType_t deadline;
+} HopPending;
+
+typedef struct {
+    ID neighbor;                // NO_ID for a free slot
+    ID msg_id;
+    TickType_t due;             // goes out on its own from here
+} HopOwed;
+
+static const char *TAG = "HOP";
+
+static HopPending s_pending[HOP_PENDING_MAX];
+static HopOwed s_owed[HOP_OWED_MAX];
+static HopAckStats s_stats;
+static SemaphoreHandle_t s_lock;
+
+void hop_ack_init(void) {
+    memset(s_pending, 0, sizeof(s_pending));
+    memset(s_owed, 0, sizeof(s_owed));
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_lock = xSemaphoreCreateMutex();
+}
+
+static HopPending *find_pending(ID msg_id) {
+    for (int i = 0; i < HOP_PENDING_MAX; i++) {
+        if (s_pending[i].msg_id == msg_id) return &s_pending[i];
+    }
+    return NULL;
+}
+
+uint32_t hop_rto_ms(ID neighbor) {
+    NodeEntry *node = get_node_ptr(neighbor);
+    if (!node || node->srtt_ms == 0) return HOP_RTO_INITIAL_MS;
+
+    uint32_t rto = node->srtt_ms + 4 * node->rttvar_ms;
+    if (rto < HOP_RTO_MIN_MS) rto = HOP_RTO_MIN_MS;
+    if (rto > HOP_RTO_MAX_MS) rto = HOP_RTO_MAX_MS;
+    return rto;
+}
+
+// rfc 6298 with the usual 1/8 and 1/4 gains
+static void rtt_sample(NodeEntry *node, uint32_t rtt_ms) {
+    if (rtt_ms == 0) rtt_ms = 1;
+    if (node->srtt_ms == 0) {
+        node->srtt_ms = rtt_ms;
+        node->rttvar_ms = rtt_ms / 2;
+        return;
+    }
+    uint32_t err = rtt_ms > node->srtt_ms ? rtt_ms - node->srtt_ms : node->srtt_ms - rtt_ms;
+    node->rttvar_ms = (3 * node->rttvar_ms + err) / 4;
+    node->srtt_ms = (7 * node->srtt_ms + rtt_ms) / 8;
+}
+
+bool hop_ack_speaks(ID neighbor) {
+    return neighbor != BROADCAST_ID && node_wire_version(neighbor) >= WIRE_VERSION_HOP_ACKS;
+}
+
+bool hop_track(ID msg_id, ID next_hop) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    HopPending *pending = find_pending(msg_id);
+    bool fresh = !pending;
+    if (!pending) {
+        pending = find_pending(NO_ID);
+        if (!pending) {
+            xSemaphoreGive(s_lock);
+            ESP_LOGW(TAG, "no room to track msg %hu, it goes out without retries", msg_id);
+            return false;
+        }
+        memset(pending, 0, sizeof(*pending));
+        pending->msg_id = msg_id;
+        s_stats.tracked++;
+    }
+    if (pending->next_hop != next_hop) {
+        // new frame, or falling over to another neighbor
+        pending->next_hop = next_hop;
+        pending->tries = 0;
+    }
+    pending->on_air = false;
+    pending->sent_at = xTaskGetTickCount();
+    xSemaphoreGive(s_lock);
+    return fresh;
+}
+
+void hop_untrack(ID msg_id) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    HopPending *pending = find_pending(msg_id);
+    if (pending) {
+        pending->msg_id = NO_ID;
+        s_stats.tracked--;
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void hop_on_air(ID msg_id, bool sent) {
+    // the rtt comes from short frames. a long one is passed on by a neighbor that may be
+    // sending one as long itself when it comes in, and only acks after that
+    DataEntry *data = msg_find(msg_id);
+    uint32_t busy_ms = data && data->length > HOP_RTO_LONG_FRAME ? airtime_frame_ms(FRAME_HEADER_LEN + data->length) : 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    HopPending *pending = find_pending(msg_id);
+    if (pending && !pending->on_air) {
+        TickType_t now = xTaskGetTickCount();
+        pending->on_air = true;
+        pending->sent_at = now;
+        // the module refusing it counts as a lost try
+        uint32_t wait_ms = sent ? (hop_rto_ms(pending->next_hop) << pending->tries) + busy_ms : 0;
+        if (wait_ms > HOP_RTO_MAX_MS) wait_ms = HOP_RTO_MAX_MS;
+        pending->deadline = now + pdMS_TO_TICKS(wait_ms);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+uint32_t hop_listen_ms(void) {
+    return airtime_frame_ms(FRAME_HEADER_LEN + sizeof(HOP_ACK_CONTENT) - 1) + HOP_LISTEN_SLACK_MS;
+}
+
+static void hop_ack_send(ID from, ID id) {
+    ID ack = create_data_object(NO_ID, ACK, HOP_ACK_CONTENT, g_my_address, from, g_my_address, 0, 0, 0, id);
+    queue_send(ack, from, false);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_stats.acks_sent++;
+    xSemaphoreGive(s_lock);
+}
+
+void hop_ack_owe(ID from, ID id, uint8_t version) {
+    // the frame's own version tells before the node table has heard of from
+    if (version < WIRE_VERSION_HOP_ACKS && !hop_ack_speaks(from)) return;
+
+    // waiting for a frame that isn't coming costs the neighbor more than the ack's own frame
+    if (node_wire_version(from) < WIRE_VERSION_ACKS || !queue_has_frame_for(from)) {
+        hop_ack_send(from, id);
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    HopOwed *slot = NULL;
+    for (int i = 0; i < HOP_OWED_MAX; i++) {
+        if (s_owed[i].neighbor == from && s_owed[i].msg_id == id) {
+            // another copy, the ack already waiting answers it
+            xSemaphoreGive(s_lock);
+            return;
+        }
+        if (!slot && s_owed[i].neighbor == NO_ID) slot = &s_owed[i];
+    }
+    if (slot) {
+        slot->neighbor = from;
+        slot->msg_id = id;
+        slot->due = xTaskGetTickCount() + pdMS_TO_TICKS(HOP_ACK_DELAY_MS);
+    }
+    xSemaphoreGive(s_lock);
+
+    if (!slot) hop_ack_send(from, id);
+}
+
+int hop_acks_peek(ID target, ID *out, int max) {
+    // oldest first, the order they are due in
+    HopOwed found[HOP_OWED_MAX];
+    int count = 0;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < HOP_OWED_MAX; i++) {
+        HopOwed *owed = &s_owed[i];
+        if (owed->neighbor == NO_ID || (target != BROADCAST_ID && owed->neighbor != target)) continue;
+        int at = count++;
+        while (at > 0 && (int32_t)(found[at - 1].due - owed->due) > 0) {
+            found[at] = found[at - 1];
+            at--;
+        }
+        found[at] = *owed;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (count > max) count = max;
+    for (int i = 0; i < count; i++) out[i] = found[i].msg_id;
+    return count;
+}
+
+void hop_acks_taken(ID target, const ID *ids, int count) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int k = 0; k < count; k++) {
+        for (int i = 0; i < HOP_OWED_MAX; i++) {
+            HopOwed *owed = &s_owed[i];
+            if (owed->neighbor == NO_ID || (target != BROADCAST_ID && owed->neighbor != target)) continue;
+            if (owed->msg_id == ids[k]) {
+                owed->neighbor = NO_ID;
+                s_stats.acks_carried++;
+            }
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+bool hop_ack_received(ID msg_id, ID from) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    HopPending *pending = find_pending(msg_id);
+    if (!pending || pending->next_hop != from) {
+        // late ack for a copy we already gave up on, or for someone else's frame
+        xSemaphoreGive(s_lock);
+        return false;
+    }
+    bool sample = pending->on_air && pending->tries == 0;
+    uint32_t rtt_ms = (xTaskGetTickCount() - pending->sent_at) * portTICK_PERIOD_MS;
+    pending->msg_id = NO_ID;
+    s_stats.acked++;
+    xSemaphoreGive(s_lock);
+
+    NodeEntry *node = get_node_ptr(from);
+    if (node) {
+        if (sample) rtt_sample(node, rtt_ms);
+        node_link_result(node, true);
+    }
+    return true;
+}
+
+void hop_ack_stats(HopAckStats *out) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *out = s_stats;
+    xSemaphoreGive(s_lock);
+}
+
+// the neighbor didn't ack in time. same neighbor again while tries are left, else the next
+// best route if there is one
+static void hop_timed_out(HopPending expired) {
+    NodeEntry *node = get_node_ptr(expired.next_hop);
+    if (node) node_link_result(node, false);
+
+    DataEntry *data = msg_find(expired.msg_id);
+    if (!data) {
+        // dropped from the store meanwhile, nothing left to send
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        HopPending *pending = find_pending(expired.msg_id);
+        if (pending) pending->msg_id = NO_ID;
+        s_stats.given_up++;
+        xSemaphoreGive(s_lock);
+        return;
+    }
+
+    if (expired.tries + 1 < HOP_MAX_TRIES) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        HopPending *pending = find_pending(expired.msg_id);
+        if (pending) pending->tries++;
+        s_stats.retransmits++;
+        xSemaphoreGive(s_lock);
+        printf("HOP: msg %hu not acked by %hu, try %d\n", expired.msg_id, expired.next_hop, expired.tries + 2);
+        queue_send(expired.msg_id, expired.next_hop, false);
+        return;
+    }
+
+    router_bad_intermediate(g_router, expired.next_hop);
+    ID next = router_query_intermediate(g_router, data->dst_node);
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    HopPending *pending = find_pending(expired.msg_id);
+    bool fall_over = pending && next != NO_ID && expired.fallovers < HOP_MAX_FALLOVERS;
+    if (fall_over) {
+        pending->fallovers++;
+        s_stats.fallovers++;
+    } else {
+        if (pending) pending->msg_id = NO_ID;
+        s_stats.given_up++;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (fall_over) {
+        printf("HOP: %hu never acked msg %hu, trying %hu toward %hu\n", expired.next_hop, expired.msg_id, next, data->dst_node);
+        queue_send(expired.msg_id, data->dst_node, true);
+    } else {
+        ESP_LOGW(TAG, "msg %hu to %hu given up after %hu", expired.msg_id, data->dst_node, expired.next_hop);
+    }
+}
+
+void hop_retry_task(void *arg) {
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(HOP_TICK_MS));
+        TickType_t now = xTaskGetTickCount();
+
+        // copied out so queue_send and the router run without the lock
+        HopPending expired[HOP_PENDING_MAX];
+        int count = 0;
+        HopOwed due[HOP_OWED_MAX];
+        int due_count = 0;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        for (int i = 0; i < HOP_OWED_MAX; i++) {
+            HopOwed *owed = &s_owed[i];
+            if (owed->neighbor == NO_ID || (int32_t)(now - owed->due) < 0) continue;
+            // one frame per neighbor, the rest of what it is owed rides in its trailer
+            bool have = false;
+            for (int k = 0; k < due_count; k++) have |= due[k].neighbor == owed->neighbor;
+            if (have) continue;
+            due[due_count++] = *owed;
+            owed->neighbor = NO_ID;
+        }
+        for (int i = 0; i < HOP_PENDING_MAX; i++) {
+            HopPending *pending = &s_pending[i];
+            if (pending->msg_id == NO_ID) continue;
+            if (pending->on_air && (int32_t)(now - pending->deadline) >= 0) {
+                // back to waiting for the send queue until it is handled
+                pending->on_air = false;
+                pending->sent_at = now;
+                expired[count++] = *pending;
+            } else if (!pending->on_air && now - pending->sent_at >= pdMS_TO_TICKS(HOP_STALE_MS)) {
+                pending->msg_id = NO_ID;
+                s_stats.given_up++;
+            }
+        }
+        xSemaphoreGive(s_lock);
+
+        for (int i = 0; i < due_count; i++) {
+            hop_ack_send(due[i].neighbor, due[i].msg_id);
+        }
+        for (int i = 0; i < count; i++) {
+            hop_timed_out(expired[i]);
+        }
+    }
+}
@@ -0,0 +1,213 @@
+#include "json_writer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char HEX[] = "0123456789abcdef";
+
+void json_writer_init(JsonWriter *w, char *buf, size_t cap, JsonFlush flush, void *ctx) {
+    memset(w, 0, sizeof(*w));
+    w->buf = buf;
+    w->cap = cap;
+    w->flush = flush;
+    w->ctx = ctx;
+}
+
+static bool flush_buf(JsonWriter *w) {
+    if (!w->len) return true;
+    if (!w->flush(w->ctx, w->buf, w->len)) {
+        w->failed = true;
+        return false;
+    }
+    w->chunks++;
+    w->len = 0;
+    return true;
+}
+
+static void put(JsonWriter *w, const char *data, size_t len) {
+    if (w->failed) return;
+    if (len <= w->cap - w->len) {
+        // what nearly every call comes down to
+        memcpy(w->buf + w->len, data, len);
+        w->len += len;
+        w->total += len;
+        return;
+    }
+    while (len) {
+        if (w->len == w->cap && !flush_buf(w)) return;
+        size_t n = w->cap - w->len < len ? w->cap - w->len : len;
+        memcpy(w->buf + w->len, data, n);
+        w->len += n;
+        w->total += n;
+        data += n;
+        len -= n;
+    }
+}
+
+// the comma in front of everything but the first value of a container. top level values
+// are documents of their own, a stream of events has many
+static void before_value(JsonWriter *w) {
+    if (w->after_key) {
+        w->after_key = 0;
+        return;
+    }
+    uint32_t bit = 1u << w->depth;
+    if (w->depth && (w->filled & bit)) put(w, ",", 1);
+    w->filled |= bit;
+}
+
+static void open_container(JsonWriter *w, char c) {
+    before_value(w);
+    if (w->depth + 1 >= JSON_MAX_DEPTH) {
+        w->failed = true;
+        return;
+    }
+    put(w, &c, 1);
+    w->depth++;
+    w->filled &= ~(1u << w->depth);
+}
+
+static void close_container(JsonWriter *w, char c) {
+    if (!w->depth) {
+        w->failed = true;
+        return;
+    }
+    w->depth--;
+    put(w, &c, 1);
+}
+
+void json_object_begin(JsonWriter *w) { open_container(w, '{'); }
+void json_object_end(JsonWriter *w) { close_container(w, '}'); }
+void json_array_begin(JsonWriter *w) { open_container(w, '['); }
+void json_array_end(JsonWriter *w) { close_container(w, ']'); }
+
+// runs that need nothing done go in with one copy
+static void put_escaped(JsonWriter *w, const char *s, size_t len) {
+    put(w, "\"", 1);
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char) s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        char esc[6] = { '\\', 0 };
+        size_t esc_len = 2;
+        switch (c) {
+            case '"':  esc[1] = '"';  break;
+            case '\\': esc[1] = '\\'; break;
+            case '\n': esc[1] = 'n';  break;
+            case '\r': esc[1] = 'r';  break;
+            case '\t': esc[1] = 't';  break;
+            case '\b': esc[1] = 'b';  break;
+            case '\f': esc[1] = 'f';  break;
+            default:
+                memcpy(esc, "\\u00", 4);
+                esc[4] = HEX[c >> 4];
+                esc[5] = HEX[c & 0xF];
+                esc_len = 6;
+                break;
+        }
+        put(w, s + run, i - run);
+        put(w, esc, esc_len);
+        run = i + 1;
+    }
+    put(w, s + run, len - run);
+    put(w, "\"", 1);
+}
+
+void json_key(JsonWriter *w, const char *key) {
+    // keys are names in the code, nothing in them to escape
+    before_value(w);
+    put(w, "\"", 1);
+    put(w, key, strlen(key));
+    put(w, "\":", 2);
+    w->after_key = 1;
+}
+
+void json_string(JsonWriter *w, const char *s) {
+    json_string_len(w, s, strlen(s));
+}
+
+void json_string_len(JsonWriter *w, const char *s, size_t len) {
+    before_value(w);
+    put_escaped(w, s, len);
+}
+
+// digits from the back of text, snprintf is most of the time of a numeric field otherwise
+static void put_uint(JsonWriter *w, uint64_t v, bool negative) {
+    char text[24];
+    char *p = text + sizeof text;
+    do {
+        *--p = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (negative) *--p = '-';
+    put(w, p, (size_t)(text + sizeof text - p));
+}
+
+void json_int(JsonWriter *w, int64_t v) {
+    before_value(w);
+    put_uint(w, v < 0 ? 0 - (uint64_t) v : (uint64_t) v, v < 0);
+}
+
+void json_uint(JsonWriter *w, uint64_t v) {
+    before_value(w);
+    put_uint(w, v, false);
+}
+
+void json_double(JsonWriter *w, double v, int decimals) {
+    if (!isfinite(v)) {
+        json_null(w);
+        return;
+    }
+    static const uint32_t SCALE[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+    if (decimals >= 0 && decimals <= 6 && fabs(v) < 1e12) {
+        // the usual rssi/snr/seconds, without snprintf
+        uint64_t scaled = (uint64_t)(fabs(v) * SCALE[decimals] + 0.5);
+        uint64_t whole = scaled / SCALE[decimals];
+        before_value(w);
+        put_uint(w, whole, v < 0 && scaled);
+        if (decimals) {
+            char frac[8];
+            uint64_t rest = scaled % SCALE[decimals];
+            frac[0] = '.';
+            for (int i = decimals; i > 0; i--) {
+                frac[i] = (char)('0' + rest % 10);
+                rest /= 10;
+            }
+            put(w, frac, (size_t) decimals + 1);
+        }
+        return;
+    }
+    char text[48];
+    int n = snprintf(text, sizeof text, "%.*f", decimals, v);
+    if (n < 0 || n >= (int) sizeof text) {
+        // too big for the fixed point notation to be of any use
+        n = snprintf(text, sizeof text, "%g", v);
+    }
+    before_value(w);
+    put(w, text, (size_t) n);
+}
+
+void json_bool(JsonWriter *w, bool v) {
+    before_value(w);
+    put(w, v ? "true" : "false", v ? 4 : 5);
+}
+
+void json_null(JsonWriter *w) {
+    before_value(w);
+    put(w, "null", 4);
+}
+
+void json_value_raw(JsonWriter *w, const char *json, size_t len) {
+    before_value(w);
+    put(w, json, len);
+}
+
+void json_write_raw(JsonWriter *w, const char *data, size_t len) {
+    put(w, data, len);
+}
+
+bool json_writer_finish(JsonWriter *w) {
+    if (!w->failed) flush_buf(w);
+    return !w->failed;
+}
@@ -0,0 +1,124 @@
+#include "line_ring.h"
+
+#include <string.h>
+
+void line_ring_init(LineRing *ring) {
+    memset(ring, 0, sizeof(*ring));
+}
+
+static uint16_t slot_next(uint16_t i) {
+    return (uint16_t)((i + 1) % LINE_RING_SLOTS);
+}
+
+static bool slots_outstanding(const LineRing *ring) {
+    return ring->slot_tail != ring->slot_head;
+}
+
+// walk the tail over everything released so far, in hand out order
+static void reclaim(LineRing *ring) {
+    while (slots_outstanding(ring) &&
+           atomic_load_explicit(&ring->slots[ring->slot_tail].released, memory_order_acquire)) {
+        ring->slot_tail = slot_next(ring->slot_tail);
+    }
+}
+
+// oldest byte still in use, either by a consumer or by the partial line
+static size_t tail_of(const LineRing *ring) {
+    return slots_outstanding(ring) ? ring->slots[ring->slot_tail].start : ring->line_start;
+}
+
+size_t line_ring_reserve(LineRing *ring, char **dst) {
+    reclaim(ring);
+
+    if (!slots_outstanding(ring) && ring->line_start == ring->head) {
+        // nothing held and nothing half received, start over at the front for free
+        ring->head = ring->line_start = ring->scan = 0;
+    }
+
+    size_t tail = tail_of(ring);
+    size_t space;
+
+    if (ring->head < tail) {
+        // already wrapped, writing up to the oldest held line
+        space = tail - ring->head - 1;
+    } else {
+        space = LINE_RING_SIZE - ring->head;
+        size_t partial = ring->head - ring->line_start;
+        // a whole line might not fit before the end anymore, move the partial line to the
+        // front if the consumers have let go of it. otherwise keep filling what is left
+        if (space < UART_LINE_LEN && (!slots_outstanding(ring) || partial < tail)) {
+            memmove(ring->buf, ring->buf + ring->line_start, partial);
+            ring->scan -= ring->line_start;
+            ring->line_start = 0;
+            ring->head = partial;
+            space = slots_outstanding(ring) ? tail - ring->head - 1 : LINE_RING_SIZE - ring->head;
+        }
+    }
+
+    *dst = ring->buf + ring->head;
+    return space;
+}
+
+void line_ring_commit(LineRing *ring, size_t n) {
+    ring->head += n;
+}
+
+bool line_ring_next(LineRing *ring, LineSlice *out) {
+    for (; ring->scan < ring->head; ring->scan++) {
+        char ch = ring->buf[ring->scan];
+
+        if (ring->discarding) {
+            if (ch == '\n') {
+                ring->discarding = false;
+            }
+            ring->line_start = ring->scan + 1;
+            continue;
+        }
+
+        if (ring->scan == ring->line_start && (ch == '\r' || ch == '\n')) {
+            // stray \r or \n left over after a response, a new line starts with '+'
+            ring->line_start++;
+            continue;
+        }
+
+        if (ch != '\n' || ring->buf[ring->scan - 1] != '\r') {
+            if (ring->scan - ring->line_start >= UART_LINE_LEN) {
+                // no module line is this long, throw it away along with the rest of it
+                ring->dropped_lines++;
+                ring->discarding = true;
+                ring->line_start = ring->scan + 1;
+            }
+            continue;
+        }
+
+        reclaim(ring);
+        if (slot_next(ring->slot_head) == ring->slot_tail) {
+            // every slot is out, leave the line where it is until something comes back
+            return false;
+        }
+
+        uint16_t slot = ring->slot_head;
+        ring->slots[slot].start = ring->line_start;
+        atomic_store_explicit(&ring->slots[slot].released, false, memory_order_relaxed);
+        ring->slot_head = slot_next(slot);
+
+        ring->buf[ring->scan - 1] = '\0';
+        out->data = ring->buf + ring->line_start;
+        out->len = (uint16_t)(ring->scan - 1 - ring->line_start);
+        out->slot = slot;
+
+        ring->scan++;
+        ring->line_start = ring->scan;
+        return true;
+    }
+    return false;
+}
+
+void line_ring_release(LineRing *ring, const LineSlice *slice) {
+    atomic_store_explicit(&ring->slots[slice->slot].released, true, memory_order_release);
+}
+
+void line_ring_reset_line(LineRing *ring) {
+    ring->head = ring->scan = ring->line_start;
+    ring->discarding = false;
+}
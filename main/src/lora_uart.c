@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "driver/uart.h"
 #include "esp_random.h"
@@ -19,6 +20,14 @@
 #include "maintenance.h"
 #include "routing.h"
 #include "data_table.h"
+#include "frame_codec.h"
+#include "line_ring.h"
+#include "at_engine.h"
+#include "seen_cache.h"
+#include "hop_ack.h"
+#include "tx_sched.h"
+#include "airtime.h"
+#include "fragment.h"
 
 
 typedef enum {
@@ -32,8 +41,7 @@ typedef enum {
     CRFOP
 } Command;
 
-static MessageSendingStatus uart_send_and_block(char *, size_t, char *, size_t);
-static int send_message_blocking(ID msg_id);
+static bool send_message(ID msg_id);
 
 static void uart_reader_task(void *arg);
 static void rcv_handler_task(void *arg);
@@ -41,36 +49,52 @@ static void rcv_handler_task(void *arg);
 static const char *TAG = "UART";
 // static const int MAX_PAYLOAD = 240;
 
-static QueueHandle_t MessageQueue;
-
+// both carry LineSlice, whoever takes one off has to line_ring_release() it.
+// q_resp belongs to the AT engine
 QueueHandle_t q_resp;
 QueueHandle_t q_rcv;
 
-
-
-static bool parse_rcv_line(const char *line,
-                           ID *from, int *len, char *data, size_t data_cap,
-                           ID *origin, ID *dest, int *step, int *msg_type, ID *id, ID *ack_for,
-                           int *rssi, int *snr)
-{
-    // data->content, data->origin_node, data->dst_node, data->steps, data->message_type, data->id, data->ack_for);
-    //                          +RCV=6121,22,ping,6121,0,0,6,2009,0,-5,11
-    int scanned = sscanf(line, "+RCV=%hd,%d,%250[^,],%hd,%hd,%d,%d,%hd,%hd,%d,%d",
-        from, len, data, origin, dest, step, msg_type, id, ack_for, rssi, snr
-    );
-    printf("Scanned args = %d\n",scanned);
-    printf("+RCV=from = %hd,len = %d,data = %s,origin = %hd,dest = %hd,step = %d,msg_type = %d,id = %hd,ack_for = %hd,rssi = %d,snr = %d\n",
-        *from, *len, data, *origin, *dest, *step, *msg_type, *id, *ack_for, *rssi, *snr);
-    if (scanned != 11) {
-        printf("wrong number of args read\n");
-        return false;
-    }
-
-    return true;
+static QueueHandle_t uart_events;
+static LineRing rx_ring;
+
+// frames that went out in one AT+SEND, until the module answers for all of them. a slot
+// is free again by the time the AT engine takes another command
+typedef struct {
+    ID ids[FRAME_BUNDLE_MAX];
+    int count;
+} SentBundle;
+
+static SentBundle s_sent_bundles[AT_MAX_IN_FLIGHT + 1];
+static int s_next_bundle;
+
+
+static void frame_header_of(const DataEntry *data, uint8_t version, FrameHeader *hdr) {
+    hdr->version = version;
+    hdr->origin = data->origin_node;
+    hdr->dest = data->dst_node;
+    hdr->id = data->id;
+    hdr->ack_for = data->ack_for;
+    hdr->steps = (uint8_t) data->steps;
+    hdr->msg_type = (uint8_t) data->message_type;
+    hdr->flags = 0;
 }
 
+// data's content with the hop acks owed to whoever hears a frame to its target in a
+// trailer, as many as fit. 0 when none go with it, they only count as sent once the frame
+// is encoded (hop_acks_taken)
+static size_t content_with_acks(const DataEntry *data, FrameHeader *hdr, char *out, size_t cap, ID *acks, int *acked) {
+    *acked = 0;
+    if (hdr->version < WIRE_VERSION_ACKS || data->length + 3 > cap) return 0;
+
+    int room = (int)(cap - data->length - 1) / 2;
+    *acked = hop_acks_peek(data->target_node, acks, room < FRAME_ACKS_MAX ? room : FRAME_ACKS_MAX);
+    if (!*acked) return 0;
+    memcpy(out, data->content, data->length);
+    hdr->flags |= FRAME_FLAG_ACKS;
+    return frame_acks_append(out, data->length, cap, acks, *acked);
+}
 
-int format_message_command(ID msg_id, char *command_buffer, size_t length) {
+int format_message_command(ID msg_id, char *command_buffer, size_t length, size_t *payload_out) {
     DataEntry *data = msg_find(msg_id);
     // ID to_address = data->target_node;
     if (!data) {
@@ -78,339 +102,516 @@ int format_message_command(ID msg_id, char *command_buffer, size_t length) {
         return 0;
     }
 
-    // using uint16_t (two chars)         2bytes  2bytes       1b yte        2 bytes (meta data size = 7) saving 7 bytes
-    // Build message payload: "<content>,<origin>,<dest>,<steps>,<msg_type>,<id>,<ack_for_id>"
-    // char cmd[512];
-    char payload[256];
-    int payload_len = 0;
+    // packed header is 12 bytes vs ~25 for the ascii one. only use it once the next hop
+    // has told us it can read it, everyone else still gets "<content>,<origin>,<dest>,<steps>,<msg_type>,<id>,<ack_for_id>"
+    FrameHeader hdr;
+    frame_header_of(data, node_wire_version(data->target_node), &hdr);
+
+    char content[LORA_MAX_PAYLOAD - FRAME_HEADER_LEN];
+    ID acks[FRAME_ACKS_MAX];
+    int acked;
+    size_t content_len = content_with_acks(data, &hdr, content, sizeof(content), acks, &acked);
+
+    char payload[LORA_MAX_PAYLOAD + 1];
+    int payload_len = -1;
+    if (acked) {
+        payload_len = frame_encode(&hdr, content, content_len, payload, sizeof(payload));
+        // escaping took the trailer past the limit, the acks wait for the next frame
+        if (payload_len < 0) acked = 0;
+    }
+    if (!acked) {
+        hdr.flags = 0;
+        payload_len = frame_encode(&hdr, data->content, data->length, payload, sizeof(payload));
+    }
+    if (payload_len < 0) {
+        ESP_LOGE(TAG, "msg id=%d does not fit in one frame (content len = %d)", msg_id, data->length);
+        return 0;
+    }
 
-    payload_len = snprintf(payload, sizeof(payload), "%s,%u,%u,%d,%d,%u,%u",
-                        data->content, data->origin_node, data->dst_node, data->steps, data->message_type, data->id, data->ack_for);
+    // payload may be escaped binary so copy it by length instead of through %s
+    int prefix_len = snprintf(command_buffer, length, "AT+SEND=%d,%d,", data->target_node, payload_len);
+    if (prefix_len < 0 || (size_t)(prefix_len + payload_len + 3) > length) {
+        ESP_LOGE(TAG, "msg id=%d command does not fit in buffer", msg_id);
+        return 0;
+    }
+    memcpy(command_buffer + prefix_len, payload, payload_len);
+    memcpy(command_buffer + prefix_len + payload_len, "\r\n", 3);
 
-    int final_str_length = snprintf(command_buffer, length, "AT+SEND=%d,%d,%s\r\n", data->target_node, payload_len, payload);
+    int final_str_length = prefix_len + payload_len + 2;
+    *payload_out = (size_t) payload_len;
+    if (acked) hop_acks_taken(data->target_node, acks, acked);
 
-    printf("COMMAND: %s",command_buffer);
+    printf("COMMAND (wire v%d): %s", hdr.version, command_buffer);
 
     return final_str_length;
 
 }
 
 
-static int send_message_blocking(ID msg_id) {
+// module answered the AT+SEND (or the command) for msg_id
+static void message_sent(MessageSendingStatus status, const char *response, void *ctx) {
+    ID msg_id = (ID)(uintptr_t) ctx;
+    // a copy, the answer can come seconds after it was written and the slot may be reused
+    // by then. changes go through the id
+    DataEntry data;
+    char content[UART_LINE_LEN];
+    if (!msg_copy(msg_id, &data, content, sizeof(content))) {
+        return;
+    }
+
+    if (data.message_type == COMMAND) {
+        // if msg was a command create a ack msg with the result of the command (and mark as acked ig)
+        create_data_object(NO_ID, COMMAND, (char *) response, -1, g_my_address, -1, 0, 0, 0, msg_id);
+        msg_set_ack(msg_id, 1, NULL);
+        // the airtime model follows the radio settings, asked for or changed
+        if (!airtime_parse_parameters(response) && status == OK) {
+            airtime_parse_parameters(data.content);
+        }
+    }
+    ESP_LOGI(TAG, "Response = \"%s\" (code %d) for msg %d",response, status, msg_id);
+
+    msg_set_status(msg_id, status);
+    if (hop_ack_wanted(data.message_type, data.target_node)) {
+        hop_on_air(msg_id, status == OK);
+    }
+}
+
+
+static void bundle_sent(MessageSendingStatus status, const char *response, void *ctx) {
+    SentBundle *sent = ctx;
+    for (int i = 0; i < sent->count; i++) {
+        message_sent(status, response, (void *)(uintptr_t) sent->ids[i]);
+    }
+}
+
+typedef struct {
+    ID target;
+    uint8_t version;
+    FrameBundle bundle;
+    SentBundle *sent;
+    size_t class_bytes[TX_CLASS_COUNT];
+    ID acks[FRAME_ACKS_MAX];        // in the first frame's trailer
+    int acked;
+} BundleBuild;
+
+static bool bundle_add(BundleBuild *build, const DataEntry *data) {
+    FrameHeader hdr;
+    frame_header_of(data, build->version, &hdr);
+    bool added = false;
+    if (build->sent->count == 0) {
+        // the acks it carries go in the first one
+        char content[LORA_MAX_PAYLOAD - FRAME_HEADER_LEN];
+        size_t content_len = content_with_acks(data, &hdr, content, sizeof(content), build->acks, &build->acked);
+        added = build->acked && frame_bundle_add(&build->bundle, &hdr, content, content_len);
+        if (!added) {
+            build->acked = 0;
+            hdr.flags = 0;
+        }
+    }
+    if (!added && !frame_bundle_add(&build->bundle, &hdr, data->content, data->length)) return false;
+    build->sent->ids[build->sent->count++] = data->id;
+    build->class_bytes[tx_class_of(data->message_type)] += 1 + FRAME_HEADER_LEN + data->length + (added ? 2 * build->acked + 1 : 0);
+    return true;
+}
+
+// tx_sched_take() match: queued for the same next hop and still fits
+static bool bundle_match(ID msg_id, void *ctx) {
+    BundleBuild *build = ctx;
+    if (build->sent->count == FRAME_BUNDLE_MAX) return false;
     DataEntry *data = msg_find(msg_id);
+    if (!data || data->message_type == COMMAND || data->target_node != build->target) return false;
+    for (int i = 0; i < build->sent->count; i++) {
+        // queued twice (a retry while the first copy still waited), it goes once
+        if (build->sent->ids[i] == msg_id) return true;
+    }
+    return bundle_add(build, data);
+}
+
+// sends first together with whatever else waits for the same next hop. false when there is
+// nothing to go with it, or the next hop can't split bundles, and it should go on its own
+static bool send_bundle(DataEntry *first) {
+    uint8_t version = node_wire_version(first->target_node);
+    if (version < WIRE_VERSION_BUNDLE) return false;
+
+    BundleBuild build = { .target = first->target_node, .version = version };
+    build.sent = &s_sent_bundles[s_next_bundle];
+    build.sent->count = 0;
+    frame_bundle_init(&build.bundle);
+    if (!bundle_add(&build, first) || tx_sched_take(bundle_match, &build) == 0) return false;
+    s_next_bundle = (s_next_bundle + 1) % (AT_MAX_IN_FLIGHT + 1);
+    if (build.acked) hop_acks_taken(build.target, build.acks, build.acked);
+
+    char payload[LORA_MAX_PAYLOAD + 1];
+    int payload_len = frame_bundle_finish(&build.bundle, payload, sizeof(payload));
+    char command_buffer[UART_LINE_LEN];
+    int prefix_len = snprintf(command_buffer, sizeof(command_buffer), "AT+SEND=%d,%d,", build.target, payload_len);
+    memcpy(command_buffer + prefix_len, payload, payload_len);
+    memcpy(command_buffer + prefix_len + payload_len, "\r\n", 3);
+    printf("BUNDLE of %d frames to %hu (len = %d)\n", build.sent->count, build.target, payload_len);
+
+    // the airtime split between the classes by the bytes each put in
+    uint32_t frame_ms = airtime_frame_ms(payload_len);
+    for (int c = 0; c < TX_CLASS_COUNT; c++) {
+        if (build.class_bytes[c]) airtime_charge((TxClass) c, frame_ms * build.class_bytes[c] / (build.bundle.len - 1));
+    }
+    at_submit(command_buffer, prefix_len + payload_len + 2, at_send_timeout_ms(payload_len), bundle_sent, build.sent, portMAX_DELAY);
+    return true;
+}
 
-    char command_buffer[256];
+
+// formats msg_id and hands it to the module. returns once it is written, the answer
+// comes back through message_sent() so the next frame can be encoded meanwhile
+static bool send_message(ID msg_id) {
+    DataEntry *data = msg_find(msg_id);
+    if (!data) {
+        return false;
+    }
+
+    char command_buffer[UART_LINE_LEN];
     size_t length;
+    size_t payload_len;
+    uint32_t timeout_ms = 0;
 
     if (data->message_type == COMMAND) {
         // send message as just content
         length = strlcpy(command_buffer, data->content, sizeof(command_buffer));
         if (length >= sizeof(command_buffer) - 2) {
-            length -= 2;
+            length = sizeof(command_buffer) - 3;
         }
         command_buffer[length++] = '\r';
         command_buffer[length++] = '\n';
         command_buffer[length] = '\0';
         ESP_LOGI(TAG, "Sending command construction \"%s\" (len = %d)",command_buffer, length);
+    } else if (send_bundle(data)) {
+        return true;
     } else {
         // send formatted message
-        length = format_message_command(msg_id, command_buffer, sizeof(command_buffer));
+        length = format_message_command(msg_id, command_buffer, sizeof(command_buffer), &payload_len);
         printf("Command (len = %d) is \"%s\"",length, command_buffer);
         if (!length) {
             ESP_LOGE(TAG, "Issue formatting send message string");
-
-            return 0;
+            data->transfer_status = ERR;
+            msg_changed(msg_id);
+            return false;
         }
+        // the scheduler already waited for room in the budget, this is the exact cost
+        airtime_charge(tx_class_of(data->message_type), airtime_frame_ms(payload_len));
+        timeout_ms = at_send_timeout_ms(payload_len);
     }
 
-    size_t max_response_length = 40;
-    char response_buffer[max_response_length];
-
-    int send_status = uart_send_and_block(command_buffer, length, response_buffer, max_response_length);
-
-    if (data->message_type == COMMAND) {
-        // if msg was a command create a ack msg with the result of the command (and mark as acked ig)
-        create_data_object(NO_ID, COMMAND, response_buffer, -1, g_my_address, -1, 0, 0, 0, msg_id);
-        data->ack_status = 1;
-    }
-    ESP_LOGI(TAG, "Response = \"%s\" (code %d) for msg %d",response_buffer, send_status, msg_id);
-
-    data->transfer_status = send_status;
-
-    return send_status;
+    return at_submit(command_buffer, length, timeout_ms, message_sent, (void *)(uintptr_t) msg_id, portMAX_DELAY);
 }
 
 
-static MessageSendingStatus uart_send_and_block(char *cmd, size_t length, char *resp_buffer, size_t max_resp_length) {
-    if (length == 0) {
-        length = strlen(cmd);
+bool queue_send(ID msg_id, ID target, bool use_router) {
+    DataEntry *data = msg_find(msg_id);
+    if (!data) {
+        ESP_LOGE(TAG, "queue_send for msg id=%d which is not in the table", msg_id);
+        return false;
     }
+    ID final_target = target;
+    if (use_router) {
+        router_print(g_router);
+        final_target = router_query_intermediate(g_router, target);
+        printf("ROUTER: sending msg (%hu) to %hu as intermediate to %hu\n",msg_id, final_target, target);
+        if (final_target == NO_ID) {
+            printf("ERROR ROUTER CANNOT RESOLVE WHERE TO SEND MSG: %hu\n",msg_id);
+            return false; // fix this
+        }
 
-    // 1) Flush stale responses
-    char junk[256];
-    while (xQueueReceive(q_resp, junk, 0) == pdTRUE) {
-        ESP_LOGW(TAG, "Flushing stale line from response queue: \"%s\"",junk);
     }
+    // the sending task can pop it the moment it is pushed, on the other core, so target,
+    // status and the hop timer are in place before that
+    ID prev_target = data->target_node;
+    MessageSendingStatus prev_status = data->transfer_status;
+    data->target_node = final_target;
+    data->transfer_status = QUEUED;
+    bool tracked = false;
+    // a neighbor from before hop acks, or before fragments for a FRAGMENT, wouldn't ack it
+    // and would look like a dead link
+    if (hop_ack_wanted(data->message_type, final_target) && hop_ack_speaks(final_target) &&
+        (data->message_type != FRAGMENT || node_wire_version(final_target) >= WIRE_VERSION_FRAGMENT)) {
+        tracked = hop_track(msg_id, final_target);
+    }
+    if (!tx_sched_push(msg_id, data->message_type, data->length)) {
+        data->target_node = prev_target;
+        data->transfer_status = prev_status;
+        if (tracked) hop_untrack(msg_id);
+        return false;
+    }
+    msg_changed(msg_id);
+    return true;
+}
 
-    // 2) Send command
-
-    // for (int i = 0; i < length; i++) {
-    //     char ch = cmd[i];
-    //     printf("char: 0x%02X '%c'\n",
-    //         ch,
-    //         (ch >= 32 && ch <= 126) ? ch : '.');
-    // }
-
-    uart_write_bytes(UART_PORT, cmd, length);
 
-    // 3) Collect lines
-    char line[256];
-    size_t resp_len = 0;
-    bool got_any = false;
-    MessageSendingStatus status = OK;
+static bool heard_by(ID msg_id, void *ctx) {
+    ID neighbor = *(ID *) ctx;
+    DataEntry *data = msg_find(msg_id);
+    return data && data->message_type != COMMAND &&
+           (data->target_node == neighbor || data->target_node == BROADCAST_ID);
+}
 
-    const int overall_timeout_ms  = 2000;
-    const int interline_timeout_ms = 100;
+bool queue_has_frame_for(ID neighbor) {
+    return tx_sched_any(heard_by, &neighbor);
+}
 
-    TickType_t start    = xTaskGetTickCount();
-    TickType_t deadline = start + pdMS_TO_TICKS(overall_timeout_ms);
-    TickType_t last_line_time = 0;
 
-    for (;;) {
-        TickType_t now = xTaskGetTickCount();
+void uart_init(void) {
+    line_ring_init(&rx_ring);
+    q_rcv  = xQueueCreate(16, sizeof(LineSlice));
+    q_resp = xQueueCreate(16, sizeof(LineSlice));
 
-        // hard overall timeout
-        if (now >= deadline) {
-            if (resp_len > 0) resp_buffer[resp_len] = '\0';
-            return got_any ? status : NO_STATUS;
-        }
+    uart_config_t uart_config = {
+        .baud_rate = BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    };
 
-        if (got_any && (now - last_line_time > pdMS_TO_TICKS(interline_timeout_ms))) {
-            if (resp_len > 0) resp_buffer[resp_len] = '\0';
-            return status;
-        }
+    ESP_ERROR_CHECK(uart_driver_install(UART_PORT, UART_READ_BUFF, UART_WRITE_BUFF, UART_EVENT_QUEUE_LEN, &uart_events, 0));
+    ESP_ERROR_CHECK(uart_param_config(UART_PORT, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(UART_PORT, TX_PIN, RX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
 
-        TickType_t wait = pdMS_TO_TICKS(interline_timeout_ms);
-        if (now + wait > deadline) {
-            wait = deadline - now;
-        }
+    at_engine_init(q_resp, &rx_ring);
+    seen_cache_init();
+    hop_ack_init();
+    frag_init();
+    airtime_init();
+    tx_sched_init();
+    xTaskCreate(uart_reader_task, "uart_reader_task", 4096, NULL, 10, NULL);
+    xTaskCreate(rcv_handler_task, "rcv_reader_task", 4096, NULL, 10, NULL);
+}
 
-        if (xQueueReceive(q_resp, line, wait) != pdTRUE) {
-            continue;
+// one frame off the air, on its own or out of a bundle
+static void handle_frame(const RcvLine *rcv, const FrameHeader *hdr, char *data, size_t data_len) {
+    // acks riding along count even when the frame itself is a copy we already had
+    if (hdr->flags & FRAME_FLAG_ACKS) {
+        ID acks[FRAME_ACKS_MAX];
+        int count = frame_acks_strip(data, &data_len, acks, FRAME_ACKS_MAX);
+        for (int i = 0; i < count; i++) {
+            hop_ack_received(acks[i], rcv->from);
         }
+    }
 
-        now = xTaskGetTickCount();
-        last_line_time = now;
-        got_any = true;
+    ID from = rcv->from, origin = hdr->origin, dest = hdr->dest, id = hdr->id, ack_for = hdr->ack_for;
+    int step = hdr->steps, msg_type = hdr->msg_type, rssi = rcv->rssi, snr = rcv->snr;
+    printf("+RCV (wire v%d) from = %hu,data = %s,origin = %hu,dest = %hu,step = %d,msg_type = %d,id = %hu,ack_for = %hu,rssi = %d,snr = %d\n",
+        hdr->version, from, data, origin, dest, step, msg_type, id, ack_for, rssi, snr);
 
-        ESP_LOGD(TAG, "Response line: \"%s\"\n", line);
+    // only the next hop hears a unicast frame, and it acks every copy. the
+    // one before may not have heard the ack for the first
+    if (ack_for == NO_ID && hop_ack_wanted(msg_type, dest)) {
+        hop_ack_owe(from, id, hdr->version);
+    }
 
-        // -------- status parsing (both 998 + 993) --------
+    // every copy of a flood after the first, and our own frames relayed back
+    // to us, stop here before they touch routes, the table or the send queue
+    if (origin == g_my_address || seen_cache_check(origin, id)) {
+        printf("frame (%hu, %hu) heard before, dropped\n", origin, id);
+        return;
+    }
 
-        // 998-style: +ERR=code
-        if (!strncmp(line, "+ERR", 4)) {
-            int err;
-            if (sscanf(line, "+ERR=%d", &err) == 1) {
-                status = err;
-            } else {
-                status = ERR;
-            }
-        }
+    // from the last node to receiving at this node is a step
+    step +=1;
 
-        else if (!strncmp(line, "+OK", 3) || !strncmp(line, "OK",2)) {
-            status = OK;
-        }
+    router_update(g_router, origin, dest, from, step);
 
-        // 993-style: AT_FOO_ERROR
-        else if (!strncmp(line, "AT_", 3) && strstr(line, "_ERROR") != NULL) {
-            status = ERR;
-        }
+    // a hop ack ends here, it never goes into the table or further along
+    if (msg_type == ACK && dest == g_my_address && strcmp(data, HOP_ACK_CONTENT) == 0) {
+        hop_ack_received(ack_for, from);
+        NodeEntry *acker = get_node_ptr(from);
+        if (acker) node_heard(acker, rssi, snr);
+        return;
+    }
 
-        // -------- accumulate all lines into resp_buffer --------
 
-        size_t line_len = strlen(line);
-        const char *sep = "<br>";
-        size_t sep_len = got_any && resp_len > 0 ? strlen(sep) : 0;
+    // check to see if id already exists.
+    // only create if NEW
+    // handle this diffrently lowkey, if you re-receive a message do somthing else
+    DataEntry *existing = msg_find(id);
+    ID rcv_msg_id;
 
-        if (resp_len + sep_len + line_len + 1 < max_resp_length) {
-            if (sep_len > 0) {
-                memcpy(resp_buffer + resp_len, sep, sep_len);
-                resp_len += sep_len;
-            }
-            memcpy(resp_buffer + resp_len, line, line_len);
-            resp_len += line_len;
-            resp_buffer[resp_len] = '\0';
+    bool should_handle = true;
+    if (existing) {
+        // same id from a different origin, or heard again after the seen window
+        if ((existing->message_type == MAINTENANCE) && (strncmp("gbcast",existing->content,7) == 0)) {
+            // this gbcast msg has already been heard
+            printf("GBcast already received here");
+            should_handle = false;
         }
+        printf("msg with id=%d already exists.\n\tExisting content = \"%s\"\n\tNew content = \"%s\"\n",id, existing->content, data);
+        rcv_msg_id = existing->id;
+    } else {
+        rcv_msg_id = create_data_object(id, msg_type, data, from, dest, origin, step, rssi, snr, ack_for);
     }
-}
 
+    // update node given newest message
+    nodes_update(rcv_msg_id);
 
-void queue_send(ID msg_id, ID target, bool use_router) {
-    DataEntry *data = msg_find(msg_id);
-    ID final_target = target;
-    if (use_router) {
-        router_print(g_router);
-        final_target = router_query_intermediate(g_router, target);
-        printf("ROUTER: sending msg (%hu) to %hu as intermediate to %hu\n",msg_id, final_target, target);
-        if (final_target == NO_ID) {
-            printf("ERROR ROUTER CANNOT RESOLVE WHERE TO SEND MSG: %hu\n",msg_id);
-            return; // fix this
-        }
-
+    // anyone who sends us a packed frame can read one back, at least that version of it
+    if (hdr->version >= WIRE_VERSION_BINARY) {
+        node_saw_wire_version(from, hdr->version);
     }
-    data->target_node = final_target;
-    data->transfer_status = QUEUED;
-    xQueueSend(MessageQueue, &msg_id, pdMS_TO_TICKS(50));
-}
 
+    // if a duplicate is not forbiden
+    if (should_handle) {
 
-void uart_init(void) {
-    q_rcv  = xQueueCreate(16, 256);
-    q_resp = xQueueCreate(16, 256);
+        if (msg_type == MAINTENANCE) {
+            handle_maintenance_msg(rcv_msg_id);
 
-    uart_config_t uart_config = {
-        .baud_rate = BAUD,
-        .data_bits = UART_DATA_8_BITS,
-        .parity = UART_PARITY_DISABLE,
-        .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
-    };
+        }
 
-    ESP_ERROR_CHECK(uart_driver_install(UART_PORT, UART_READ_BUFF, UART_WRITE_BUFF, 0, NULL, 0));
-    ESP_ERROR_CHECK(uart_param_config(UART_PORT, &uart_config));
-    ESP_ERROR_CHECK(uart_set_pin(UART_PORT, TX_PIN, RX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+        // a piece of something longer, or how much of one of ours got there
+        if (msg_type == FRAGMENT && dest == g_my_address && !existing) {
+            frag_received(rcv_msg_id);
+        }
 
-    xTaskCreate(uart_reader_task, "uart_reader_task", 4096, NULL, 10, NULL);
-    xTaskCreate(rcv_handler_task, "rcv_reader_task", 4096, NULL, 10, NULL);
+        // addressed past us, pass it one hop further along our best route. the
+        // seen cache stops it if it ever comes round again
+        if (!existing && msg_type != MAINTENANCE && ack_for == NO_ID &&
+            dest != g_my_address && dest != BROADCAST_ID) {
+            printf("relaying msg (%hu, %hu) on toward %hu\n", origin, id, dest);
+            queue_send(rcv_msg_id, dest, true);
+        }
 
-    MessageQueue = xQueueCreate(16, sizeof(ID));
+        // im switching from msg_type == ACK to check to see if msg has ack_for
+        if (ack_for != NO_ID) {
+            // mark it as acked because it is. it may have been dropped from the store already
+            ID acked_src;
+            if (!msg_set_ack(ack_for, 1, &acked_src)) {
+                printf("ack for msg %d which is no longer in the table\n", ack_for);
+            } else if (dest != g_my_address) {
+                // msg went from src -> dst. but now we wanna send to src
+                queue_send(id, acked_src, true);
+            }
+            // if msg is an ACK
+            // the goal is to send it along the path it came
+        }  
+
+        // create ack if msg of type and at destination
+        // if (dest == g_address.i_addr) {
+        //     char msg_id_buff[32];
+        //     snprintf(msg_id_buff, 32, "ack msg for %d", id);
+        //     ID ack_id = create_data_object(NO_ID, ACK, msg_id_buff , g_address.i_addr, origin, g_address.i_addr, 0, 0, 0, id);
+        //     queue_send(ack_id, from);
+        // }
+    }
 }
 
 static void rcv_handler_task(void *arg) {
-    char line[256];
+    LineSlice slice;
     for (;;) {
-        if (xQueueReceive(q_rcv, line, portMAX_DELAY) == pdTRUE) {
-            int len,step,msg_type,rssi,snr;
-            ID from, origin, dest, id, ack_for;
-            char data[256];
-            if (parse_rcv_line(line, &from, &len, data, sizeof(data), &origin, &dest, &step, &msg_type, &id, &ack_for, &rssi, &snr)) {
-                // from the last node to receiving at this node is a step
-                step +=1;
-
-                router_update(g_router, origin, dest, from, step);
-
-
-                // check to see if id already exists.
-                // only create if NEW
-                // handle this diffrently lowkey, if you re-receive a message do somthing else
-                DataEntry *existing = msg_find(id);
-                ID rcv_msg_id;
-
-                bool should_handle = true;
-                if (existing) {
-                    // if its a gbcast we want to eliminate dups
-                    if ((existing->message_type == MAINTENANCE) && (strncmp("gbcast",existing->content,7) == 0)) {
-                        // this gbcast msg has already been heard
-                        printf("GBcast already received here");
-                        should_handle = false;
-                    }
-                    printf("msg with id=%d already exists.\n\tExisting content = \"%s\"\n\tNew content = \"%s\"\n",id, existing->content, data);
-                    rcv_msg_id = existing->id;
-                } else {
-                    rcv_msg_id = create_data_object(id, msg_type, data, from, dest, origin, step, rssi, snr, ack_for);
+        if (xQueueReceive(q_rcv, &slice, portMAX_DELAY) == pdTRUE) {
+            const char *line = slice.data;
+            RcvLine rcv;
+            FrameHeader hdr;
+            char data[LORA_MAX_PAYLOAD + 1];
+            size_t data_len;
+            uint8_t raw[LORA_MAX_PAYLOAD];
+            size_t raw_len;
+            if (!frame_parse_rcv(line, slice.len, &rcv)) {
+                printf("UART PARSE FAIL: '%s'\n", line);
+            } else if ((raw_len = frame_bundle_open(rcv.payload, rcv.payload_len, raw, sizeof(raw))) > 0) {
+                // every frame in it as if it came on its own, with the same rssi and snr
+                size_t offset = 0;
+                while (frame_bundle_next(raw, raw_len, &offset, &hdr, data, sizeof(data), &data_len)) {
+                    handle_frame(&rcv, &hdr, data, data_len);
                 }
-
-                // update node given newest message
-                nodes_update(rcv_msg_id);
-
-                // if a duplicate is not forbiden
-                if (should_handle) {
-
-                    if (msg_type == MAINTENANCE) {
-                        handle_maintenance_msg(rcv_msg_id);
-
-                    }
-
-                    // im switching from msg_type == ACK to check to see if msg has ack_for
-                    if (ack_for != NO_ID) {
-                        DataEntry *acked_msg = msg_find(ack_for);
-                        // mark it as acked because it is
-                        acked_msg->ack_status = 1;
-
-                        if (dest != g_my_address) {
-                            // msg went from src -> dst. but now we wanna send to src
-                            queue_send(id, acked_msg->src_node, true);
-                        }
-                        // if msg is an ACK
-                        // the goal is to send it along the path it came
-                    }  
-
-                    // create ack if msg of type and at destination
-                    // if (dest == g_address.i_addr) {
-                    //     char msg_id_buff[32];
-                    //     snprintf(msg_id_buff, 32, "ack msg for %d", id);
-                    //     ID ack_id = create_data_object(NO_ID, ACK, msg_id_buff , g_address.i_addr, origin, g_address.i_addr, 0, 0, 0, id);
-                    //     queue_send(ack_id, from);
-                    // }
+                if (offset < raw_len) {
+                    printf("BUNDLE from %hu cut short at %u of %u bytes\n", rcv.from, (unsigned) offset, (unsigned) raw_len);
                 }
+            } else if (frame_decode(rcv.payload, rcv.payload_len, &hdr, data, sizeof(data), &data_len)) {
+                handle_frame(&rcv, &hdr, data, data_len);
             } else {
                 printf("UART PARSE FAIL: '%s'\n", line);
             }
+            line_ring_release(&rx_ring, &slice);
         }
     }
 }
 
 
+// hand every complete line in the ring to whoever deals with it
+static void dispatch_lines(void) {
+    LineSlice slice;
+    while (line_ring_next(&rx_ring, &slice)) {
+        QueueHandle_t q = strncmp(slice.data, "+RCV=", 5) == 0 ? q_rcv : q_resp;
+        if (xQueueSend(q, &slice, 0) != pdTRUE) {
+            ESP_LOGW(TAG, "Line queue full, dropping \"%s\"", slice.data);
+            line_ring_release(&rx_ring, &slice);
+        }
+    }
+}
+
 static void uart_reader_task(void *arg) {
     ESP_LOGI(TAG, "UART READER INIT\n");
-    char line[256];
-    int len = 0;
-    bool saw_cr = false;
 
     for (;;) {
-        uint8_t ch;
-        int n = uart_read_bytes(UART_PORT, &ch, 1, pdMS_TO_TICKS(50));
-        if (n <= 0) continue;
-
-        // printf("TX char: 0x%02X '%c'\n",
-        //     ch,
-        //     (ch >= 32 && ch <= 126) ? ch : '.');
-
-        if (len == 0 && ((ch == '\r') || (ch == '\n')) ) {
-            printf("Ditching char either '\\r' or '\\n'\n");
-            // this is an attempt to remove extra \n or \r being sent after a response is created
-            // if the \r\n already terminated the message any tailing \r or \n will be forgotten bc new msg should start with '+'
-            continue;
-        }
-        if (ch == '\r') { saw_cr = true; continue; }
-        if (saw_cr && ch == '\n') {
-            line[len] = '\0';
-
-            if (strncmp(line, "+RCV=", 5) == 0) {
-                xQueueSend(q_rcv, line, 0);
-            } else {
-                xQueueSend(q_resp, line, 0);
+        uart_event_t event;
+        // the timeout only matters when the ring was full last time round, then we retry
+        if (xQueueReceive(uart_events, &event, pdMS_TO_TICKS(50)) == pdTRUE) {
+            if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL) {
+                // bytes are gone, whatever line was in progress is garbage now
+                ESP_LOGW(TAG, "UART rx overflow (event %d), flushing", event.type);
+                uart_flush_input(UART_PORT);
+                xQueueReset(uart_events);
+                line_ring_reset_line(&rx_ring);
+                continue;
             }
-
-            len = 0; saw_cr = false;
-            continue;
         }
-        saw_cr = false;
 
-        if (len < (int)sizeof(line) - 1) line[len++] = (char)ch;
-        else len = 0; // overflow: reset
+        // read everything the driver holds, not just event.size. events get dropped
+        // when their queue is full and the data is still there
+        for (;;) {
+            size_t buffered = 0;
+            uart_get_buffered_data_len(UART_PORT, &buffered);
+            if (buffered == 0) break;
+
+            char *dst;
+            size_t space = line_ring_reserve(&rx_ring, &dst);
+            if (space == 0) break;
+
+            int n = uart_read_bytes(UART_PORT, dst, buffered < space ? buffered : space, 0);
+            if (n <= 0) break;
+            line_ring_commit(&rx_ring, (size_t) n);
+            dispatch_lines();
+        }
+        dispatch_lines();
     }
 }
 
 void message_sending_task(void *args) {
     ID msg_id;
     for (;;) {
-        if (xQueueReceive(MessageQueue, &msg_id, portMAX_DELAY)) {
-            // change this later
-            send_message_blocking(msg_id);
-
-            uint32_t jitter_ms = 10 + (esp_random() % 40);
-            vTaskDelay(pdMS_TO_TICKS(jitter_ms));
+        // only pick the next frame once the module can take it, anything more urgent that
+        // comes in meanwhile still goes first
+        at_engine_wait_slot(portMAX_DELAY);
+        msg_id = tx_sched_pop(portMAX_DELAY);
+        if (msg_id != NO_ID) {
+            // random backoff before keying up from idle so nodes answering the same
+            // broadcast don't all transmit at once. back to back frames go straight out,
+            // the module is still on air with the one before
+            if (at_engine_idle()) {
+                uint32_t jitter_ms = 10 + (esp_random() % 40);
+                vTaskDelay(pdMS_TO_TICKS(jitter_ms));
+            } else {
+                // the module is still on air with the one before, frames for the same next
+                // hop that come in meanwhile can go out with this one
+                for (int waited = 0; waited < TX_BUNDLE_LINGER_MS && !at_engine_idle(); waited += 10) {
+                    vTaskDelay(pdMS_TO_TICKS(10));
+                }
+            }
+            send_message(msg_id);
+
+            DataEntry *data = msg_find(msg_id);
+            if (data && hop_ack_wanted(data->message_type, data->target_node) && hop_ack_speaks(data->target_node) &&
+                data->length > HOP_RTO_LONG_FRAME) {
+                // its ack comes right after it is off the air, and the next long frame
+                // going out back to back would drown it
+                while (!at_engine_idle()) vTaskDelay(pdMS_TO_TICKS(10));
+                vTaskDelay(pdMS_TO_TICKS(hop_listen_ms()));
+            }
         }
     }
 
@@ -4,15 +4,39 @@
 #include "data_table.h"
 #include "node_table.h"
 #include "lora_uart.h"
+#include "frame_codec.h"
+#include "airtime.h"
+#include "esp_random.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#define RQUERY_INTERVAL_MS (120000)
+#define RQUERY_INTERVAL_MS  (120000)
+// the first request goes out once neighbors have had time to hear us, spread so a mesh
+// powered up together doesn't ask all at once
+#define RQUERY_FIRST_MS     (15000)
+#define RQUERY_REQUEST_PREFIX "rq2"
+// neighbors whose progress fits in one request, 6 bytes each
+#define RQUERY_REQUEST_MAX  (24)
+// every neighbor answers a request, each at a random point in this window so the answers
+// don't all land on the asker at once. a full answer is about a second on air
+#define RQUERY_ANSWER_SPREAD_MS (8000)
+// route changes go out as a broadcast advert at most this often
+#define RQUERY_TICK_MS      (250)
+#define TRIGGER_HOLDDOWN_MS (10000)
+// a neighbor that missed our wire= at boot, or whose answer we missed, is asked again with
+// the next few rquery rounds. one that never answers is older than wire= and left alone
+#define WIRE_ASK_MAX        (3)
 
 // static void parse_new_nodes(const char *content);
 // static int gather_nodes(char *out_buffer);
 static void update_name(ID origin_node, char buffer[32]);
+static uint16_t advert_epoch(void);
+static uint16_t advert_since(const char *packed);
+static void take_advert(DataEntry *advert_msg);
+
+static uint16_t s_epoch;
 /*
 
 PING
@@ -31,10 +55,25 @@ GLOBAL BCAST
 GLOBAL BCAST RESPONSE
     - nothing, the acks themselfs will be enough information
 
+WIRE
+    - "wire=<version>" announce the highest frame format this node can read
+WIRE RESPONSE
+    - our own "wire=<version>" so the announcer can switch to it too
+
+RQUERY
+    - "rq2<packed (neighbor, its epoch, its advert seq)>" how far we got with each neighbor's routes
+RQUERY RESPONSE
+    - "ra2<packed advert>" the routes that changed since, straight back to the asker
+      within RQUERY_ANSWER_SPREAD_MS
+ROUTE ADVERT
+    - "ra2<packed advert>" broadcast when our routes changed, nobody answers
+    - a bare "rquery" from an old node still gets the "count;dest:steps:cost;..." text answer
+
 */
 
 void handle_maintenance_msg(ID msg_id) {
     DataEntry *respond_to_msg = msg_find(msg_id);
+    if (!respond_to_msg) return;
     printf("MAINTENANCE msg handling for ID=%d : \"%s\"\n", respond_to_msg->id, respond_to_msg->content);
     // make sure msg is either broadcasted, or meant for this node
     // also check to make sure message has not already been received ******* DO THIS LATER
@@ -59,7 +98,7 @@ void handle_maintenance_msg(ID msg_id) {
  
     } else if (respond_to_msg->ack_for != NO_ID) {
         DataEntry *acked_msg = msg_find(respond_to_msg->ack_for);
-        if (strncmp(acked_msg->content, "ping", 5) == 0) {
+        if (acked_msg && strncmp(acked_msg->content, "ping", 5) == 0) {
             update_name(respond_to_msg->origin_node, respond_to_msg->content);
         }
     }
@@ -84,7 +123,7 @@ void handle_maintenance_msg(ID msg_id) {
         // if msg is resposne to a discovery node
         DataEntry *acked_msg = msg_find(respond_to_msg->ack_for);
         // if it is the discovery message then deal with it
-        if (strncmp(acked_msg->content, "gbcast", 7) == 0) {
+        if (acked_msg && strncmp(acked_msg->content, "gbcast", 7) == 0) {
             update_name(respond_to_msg->origin_node, respond_to_msg->content);
         }
 
@@ -92,19 +131,25 @@ void handle_maintenance_msg(ID msg_id) {
 
     // RQUERY
 
-    if (strncmp(respond_to_msg->content, "rquery", 7) == 0) { 
-        NodeEntry *from_node = get_node_ptr(respond_to_msg->src_node);
-        // this nodes router and the node obj of the src
-        len = router_answer_rquery(g_router, from_node, 5, buffer, 240);
-        // provide router details
+    if (strncmp(respond_to_msg->content, RQUERY_REQUEST_PREFIX, 3) == 0) {
+        // answered later from rquery_task, a newer request replaces one still waiting
+        NodeEntry *asker = get_node_ptr(respond_to_msg->src_node);
+        if (asker && respond_to_msg->src_node == respond_to_msg->origin_node) {
+            asker->answer_since = advert_since(respond_to_msg->content + 3);
+            asker->answer_at = xTaskGetTickCount() + pdMS_TO_TICKS(esp_random() % RQUERY_ANSWER_SPREAD_MS);
+            asker->answer_for = msg_id;
+        }
 
-    } else if (respond_to_msg->ack_for != NO_ID) {
-        // if msg is resposne to a discovery node
-        DataEntry *acked_msg = msg_find(respond_to_msg->ack_for);
-        // if it is the discovery message then deal with it
-        if (strncmp(acked_msg->content, "rquery", 7) == 0) {
-            router_parse_rquery(g_router, respond_to_msg->src_node, respond_to_msg->content);
+    } else if (strncmp(respond_to_msg->content, "rquery", 7) == 0) {
+        NodeEntry *from_node = get_node_ptr(respond_to_msg->src_node);
+        // this nodes router and the node obj of the src. not in a full node table, no answer
+        if (from_node) {
+            len = router_answer_rquery(g_router, from_node, 5, buffer, 240);
+            should_ack_use_router = false;
         }
+
+    } else if (strncmp(respond_to_msg->content, ROUTE_ADVERT_PREFIX, 3) == 0) {
+        take_advert(respond_to_msg);
     }
 
     // UNLINK
@@ -121,8 +166,11 @@ void handle_maintenance_msg(ID msg_id) {
             // yes we should cut the link
             // tell router we are unlinking
             router_unlink_node(g_router, respond_to_msg->origin_node);
-            // tell node the same
-            linked_node->link_enabled = false;
+            // tell node the same, if the node table had room for it
+            if (linked_node) {
+                linked_node->link_enabled = false;
+                node_changed(linked_node->address);
+            }
             buffer[len++] = 'y';
         }
         buffer[len] = '\0';
@@ -131,7 +179,7 @@ void handle_maintenance_msg(ID msg_id) {
         // if msg is resposne to a discovery node
         DataEntry *acked_msg = msg_find(respond_to_msg->ack_for);
         // if it is the discovery message then deal with it
-        if (strncmp(acked_msg->content, "unlink", 7) == 0) {
+        if (acked_msg && strncmp(acked_msg->content, "unlink", 7) == 0) {
             if (respond_to_msg->content[0] == 'y') {
                 should_ack_use_router = false; // probably not needed but whatever
                 // other node unlinked so we can unlink
@@ -139,7 +187,10 @@ void handle_maintenance_msg(ID msg_id) {
                 // tell router we are unlinking
                 router_unlink_node(g_router, respond_to_msg->origin_node);
                 // tell node the same
-                linked_node->link_enabled = false;
+                if (linked_node) {
+                    linked_node->link_enabled = false;
+                    node_changed(linked_node->address);
+                }
             }
         }
     }
@@ -154,11 +205,28 @@ void handle_maintenance_msg(ID msg_id) {
         // tell router we are linking
         router_link_node(g_router, respond_to_msg->origin_node);
         // tell node the same
-        unlinked_node->link_enabled = true;
+        if (unlinked_node) {
+            unlinked_node->link_enabled = true;
+            node_changed(unlinked_node->address);
+        }
 
     }
     // no ack for link
 
+    // WIRE
+
+    if (strncmp(respond_to_msg->content, "wire=", 5) == 0) {
+        // neighbor is telling us which frame format it can read
+        int version = atoi(respond_to_msg->content + 5);
+        if (version >= 0) {
+            node_set_wire_version(respond_to_msg->src_node, (uint8_t) version);
+        }
+        // answer an announcement with our own so they learn about us too
+        if (respond_to_msg->ack_for == NO_ID) {
+            should_ack_use_router = false;
+            len = sprintf(buffer, "wire=%d", WIRE_VERSION);
+        }
+    }
 
     
     if (len) {
@@ -171,11 +239,16 @@ void handle_maintenance_msg(ID msg_id) {
 
 static void update_name(ID origin_node, char buffer[32]) {
     NodeEntry *heard_node = get_node_ptr(origin_node);
+    if (!heard_node) {
+        // the node table is full
+        return;
+    }
     int c = 0;
     for (; c < (int)sizeof(heard_node->name) - 1 && buffer[c]; c++) {
         heard_node->name[c] = buffer[c];
     }
     heard_node->name[c] = '\0';
+    node_changed(heard_node->address);
     printf("Node id = %hu new name is: %s\n",heard_node->address, heard_node->name);
 }
 
@@ -191,6 +264,7 @@ void resolve_system_command(char *cmd_buffer) {
         printf("New name is %s\n",name);
         strlcpy(g_this_node->name, name, 32);
         g_this_node->name[len] = '\0';
+        node_changed(g_my_address);
     } else if (sscanf(cmd_buffer, "SYS+LINK=%hu",&node_id)) {
         if (node_id == g_my_address) {
             printf("[LINK] Cannot link to self\n");
@@ -204,6 +278,7 @@ void resolve_system_command(char *cmd_buffer) {
 
         router_link_node(g_router, node_id);
         unlinked_node->link_enabled = true;
+        node_changed(node_id);
 
         // send msg of re link to neighbor
         ID unlink_msg = create_data_object(NO_ID, MAINTENANCE, "link", g_my_address, unlinked_node->address, g_my_address, 0, 0, 0, NO_ID);
@@ -223,19 +298,222 @@ void resolve_system_command(char *cmd_buffer) {
 
         ID unlink_msg = create_data_object(NO_ID, MAINTENANCE, "unlink", g_my_address, node_id, g_my_address, 0, 0, 0, NO_ID);
         queue_send(unlink_msg, node_id, false);
+    } else if (!strncmp(cmd_buffer, "SYS+RETAIN=", 11)) {
+        // SYS+RETAIN=<max entries>,<max bytes>,<max age s>, 0 entries/bytes means all of the store
+        int max_entries;
+        unsigned max_bytes, max_age;
+        if (sscanf(cmd_buffer, "SYS+RETAIN=%d,%u,%u", &max_entries, &max_bytes, &max_age) != 3) {
+            printf("[RETAIN] expected SYS+RETAIN=entries,bytes,age_s\n");
+            return;
+        }
+        RetentionPolicy policy;
+        msg_table_get_policy(&policy);
+        policy.max_entries = max_entries;
+        policy.max_bytes = max_bytes;
+        policy.max_age_s = max_age;
+        msg_table_set_policy(&policy);
+    } else if (!strncmp(cmd_buffer, "SYS+QUOTA=", 10)) {
+        // SYS+QUOTA=<message type>,<entries>
+        int type;
+        unsigned quota;
+        if (sscanf(cmd_buffer, "SYS+QUOTA=%d,%u", &type, &quota) != 2 || type < BROADCAST || type >= MSG_TYPE_COUNT) {
+            printf("[QUOTA] expected SYS+QUOTA=type,entries\n");
+            return;
+        }
+        RetentionPolicy policy;
+        msg_table_get_policy(&policy);
+        policy.quota[type] = (uint16_t) quota;
+        msg_table_set_policy(&policy);
+    } else if (!strncmp(cmd_buffer, "SYS+METRIC=", 11)) {
+        // SYS+METRIC=hops|etx|snr
+        char metric_name[8];
+        RouteMetric metric = METRIC_COUNT;
+        if (sscanf(cmd_buffer, "SYS+METRIC=%7[a-z]", metric_name) == 1) {
+            metric = route_metric_from_name(metric_name);
+        }
+        if (metric == METRIC_COUNT) {
+            printf("[METRIC] expected SYS+METRIC=hops, etx or snr\n");
+            return;
+        }
+        router_set_metric(g_router, metric);
+        printf("[METRIC] routes now chosen by %s\n", route_metric_name(metric));
+    } else if (!strncmp(cmd_buffer, "SYS+DUTY=", 9)) {
+        // SYS+DUTY=<permille>[,<window s>], 0 permille for no limit
+        unsigned permille, window_s = AIRTIME_WINDOW_S;
+        if (sscanf(cmd_buffer, "SYS+DUTY=%u,%u", &permille, &window_s) < 1) {
+            printf("[DUTY] expected SYS+DUTY=permille[,window_s]\n");
+            return;
+        }
+        airtime_set_duty(permille, window_s);
     }
 }
 
 
+// every rquery doubles as a probe of the links to our neighbors: one that heard us last
+// round and didn't answer by now lost the query or the answer
+static void close_probe_round(void) {
+    int count = node_table_count();
+    for (int i = 0; i < count; i++) {
+        NodeEntry *node = node_table_at(i);
+        if (node->rquery_asked) {
+            node_link_result(node, node->rquery_answered);
+        }
+        // heard directly means a neighbor
+        node->rquery_asked = node->address != g_my_address && node->messages > 0 && node->link_enabled;
+        node->rquery_answered = false;
+    }
+}
+
+// neighbors tell our seqs from before a reboot apart by this
+static uint16_t advert_epoch(void) {
+    while (s_epoch == 0) {
+        s_epoch = (uint16_t) esp_random();
+    }
+    return s_epoch;
+}
+
+static inline void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)(v & 0xFF);
+}
+
+static inline uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// the seq the asking neighbor has our routes up to, 0 if it has none or they're from
+// before our last reboot
+static uint16_t advert_since(const char *packed) {
+    uint8_t raw[RQUERY_REQUEST_MAX * 6];
+    size_t len = frame_text_unpack(packed, strlen(packed), raw, sizeof(raw));
+    for (size_t i = 0; i + 6 <= len; i += 6) {
+        if (get_u16(raw + i) == g_my_address) {
+            return get_u16(raw + i + 2) == advert_epoch() ? get_u16(raw + i + 4) : 0;
+        }
+    }
+    return 0;
+}
+
+static void take_advert(DataEntry *advert_msg) {
+    // only adverts heard first hand, a relayed one says nothing about the link
+    if (advert_msg->src_node != advert_msg->origin_node) return;
+    NodeEntry *neighbor = get_node_ptr(advert_msg->src_node);
+    RouteAdvert advert;
+    if (!neighbor || !router_read_advert(g_router, advert_msg->src_node, advert_msg->content, &advert)) return;
+
+    if (advert.epoch != neighbor->advert_epoch) {
+        // it rebooted, whatever we had from it is from before
+        neighbor->advert_epoch = advert.epoch;
+        neighbor->advert_seq = 0;
+    }
+    // the routes are taken either way, but we only got everything up to upto_seq if the
+    // advert starts at or before where we were
+    if (advert.from_seq == 0 ||
+        (neighbor->advert_seq != 0 && !route_seq_after(advert.from_seq, neighbor->advert_seq))) {
+        if (neighbor->advert_seq == 0 || route_seq_after(advert.upto_seq, neighbor->advert_seq)) {
+            neighbor->advert_seq = advert.upto_seq;
+        }
+    }
+
+    if (advert_msg->ack_for != NO_ID) {
+        DataEntry *acked_msg = msg_find(advert_msg->ack_for);
+        if (acked_msg && strncmp(acked_msg->content, RQUERY_REQUEST_PREFIX, 3) == 0) {
+            neighbor->rquery_answered = true;
+        }
+    }
+}
+
+// the answers whose time has come, straight back over the link the request came in on.
+// the answer is also the etx probe for that link
+static void send_due_answers(TickType_t now) {
+    int count = node_table_count();
+    for (int i = 0; i < count; i++) {
+        NodeEntry *node = node_table_at(i);
+        if (node->answer_for == NO_ID || (int32_t)(now - node->answer_at) < 0) continue;
+
+        char content[240];
+        uint16_t upto;
+        int len = router_write_advert(g_router, advert_epoch(), node->answer_since, content, sizeof(content), &upto);
+        if (len > 0) {
+            ID msg = create_data_object(NO_ID, MAINTENANCE, content, g_my_address, node->address, g_my_address, 0, 0, 0, node->answer_for);
+            queue_send(msg, node->address, false);
+        }
+        node->answer_for = NO_ID;
+    }
+}
+
+// ask every neighbor for the routes that changed since we last heard from it
+static void send_route_request(void) {
+    uint8_t raw[RQUERY_REQUEST_MAX * 6];
+    size_t len = 0;
+    int count = node_table_count();
+    for (int i = 0; i < count && len < sizeof(raw); i++) {
+        NodeEntry *node = node_table_at(i);
+        if (node->advert_epoch == 0) continue;   // never sent us an advert
+        put_u16(raw + len, node->address);
+        put_u16(raw + len + 2, node->advert_epoch);
+        put_u16(raw + len + 4, node->advert_seq);
+        len += 6;
+    }
+
+    char content[3 + FRAME_TEXT_LEN(sizeof(raw)) + 1];
+    memcpy(content, RQUERY_REQUEST_PREFIX, 3);
+    content[3] = '\0';
+    if (len) frame_text_pack(raw, len, content + 3, sizeof(content) - 3);
+
+    ID msg = create_data_object(NO_ID, MAINTENANCE, content, g_my_address, 0, g_my_address, 0, 0, 0, NO_ID);
+    queue_send(msg, 0, false);
+}
+
+// until we know what a neighbor reads it only gets legacy frames and no hop acks
+static void ask_wire_versions(void) {
+    char content[16];
+    sprintf(content, "wire=%d", WIRE_VERSION);
+    int count = node_table_count();
+    for (int i = 0; i < count; i++) {
+        NodeEntry *node = node_table_at(i);
+        if (node->address == g_my_address || node->messages == 0) continue;
+        if (node->wire_version >= WIRE_VERSION || node->wire_asks >= WIRE_ASK_MAX) continue;
+        node->wire_asks++;
+        ID msg = create_data_object(NO_ID, MAINTENANCE, content, g_my_address, node->address, g_my_address, 0, 0, 0, NO_ID);
+        queue_send(msg, node->address, false);
+    }
+}
+
+// the routes that changed since the last push, to whoever hears it
+static uint16_t push_route_changes(uint16_t pushed_seq) {
+    char content[240];
+    uint16_t upto;
+    if (router_write_advert(g_router, advert_epoch(), pushed_seq, content, sizeof(content), &upto) <= 0) {
+        return pushed_seq;
+    }
+    ID msg = create_data_object(NO_ID, MAINTENANCE, content, g_my_address, 0, g_my_address, 0, 0, 0, NO_ID);
+    queue_send(msg, 0, false);
+    return upto;
+}
+
 void rquery_task(void *arg) {
+    TickType_t next_request = xTaskGetTickCount() + pdMS_TO_TICKS(RQUERY_FIRST_MS + esp_random() % RQUERY_FIRST_MS);
+    TickType_t last_push = xTaskGetTickCount();
+    uint16_t pushed_seq = 0;
+
     for (;;) {
-        vTaskDelay(pdMS_TO_TICKS(RQUERY_INTERVAL_MS));
-        ID msg = create_data_object(
-            NO_ID, MAINTENANCE, "rquery",
-            g_my_address, 0, g_my_address,
-            0, 0, 0, NO_ID
-        );
-        queue_send(msg, 0, false);
+        vTaskDelay(pdMS_TO_TICKS(RQUERY_TICK_MS));
+        TickType_t now = xTaskGetTickCount();
+        send_due_answers(now);
+
+        if ((int32_t)(now - next_request) >= 0) {
+            close_probe_round();
+            send_route_request();
+            ask_wire_versions();
+            next_request = now + pdMS_TO_TICKS(RQUERY_INTERVAL_MS);
+        } else if (router_advert_seq(g_router) != pushed_seq &&
+                   now - last_push >= pdMS_TO_TICKS(TRIGGER_HOLDDOWN_MS)) {
+            // triggered update, neighbors hear about a change within the hold down
+            // instead of at their next request
+            pushed_seq = push_route_changes(pushed_seq);
+            last_push = now;
+        }
     }
 }
 
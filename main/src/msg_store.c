@@ -0,0 +1,199 @@
+#include "msg_store.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#define NO_SLOT (0xFFFF)
+
+typedef struct {
+    uint16_t size;
+    uint16_t count;
+    char *blocks;
+    uint16_t *free;         // stack of free block indices
+    uint16_t free_top;
+} ContentClass;
+
+typedef struct {
+    uint16_t prev;          // allocation order, oldest at s_order_head
+    uint16_t next;
+    uint16_t block;
+    uint8_t cls;
+} SlotInfo;
+
+static const char *TAG = "MSG STORE";
+
+static DataEntry s_entries[MSG_STORE_ENTRIES];
+static SlotInfo s_slots[MSG_STORE_ENTRIES];
+static uint16_t s_free_slots[MSG_STORE_ENTRIES];
+static uint16_t s_free_slot_top;
+static uint16_t s_order_head = NO_SLOT;
+static uint16_t s_order_tail = NO_SLOT;
+static size_t s_bytes_used;
+
+static char s_tiny[MSG_STORE_TINY_BLOCKS][16];
+static char s_small[MSG_STORE_SMALL_BLOCKS][48];
+static char s_medium[MSG_STORE_MEDIUM_BLOCKS][112];
+static char s_large[MSG_STORE_LARGE_BLOCKS][MSG_STORE_CONTENT_MAX + 1];
+static char s_blob[MSG_STORE_BLOB_BLOCKS][MSG_STORE_BLOB_MAX + 1];
+static uint16_t s_tiny_free[MSG_STORE_TINY_BLOCKS];
+static uint16_t s_small_free[MSG_STORE_SMALL_BLOCKS];
+static uint16_t s_medium_free[MSG_STORE_MEDIUM_BLOCKS];
+static uint16_t s_large_free[MSG_STORE_LARGE_BLOCKS];
+static uint16_t s_blob_free[MSG_STORE_BLOB_BLOCKS];
+
+static ContentClass s_classes[] = {
+    { sizeof(s_tiny[0]),   MSG_STORE_TINY_BLOCKS,   &s_tiny[0][0],   s_tiny_free,   0 },
+    { sizeof(s_small[0]),  MSG_STORE_SMALL_BLOCKS,  &s_small[0][0],  s_small_free,  0 },
+    { sizeof(s_medium[0]), MSG_STORE_MEDIUM_BLOCKS, &s_medium[0][0], s_medium_free, 0 },
+    { sizeof(s_large[0]),  MSG_STORE_LARGE_BLOCKS,  &s_large[0][0],  s_large_free,  0 },
+    { sizeof(s_blob[0]),   MSG_STORE_BLOB_BLOCKS,   &s_blob[0][0],   s_blob_free,   0 },
+};
+#define CLASS_COUNT ((int)(sizeof(s_classes) / sizeof(s_classes[0])))
+#define BLOB_CLASS  (CLASS_COUNT - 1)
+
+void msg_store_init(void) {
+    // lowest index on top so a fresh node fills the slabs front to back
+    s_free_slot_top = 0;
+    for (int i = MSG_STORE_ENTRIES - 1; i >= 0; i--) {
+        s_free_slots[s_free_slot_top++] = (uint16_t) i;
+    }
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        ContentClass *cls = &s_classes[c];
+        cls->free_top = 0;
+        for (int i = cls->count - 1; i >= 0; i--) {
+            cls->free[cls->free_top++] = (uint16_t) i;
+        }
+    }
+    s_order_head = s_order_tail = NO_SLOT;
+    s_bytes_used = 0;
+}
+
+int msg_store_slot(const DataEntry *entry) {
+    return (int)(entry - s_entries);
+}
+
+DataEntry *msg_store_entry(int slot) {
+    return &s_entries[slot];
+}
+
+// a frame's worth never takes a blob block, there are only a few of them
+static bool class_takes(int c, size_t len) {
+    return s_classes[c].size > len && (c != BLOB_CLASS || len > MSG_STORE_CONTENT_MAX);
+}
+
+// smallest class with a free block len fits in, -1 if none
+static int free_class(size_t len) {
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        if (class_takes(c, len) && s_classes[c].free_top) return c;
+    }
+    return -1;
+}
+
+DataEntry *msg_store_alloc(size_t len) {
+    if (len > MSG_STORE_BLOB_MAX || s_free_slot_top == 0) {
+        return NULL;
+    }
+
+    int c = free_class(len);
+    if (c < 0) {
+        return NULL;
+    }
+
+    ContentClass *cls = &s_classes[c];
+    uint16_t block = cls->free[--cls->free_top];
+    uint16_t slot = s_free_slots[--s_free_slot_top];
+
+    DataEntry *entry = &s_entries[slot];
+    memset(entry, 0, sizeof(*entry));
+    entry->content = cls->blocks + (size_t) block * cls->size;
+
+    SlotInfo *info = &s_slots[slot];
+    info->cls = (uint8_t) c;
+    info->block = block;
+    info->next = NO_SLOT;
+    info->prev = s_order_tail;
+    if (s_order_tail != NO_SLOT) s_slots[s_order_tail].next = slot;
+    else s_order_head = slot;
+    s_order_tail = slot;
+
+    s_bytes_used += cls->size;
+    return entry;
+}
+
+void msg_store_free(DataEntry *entry) {
+    int slot = msg_store_slot(entry);
+    if (slot < 0 || slot >= MSG_STORE_ENTRIES) {
+        ESP_LOGE(TAG, "free of an entry that is not from the store");
+        return;
+    }
+    SlotInfo *info = &s_slots[slot];
+
+    if (info->prev != NO_SLOT) s_slots[info->prev].next = info->next;
+    else s_order_head = info->next;
+    if (info->next != NO_SLOT) s_slots[info->next].prev = info->prev;
+    else s_order_tail = info->prev;
+
+    ContentClass *cls = &s_classes[info->cls];
+    cls->free[cls->free_top++] = info->block;
+    s_free_slots[s_free_slot_top++] = (uint16_t) slot;
+    s_bytes_used -= cls->size;
+}
+
+DataEntry *msg_store_oldest(void) {
+    return s_order_head == NO_SLOT ? NULL : &s_entries[s_order_head];
+}
+
+DataEntry *msg_store_newest(void) {
+    return s_order_tail == NO_SLOT ? NULL : &s_entries[s_order_tail];
+}
+
+DataEntry *msg_store_older(const DataEntry *entry) {
+    uint16_t prev = s_slots[msg_store_slot(entry)].prev;
+    return prev == NO_SLOT ? NULL : &s_entries[prev];
+}
+
+int msg_store_used(void) {
+    return MSG_STORE_ENTRIES - s_free_slot_top;
+}
+
+bool msg_store_block_free(size_t len) {
+    return len <= MSG_STORE_BLOB_MAX && free_class(len) >= 0;
+}
+
+bool msg_store_block_fits(const DataEntry *entry, size_t len) {
+    return class_takes(s_slots[msg_store_slot(entry)].cls, len);
+}
+
+size_t msg_store_entry_bytes(const DataEntry *entry) {
+    return s_classes[s_slots[msg_store_slot(entry)].cls].size;
+}
+
+size_t msg_store_bytes_used(void) {
+    return s_bytes_used;
+}
+
+size_t msg_store_bytes_capacity(void) {
+    size_t bytes = 0;
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        bytes += (size_t) s_classes[c].count * s_classes[c].size;
+    }
+    return bytes;
+}
+
+size_t msg_store_footprint(void) {
+    size_t bytes = sizeof(s_entries) + sizeof(s_slots) + sizeof(s_free_slots);
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        bytes += (size_t) s_classes[c].count * (s_classes[c].size + sizeof(uint16_t));
+    }
+    return bytes;
+}
+
+void msg_store_log_usage(void) {
+    ESP_LOGI(TAG, "%d entries of %u B, content %ux%u %ux%u %ux%u %ux%u %ux%u, %u bytes reserved",
+        MSG_STORE_ENTRIES, (unsigned) sizeof(DataEntry),
+        s_classes[0].count, s_classes[0].size, s_classes[1].count, s_classes[1].size,
+        s_classes[2].count, s_classes[2].size, s_classes[3].count, s_classes[3].size,
+        s_classes[4].count, s_classes[4].size, (unsigned) msg_store_footprint());
+}
@@ -1,7 +1,9 @@
 #include "node_table.h"
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "freertos/FreeRTOS.h"
@@ -12,26 +14,85 @@
 #include "data_table.h"
 #include "esp_log.h"
 #include "node_globals.h"
+#include "frame_codec.h"
+#include "hop_ack.h"
+#include "event_bus.h"
 
 
-NodeEntry *g_node_table = NULL;
+// twice the capacity, rounded to a power of two, keeps probes short
+#define NODE_INDEX_SLOTS (1u << (32 - __builtin_clz(NODE_TABLE_CAPACITY * 2 - 1)))
+
+static NodeEntry s_nodes[NODE_TABLE_CAPACITY];
+static atomic_int s_node_count;
+// slot + 1 of the node with that address, 0 when empty. filled in only after the node is
+static atomic_uint_least16_t s_index[NODE_INDEX_SLOTS];
+// bumped on every change the page could see, the ETag of /api/nodes
+static atomic_uint s_version;
+
 static SemaphoreHandle_t g_ntb_mutex;
 static const char *TAG = "NODE TABLE";
 static const int REQUEST_STATUS_TIME = 120;
 static const float EMA_SMOOTHING = 0.15;
+// probes come one per rquery round, so these move faster than the per frame averages
+static const float LINK_SMOOTHING = 0.2;
 
 void node_table_init(void) {
     ESP_LOGI(TAG, "NODE TABLE INIT");
     g_ntb_mutex = xSemaphoreCreateMutex();
+    atomic_store(&s_node_count, 0);
+    for (size_t i = 0; i < NODE_INDEX_SLOTS; i++) {
+        atomic_store(&s_index[i], 0);
+    }
+}
+
+static inline size_t index_home(ID address) {
+    return (address * 40503u) & (NODE_INDEX_SLOTS - 1);
+}
+
+NodeEntry *get_node_ptr(int address) {
+    for (size_t i = index_home((ID) address); ; i = (i + 1) & (NODE_INDEX_SLOTS - 1)) {
+        unsigned slot = atomic_load_explicit(&s_index[i], memory_order_acquire);
+        if (slot == 0) return NULL;
+        if (s_nodes[slot - 1].address == address) return &s_nodes[slot - 1];
+    }
+}
+
+int node_table_count(void) {
+    return atomic_load_explicit(&s_node_count, memory_order_acquire);
+}
+
+NodeEntry *node_table_at(int index) {
+    return &s_nodes[index];
 }
 
+uint32_t node_table_version(void) {
+    return atomic_load(&s_version);
+}
+
+void node_changed(ID address) {
+    atomic_fetch_add(&s_version, 1);
+    event_publish(EVENT_NODE, address);
+}
 
 NodeEntry *create_node_object(ID address) {
-	NodeEntry *new_entry = malloc(sizeof(NodeEntry));
-    if (!new_entry) {
+    xSemaphoreTake(g_ntb_mutex, portMAX_DELAY);
+
+    // someone else may have added it since the caller looked
+    NodeEntry *existing = get_node_ptr(address);
+    if (existing) {
+        xSemaphoreGive(g_ntb_mutex);
+        return existing;
+    }
+    int count = atomic_load_explicit(&s_node_count, memory_order_relaxed);
+    if (count == NODE_TABLE_CAPACITY) {
+        xSemaphoreGive(g_ntb_mutex);
+        ESP_LOGW(TAG, "Node table full, not adding %hu", address);
         return NULL;
     }
 
+    NodeEntry *new_entry = &s_nodes[count];
+    memset(new_entry, 0, sizeof(*new_entry));
+
     new_entry->avg_rssi = 0;
     new_entry->avg_snr = 0;
     new_entry->messages = 0;
@@ -41,6 +102,9 @@ NodeEntry *create_node_object(ID address) {
     new_entry->address = address;
     new_entry->link_enabled = true;
     new_entry->last_rquery = 0;
+    new_entry->wire_version = WIRE_VERSION_LEGACY;
+    new_entry->link_delivery = 1.0f;
+    new_entry->link_samples = 0;
 
     // new nodes should inherit last connection time from parents
     time(&new_entry->last_connection);
@@ -53,27 +117,22 @@ NodeEntry *create_node_object(ID address) {
     int len =sprintf(new_entry->name, "Node %hu", address);
     new_entry->name[len] = '\0';
 
-    xSemaphoreTake(g_ntb_mutex, portMAX_DELAY);
-
-    new_entry->next = g_node_table;
-    g_node_table = new_entry;
+    // publish: walkers see it through the count, lookups through the index
+    size_t i = index_home(address);
+    while (atomic_load_explicit(&s_index[i], memory_order_relaxed)) {
+        i = (i + 1) & (NODE_INDEX_SLOTS - 1);
+    }
+    atomic_store_explicit(&s_node_count, count + 1, memory_order_release);
+    atomic_store_explicit(&s_index[i], (uint_least16_t)(count + 1), memory_order_release);
 
     xSemaphoreGive(g_ntb_mutex);
 
     ESP_LOGI(TAG, "Node added (%hu)",new_entry->address);
+    node_changed(address);
 
     return new_entry;
 }
 
-NodeEntry *get_node_ptr(int address) {
-	NodeEntry *walk = g_node_table;
-	while (walk) {
-		if (walk->address == address) return walk;
-		walk = walk->next;
-	}
-	return NULL;
-}
-
 int nodes_update(ID msg_id) {
     DataEntry *data = msg_find(msg_id);
     if (!data) return 0;
@@ -89,20 +148,28 @@ int nodes_update(ID msg_id) {
     NodeEntry *origin_node = node_create_if_needed(data->origin_node);
     NodeEntry *src_node    = node_create_if_needed(src);
 
-    time(&origin_node->last_connection);
-    origin_node->status = ALIVE;
-    origin_node->misses = 0;
+    if (origin_node) {
+        time(&origin_node->last_connection);
+        origin_node->status = ALIVE;
+        origin_node->misses = 0;
+    }
 
     if (src_node) {
-        time(&src_node->last_connection);
-        src_node->status = ALIVE;
-        src_node->misses = 0;
-        update_metrics(src_node, data->rssi, data->snr);
+        node_heard(src_node, data->rssi, data->snr);
     }
+    if (origin_node && origin_node != src_node) node_changed(origin_node->address);
 
     return 1;
 }
 
+void node_heard(NodeEntry *node, int rssi, int snr) {
+    time(&node->last_connection);
+    node->status = ALIVE;
+    node->misses = 0;
+    update_metrics(node, rssi, snr);
+    node_changed(node->address);
+}
+
 // for any time a node is a src or origin run it though this function
 // it will do nothing if already in set but if its new it will return 1 and add node
 NodeEntry *node_create_if_needed(ID addr) {
@@ -121,6 +188,7 @@ void attempt_to_reach_node(ID addr) {
 
     // if node is new attempt to ping node
     node->status = UNKNOWN;
+    node_changed(addr);
     if (node->ping_task == NULL) {
         xTaskCreate(
             ping_suspect_node,
@@ -138,26 +206,27 @@ void ping_suspect_node(void *args) {
     NodeEntry *node = (NodeEntry *)args;
     if (!node) { vTaskDelete(NULL); return; }
 
-    DataEntry *ping_msg = msg_find(node->ping_id);
-    if (!ping_msg) { 
+    // by id from here on, the ping can be dropped from the store while we wait
+    ID ping_id = node->ping_id;
+    if (!msg_set_ack(ping_id, 0, NULL)) {
         ESP_LOGW(TAG, "no ping msg for node %d",node->address);
+        node->ping_task = NULL;
         vTaskDelete(NULL); return; 
     }
 
-    ping_msg->ack_status = 0;
-
-    int delay = 1;
+    // the first hop's ack timeout, twice for there and back, doubled on every try
+    uint32_t wait_ms = 2 * hop_rto_ms(router_query_intermediate(g_router, node->address));
     bool success = false;
 
     for (int i = 0; i < 4; i++) {
         // send ping
-        queue_send(node->ping_id, node->address, true);
+        queue_send(ping_id, node->address, true);
 
-        vTaskDelay(pdMS_TO_TICKS(delay * 1500));
+        vTaskDelay(pdMS_TO_TICKS(wait_ms));
 
-        delay <<= 1;
+        wait_ms <<= 1;
 
-        if (ping_msg->ack_status) {
+        if (msg_ack_status(ping_id) > 0) {
             success = true;
             break;
         } else {
@@ -167,6 +236,7 @@ void ping_suspect_node(void *args) {
 
     node->status = success ? ALIVE : DEAD;
     node->ping_task = NULL;
+    node_changed(node->address);
 
     vTaskDelete(NULL);
 }
@@ -177,14 +247,17 @@ void node_status_task(void *args) {
 
     for (;;) {
         time_t now = time(NULL);
-        NodeEntry *node = g_node_table;
+        int count = node_table_count();
 
-        while (node) {
+        for (int i = 0; i < count; i++) {
+            NodeEntry *node = &s_nodes[i];
             int delta = difftime(now, node->last_connection);
 
             if (delta <= REQUEST_STATUS_TIME) {
+                bool revived = node->status != ALIVE;
                 node->status = ALIVE;
                 node->misses = 0;
+                if (revived) node_changed(node->address);
             } else if (delta > REQUEST_STATUS_TIME &&
                        node->status == ALIVE) {
                 ESP_LOGW(TAG,
@@ -192,8 +265,6 @@ void node_status_task(void *args) {
                          node->address);
                 attempt_to_reach_node(node->address);
             }
-
-            node = node->next;
         }
 
         vTaskDelayUntil(&last, period);
@@ -207,33 +278,83 @@ void update_metrics(NodeEntry *node, int rssi, int snr) {
 		node->avg_rssi = rssi;
 		node->avg_snr = snr;
 		node->messages = 1;
-		return;
+	} else {
+		node->avg_rssi = (rssi * EMA_SMOOTHING) + (1.0f - EMA_SMOOTHING) * node->avg_rssi;
+		node->avg_snr = (snr * EMA_SMOOTHING) + (1.0f - EMA_SMOOTHING) * node->avg_snr;
+		node->messages += 1;
 	}
-	node->avg_rssi = (rssi * EMA_SMOOTHING) + (1.0f - EMA_SMOOTHING) * node->avg_rssi;
-	node->avg_snr = (snr * EMA_SMOOTHING) + (1.0f - EMA_SMOOTHING) * node->avg_snr;
-	node->messages += 1;
+	router_observe_link(g_router, node->address, node->avg_snr, node->link_delivery, node->link_samples);
+}
+
+void node_link_result(NodeEntry *node, bool answered) {
+	float result = answered ? 1.0f : 0.0f;
+	if (node->link_samples == 0) {
+		node->link_delivery = result;
+	} else {
+		node->link_delivery = (result * LINK_SMOOTHING) + (1.0f - LINK_SMOOTHING) * node->link_delivery;
+	}
+	node->link_samples += 1;
+	router_observe_link(g_router, node->address, node->avg_snr, node->link_delivery, node->link_samples);
 }
 
 
-int format_node_as_json(NodeEntry *data, char *out, int buff_size) {
-    // name, address, avg_rssi, avg_snr, messages
+void write_node_json(JsonWriter *w, const NodeEntry *data) {
     time_t now = time(NULL);
     double seconds_since_last = difftime(now, data->last_connection);
     if (seconds_since_last < 0) seconds_since_last = 0;
+    char address[8];
+    snprintf(address, sizeof address, "%hu", data->address);
+
+    json_object_begin(w);
+    json_key(w, "name");            json_string(w, (data->name[0] != '\0') ? data->name : "(null)");
+    json_key(w, "address");         json_string(w, address);
+    json_key(w, "avg_rssi");        json_double(w, data->avg_rssi, 2);
+    json_key(w, "avg_snr");         json_double(w, data->avg_snr, 2);
+    json_key(w, "messages");        json_int(w, data->messages);
+    json_key(w, "current_node");    json_int(w, data->address == g_my_address);
+    json_key(w, "last_connection"); json_double(w, seconds_since_last, 0);
+    json_key(w, "status");          json_int(w, data->status);
+    json_key(w, "link_enabled");    json_int(w, data->link_enabled);
+    json_object_end(w);
+}
+
+
+// frame format to use when sending to target. a broadcast is heard by every neighbor
+// so it only goes out packed once all of them (anyone we have heard directly) can read it
+uint8_t node_wire_version(ID target) {
+    if (target != BROADCAST_ID) {
+        NodeEntry *node = get_node_ptr(target);
+        return node ? node->wire_version : WIRE_VERSION_LEGACY;
+    }
 
-    int n = sprintf(
-        out,
-        "{\"name\" : \"%s\", \"address\" : \"%hu\", \"avg_rssi\" : %.2f, \"avg_snr\" : %.2f, \"messages\" : %d, \"current_node\" : %d, \"last_connection\" : %.0f, \"status\" : %d, \"link_enabled\" : %d}",
-        (data->name[0] != '\0') ? data->name : "(null)",
-        data->address,
-        data->avg_rssi,
-        data->avg_snr,
-        data->messages,
-        data->address == g_my_address,
-        seconds_since_last,
-        data->status,
-        data->link_enabled
-    );
-    out[buff_size - 1] = '\0';
-    return n;
-}
\ No newline at end of file
+    uint8_t version = WIRE_VERSION;
+    bool any = false;
+
+    int count = node_table_count();
+    for (int i = 0; i < count; i++) {
+        const NodeEntry *walk = &s_nodes[i];
+        if (walk->address == g_my_address || walk->messages == 0) continue;
+        any = true;
+        if (walk->wire_version < version) version = walk->wire_version;
+    }
+
+    return any ? version : WIRE_VERSION_LEGACY;
+}
+
+static void update_wire_version(ID addr, uint8_t version, bool lower) {
+    NodeEntry *node = get_node_ptr(addr);
+    if (!node) return;
+
+    if (version > WIRE_VERSION) version = WIRE_VERSION;
+    if (node->wire_version == version || (!lower && version < node->wire_version)) return;
+    ESP_LOGI(TAG, "Node %hu speaks wire v%d", addr, version);
+    node->wire_version = version;
+}
+
+void node_set_wire_version(ID addr, uint8_t version) {
+    update_wire_version(addr, version, true);
+}
+
+void node_saw_wire_version(ID addr, uint8_t version) {
+    update_wire_version(addr, version, false);
+}
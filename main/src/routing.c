@@ -1,103 +1,216 @@
 #include "routing.h"
 #include "node_table.h"
+#include "frame_codec.h"
 
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+// route entries are referred to as dest index * MAX_ROUTING_ENTRIES + entry
+#define NO_REF (0xFFFF)
+// twice the capacity, rounded to a power of two, keeps probes short
+#define DEST_INDEX_SLOTS (1u << (32 - __builtin_clz(ROUTER_MAX_DESTINATIONS * 2 - 1)))
+
+// a link this bad is as good as gone, it still beats no route at all
+#define LINK_COST_CAP   (8 * ROUTE_COST_UNIT)
+// delivery ratios from fewer probes than this are noise, etx goes by snr until then
+#define ETX_MIN_SAMPLES (5)
+// at or above SNR_SOLID_DB a link costs one hop, every SNR_DB_PER_HOP below that adds another
+#define SNR_SOLID_DB    (5.0f)
+#define SNR_DB_PER_HOP  (5.0f)
+// cost changes smaller than this aren't worth an advert
+#define COST_NEWS       (ROUTE_COST_UNIT / 4)
+
+// packed advert: epoch, from seq, upto seq (u16 each), route count (u8), then per route
+// dest, via (u16), steps (u8), cost (u16). an unreachable route has steps 0
+#define ADVERT_HEADER_LEN (7)
+#define ADVERT_ROUTE_LEN  (7)
+
 typedef struct {
 	int steps;
 	ID intermediate_node;
 	bool in_use;
 	bool link_active;
+	bool cost_advertised;   // path_cost came from an rquery answer, not a guess from steps
+	uint16_t link_cost;     // to intermediate_node under the current metric
+	uint16_t path_cost;     // from intermediate_node on to the destination
+	uint16_t via_prev;      // other entries through the same intermediate node
+	uint16_t via_next;
 } IntermediateStepInfo;
 
 typedef struct destination_approximator_struct {
 	IntermediateStepInfo best_routing_info[MAX_ROUTING_ENTRIES];
 	ID destination_node;
 	int count;
-	uint32_t last_updated_seq;
-
-	struct destination_approximator_struct *next;
+	uint16_t changed_seq;   // advert seq of the last change worth telling neighbors about
+	// what that change was
+	bool adv_reachable;
+	int adv_steps;
+	uint16_t adv_cost;
+	ID adv_via;
+	uint16_t via_head;      // first route entry, of any destination, that goes through this node
+	uint16_t link_cost[METRIC_COUNT];   // the hop to this node when it is a neighbor
 } DestinationApproximator;
 
 
 typedef struct router_struct {
-	DestinationApproximator *destination_list;
+	// in the order destinations were first heard of, never removed
+	DestinationApproximator destinations[ROUTER_MAX_DESTINATIONS];
 	int approximators;
+	// destination -> index + 1, 0 when empty
+	uint16_t dest_index[DEST_INDEX_SLOTS];
 	ID node_id;
-	uint32_t discovery_seq;
+	uint16_t advert_seq;    // bumped for every change worth advertising, never 0
+	RouteMetric metric;
 } Router;
 
 
 // hidden
 static DestinationApproximator *create_destination_approximator(Router *router, ID destination_node);
 static DestinationApproximator *get_destination_approximator(Router *router, ID destination_node);
-static bool update_approximation_entry(Router *router, DestinationApproximator *approximator, ID intermediate_node, int steps);
-static bool remove_approximation_entry(DestinationApproximator *approximator, ID intermediate_node);
-static IntermediateStepInfo *choose_approximation_route(DestinationApproximator *approximator);
-static void router_incorporate_rquery(Router *router, ID from_node, ID destination_node, int steps);
+static DestinationApproximator *find_destination_approximator(Router *router, ID destination_node);
+static bool update_approximation_entry(Router *router, DestinationApproximator *approximator, ID intermediate_node, int steps, uint16_t path_cost, bool advertised);
+static bool remove_approximation_entry(Router *router, DestinationApproximator *approximator, ID intermediate_node);
+static IntermediateStepInfo *choose_approximation_route(Router *router, DestinationApproximator *approximator);
+static void router_incorporate_rquery(Router *router, ID from_node, ID destination_node, int steps, uint16_t cost);
+static void note_change(Router *router, DestinationApproximator *approximator);
+
+static const char *const METRIC_NAMES[METRIC_COUNT] = { "hops", "etx", "snr" };
 
 
 Router *create_router(ID for_node) {
-	Router *new_router = malloc(sizeof(Router));
+	Router *new_router = calloc(1, sizeof(Router));
+	if (!new_router) return NULL;
 	new_router->node_id = for_node;
 	new_router->approximators = 0;
-	new_router->destination_list = NULL;
+	new_router->metric = ROUTER_DEFAULT_METRIC;
 
 	return new_router;
 }
 
+static inline size_t dest_home(ID destination_node) {
+	return (destination_node * 40503u) & (DEST_INDEX_SLOTS - 1);
+}
+
+static DestinationApproximator *find_destination_approximator(Router *router, ID destination_node) {
+	for (size_t i = dest_home(destination_node); ; i = (i + 1) & (DEST_INDEX_SLOTS - 1)) {
+		uint16_t slot = router->dest_index[i];
+		if (slot == 0) return NULL;
+		if (router->destinations[slot - 1].destination_node == destination_node) {
+			return &router->destinations[slot - 1];
+		}
+	}
+}
+
+static inline IntermediateStepInfo *entry_of(Router *router, uint16_t ref) {
+	return &router->destinations[ref / MAX_ROUTING_ENTRIES].best_routing_info[ref % MAX_ROUTING_ENTRIES];
+}
+
+static inline uint16_t ref_of(Router *router, DestinationApproximator *approximator, int i) {
+	return (uint16_t)((approximator - router->destinations) * MAX_ROUTING_ENTRIES + i);
+}
+
 static DestinationApproximator *create_destination_approximator(Router *router, ID destination_node) {
 	// attempt to find first
-	DestinationApproximator *approx = router->destination_list;
-	while (approx) {
-		if (approx->destination_node == destination_node) break;
-		approx = approx->next;
-	}
+	DestinationApproximator *approx = find_destination_approximator(router, destination_node);
 	if (approx) {
 		return approx;
 	}
+	if (router->approximators == ROUTER_MAX_DESTINATIONS) {
+		printf("ROUTER FULL, NOT TRACKING DESTINATION %hu\n", destination_node);
+		return NULL;
+	}
 
-	DestinationApproximator *new_approx = malloc(sizeof(DestinationApproximator));
+	DestinationApproximator *new_approx = &router->destinations[router->approximators];
 	new_approx->destination_node = destination_node;
 	for (int i = 0; i < MAX_ROUTING_ENTRIES; i++) {
 		new_approx->best_routing_info[i].in_use = false;
 		new_approx->best_routing_info[i].intermediate_node = NO_ID;
 		new_approx->best_routing_info[i].steps = INT_MAX;
 		new_approx->best_routing_info[i].link_active = false;
+		new_approx->best_routing_info[i].cost_advertised = false;
+		new_approx->best_routing_info[i].link_cost = ROUTE_COST_UNIT;
+		new_approx->best_routing_info[i].path_cost = ROUTE_COST_MAX;
+		new_approx->best_routing_info[i].via_prev = NO_REF;
+		new_approx->best_routing_info[i].via_next = NO_REF;
 	}
-	new_approx->next = router->destination_list;
 	new_approx->count = 0;
-	router->destination_list = new_approx;
+	new_approx->changed_seq = 0;
+	new_approx->adv_reachable = false;
+	new_approx->adv_steps = 0;
+	new_approx->adv_cost = ROUTE_COST_MAX;
+	new_approx->adv_via = NO_ID;
+	new_approx->via_head = NO_REF;
+	for (int m = 0; m < METRIC_COUNT; m++) {
+		new_approx->link_cost[m] = ROUTE_COST_UNIT;
+	}
+
+	size_t i = dest_home(destination_node);
+	while (router->dest_index[i]) {
+		i = (i + 1) & (DEST_INDEX_SLOTS - 1);
+	}
 	router->approximators += 1;
+	router->dest_index[i] = (uint16_t) router->approximators;
 	return new_approx;
 }
 
 static DestinationApproximator *get_destination_approximator(Router *router, ID destination_node) {
     if (!router) return NULL;
 
-    DestinationApproximator *approx = router->destination_list;
-    while (approx) {
-        if (approx->destination_node == destination_node) {
-            return approx;
-        }
-        approx = approx->next;
-    }
-
     return create_destination_approximator(router, destination_node);
 }
 
+// hang entry ref on the list of routes through its intermediate node
+static void via_link(Router *router, uint16_t ref) {
+	IntermediateStepInfo *info = entry_of(router, ref);
+	DestinationApproximator *via = get_destination_approximator(router, info->intermediate_node);
+	info->via_prev = NO_REF;
+	info->via_next = NO_REF;
+	info->link_cost = ROUTE_COST_UNIT;
+	if (!via) return;
+
+	info->link_cost = via->link_cost[router->metric];
+	info->via_next = via->via_head;
+	if (via->via_head != NO_REF) entry_of(router, via->via_head)->via_prev = ref;
+	via->via_head = ref;
+}
 
-static bool update_approximation_entry(Router *router, DestinationApproximator *approximator, ID intermediate_node, int steps) {
-    int free_index = -1;
-    int max_steps_index = -1;
-    int max_steps = -1;
+static void via_unlink(Router *router, uint16_t ref) {
+	IntermediateStepInfo *info = entry_of(router, ref);
+	DestinationApproximator *via = find_destination_approximator(router, info->intermediate_node);
+
+	if (info->via_prev != NO_REF) entry_of(router, info->via_prev)->via_next = info->via_next;
+	else if (via && via->via_head == ref) via->via_head = info->via_next;
+	if (info->via_next != NO_REF) entry_of(router, info->via_next)->via_prev = info->via_prev;
+	info->via_prev = NO_REF;
+	info->via_next = NO_REF;
+}
+
+
+static inline uint16_t cost_add(uint32_t a, uint32_t b) {
+	return a + b > ROUTE_COST_MAX ? ROUTE_COST_MAX : (uint16_t)(a + b);
+}
+
+static inline uint16_t route_cost(const IntermediateStepInfo *info) {
+	return cost_add(info->link_cost, info->path_cost);
+}
 
-    // update counter
-    router->discovery_seq++;
-	approximator->last_updated_seq = router->discovery_seq;
+// true when route a should be taken over route b
+static bool route_better(Router *router, const IntermediateStepInfo *a, const IntermediateStepInfo *b) {
+	if (router->metric == METRIC_HOPS) return a->steps < b->steps;
+	uint16_t cost_a = route_cost(a), cost_b = route_cost(b);
+	if (cost_a != cost_b) return cost_a < cost_b;
+	return a->steps < b->steps;
+}
+
+// path_cost is what the route costs past intermediate_node. advertised costs stick until
+// the next advert, a guess from steps only fills in for routes nobody advertised
+static bool update_approximation_entry(Router *router, DestinationApproximator *approximator, ID intermediate_node, int steps, uint16_t path_cost, bool advertised) {
+    if (!approximator) return false;
+
+    int free_index = -1;
+    int worst_index = -1;
 
     for (int i = 0; i < MAX_ROUTING_ENTRIES; i++) {
         IntermediateStepInfo *info = &approximator->best_routing_info[i];
@@ -106,16 +219,21 @@ static bool update_approximation_entry(Router *router, DestinationApproximator *
             	if (intermediate_node == approximator->destination_node) {
             		// this is a exact neighbor
             		info->steps = 1;
+            		info->path_cost = 0;
+            		info->cost_advertised = true;
             	} else {
             		// maybe adjust this later to take min
             		info->steps = steps;
+            		if (advertised || !info->cost_advertised) {
+            			info->path_cost = path_cost;
+            			info->cost_advertised = advertised;
+            		}
             	}
                 return true;
             }
 
-            if (info->steps > max_steps) {
-                max_steps = info->steps;
-                max_steps_index = i;
+            if (worst_index == -1 || route_better(router, &approximator->best_routing_info[worst_index], info)) {
+                worst_index = i;
             }
         } else if (free_index == -1) {
             free_index = i;
@@ -126,25 +244,33 @@ static bool update_approximation_entry(Router *router, DestinationApproximator *
         idx = free_index;
         approximator->count++;
     } else {
-        idx = max_steps_index;
+        idx = worst_index;
+        // the worst route makes room, it no longer goes through its old intermediate
+        via_unlink(router, ref_of(router, approximator, idx));
     }
     IntermediateStepInfo *slot = &approximator->best_routing_info[idx];
     slot->in_use = true;
     slot->intermediate_node = intermediate_node;
     slot->steps = steps;
+    slot->path_cost = path_cost;
+    slot->cost_advertised = advertised;
     slot->link_active = true;
+    via_link(router, ref_of(router, approximator, idx));
     return true;
 }
 
 
-static bool remove_approximation_entry(DestinationApproximator *approximator, ID intermediate_node) {
+static bool remove_approximation_entry(Router *router, DestinationApproximator *approximator, ID intermediate_node) {
     for (int i = 0; i < MAX_ROUTING_ENTRIES; i++) {
         if (approximator->best_routing_info[i].in_use &&
             approximator->best_routing_info[i].intermediate_node == intermediate_node) {
 
+            via_unlink(router, ref_of(router, approximator, i));
             approximator->best_routing_info[i].in_use = false;
             approximator->best_routing_info[i].intermediate_node = NO_ID;
             approximator->best_routing_info[i].steps = INT_MAX;
+            approximator->best_routing_info[i].path_cost = ROUTE_COST_MAX;
+            approximator->best_routing_info[i].cost_advertised = false;
             approximator->best_routing_info[i].link_active = false;
             if (approximator->count > 0) {
                 approximator->count--;
@@ -155,7 +281,7 @@ static bool remove_approximation_entry(DestinationApproximator *approximator, ID
     return false;
 }
 
-static IntermediateStepInfo *choose_approximation_route(DestinationApproximator *approximator) {
+static IntermediateStepInfo *choose_approximation_route(Router *router, DestinationApproximator *approximator) {
     if (!approximator) {
         return NULL;
     }
@@ -166,7 +292,7 @@ static IntermediateStepInfo *choose_approximation_route(DestinationApproximator
         IntermediateStepInfo *info = &approximator->best_routing_info[i];
         if (!info->in_use || !info->link_active) continue;
 
-        if (!best_found || info->steps < best_found->steps) {
+        if (!best_found || route_better(router, info, best_found)) {
             best_found = info;
         }
     }
@@ -174,74 +300,55 @@ static IntermediateStepInfo *choose_approximation_route(DestinationApproximator
     return best_found;
 }
 
-void router_unlink_node(Router *router, ID bad_node) {
-    for (DestinationApproximator *approx = router->destination_list; approx; approx = approx->next) {
-        for (int i = 0; i < MAX_ROUTING_ENTRIES; i++) {
-            IntermediateStepInfo *info = &approx->best_routing_info[i];
-            if (info->in_use && info->intermediate_node == bad_node) {
-                info->link_active = false;
-            }
-        }
-    }
+// whether a change to info alone can move what we advertise for approximator, only those
+// destinations pay for note_change. adv_via is always the best route's next hop, adv_steps
+// its steps and adv_cost less than COST_NEWS off its cost
+static bool route_change_matters(Router *router, const DestinationApproximator *approximator, const IntermediateStepInfo *info) {
+	if (!approximator->adv_reachable) return info->link_active;
+	// it was the best, it may not be any more
+	if (approximator->adv_via == info->intermediate_node) return true;
+	// any other only if it can beat the best now
+	if (!info->link_active) return false;
+	if (router->metric == METRIC_HOPS) return info->steps <= approximator->adv_steps;
+	return route_cost(info) < (uint32_t) approximator->adv_cost + COST_NEWS;
 }
 
-void router_link_node(Router *router, ID node) {
-    for (DestinationApproximator *approx = router->destination_list; approx; approx = approx->next) {
-        for (int i = 0; i < MAX_ROUTING_ENTRIES; i++) {
-            IntermediateStepInfo *info = &approx->best_routing_info[i];
-            if (info->in_use && info->intermediate_node == node) {
-                info->link_active = true;
-            }
-        }
-    }
+// every route through node, however many destinations the router knows
+static void set_link_active(Router *router, ID node, bool active) {
+	DestinationApproximator *via = find_destination_approximator(router, node);
+	if (!via) return;
+	for (uint16_t ref = via->via_head; ref != NO_REF; ref = entry_of(router, ref)->via_next) {
+		IntermediateStepInfo *info = entry_of(router, ref);
+		if (info->link_active == active) continue;
+		info->link_active = active;
+		DestinationApproximator *dest = &router->destinations[ref / MAX_ROUTING_ENTRIES];
+		if (route_change_matters(router, dest, info)) note_change(router, dest);
+	}
 }
 
-void router_parse_rquery(Router *router, ID from_node, char *buffer) {
-    if (!router || !buffer) {
-        return;
-    }
-
-    char *saveptr = NULL;
-    char *token   = strtok_r(buffer, ";", &saveptr);
-    if (!token) {
-        return;
-    }
-
-    int advertised_count = 0;
-    if (sscanf(token, "%d", &advertised_count) != 1) {
-        advertised_count = 0;  // treat as "unknown / unlimited"
-    }
-
-    int parsed = 0;
-
-    // Remaining tokens: "dest:steps"
-    while ((token = strtok_r(NULL, ";", &saveptr)) != NULL) {
-        if (advertised_count > 0 && parsed >= advertised_count) {
-            break;  // processed as many as the sender claimed
-        }
-
-        unsigned int tmp_id = 0;  // for %u
-        int steps = 0;
-
-        // dest is uint32_t (ID), steps is int
-        if (sscanf(token, "%u:%d", &tmp_id, &steps) != 2) {
-            // malformed pair, skip
-            continue;
-        }
+void router_unlink_node(Router *router, ID bad_node) {
+	set_link_active(router, bad_node, false);
+}
 
-        ID dest_id = (ID)tmp_id;
-        router_incorporate_rquery(router, from_node, dest_id, steps);
-        parsed++;
-    }
+void router_link_node(Router *router, ID node) {
+	set_link_active(router, node, true);
 }
 
+// what our best route costs to someone one hop further out. with hop counting that is the
+// steps, so neighbors on another metric still read it as hops
+static uint16_t advertised_cost(Router *router, const IntermediateStepInfo *info) {
+	if (router->metric == METRIC_HOPS) return cost_add((uint32_t) info->steps * ROUTE_COST_UNIT, 0);
+	return route_cost(info);
+}
 
+// a node on the old text rquery, answered with up to count "dest:steps:cost" pairs
 int router_answer_rquery(Router *router, NodeEntry *node_obj, int count, char *buffer, size_t buffer_size) {
-	uint32_t node_last_updated = node_obj->last_rquery;
+	uint16_t node_last_updated = (uint16_t) node_obj->last_rquery;
 
 	typedef struct {
 		ID destination_node;
 		int steps;
+		uint16_t cost;
 	} RqueryResult;
 
 	RqueryResult info_to_return[count];
@@ -250,23 +357,25 @@ int router_answer_rquery(Router *router, NodeEntry *node_obj, int count, char *b
 	int potetial_approx_found = 0;
 	IntermediateStepInfo *best_step = NULL;
 
-	DestinationApproximator *approx = router->destination_list;
-	for (; approx != NULL; approx = approx->next) {
+	DestinationApproximator *approx = NULL;
+	for (int d = 0; d < router->approximators; d++) {
+	    approx = &router->destinations[d];
 	    if (inter_steps_found >= count) break;
 	    if (approx->destination_node == node_obj->address) continue; // skip self
 
-	    if (approx->last_updated_seq > node_last_updated) {
+	    if (route_seq_after(approx->changed_seq, node_last_updated)) {
 	        // NEW info for this requester
-	        IntermediateStepInfo *best_step = choose_approximation_route(approx);
-	        if (!best_step) continue; 
+	        IntermediateStepInfo *best_step = choose_approximation_route(router, approx);
+	        if (!best_step) continue;
 
 	        info_to_return[inter_steps_found++] =
 	            (RqueryResult){
 	                .destination_node = approx->destination_node,
-	                .steps = best_step->steps
+	                .steps = best_step->steps,
+	                .cost = advertised_cost(router, best_step)
 	            };
 	    } else {
-	        if (potetial_approx_found >= count) continue; 
+	        if (potetial_approx_found >= count) continue;
 	        potential_other_approximators[potetial_approx_found++] = approx;
 	    }
 	}
@@ -277,13 +386,14 @@ int router_answer_rquery(Router *router, NodeEntry *node_obj, int count, char *b
 		for (int i = 0; i < potetial_approx_found; i++) {
 			if (inter_steps_found >= count) break; // too many
 			approx = potential_other_approximators[i];
-			best_step = choose_approximation_route(approx);
-			if (!best_step) continue; 
+			best_step = choose_approximation_route(router, approx);
+			if (!best_step) continue;
 			info_to_return[inter_steps_found++] = (RqueryResult){ .destination_node = approx->destination_node,
-																  .steps = best_step->steps};
+																  .steps = best_step->steps,
+																  .cost = advertised_cost(router, best_step)};
 		}
 	}
-	node_obj->last_rquery = router->discovery_seq;
+	node_obj->last_rquery = router->advert_seq;
 
 	if (buffer_size == 0) return 0; // nothing we can do
 
@@ -294,7 +404,7 @@ int router_answer_rquery(Router *router, NodeEntry *node_obj, int count, char *b
     if (n < 0 || (size_t)n >= buffer_size - offset) {
         // truncated or error; ensure null-termination and bail
         buffer[buffer_size - 1] = '\0';
-        node_obj->last_rquery = router->discovery_seq;
+        node_obj->last_rquery = router->advert_seq;
         return 0;
     }
     offset += n;
@@ -306,9 +416,10 @@ int router_answer_rquery(Router *router, NodeEntry *node_obj, int count, char *b
 
         n = snprintf(buffer + offset,
                      buffer_size - offset,
-                     ";%u:%d",
+                     ";%u:%d:%u",
                      (unsigned) info_to_return[i].destination_node,
-                     info_to_return[i].steps);
+                     info_to_return[i].steps,
+                     (unsigned) info_to_return[i].cost);
 
         if (n < 0 || (size_t)n >= buffer_size - offset) {
             // truncated or error; stop appending
@@ -325,23 +436,146 @@ int router_answer_rquery(Router *router, NodeEntry *node_obj, int count, char *b
 
 
 ID router_query_intermediate(Router *router, ID destination_node) {
-	DestinationApproximator *approx = router->destination_list;
-	while (approx) {
-		if (approx->destination_node == destination_node) break;
-		approx = approx->next;
-	}
+	DestinationApproximator *approx = find_destination_approximator(router, destination_node);
 	if (!approx) {
 		printf("NO APPROXIMATOR TABLE FOR DESTINATION NODE %d\n",destination_node);
 		return NO_ID;
 	}
-	IntermediateStepInfo *info = choose_approximation_route(approx);
+	IntermediateStepInfo *info = choose_approximation_route(router, approx);
 	if (!info) return NO_ID;
 	return info->intermediate_node;
 }
 
-static void router_incorporate_rquery(Router *router, ID from_node, ID destination_node, int steps) {
+static void router_incorporate_rquery(Router *router, ID from_node, ID destination_node, int steps, uint16_t cost) {
 	DestinationApproximator *dest_approx = get_destination_approximator(router, destination_node);
-	update_approximation_entry(router, dest_approx, from_node, steps + 1);
+	if (!dest_approx) return;
+	update_approximation_entry(router, dest_approx, from_node, steps + 1, cost, true);
+	note_change(router, dest_approx);
+}
+
+// bumps the destination's seq when what we'd advertise for it moved enough to tell anyone:
+// it became reachable or not, its next hop or steps changed, or its cost moved by COST_NEWS
+static void note_change(Router *router, DestinationApproximator *approximator) {
+	IntermediateStepInfo *best = choose_approximation_route(router, approximator);
+	bool reachable = best != NULL;
+	int steps = best ? best->steps : 0;
+	uint16_t cost = best ? advertised_cost(router, best) : ROUTE_COST_MAX;
+	ID via = best ? best->intermediate_node : NO_ID;
+
+	if (reachable == approximator->adv_reachable && steps == approximator->adv_steps &&
+	    via == approximator->adv_via && abs((int) cost - (int) approximator->adv_cost) < COST_NEWS) {
+		return;
+	}
+	approximator->adv_reachable = reachable;
+	approximator->adv_steps = steps;
+	approximator->adv_cost = cost;
+	approximator->adv_via = via;
+	if (++router->advert_seq == 0) router->advert_seq = 1;
+	approximator->changed_seq = router->advert_seq;
+}
+
+uint16_t router_advert_seq(Router *router) {
+	return router->advert_seq;
+}
+
+static inline void put_u16(uint8_t *p, uint16_t v) {
+	p[0] = (uint8_t)(v >> 8);
+	p[1] = (uint8_t)(v & 0xFF);
+}
+
+static inline uint16_t get_u16(const uint8_t *p) {
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+int router_write_advert(Router *router, uint16_t epoch, uint16_t since_seq, char *out, size_t out_cap, uint16_t *upto_seq) {
+	// a neighbor that claims more than we ever sent has our old epoch's seqs, start over
+	bool full = since_seq == 0 || route_seq_after(since_seq, router->advert_seq);
+	uint16_t base = full ? (uint16_t)(router->advert_seq + 1) : since_seq;
+	uint16_t window = router->advert_seq - base;
+
+	// the destinations that changed soonest after base, in the order they changed
+	DestinationApproximator *picked[ADVERT_MAX_ROUTES];
+	uint16_t picked_delta[ADVERT_MAX_ROUTES];
+	int count = 0;
+	bool more = false;
+	for (int d = 0; d < router->approximators; d++) {
+		DestinationApproximator *approx = &router->destinations[d];
+		uint16_t delta = approx->changed_seq - base - 1;
+		if (approx->changed_seq == 0 || delta >= window) continue;
+		// a neighbor starting from nothing has nothing to withdraw
+		if (full && !approx->adv_reachable) continue;
+
+		int at = count;
+		while (at > 0 && picked_delta[at - 1] > delta) at--;
+		if (at == ADVERT_MAX_ROUTES) {
+			more = true;
+			continue;
+		}
+		if (count == ADVERT_MAX_ROUTES) {
+			more = true;
+			count--;
+		}
+		memmove(&picked[at + 1], &picked[at], (count - at) * sizeof(picked[0]));
+		memmove(&picked_delta[at + 1], &picked_delta[at], (count - at) * sizeof(picked_delta[0]));
+		picked[at] = approx;
+		picked_delta[at] = delta;
+		count++;
+	}
+	*upto_seq = more ? picked[count - 1]->changed_seq : router->advert_seq;
+
+	uint8_t raw[ADVERT_HEADER_LEN + ADVERT_MAX_ROUTES * ADVERT_ROUTE_LEN];
+	put_u16(raw, epoch);
+	put_u16(raw + 2, full ? 0 : since_seq);
+	put_u16(raw + 4, *upto_seq);
+	raw[6] = (uint8_t) count;
+	uint8_t *p = raw + ADVERT_HEADER_LEN;
+	for (int i = 0; i < count; i++, p += ADVERT_ROUTE_LEN) {
+		// as things stand now, which is at least as new as the change that picked it
+		IntermediateStepInfo *best = choose_approximation_route(router, picked[i]);
+		put_u16(p, picked[i]->destination_node);
+		put_u16(p + 2, best ? best->intermediate_node : NO_ID);
+		p[4] = best ? (uint8_t)(best->steps > 255 ? 255 : best->steps) : 0;
+		put_u16(p + 5, best ? advertised_cost(router, best) : ROUTE_COST_MAX);
+	}
+
+	if (out_cap < 4) return 0;
+	memcpy(out, ROUTE_ADVERT_PREFIX, 3);
+	size_t len = frame_text_pack(raw, (size_t)(p - raw), out + 3, out_cap - 3);
+	if (!len) return 0;
+	return (int)(len + 3);
+}
+
+bool router_read_advert(Router *router, ID from_node, const char *content, RouteAdvert *advert) {
+	if (strncmp(content, ROUTE_ADVERT_PREFIX, 3) != 0) return false;
+
+	uint8_t raw[ADVERT_HEADER_LEN + ADVERT_MAX_ROUTES * ADVERT_ROUTE_LEN];
+	size_t len = frame_text_unpack(content + 3, strlen(content + 3), raw, sizeof(raw));
+	if (len < ADVERT_HEADER_LEN || len < ADVERT_HEADER_LEN + (size_t) raw[6] * ADVERT_ROUTE_LEN) {
+		return false;
+	}
+	advert->epoch = get_u16(raw);
+	advert->from_seq = get_u16(raw + 2);
+	advert->upto_seq = get_u16(raw + 4);
+
+	const uint8_t *p = raw + ADVERT_HEADER_LEN;
+	for (int i = 0; i < raw[6]; i++, p += ADVERT_ROUTE_LEN) {
+		ID dest = get_u16(p);
+		ID via = get_u16(p + 2);
+		int steps = p[4];
+		uint16_t cost = get_u16(p + 5);
+		if (dest == router->node_id || dest == from_node) continue;
+
+		if (steps == 0 || cost == ROUTE_COST_MAX || via == router->node_id) {
+			// gone, or it goes through us: from_node is no way to dest (poisoned reverse)
+			DestinationApproximator *approx = find_destination_approximator(router, dest);
+			if (approx && remove_approximation_entry(router, approx, from_node)) {
+				note_change(router, approx);
+			}
+			continue;
+		}
+		router_incorporate_rquery(router, from_node, dest, steps, cost);
+	}
+	return true;
 }
 
 void router_update(Router *router, ID origin_node, ID destination_node, ID from_node, int steps) {
@@ -349,30 +583,100 @@ void router_update(Router *router, ID origin_node, ID destination_node, ID from_
 	DestinationApproximator *origin_approx = get_destination_approximator(router, origin_node);
 
 	// we can get to the from node in one step
-	update_approximation_entry(router, from_approx, from_node, 1);
-	update_approximation_entry(router, origin_approx, from_node, steps);
+	if (update_approximation_entry(router, from_approx, from_node, 1, 0, true)) {
+		note_change(router, from_approx);
+	}
+	// past from_node we only know the steps, guess every one of them is a perfect hop
+	if (update_approximation_entry(router, origin_approx, from_node, steps,
+	                               cost_add(steps > 1 ? (uint32_t)(steps - 1) * ROUTE_COST_UNIT : 0, 0), false)) {
+		note_change(router, origin_approx);
+	}
 }
 
 void router_bad_intermediate(Router *router, ID intermediate_node) {
-	if (router->approximators == 0) return;
-	DestinationApproximator *approx = router->destination_list;
-	while (approx) {
+	DestinationApproximator *via = find_destination_approximator(router, intermediate_node);
+	if (!via) return;
+
+	uint16_t ref = via->via_head;
+	while (ref != NO_REF) {
+		uint16_t next = entry_of(router, ref)->via_next;
+		DestinationApproximator *approx = &router->destinations[ref / MAX_ROUTING_ENTRIES];
+		remove_approximation_entry(router, approx, intermediate_node);
+		note_change(router, approx);
+		ref = next;
+	}
+}
+
+static uint16_t etx_link_cost(float delivery) {
+	// sends it takes to get a frame across and the answer back
+	if (delivery * LINK_COST_CAP <= ROUTE_COST_UNIT) return LINK_COST_CAP;
+	return (uint16_t)(ROUTE_COST_UNIT / delivery + 0.5f);
+}
+
+static uint16_t snr_link_cost(float avg_snr) {
+	if (avg_snr >= SNR_SOLID_DB) return ROUTE_COST_UNIT;
+	float cost = ROUTE_COST_UNIT * (1.0f + (SNR_SOLID_DB - avg_snr) / SNR_DB_PER_HOP);
+	return cost >= LINK_COST_CAP ? LINK_COST_CAP : (uint16_t)(cost + 0.5f);
+}
+
+void router_observe_link(Router *router, ID neighbor, float avg_snr, float delivery, int samples) {
+	DestinationApproximator *via = get_destination_approximator(router, neighbor);
+	if (!via) return;
+
+	uint16_t before = via->link_cost[router->metric];
+	via->link_cost[METRIC_HOPS] = ROUTE_COST_UNIT;
+	via->link_cost[METRIC_SNR] = snr_link_cost(avg_snr);
+	via->link_cost[METRIC_ETX] = samples >= ETX_MIN_SAMPLES ? etx_link_cost(delivery) : via->link_cost[METRIC_SNR];
+
+	uint16_t after = via->link_cost[router->metric];
+	if (after == before) return;
+	// every route through the neighbor sees the new cost straight away
+	for (uint16_t ref = via->via_head; ref != NO_REF; ref = entry_of(router, ref)->via_next) {
+		IntermediateStepInfo *info = entry_of(router, ref);
+		info->link_cost = after;
+		DestinationApproximator *dest = &router->destinations[ref / MAX_ROUTING_ENTRIES];
+		if (route_change_matters(router, dest, info)) note_change(router, dest);
+	}
+}
+
+void router_set_metric(Router *router, RouteMetric metric) {
+	if (!router || metric >= METRIC_COUNT || metric == router->metric) return;
+	router->metric = metric;
+
+	for (int d = 0; d < router->approximators; d++) {
+		DestinationApproximator *approx = &router->destinations[d];
 		for (int i = 0; i < MAX_ROUTING_ENTRIES; i++) {
 			IntermediateStepInfo *info = &approx->best_routing_info[i];
-			if (info->in_use && (info->intermediate_node == intermediate_node)) {
-				remove_approximation_entry(approx, intermediate_node);
-				break;
-			}
+			if (!info->in_use) continue;
+			DestinationApproximator *via = find_destination_approximator(router, info->intermediate_node);
+			info->link_cost = via ? via->link_cost[metric] : ROUTE_COST_UNIT;
 		}
+	}
+	// best routes and what they cost may all have moved
+	for (int d = 0; d < router->approximators; d++) {
+		note_change(router, &router->destinations[d]);
+	}
+}
 
-		approx = approx->next;
+RouteMetric router_get_metric(Router *router) {
+	return router->metric;
+}
+
+const char *route_metric_name(RouteMetric metric) {
+	return metric < METRIC_COUNT ? METRIC_NAMES[metric] : "unknown";
+}
+
+RouteMetric route_metric_from_name(const char *name) {
+	for (int m = 0; m < METRIC_COUNT; m++) {
+		if (strcmp(name, METRIC_NAMES[m]) == 0) return (RouteMetric) m;
 	}
-} 
+	return METRIC_COUNT;
+}
 
 void router_print(Router *router) {
-	printf("Router For Node %hu\n",router->node_id);
-	DestinationApproximator *approx = router->destination_list;
-	while (approx) {
+	printf("Router For Node %hu (metric %s)\n",router->node_id, route_metric_name(router->metric));
+	for (int d = 0; d < router->approximators; d++) {
+		DestinationApproximator *approx = &router->destinations[d];
 		printf("\tTo reach %hu: ",approx->destination_node);
 		for (int i = 0; i < MAX_ROUTING_ENTRIES; i++) {
 			IntermediateStepInfo *info = &approx->best_routing_info[i];
@@ -382,12 +686,9 @@ void router_print(Router *router) {
 				} else {
 					printf("cut");
 				}
-				printf("(use %hu, %d steps away) ",info->intermediate_node, info->steps);
+				printf("(use %hu, %d steps away, cost %u) ",info->intermediate_node, info->steps, (unsigned) route_cost(info));
 			}
 		}
 		printf("\n");
-		approx = approx->next;
 	}
 }
-
-
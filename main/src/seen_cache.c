@@ -0,0 +1,86 @@
+#include "seen_cache.h"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+// keep each generation at most half full so probes stay short
+#define GEN_MAX_KEYS (SEEN_CACHE_SLOTS / 2)
+
+typedef struct {
+    uint32_t keys[SEEN_CACHE_SLOTS];    // (origin << 16) | id, 0 is empty. ids are never 0
+    uint16_t count;
+} SeenGen;
+
+static const char *TAG = "SEEN";
+
+static SeenGen s_gens[2];
+static int s_current;
+static TickType_t s_rotated_at;
+static uint32_t s_suppressed;
+
+void seen_cache_init(void) {
+    memset(s_gens, 0, sizeof(s_gens));
+    s_current = 0;
+    s_rotated_at = xTaskGetTickCount();
+    s_suppressed = 0;
+}
+
+static inline uint32_t slot_of(uint32_t key) {
+    // fibonacci hashing, ids are random but origins are small and close together
+    return (key * 2654435769u) >> (32 - __builtin_ctz(SEEN_CACHE_SLOTS));
+}
+
+static bool gen_contains(const SeenGen *gen, uint32_t key) {
+    for (uint32_t i = slot_of(key); ; i = (i + 1) & (SEEN_CACHE_SLOTS - 1)) {
+        if (gen->keys[i] == key) return true;
+        if (gen->keys[i] == 0) return false;
+    }
+}
+
+static void gen_add(SeenGen *gen, uint32_t key) {
+    uint32_t i = slot_of(key);
+    while (gen->keys[i] != 0) {
+        i = (i + 1) & (SEEN_CACHE_SLOTS - 1);
+    }
+    gen->keys[i] = key;
+    gen->count++;
+}
+
+// the older generation is forgotten and becomes the current one
+static void rotate(void) {
+    s_current ^= 1;
+    memset(&s_gens[s_current], 0, sizeof(SeenGen));
+    s_rotated_at = xTaskGetTickCount();
+}
+
+bool seen_cache_check(ID origin, ID id) {
+    uint32_t key = ((uint32_t) origin << 16) | id;
+
+    TickType_t age = xTaskGetTickCount() - s_rotated_at;
+    if (age >= 2 * pdMS_TO_TICKS(SEEN_WINDOW_MS)) {
+        // quiet for a while, both generations are stale
+        rotate();
+        rotate();
+    } else if (age >= pdMS_TO_TICKS(SEEN_WINDOW_MS)) {
+        rotate();
+    }
+
+    if (gen_contains(&s_gens[s_current], key) || gen_contains(&s_gens[s_current ^ 1], key)) {
+        s_suppressed++;
+        ESP_LOGD(TAG, "(%hu, %hu) heard before, %u suppressed so far", origin, id, (unsigned) s_suppressed);
+        return true;
+    }
+
+    if (s_gens[s_current].count >= GEN_MAX_KEYS) {
+        rotate();
+    }
+    gen_add(&s_gens[s_current], key);
+    return false;
+}
+
+uint32_t seen_cache_suppressed(void) {
+    return s_suppressed;
+}
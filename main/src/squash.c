@@ -0,0 +1,101 @@
+#include "squash.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+// ordered by how much they save on the traffic the mesh carries, the order is part of the
+// wire format
+static const char *const CODEBOOK[SQUASH_CODES] = {
+    "ping", "gbcast", "rquery", "Node ", "hop", "wire=", "sim msg ", "reply ", "msg",
+    "node", "route", "status", "hello", "test", "ok", "ack", "send", "1000", "100", "10",
+    "00", " the ", " and ", "the ", "and ", " of ", " to ", " in ", " is ", " it ", " a ",
+    " for ", " you ", "you", " on ", " be ", " are ", " with ", " have ", " this ",
+    " that ", "that", " we ", " at ", " not ", " can ", " will ", " what ", " here",
+    " there", " where", " when", " just", " now", " all", " get", " see", "ing ", "ing",
+    "tion", "ion", "ent", "ed ", "er ", "es ", "s ", "e ", "t ", "d ", "y ", "n ", "r ",
+    "o ", "f ", "l ", "h ", ", ", ". ", "? ", "! ", ": ", "...", " th", " a", " t", " s",
+    " w", " i", " o", " c", " b", " m", " h", " f", " p", " d", " n", " l", " g", " r",
+    " e", " u", " ", "e", "t", "a", "o", "i", "n", "s", "r", "h", "l", "d", "c", "u", "m",
+    "f", "p", "g", "w", "y", "b", "v", "k", "x", "j", "q", "z", "0", "1", "2", "3", "4",
+    "5", "6", "7", "8", "9", ".", ",", ":", "=", "?", "!", "'", "-", "/", "+", "(", ")",
+    "\n", "A", "I", "N", "T", "S", "th", "he", "in", "er", "an", "re", "on", "at", "en",
+    "nd", "ti", "es", "or", "te", "of", "ed", "is", "it", "al", "ar", "st", "to", "nt",
+    "ng", "se", "ha", "as", "ou", "io", "le", "ve", "co", "me", "de", "hi", "ri", "ro",
+    "ic", "ne", "ea", "ra", "ce", "li", "ch", "ll", "be", "ma", "si", "om", "ur", "ca",
+    "el", "ta", "la", "ns", "di", "fo", "ho", "pe", "ec", "pr", "no", "ct", "us", "ac",
+    "ot", "il", "tr", "ly", "nc", "et", "ut", "ss", "so", "rs", "un", "lo", "wa", "ge",
+    "ie", "wh", "ee", "wi", "em", "ad", "ol", "rt", "po", "we", "na", "ul", "ni", "ts",
+    "mo", "ow", "pa", "im",
+};
+
+// bytes no entry starts with, out as they are
+static size_t flush_verbatim(const uint8_t *run, size_t run_len, uint8_t *out, size_t at, size_t cap) {
+    if (!run_len) return at;
+    if (run_len == 1) {
+        if (at + 2 > cap) return 0;
+        out[at++] = SQUASH_VERBATIM;
+    } else {
+        if (at + 2 + run_len > cap) return 0;
+        out[at++] = SQUASH_RUN;
+        out[at++] = (uint8_t) run_len;
+    }
+    memcpy(out + at, run, run_len);
+    return at + run_len;
+}
+
+size_t squash(const uint8_t *in, size_t len, uint8_t *out, size_t cap) {
+    if (cap > len) cap = len;     // no good unless it saves something
+    size_t at = 0;
+    size_t run_start = 0, run_len = 0;
+
+    for (size_t i = 0; i < len; ) {
+        int best = -1;
+        size_t best_len = 0;
+        for (int code = 0; code < SQUASH_CODES; code++) {
+            const char *entry = CODEBOOK[code];
+            if ((uint8_t) entry[0] != in[i]) continue;
+            size_t entry_len = strlen(entry);
+            if (entry_len > best_len && entry_len <= len - i && memcmp(entry, in + i, entry_len) == 0) {
+                best = code;
+                best_len = entry_len;
+            }
+        }
+
+        if (best < 0) {
+            if (!run_len) run_start = i;
+            i++;
+            if (++run_len < 0xFF) continue;
+        }
+        at = flush_verbatim(in + run_start, run_len, out, at, cap);
+        run_len = 0;
+        if (!at && i) return 0;
+        if (best < 0) continue;
+        if (at + 1 > cap) return 0;
+        out[at++] = (uint8_t) best;
+        i += best_len;
+    }
+    at = flush_verbatim(in + run_start, run_len, out, at, cap);
+    return at < len ? at : 0;
+}
+
+size_t unsquash(const uint8_t *in, size_t len, uint8_t *out, size_t cap) {
+    size_t at = 0;
+    for (size_t i = 0; i < len; ) {
+        uint8_t code = in[i++];
+        const uint8_t *from;
+        size_t n;
+        if (code == SQUASH_VERBATIM || code == SQUASH_RUN) {
+            n = code == SQUASH_VERBATIM ? 1 : (i < len ? in[i++] : 0);
+            if (!n || i + n > len) return 0;
+            from = in + i;
+            i += n;
+        } else {
+            from = (const uint8_t *) CODEBOOK[code];
+            n = strlen(CODEBOOK[code]);
+        }
+        if (at + n > cap) return 0;
+        memcpy(out + at, from, n);
+        at += n;
+    }
+    return at;
+}
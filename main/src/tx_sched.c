@@ -0,0 +1,270 @@
+#include "tx_sched.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "airtime.h"
+#include "frame_codec.h"
+
+// nothing fits the airtime budget, look again after at most this long
+#define TX_HOLD_RECHECK_MS (500)
+
+typedef struct {
+    ID msg_id;
+    uint16_t bytes;
+    TickType_t queued_at;
+} TxItem;
+
+typedef struct {
+    TxItem items[TX_QUEUE_DEPTH];
+    uint8_t head;
+    uint8_t count;
+    int32_t deficit;                // bytes it may still send this round
+} TxQueue;
+
+static const char *TAG = "TX SCHED";
+
+static const char *const CLASS_NAMES[TX_CLASS_COUNT] = { "urgent", "normal", "maintenance" };
+static const int32_t CLASS_QUANTUM[TX_CLASS_COUNT] = {
+    0, TX_WEIGHT_NORMAL * TX_QUANTUM_BYTES, TX_WEIGHT_MAINTENANCE * TX_QUANTUM_BYTES,
+};
+static const uint32_t WAIT_BOUNDS_MS[TX_WAIT_BUCKETS - 1] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000 };
+
+static TxQueue s_queues[TX_CLASS_COUNT];
+static TxClassStats s_stats[TX_CLASS_COUNT];
+// the shared class whose turn it is
+static TxClass s_turn = TX_CLASS_NORMAL;
+static SemaphoreHandle_t s_lock;
+static SemaphoreHandle_t s_waiting;     // counts frames queued
+
+void tx_sched_init(void) {
+    memset(s_queues, 0, sizeof(s_queues));
+    memset(s_stats, 0, sizeof(s_stats));
+    s_turn = TX_CLASS_NORMAL;
+    s_lock = xSemaphoreCreateMutex();
+    s_waiting = xSemaphoreCreateCounting(TX_CLASS_COUNT * TX_QUEUE_DEPTH, 0);
+}
+
+TxClass tx_class_of(MessageType type) {
+    switch (type) {
+        case ACK:
+        case CRITICAL:
+        case COMMAND:
+            return TX_CLASS_URGENT;
+        case MAINTENANCE:
+        case PING:
+            return TX_CLASS_MAINTENANCE;
+        default:
+            return TX_CLASS_NORMAL;
+    }
+}
+
+const char *tx_class_name(TxClass tx_class) {
+    return tx_class < TX_CLASS_COUNT ? CLASS_NAMES[tx_class] : "?";
+}
+
+uint32_t tx_wait_bucket_ms(int bucket) {
+    return bucket < TX_WAIT_BUCKETS - 1 ? WAIT_BOUNDS_MS[bucket] : 0;
+}
+
+static int depth_bucket(int depth) {
+    int bucket = 0;
+    while (depth > 0 && bucket < TX_DEPTH_BUCKETS - 1) {
+        depth >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static int wait_bucket(uint32_t wait_ms) {
+    int bucket = 0;
+    while (bucket < TX_WAIT_BUCKETS - 1 && wait_ms >= WAIT_BOUNDS_MS[bucket]) bucket++;
+    return bucket;
+}
+
+bool tx_sched_push(ID msg_id, MessageType type, size_t bytes) {
+    TxClass tx_class = tx_class_of(type);
+    TxQueue *queue = &s_queues[tx_class];
+    TxClassStats *stats = &s_stats[tx_class];
+    // a module command never goes on air, the budget has nothing to hold it back for
+    if (type == COMMAND) bytes = 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (queue->count == TX_QUEUE_DEPTH) {
+        stats->rejected++;
+        xSemaphoreGive(s_lock);
+        ESP_LOGW(TAG, "%s queue full, msg %hu not queued", CLASS_NAMES[tx_class], msg_id);
+        return false;
+    }
+    stats->depth[depth_bucket(queue->count)]++;
+    TxItem *item = &queue->items[(queue->head + queue->count) % TX_QUEUE_DEPTH];
+    item->msg_id = msg_id;
+    item->bytes = (uint16_t)(bytes > TX_QUANTUM_BYTES ? TX_QUANTUM_BYTES : bytes);
+    item->queued_at = xTaskGetTickCount();
+    queue->count++;
+    stats->queued++;
+    if (queue->count > stats->high_water) stats->high_water = queue->count;
+    // counted while still locked so tx_sched_take() never finds a frame it can't uncount
+    xSemaphoreGive(s_waiting);
+    xSemaphoreGive(s_lock);
+    return true;
+}
+
+// on air time of the frame at the head of the class, 0 if it is empty or a command
+static uint32_t head_airtime_ms(TxClass tx_class) {
+    TxQueue *queue = &s_queues[tx_class];
+    if (!queue->count || !queue->items[queue->head].bytes) return 0;
+    return airtime_frame_ms(queue->items[queue->head].bytes + FRAME_HEADER_LEN);
+}
+
+// the class to send from next, TX_CLASS_COUNT when every waiting frame is held back by
+// the airtime budget (hold_ms says for how long). urgent first, then deficit round robin
+// between the two shared ones: the one whose turn it is sends while its head fits what it
+// has left, then the other gets a fresh quantum
+static TxClass pick_class(uint32_t *hold_ms) {
+    bool ready[TX_CLASS_COUNT];
+    *hold_ms = UINT32_MAX;
+    for (int c = 0; c < TX_CLASS_COUNT; c++) {
+        ready[c] = false;
+        if (!s_queues[c].count) continue;
+        uint32_t frame_ms = head_airtime_ms((TxClass) c);
+        uint32_t wait_ms = frame_ms ? airtime_wait_ms((TxClass) c, frame_ms) : 0;
+        ready[c] = wait_ms == 0;
+        if (wait_ms && wait_ms < *hold_ms) *hold_ms = wait_ms;
+    }
+
+    if (ready[TX_CLASS_URGENT]) return TX_CLASS_URGENT;
+    if (!ready[TX_CLASS_NORMAL] && !ready[TX_CLASS_MAINTENANCE]) return TX_CLASS_COUNT;
+    if (!ready[TX_CLASS_NORMAL] || !ready[TX_CLASS_MAINTENANCE]) {
+        // only one of them can go, there is nothing to share
+        return ready[TX_CLASS_NORMAL] ? TX_CLASS_NORMAL : TX_CLASS_MAINTENANCE;
+    }
+
+    for (;;) {
+        TxQueue *queue = &s_queues[s_turn];
+        if (queue->count && queue->items[queue->head].bytes <= queue->deficit) {
+            return s_turn;
+        }
+        s_turn = s_turn == TX_CLASS_NORMAL ? TX_CLASS_MAINTENANCE : TX_CLASS_NORMAL;
+        if (s_queues[s_turn].count) s_queues[s_turn].deficit += CLASS_QUANTUM[s_turn];
+    }
+}
+
+ID tx_sched_pop(TickType_t wait) {
+    if (xSemaphoreTake(s_waiting, wait) != pdTRUE) return NO_ID;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint32_t hold_ms;
+    TxClass tx_class;
+    bool held = false;
+    while ((tx_class = pick_class(&hold_ms)) == TX_CLASS_COUNT) {
+        if (hold_ms == UINT32_MAX) {
+            // tx_sched_take() had them all
+            xSemaphoreGive(s_lock);
+            return NO_ID;
+        }
+        // over budget. something more urgent may come in meanwhile, so look again soon
+        xSemaphoreGive(s_lock);
+        if (!held) airtime_note_held();
+        held = true;
+        vTaskDelay(pdMS_TO_TICKS(hold_ms < TX_HOLD_RECHECK_MS ? hold_ms : TX_HOLD_RECHECK_MS));
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+    }
+    TxQueue *queue = &s_queues[tx_class];
+    TxItem item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % TX_QUEUE_DEPTH;
+    queue->count--;
+    // a class that sent on its own owes nothing once it shares again, and an idle one
+    // saves nothing up
+    queue->deficit = queue->deficit > item.bytes ? queue->deficit - item.bytes : 0;
+    if (!queue->count) queue->deficit = 0;
+
+    TxClassStats *stats = &s_stats[tx_class];
+    stats->sent++;
+    stats->wait[wait_bucket((xTaskGetTickCount() - item.queued_at) * portTICK_PERIOD_MS)]++;
+    xSemaphoreGive(s_lock);
+    return item.msg_id;
+}
+
+int tx_sched_take(bool (*match)(ID msg_id, void *ctx), void *ctx) {
+    int taken = 0;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    TickType_t now = xTaskGetTickCount();
+    for (int c = 0; c < TX_CLASS_COUNT; c++) {
+        TxQueue *queue = &s_queues[c];
+        int kept = 0;
+        for (int i = 0; i < queue->count; i++) {
+            TxItem item = queue->items[(queue->head + i) % TX_QUEUE_DEPTH];
+            if (match(item.msg_id, ctx)) {
+                taken++;
+                s_stats[c].sent++;
+                s_stats[c].wait[wait_bucket((now - item.queued_at) * portTICK_PERIOD_MS)]++;
+                xSemaphoreTake(s_waiting, 0);
+            } else {
+                // close the gap, the rest keep their order
+                queue->items[(queue->head + kept++) % TX_QUEUE_DEPTH] = item;
+            }
+        }
+        queue->count = kept;
+        if (!queue->count) queue->deficit = 0;
+    }
+    xSemaphoreGive(s_lock);
+    return taken;
+}
+
+bool tx_sched_any(bool (*match)(ID msg_id, void *ctx), void *ctx) {
+    bool any = false;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int c = 0; c < TX_CLASS_COUNT && !any; c++) {
+        TxQueue *queue = &s_queues[c];
+        for (int i = 0; i < queue->count && !any; i++) {
+            any = match(queue->items[(queue->head + i) % TX_QUEUE_DEPTH].msg_id, ctx);
+        }
+    }
+    xSemaphoreGive(s_lock);
+    return any;
+}
+
+void tx_sched_stats(TxClassStats out[TX_CLASS_COUNT]) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    memcpy(out, s_stats, sizeof(s_stats));
+    xSemaphoreGive(s_lock);
+}
+
+static int format_buckets(char *out, int buff_size, const uint32_t *buckets, int count) {
+    int n = 0;
+    for (int i = 0; i < count && n < buff_size; i++) {
+        n += snprintf(out + n, buff_size - n, "%s%u", i ? ", " : "", (unsigned) buckets[i]);
+    }
+    return n;
+}
+
+int format_tx_stats_as_json(char *out, int buff_size) {
+    TxClassStats stats[TX_CLASS_COUNT];
+    tx_sched_stats(stats);
+
+    int n = snprintf(out, buff_size, "{\"depth\" : %d, \"wait_ms\" : [", TX_QUEUE_DEPTH);
+    for (int i = 0; i < TX_WAIT_BUCKETS - 1 && n < buff_size; i++) {
+        n += snprintf(out + n, buff_size - n, "%s%u", i ? ", " : "", (unsigned) WAIT_BOUNDS_MS[i]);
+    }
+    if (n < buff_size) n += snprintf(out + n, buff_size - n, "], \"classes\" : [");
+    for (int c = 0; c < TX_CLASS_COUNT && n < buff_size; c++) {
+        n += snprintf(out + n, buff_size - n,
+            "%s{\"class\" : \"%s\", \"queued\" : %u, \"sent\" : %u, \"rejected\" : %u, \"high_water\" : %u, \"depth_hist\" : [",
+            c ? ", " : "", CLASS_NAMES[c], (unsigned) stats[c].queued, (unsigned) stats[c].sent,
+            (unsigned) stats[c].rejected, stats[c].high_water);
+        if (n < buff_size) n += format_buckets(out + n, buff_size - n, stats[c].depth, TX_DEPTH_BUCKETS);
+        if (n < buff_size) n += snprintf(out + n, buff_size - n, "], \"wait_hist\" : [");
+        if (n < buff_size) n += format_buckets(out + n, buff_size - n, stats[c].wait, TX_WAIT_BUCKETS);
+        if (n < buff_size) n += snprintf(out + n, buff_size - n, "]}");
+    }
+    if (n < buff_size) n += snprintf(out + n, buff_size - n, "]}");
+
+    out[buff_size - 1] = '\0';
+    return n;
+}
@@ -14,22 +14,19 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "nvs_flash.h"
+#include "esp_random.h"
 
 
 #include "maintenance.h"
 #include "data_table.h"
 #include "lora_uart.h"
 #include "node_table.h"
-#include "hash_table.h"
-
-int cmp_dataentry_timestamp_asc(const void *a, const void *b) {
-    const DataEntry *da = *(DataEntry * const *)a;
-    const DataEntry *db = *(DataEntry * const *)b;
-
-    if (da->timestamp < db->timestamp) return   1;
-    if (da->timestamp > db->timestamp) return  -1;
-    return 0;
-}
+#include "tx_sched.h"
+#include "airtime.h"
+#include "fragment.h"
+#include "event_bus.h"
+#include "json_writer.h"
+#include "web_assets.h"
 
 static int hexval(char c) {
     if (c >= '0' && c <= '9') return c - '0';
@@ -71,19 +68,69 @@ void url_decode_inplace(char *s) {
 
 
 static const char *TAG = "ap_http_hello";
+// gzipped at build time by web_assets.cmake, with the plain ones for clients that don't take gzip
+extern const uint8_t index_html_gz_start[] asm("_binary_index_html_gz_start");
+extern const uint8_t index_html_gz_end[]   asm("_binary_index_html_gz_end");
 extern const uint8_t index_html_start[] asm("_binary_index_html_start");
 extern const uint8_t index_html_end[]   asm("_binary_index_html_end");
+extern const uint8_t style_css_gz_start[] asm("_binary_style_css_gz_start");
+extern const uint8_t style_css_gz_end[]   asm("_binary_style_css_gz_end");
 extern const uint8_t style_css_start[] asm("_binary_style_css_start");
 extern const uint8_t style_css_end[]   asm("_binary_style_css_end");
 // extern const uint8_t script_js_start[] asm("_binary_script_js_start");
 // extern const uint8_t script_js_end[]   asm("_binary_script_js_end");
 
+typedef struct {
+    const uint8_t *gz_start, *gz_end;
+    const uint8_t *start, *end;
+    const char *type;
+    const char *cache;
+    const char *etag_gz;            // strong, the gzipped and the plain bytes differ
+    const char *etag;
+} WebAsset;
+
+// the page is asked for again every load (304 when it didn't change), the stylesheet's
+// name changes with its content so it is kept for good
+static const WebAsset INDEX_ASSET = {
+    index_html_gz_start, index_html_gz_end, index_html_start, index_html_end,
+    "text/html", "no-cache", "\"" WEB_INDEX_HASH "-gz\"", "\"" WEB_INDEX_HASH "\"",
+};
+static const WebAsset CSS_ASSET = {
+    style_css_gz_start, style_css_gz_end, style_css_start, style_css_end,
+    "text/css", "public, max-age=31536000, immutable", "\"" WEB_CSS_HASH "-gz\"", "\"" WEB_CSS_HASH "\"",
+};
+
+static bool accepts_gzip(httpd_req_t *req) {
+    char enc[128];
+    // a long list cut short still has gzip near the front where browsers put it
+    esp_err_t err = httpd_req_get_hdr_value_str(req, "Accept-Encoding", enc, sizeof enc);
+    return (err == ESP_OK || err == ESP_ERR_HTTPD_RESULT_TRUNC) && strstr(enc, "gzip");
+}
+
+static esp_err_t send_asset(httpd_req_t *req, const WebAsset *asset) {
+    bool gz = accepts_gzip(req);
+    const char *etag = gz ? asset->etag_gz : asset->etag;
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    httpd_resp_set_hdr(req, "Cache-Control", asset->cache);
+    httpd_resp_set_hdr(req, "ETag", etag);
+
+    char have[96];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", have, sizeof have) == ESP_OK && strstr(have, etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    httpd_resp_set_type(req, asset->type);
+    if (gz) {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        return httpd_resp_send(req, (const char *) asset->gz_start, asset->gz_end - asset->gz_start);
+    }
+    return httpd_resp_send(req, (const char *) asset->start, asset->end - asset->start);
+}
+
 static esp_err_t css_get_handler(httpd_req_t *req)
 {
-    size_t len = style_css_end - style_css_start;
-    httpd_resp_set_type(req, "text/css");
-    httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=31536000, immutable");
-    return httpd_resp_send(req, (const char *)style_css_start, len);
+    return send_asset(req, &CSS_ASSET);
 }
 
 // static esp_err_t js_get_handler(httpd_req_t *req)
@@ -98,86 +145,309 @@ static esp_err_t css_get_handler(httpd_req_t *req)
 // GET /
 static esp_err_t root_get_handler(httpd_req_t *req)
 {
-    httpd_resp_set_type(req, "text/html");
-    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
-    size_t len = (size_t)(index_html_end - index_html_start);
-    return httpd_resp_send(req, (const char*)index_html_start, len);
+    return send_asset(req, &INDEX_ASSET);
 }
 
-static esp_err_t api_get_msgs(httpd_req_t *req) {
-    // since_id -> only grab messages before id
-    //
-    // address -> only returns messages between (this and address) ignore relay
-    // modes (conversational, all, relay, broadcasts)
-    // printf("GET /api/messages\n");
-    uint64_t since_id = 0;
-    bool have_since_id = false;
-
-    int qlen = httpd_req_get_url_query_len(req);
-    if (qlen > 0) {
-        char *q = malloc(qlen + 1);
-        if (!q) {
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "OOM");
-            return ESP_FAIL;
-        }
-        if (httpd_req_get_url_query_str(req, q, qlen + 1) == ESP_OK) {
-            char v[32];
-            if (httpd_query_key_value(q, "since_id", v, sizeof v) == ESP_OK) {
-                char *end = NULL;
-                unsigned long long tmp = strtoull(v, &end, 10);
-                if (end && *end == '\0') {
-                    since_id = (uint64_t)tmp;
-                    have_since_id = true;
-                }
-            }
-        }
-        free(q);
-    }
+static bool send_chunk(void *ctx, const char *data, size_t len) {
+    return httpd_resp_send_chunk((httpd_req_t *) ctx, data, len) == ESP_OK;
+}
 
+// every JSON response goes out through a writer, in chunks about a TCP segment long. one
+// with an etag the page may keep and ask again for with If-None-Match
+static bool json_response_begin(httpd_req_t *req, JsonWriter *w, const char *etag) {
+    char *chunk = malloc(JSON_CHUNK_BYTES);
+    if (!chunk) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "OOM");
+        return false;
+    }
     httpd_resp_set_type(req, "application/json; charset=utf-8");
-    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
-    httpd_resp_sendstr_chunk(req, "[");
+    if (etag) {
+        httpd_resp_set_hdr(req, "ETag", etag);
+        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    } else {
+        httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    }
+    json_writer_init(w, chunk, JSON_CHUNK_BYTES, send_chunk, req);
+    return true;
+}
+
+static esp_err_t json_response_end(httpd_req_t *req, JsonWriter *w) {
+    bool sent = json_writer_finish(w);
+    free(w->buf);
+    if (!sent) return ESP_FAIL;
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// tables count their changes from 0 every boot, this tells the boots apart
+static uint32_t s_boot_tag;
 
-    DataEntry *entry;
-    void **messages = sort_hash_to_array(g_msg_table, cmp_dataentry_timestamp_asc);
-    if (messages) {
-        char buffer[1024];
-        bool first = true;
-        for (int i = 0; i < g_msg_table->entries; i++) {
-            entry = (DataEntry *) messages[i];
+// weak: last_connection of a node counts up without the node changing. the query is part
+// of it because what a query lists changes with more than the version, since_id being
+// dropped makes it list everything
+static void make_etag(char *out, size_t len, char table, uint32_t version, uint32_t query) {
+    snprintf(out, len, "W/\"%c%08x-%x-%x\"", table, (unsigned) s_boot_tag, (unsigned) version, (unsigned) query);
+}
 
-            if (have_since_id && entry->id == since_id) break;
+// FNV-1a of the query string, for the etag
+static uint32_t query_hash(const char *q) {
+    uint32_t h = 2166136261u;
+    while (*q) {
+        h ^= (uint8_t) *q++;
+        h *= 16777619u;
+    }
+    return h;
+}
 
-            if (!first) httpd_resp_sendstr_chunk(req, ",");
-            first = false;
+// answers 304 when the page has this version already, before anything is formatted
+static bool not_modified(httpd_req_t *req, const char *etag) {
+    char have[96];
+    // the tag without W/, a browser may send a list of them
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", have, sizeof have) != ESP_OK ||
+        !strstr(have, etag + 2)) {
+        return false;
+    }
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_send(req, NULL, 0);
+    return true;
+}
 
-            format_data_as_json(entry, buffer, sizeof buffer);
-            httpd_resp_sendstr_chunk(req, buffer);
+// true with the value in out. a key that is there but not a number up to max sets bad
+static bool query_number(const char *q, const char *key, unsigned long max, unsigned long *out, bool *bad) {
+    char v[16];
+    if (httpd_query_key_value(q, key, v, sizeof v) != ESP_OK) return false;
+    char *end = NULL;
+    unsigned long tmp = strtoul(v, &end, 10);
+    if (!v[0] || !end || *end != '\0' || tmp > max) {
+        *bad = true;
+        return false;
+    }
+    *out = tmp;
+    return true;
+}
+
+static esp_err_t api_get_msgs(httpd_req_t *req) {
+    // since_id -> only messages newer than it, all of them if it is gone
+    // before -> only messages older than it, for the next page. 404 when it is gone
+    // limit -> at most that many, newest first
+    // peer -> only messages between this node and peer, relayed ones and broadcasts left out
+    // type -> only that MessageType
+    // stage -> only that MessageRouteStage
+    // printf("GET /api/messages\n");
+    MsgQuery query = { .peer = NO_ID, .type = 0, .stage = -1, .since = NO_ID };
+    ID before = NO_ID;
+    unsigned long limit = UINT16_MAX;
+    uint32_t variant = 0;
+
+    char q[128];
+    if (httpd_req_get_url_query_str(req, q, sizeof q) == ESP_OK) {
+        unsigned long v;
+        bool bad = false;
+        if (query_number(q, "since_id", UINT16_MAX, &v, &bad)) query.since = (ID) v;
+        if (query_number(q, "before", UINT16_MAX, &v, &bad)) before = (ID) v;
+        if (query_number(q, "limit", UINT16_MAX, &v, &bad)) limit = v;
+        if (query_number(q, "peer", UINT16_MAX, &v, &bad)) query.peer = (ID) v;
+        if (query_number(q, "type", MSG_TYPE_COUNT - 1, &v, &bad)) query.type = (int) v;
+        if (query_number(q, "stage", MSG_AT_DESTINATION, &v, &bad)) query.stage = (int) v;
+        if (bad || limit == 0) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad query parameter");
         }
-        free(messages);
+        variant = query_hash(q);
     }
-    httpd_resp_sendstr_chunk(req, "]");
-    return httpd_resp_send_chunk(req, NULL, 0);
+
+    // read before the walk, anything that changes during it makes the next request a 200
+    char etag[48];
+    make_etag(etag, sizeof etag, 'm', msg_table_version(), variant);
+    if (not_modified(req, etag)) return ESP_OK;
+
+    // newest first, each one is copied out under the table lock and written without it.
+    // a reassembled message is too big for the stack
+    char *content = malloc(MSG_COPY_MAX);
+    if (!content) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "OOM");
+    }
+    DataEntry entry;
+    if (before != NO_ID && !msg_copy(before, &entry, content, MSG_COPY_MAX)) {
+        // dropped since the last page was fetched, the page starts over from the newest
+        free(content);
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "before is gone");
+    }
+    JsonWriter w;
+    if (!json_response_begin(req, &w, etag)) {
+        free(content);
+        return ESP_FAIL;
+    }
+    json_array_begin(&w);
+    ID id = before;
+    for (unsigned long n = 0; n < limit && !w.failed; n++) {
+        id = msg_query_next(&query, id, &entry, content, MSG_COPY_MAX);
+        if (id == NO_ID) break;
+        write_data_json(&w, &entry);
+    }
+    json_array_end(&w);
+    free(content);
+    return json_response_end(req, &w);
 }
 
 static esp_err_t api_get_nodes(httpd_req_t *req) {
     // printf("GET /api/nodes\n");
-    httpd_resp_set_type(req, "application/json; charset=utf-8");
-    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
-    httpd_resp_sendstr_chunk(req, "[");
+    char etag[48];
+    make_etag(etag, sizeof etag, 'n', node_table_version(), 0);
+    if (not_modified(req, etag)) return ESP_OK;
+
+    JsonWriter w;
+    if (!json_response_begin(req, &w, etag)) return ESP_FAIL;
+
+    json_array_begin(&w);
+    int count = node_table_count();
+    for (int i = 0; i < count; i++) {
+        write_node_json(&w, node_table_at(i));
+    }
+    json_array_end(&w);
+    return json_response_end(req, &w);
+}
 
-    NodeEntry *walk = g_node_table;
+static esp_err_t api_get_stats(httpd_req_t *req) {
+    JsonWriter w;
+    if (!json_response_begin(req, &w, NULL)) return ESP_FAIL;
+
+    char buffer[1024];
+    format_msg_stats_as_json(buffer, sizeof buffer);
+    json_value_raw(&w, buffer, strlen(buffer));
+    return json_response_end(req, &w);
+}
+
+static esp_err_t api_get_tx(httpd_req_t *req) {
+    JsonWriter w;
+    if (!json_response_begin(req, &w, NULL)) return ESP_FAIL;
+
+    // {"queues" : {...}, "airtime" : {...}, "fragments" : {...}}
     char buffer[1024];
-    bool first = true;
-    for (; walk; walk = walk->next) {
-        if (!first) httpd_resp_sendstr_chunk(req, ",");
-        first = false;
+    json_object_begin(&w);
+    json_key(&w, "queues");
+    format_tx_stats_as_json(buffer, sizeof buffer);
+    json_value_raw(&w, buffer, strlen(buffer));
+    json_key(&w, "airtime");
+    format_airtime_as_json(buffer, sizeof buffer);
+    json_value_raw(&w, buffer, strlen(buffer));
+    json_key(&w, "fragments");
+    format_frag_stats_as_json(buffer, sizeof buffer);
+    json_value_raw(&w, buffer, strlen(buffer));
+    json_object_end(&w);
+    return json_response_end(req, &w);
+}
 
-        format_node_as_json(walk, buffer, sizeof buffer);
-        httpd_resp_sendstr_chunk(req, buffer);
+// longest a stream stays quiet, the comment sent then finds a page that went away
+#define EVENT_KEEPALIVE_MS (15000)
+
+static httpd_req_t *s_event_reqs[EVENT_CLIENTS_MAX];
+
+// an event the same message or node comes up in again later in the batch is sent then
+static bool superseded(const BusEvent *batch, int count, int i) {
+    bool node = batch[i].kind == EVENT_NODE;
+    for (int j = i + 1; j < count; j++) {
+        if (batch[j].key == batch[i].key && (batch[j].kind == EVENT_NODE) == node &&
+            batch[j].kind != EVENT_RESET) return true;
     }
-    httpd_resp_sendstr_chunk(req, "]");
-    return httpd_resp_send_chunk(req, NULL, 0);
+    return false;
+}
+
+// "id: <seq>\nevent: message|node|reset\ndata: <json>\n\n", nothing for a message or
+// node that is gone
+static void write_event(JsonWriter *w, const BusEvent *event, DataEntry *entry, char *content) {
+    NodeEntry *node = NULL;
+    if (event->kind == EVENT_NODE) {
+        if (!(node = get_node_ptr(event->key))) return;
+    } else if (event->kind != EVENT_RESET) {
+        if (!msg_copy(event->key, entry, content, MSG_COPY_MAX)) return;
+    }
+
+    const char *name = node ? "node" : event->kind == EVENT_RESET ? "reset" : "message";
+    char head[48];
+    int n = snprintf(head, sizeof head, "id: %u\nevent: %s\ndata: ", (unsigned) event->seq, name);
+    json_write_raw(w, head, n);
+    if (node) {
+        write_node_json(w, node);
+    } else if (event->kind == EVENT_RESET) {
+        json_object_begin(w);
+        json_object_end(w);
+    } else {
+        write_data_json(w, entry);
+    }
+    json_write_raw(w, "\n\n", 2);
+}
+
+// runs one stream until the page goes away, the server goes on with other requests
+static void event_stream_task(void *arg) {
+    int client = (int)(intptr_t) arg;
+    httpd_req_t *req = s_event_reqs[client];
+    char *chunk = malloc(JSON_CHUNK_BYTES);
+    char *content = malloc(MSG_COPY_MAX);
+    BusEvent batch[EVENT_CLIENT_QUEUE];
+    DataEntry entry;
+    JsonWriter w;
+
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    // how long the page waits before it comes back after losing the stream
+    bool open = chunk && content && httpd_resp_sendstr_chunk(req, "retry: 3000\n\n") == ESP_OK;
+    while (open) {
+        if (!event_next(client, &batch[0], EVENT_KEEPALIVE_MS)) {
+            open = httpd_resp_sendstr_chunk(req, ": keepalive\n\n") == ESP_OK;
+            continue;
+        }
+        // whatever else is waiting, so a node heard ten times goes out once, and all of it
+        // in as few chunks as it takes
+        int count = 1;
+        while (count < EVENT_CLIENT_QUEUE && event_next(client, &batch[count], 0)) count++;
+        json_writer_init(&w, chunk, JSON_CHUNK_BYTES, send_chunk, req);
+        for (int i = 0; i < count; i++) {
+            if (!superseded(batch, count, i)) write_event(&w, &batch[i], &entry, content);
+        }
+        open = json_writer_finish(&w);
+    }
+    ESP_LOGI(TAG, "Event stream %d closed", client);
+
+    free(chunk);
+    free(content);
+    event_unsubscribe(client);
+    httpd_req_async_handler_complete(req);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t api_get_events(httpd_req_t *req) {
+    // the browser sends Last-Event-ID when it reconnects by itself, the page passes
+    // last_id when it opens a new stream after being hidden
+    uint32_t last_seq = 0;
+    char v[16];
+    char q[64];
+    if (httpd_req_get_hdr_value_str(req, "Last-Event-ID", v, sizeof v) == ESP_OK ||
+        (httpd_req_get_url_query_str(req, q, sizeof q) == ESP_OK &&
+         httpd_query_key_value(q, "last_id", v, sizeof v) == ESP_OK)) {
+        last_seq = strtoul(v, NULL, 10);
+    }
+
+    int client = event_subscribe(last_seq);
+    if (client < 0) {
+        // the page goes back to polling
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "30");
+        return httpd_resp_sendstr(req, "Too many event streams");
+    }
+
+    httpd_req_t *stream = NULL;
+    if (httpd_req_async_handler_begin(req, &stream) != ESP_OK) {
+        event_unsubscribe(client);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Cannot stream");
+    }
+    s_event_reqs[client] = stream;
+    if (xTaskCreate(event_stream_task, "events", 4096, (void *)(intptr_t) client, 4, NULL) != pdPASS) {
+        event_unsubscribe(client);
+        httpd_req_async_handler_complete(stream);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
 }
 
 static esp_err_t send_post_handler(httpd_req_t *req)
@@ -212,18 +482,22 @@ static esp_err_t send_post_handler(httpd_req_t *req)
     buf[read] = '\0';
     printf("buffer: %s\n",buf);
 
-    char message[250];
-    int target;
-    sscanf(buf, "target=%d&message=%249s", &target, message);
-    message[249] = '\0';
+    // the message runs to the next field, anything longer than a frame goes in fragments
+    int target = 0;
+    int start = 0;
+    sscanf(buf, "target=%d&message=%n", &target, &start);
+    char *message = buf + start;
+    if (!start) message[0] = '\0';
+    message[strcspn(message, "& \t\r\n")] = '\0';
     // add back in spaces to messages
     for (int i = 0; message[i]; i++) {
         if (message[i] == '+') message[i] = ' ';
     }
-    free(buf);
+    size_t message_len = strlen(message);
 
     ID entry_id = NO_ID;
     bool should_use_router = true;
+    bool queued = true;
 
     if (strncmp(message, "AT",2) == 0) {
         // this is a lora command
@@ -236,6 +510,16 @@ static esp_err_t send_post_handler(httpd_req_t *req)
         url_decode_inplace(message);
         // do somthing with the command
         resolve_system_command(message);
+    } else if (message_len > FRAG_CHUNK_MAX) {
+        if (target == 0 || message_len > FRAG_MAX_BYTES) {
+            ESP_LOGW(TAG, "POST /send message of %u bytes to %d is too long", (unsigned) message_len, target);
+            free(buf);
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                target == 0 ? "Broadcasts have to fit one frame" : "Message too long");
+            return ESP_FAIL;
+        }
+        // queues its own fragments
+        queued = frag_send((ID) target, message, message_len) != NO_ID;
     }
     else {
         entry_id = create_data_object(
@@ -249,11 +533,21 @@ static esp_err_t send_post_handler(httpd_req_t *req)
         );
     }
 
-    if (entry_id != NO_ID) {
-        queue_send(entry_id, target, should_use_router);
+    if (entry_id != NO_ID && !queue_send(entry_id, target, should_use_router)) {
+        queued = false;
+    }
+    if (!queued) {
+        // no route, or the radio is that far behind. let the sender know and try later
+        ESP_LOGW(TAG, "POST /send message: \"%s\" not queued", message);
+        free(buf);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        httpd_resp_sendstr(req, "Message not queued, no route or send queue full");
+        return ESP_OK;
     }
 
     ESP_LOGI(TAG, "POST /send message: \"%s\"", message);
+    free(buf);
 
     httpd_resp_set_status(req, "303 See Other");
     httpd_resp_set_hdr(req, "Location", "/");
@@ -265,15 +559,16 @@ static httpd_handle_t start_http_server(void)
 {
     httpd_config_t cfg = HTTPD_DEFAULT_CONFIG();
     httpd_handle_t server = NULL;
+    s_boot_tag = esp_random();
 
     if (httpd_start(&server, &cfg) == ESP_OK) {
         // GET /
         static const httpd_uri_t root = {
             .uri = "/", .method = HTTP_GET, .handler = root_get_handler, .user_ctx = NULL,
         };
-        // GET css
+        // GET css, under a name with its hash in it
         static const httpd_uri_t css = {
-            .uri = "/style.css", .method = HTTP_GET, .handler = css_get_handler
+            .uri = WEB_CSS_PATH, .method = HTTP_GET, .handler = css_get_handler
         };
         // GET js
         // static const httpd_uri_t js = {
@@ -287,6 +582,18 @@ static httpd_handle_t start_http_server(void)
         const httpd_uri_t uri_api_nodes = {
             .uri="/api/nodes", .method=HTTP_GET, .handler=api_get_nodes
         };
+        // GET /api/stats
+        const httpd_uri_t uri_api_stats = {
+            .uri="/api/stats", .method=HTTP_GET, .handler=api_get_stats
+        };
+        // GET /api/tx
+        const httpd_uri_t uri_api_tx = {
+            .uri="/api/tx", .method=HTTP_GET, .handler=api_get_tx
+        };
+        // GET /api/events, server-sent events
+        const httpd_uri_t uri_api_events = {
+            .uri="/api/events", .method=HTTP_GET, .handler=api_get_events
+        };
         // POST /send
         static const httpd_uri_t uri_send = {
             .uri      = "/send", .method   = HTTP_POST, .handler  = send_post_handler,
@@ -298,6 +605,9 @@ static httpd_handle_t start_http_server(void)
         httpd_register_uri_handler(server, &uri_send);
         httpd_register_uri_handler(server, &uri_api_msgs);
         httpd_register_uri_handler(server, &uri_api_nodes);
+        httpd_register_uri_handler(server, &uri_api_stats);
+        httpd_register_uri_handler(server, &uri_api_tx);
+        httpd_register_uri_handler(server, &uri_api_events);
         ESP_LOGI(TAG, "HTTP server started on port %d", cfg.server_port);
     } else {
         ESP_LOGE(TAG, "Failed to start HTTP server");
@@ -0,0 +1,61 @@
+# the web page as it goes into the firmware. the stylesheet is renamed after a hash of its
+# content and index.html rewritten to point at it, so a browser can keep it for good and
+# still gets the new one after a flash. both go in gzipped and as they are, for clients
+# that don't take gzip. web_assets.h has the stylesheet's path and the ETags for
+# web_server.c. everything is redone at configure time when a template changes.
+#
+# sets WEB_ASSETS_DIR and WEB_ASSET_FILES
+
+if(CMAKE_BUILD_EARLY_EXPANSION)
+    return()
+endif()
+
+set(WEB_TEMPLATES ${CMAKE_CURRENT_LIST_DIR}/templates)
+set(WEB_ASSETS_DIR ${CMAKE_CURRENT_BINARY_DIR}/web_assets)
+set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS
+    ${WEB_TEMPLATES}/index.html ${WEB_TEMPLATES}/style.css ${CMAKE_CURRENT_LIST_FILE})
+
+# written to a scratch file first, configure_file only touches the real one when it changed
+# so nothing is embedded and linked again for nothing
+function(web_asset_write name content)
+    file(WRITE ${WEB_ASSETS_DIR}/scratch/${name} "${content}")
+    configure_file(${WEB_ASSETS_DIR}/scratch/${name} ${WEB_ASSETS_DIR}/${name} COPYONLY)
+endfunction()
+
+function(web_asset_gzip name)
+    if(${WEB_ASSETS_DIR}/${name} IS_NEWER_THAN ${WEB_ASSETS_DIR}/${name}.gz)
+        file(ARCHIVE_CREATE OUTPUT ${WEB_ASSETS_DIR}/${name}.gz PATHS ${WEB_ASSETS_DIR}/${name}
+            FORMAT raw COMPRESSION GZip COMPRESSION_LEVEL 9)
+    endif()
+endfunction()
+
+file(SHA256 ${WEB_TEMPLATES}/style.css css_hash)
+string(SUBSTRING ${css_hash} 0 16 css_hash)
+configure_file(${WEB_TEMPLATES}/style.css ${WEB_ASSETS_DIR}/style.css COPYONLY)
+
+file(READ ${WEB_TEMPLATES}/index.html index_html)
+string(REPLACE "href=\"/style.css\"" "href=\"/style.${css_hash}.css\"" index_html "${index_html}")
+web_asset_write(index.html "${index_html}")
+string(SHA256 index_hash "${index_html}")
+string(SUBSTRING ${index_hash} 0 16 index_hash)
+
+web_asset_gzip(index.html)
+web_asset_gzip(style.css)
+
+web_asset_write(web_assets.h "\
+// generated by main/web_assets.cmake, don't edit\n\
+#ifndef WEB_ASSETS_H\n\
+#define WEB_ASSETS_H\n\
+\n\
+#define WEB_CSS_PATH    \"/style.${css_hash}.css\"\n\
+#define WEB_CSS_HASH    \"${css_hash}\"\n\
+#define WEB_INDEX_HASH  \"${index_hash}\"\n\
+\n\
+#endif // WEB_ASSETS_H\n")
+
+set(WEB_ASSET_FILES
+    ${WEB_ASSETS_DIR}/index.html.gz
+    ${WEB_ASSETS_DIR}/index.html
+    ${WEB_ASSETS_DIR}/style.css.gz
+    ${WEB_ASSETS_DIR}/style.css
+)
@@ -0,0 +1,17 @@
+#pragma once
+
+typedef int esp_err_t;
+
+#define ESP_OK          (0)
+#define ESP_FAIL        (-1)
+#define ESP_ERR_NO_MEM  (0x101)
+#define ESP_ERR_TIMEOUT (0x107)
+
+void sim_fatal(const char *file, int line, const char *expr, esp_err_t err) __attribute__((noreturn));
+
+#define ESP_ERROR_CHECK(x) do {                                 \
+        esp_err_t err_rc_ = (x);                                \
+        if (err_rc_ != ESP_OK) {                                \
+            sim_fatal(__FILE__, __LINE__, #x, err_rc_);         \
+        }                                                       \
+    } while (0)
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// deterministic per simulation seed
+uint32_t esp_random(void);
@@ -0,0 +1,30 @@
+#pragma once
+
+// host stand-in for the parts of FreeRTOS the firmware uses. tasks are cooperative
+// coroutines on a virtual millisecond clock, see sim/src/rtos.c
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+// the idf headers drag these in for everything that includes FreeRTOS.h
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define configTICK_RATE_HZ   (1000)
+#define portTICK_PERIOD_MS   ((TickType_t) 1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY        ((TickType_t) 0xFFFFFFFF)
+#define pdMS_TO_TICKS(ms)    ((TickType_t) (((uint64_t) (ms) * configTICK_RATE_HZ) / 1000))
+#define pdTICKS_TO_MS(t)     ((uint32_t) (((uint64_t) (t) * 1000) / configTICK_RATE_HZ))
+
+#define pdFALSE              (0)
+#define pdTRUE               (1)
+#define pdFAIL               (pdFALSE)
+#define pdPASS               (pdTRUE)
+#define errQUEUE_FULL        (0)
+#define errQUEUE_EMPTY       (0)
+
+#define tskIDLE_PRIORITY     (0)
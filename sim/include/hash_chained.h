@@ -0,0 +1,26 @@
+#ifndef HASH_CHAINED_H
+#define HASH_CHAINED_H
+
+#include <stddef.h>
+
+// see src/hash_chained.c
+
+typedef struct chained_entry_struct ChainedEntry;
+
+typedef struct chained_table_struct {
+        size_t size;
+        int entries;
+        ChainedEntry **table;
+        ChainedEntry *pool;
+        ChainedEntry *free_list;
+} ChainedTable;
+
+ChainedTable *chained_create(size_t size);
+ChainedTable *chained_create_pooled(size_t size, size_t capacity);
+void chained_delete(ChainedTable **ptr);
+int chained_insert(ChainedTable *table, int key, void *value);
+void *chained_find(ChainedTable *table, int key);
+void *chained_remove(ChainedTable *table, int key);
+void **chained_sort_to_array(ChainedTable *table, int (*cmp)(const void *, const void *));
+
+#endif // HASH_CHAINED_H
@@ -0,0 +1,23 @@
+#ifndef ROUTING_LIST_H
+#define ROUTING_LIST_H
+
+#include <stddef.h>
+
+#include "node_globals.h"
+#include "routing.h"
+
+// see src/routing_list.c
+
+typedef struct list_router_struct ListRouter;
+
+ListRouter *list_create_router(ID for_node);
+ID list_router_query_intermediate(ListRouter *router, ID destination_node);
+void list_router_update(ListRouter *router, ID origin_node, ID destination_node, ID from_node, int steps);
+void list_router_bad_intermediate(ListRouter *router, ID intermediate_node);
+void list_router_link_node(ListRouter *router, ID node);
+void list_router_unlink_node(ListRouter *router, ID bad_node);
+int list_router_answer_rquery(ListRouter *router, NodeEntry *node_obj, int count, char *buffer, size_t buffer_size);
+void list_router_parse_rquery(ListRouter *router, ID from_node, char *buffer);
+void list_router_print(ListRouter *router);
+
+#endif // ROUTING_LIST_H
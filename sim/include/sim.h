@@ -0,0 +1,159 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "data_table.h"
+#include "hop_ack.h"
+#include "tx_sched.h"
+#include "airtime.h"
+#include "fragment.h"
+#include "lora_uart.h"
+#include "maintenance.h"
+#include "routing.h"
+
+// firmware entry point (main/main.c)
+void app_main(void);
+
+typedef struct sim_task SimTask;
+typedef struct sim_node SimNode;
+
+// tasks blocked on something (queue, uart rx, semaphore) park on one of these
+typedef struct {
+    SimTask *head;
+    SimTask *tail;
+} SimWaitList;
+
+// ---- scheduler (rtos.c) ----
+
+uint64_t sim_now_ms(void);
+void sim_at(uint64_t when_ms, void (*fn)(void *arg, uint64_t tag), void *arg, uint64_t tag);
+SimTask *sim_task_create(SimNode *node, const char *name, void (*fn)(void *), void *arg);
+SimNode *sim_current_node(void);
+void sim_set_context_node(SimNode *node);
+bool sim_block(SimWaitList *list, TickType_t ticks);
+void sim_wake_all(SimWaitList *list);
+void sim_run_until(uint64_t end_ms);
+uint64_t sim_context_switches(void);
+
+void sim_seed(uint64_t seed);
+uint64_t sim_random(void);
+double sim_random_unit(void);
+
+// ---- logging (log.c) ----
+
+extern int g_sim_verbose;
+
+// ---- RYLR998 module model (rylr.c) ----
+
+typedef struct {
+    ID address;
+    int sf;                 // spreading factor 7..12
+    int bw;                 // AT+PARAMETER bandwidth code, 7 = 125 kHz
+    int cr;                 // coding rate code 1..4 => 4/5..4/8
+    int preamble;
+    int baud;
+
+    char cmd[UART_LINE_LEN * 2];     // bytes from the host not yet terminated by \r\n
+    size_t cmd_len;
+    char *pending[16];               // complete commands waiting for the module
+    int pending_head, pending_count;
+    bool busy;
+    uint64_t to_module_free_ms;      // serial line busy until (host -> module)
+    uint64_t to_host_free_ms;        // serial line busy until (module -> host)
+} SimRylr;
+
+void rylr_init(SimRylr *rylr);
+void rylr_host_write(SimNode *node, const void *data, size_t len);
+void rylr_radio_receive(SimNode *node, ID from, const char *payload, size_t len, int rssi, int snr);
+double rylr_airtime_ms(const SimRylr *rylr, size_t payload_len);
+
+// ---- radio channel (radio.c) ----
+
+typedef struct {
+    int to;
+    float loss;             // chance any one frame on this link is lost
+    int rssi;
+    int snr;
+} SimLink;
+
+typedef struct {
+    uint64_t frames_tx;
+    uint64_t frames_carried;       // packed frames in those, a bundle counts for every one in it
+    uint64_t frames_rx;
+    uint64_t frames_lost;          // dropped by link loss
+    uint64_t frames_collided;      // overlapped another frame or the receiver was transmitting
+    double airtime_ms;
+} SimRadioStats;
+
+typedef struct {
+    const char *topology;   // line, ring, grid, random, or a file of "a b loss [snr]" lines
+    int nodes;
+    double degree;          // target average degree for random
+    double loss;            // base loss on every link
+    double edge_loss;       // extra loss at the edge of range for random
+    bool collisions;
+} SimRadioConfig;
+
+int radio_build(SimNode *nodes, const SimRadioConfig *config);
+uint64_t radio_transmit(SimNode *node, ID dest, const char *payload, size_t len);
+const SimRadioStats *radio_stats(void);
+int radio_components(SimNode *nodes, int count, int *component_out);
+
+// ---- virtual nodes (node.c) ----
+
+struct sim_node {
+    int index;
+    ID address;
+    void *lib;
+
+    // entry points resolved from this node's private copy of the firmware
+    struct {
+        __typeof__(app_main) *app_main;
+        __typeof__(msg_find) *msg_find;
+        __typeof__(create_data_object) *create_data_object;
+        __typeof__(queue_send) *queue_send;
+        __typeof__(router_query_intermediate) *router_query_intermediate;
+        __typeof__(resolve_system_command) *resolve_system_command;
+        __typeof__(hop_ack_stats) *hop_ack_stats;      // NULL for firmware from before hop acks
+        __typeof__(tx_sched_stats) *tx_sched_stats;    // and before the transmit scheduler
+        __typeof__(tx_class_name) *tx_class_name;
+        __typeof__(tx_wait_bucket_ms) *tx_wait_bucket_ms;
+        __typeof__(airtime_stats) *airtime_stats;      // and before the airtime budget
+        __typeof__(frag_send) *frag_send;              // and before fragmentation
+        __typeof__(frag_stats) *frag_stats;
+        Router **g_router;
+    } fw;
+
+    SimRylr rylr;
+
+    // module -> host serial buffer read by uart_read_bytes()
+    uint8_t rx_buf[UART_READ_BUFF];
+    size_t rx_head;
+    size_t rx_len;
+    uint64_t rx_overflow;
+    SimWaitList rx_waiters;
+    QueueHandle_t uart_events;      // NULL unless the firmware asked for driver events
+    FILE *uart_record;              // raw module -> host bytes, for replaying through the splitter
+    bool uart_installed;
+
+    // radio
+    SimLink *links;
+    int link_count;
+    int link_cap;
+    uint64_t tx_until_ms;
+    struct sim_reception *receiving;
+    double airtime_ms;
+};
+
+int sim_nodes_load(SimNode *nodes, int count, const char *library_path);
+void sim_node_boot(SimNode *node);
+void sim_node_uart_rx(SimNode *node, const char *data, size_t len);
+
+#endif // SIM_H
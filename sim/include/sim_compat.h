@@ -0,0 +1,20 @@
+#pragma once
+
+// force included into every firmware source built for the host. covers the
+// few newlib extensions the firmware leans on that glibc may not have
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#if !defined(__GLIBC__) || !__GLIBC_PREREQ(2, 38)
+static inline size_t sim_strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#define strlcpy sim_strlcpy
+#endif
@@ -0,0 +1,15 @@
+#ifndef SIM_RNG_H
+#define SIM_RNG_H
+
+#include <stdint.h>
+
+// xorshift64*, the simulator's and the benches' random numbers. the same seed gives the
+// same stream, so runs can be repeated. state must not be 0
+static inline uint64_t sim_rng_next(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+#endif // SIM_RNG_H
@@ -0,0 +1,220 @@
+// how much the frame codec's content compression saves on recorded traffic, and what it
+// costs. takes uart captures (meshsim --record-uart, or a capture off a real board), pulls
+// the content of every frame heard out of the +RCV lines, bundles included, and runs it
+// through frame_compress() the way the encoder does for a next hop at WIRE_VERSION_COMPRESS.
+// every frame has to come back the same through frame_decompress() before anything is timed.
+//
+//   sim/build/meshsim -n 20 --record-uart traffic.bin && sim/build/compress_bench traffic.bin
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "frame_codec.h"
+
+#define TYPE_SLOTS (16)
+
+typedef struct {
+    char content[LORA_MAX_PAYLOAD + 1];
+    size_t len;
+    uint8_t msg_type;
+} Sample;
+
+typedef struct {
+    Sample *items;
+    size_t count;
+    size_t cap;
+} SampleList;
+
+typedef struct {
+    uint32_t frames;
+    uint32_t squashed;
+    uint32_t packed;
+    uint64_t content_bytes;
+    uint64_t air_bytes;         // content as it goes on air, raw when nothing helps
+} TypeStats;
+
+static const char *const TYPE_NAMES[TYPE_SLOTS] = {
+    "?", "broadcast", "normal", "ack", "critical", "maintenance", "ping", "command", "fragment",
+};
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void add_sample(SampleList *list, const FrameHeader *hdr, const char *content, size_t len) {
+    if (list->count == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 256;
+        list->items = realloc(list->items, list->cap * sizeof(Sample));
+    }
+    Sample *sample = &list->items[list->count++];
+    memcpy(sample->content, content, len);
+    sample->content[len] = '\0';
+    sample->len = len;
+    sample->msg_type = hdr->msg_type < TYPE_SLOTS ? hdr->msg_type : 0;
+}
+
+// every frame in the +RCV lines of one capture
+static int read_capture(const char *path, SampleList *list) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "compress_bench: cannot read %s\n", path);
+        return -1;
+    }
+    size_t cap = 1 << 16, len = 0, n;
+    char *data = malloc(cap);
+    while ((n = fread(data + len, 1, cap - len, f)) > 0) {
+        len += n;
+        if (len == cap) data = realloc(data, cap *= 2);
+    }
+    fclose(f);
+
+    for (char *line = data, *end; line < data + len; line = end + 2) {
+        end = line;
+        while (end + 1 < data + len && !(end[0] == '\r' && end[1] == '\n')) end++;
+        if (end + 1 >= data + len) break;
+
+        RcvLine rcv;
+        FrameHeader hdr;
+        char content[LORA_MAX_PAYLOAD + 1];
+        size_t content_len;
+        uint8_t raw[LORA_MAX_PAYLOAD];
+        size_t raw_len;
+        if (!frame_parse_rcv(line, (size_t)(end - line), &rcv)) continue;
+        if ((raw_len = frame_bundle_open(rcv.payload, rcv.payload_len, raw, sizeof(raw))) > 0) {
+            size_t offset = 0;
+            while (frame_bundle_next(raw, raw_len, &offset, &hdr, content, sizeof(content), &content_len)) {
+                add_sample(list, &hdr, content, content_len);
+            }
+        } else if (frame_decode(rcv.payload, rcv.payload_len, &hdr, content, sizeof(content), &content_len)) {
+            add_sample(list, &hdr, content, content_len);
+        }
+    }
+    free(data);
+    return 0;
+}
+
+static void tally(TypeStats *stats, uint8_t flag, size_t len, size_t air_len) {
+    stats->frames++;
+    stats->squashed += flag == FRAME_FLAG_SQUASHED;
+    stats->packed += flag == FRAME_FLAG_PACKED;
+    stats->content_bytes += len;
+    stats->air_bytes += air_len ? air_len : len;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s [options] CAPTURE...\n"
+        "  -r, --reps N   timed passes over every frame (200)\n",
+        argv0);
+}
+
+int main(int argc, char **argv) {
+    int reps = 200;
+    static const struct option longopts[] = {
+        { "reps", required_argument, NULL, 'r' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "r:h", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'r': reps = atoi(optarg); break;
+            default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (optind >= argc || reps < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    SampleList samples = { 0 };
+    for (int i = optind; i < argc; i++) {
+        if (read_capture(argv[i], &samples) != 0) return 1;
+    }
+    if (!samples.count) {
+        fprintf(stderr, "compress_bench: no frames in the captures\n");
+        return 1;
+    }
+
+    TypeStats stats[TYPE_SLOTS] = { 0 };
+    TypeStats total = { 0 };
+    size_t errors = 0;
+    for (size_t i = 0; i < samples.count; i++) {
+        const Sample *sample = &samples.items[i];
+        uint8_t air[LORA_MAX_PAYLOAD];
+        uint8_t flag;
+        size_t air_len = frame_compress(sample->content, sample->len, air, sizeof(air), &flag);
+        if (air_len) {
+            char back[LORA_MAX_PAYLOAD + 1];
+            size_t back_len = frame_decompress(flag, air, air_len, back, sizeof(back));
+            if (back_len != sample->len || memcmp(back, sample->content, back_len) != 0) {
+                if (errors++ < 10) fprintf(stderr, "frame %zu (\"%s\") doesn't come back\n", i, sample->content);
+            }
+        }
+
+        tally(&stats[sample->msg_type], flag, sample->len, air_len);
+        tally(&total, flag, sample->len, air_len);
+    }
+    if (errors) {
+        fprintf(stderr, "%zu of %zu frames don't round trip\n", errors, samples.count);
+        return 1;
+    }
+
+    // timed after the check so the numbers are for code that is known to be right
+    uint8_t air[LORA_MAX_PAYLOAD];
+    uint8_t flags[samples.count];
+    uint8_t *compressed = malloc(samples.count * LORA_MAX_PAYLOAD);
+    size_t *compressed_len = malloc(samples.count * sizeof(size_t));
+    volatile size_t sink = 0;
+    double start = now_ns();
+    for (int rep = 0; rep < reps; rep++) {
+        for (size_t i = 0; i < samples.count; i++) {
+            sink += frame_compress(samples.items[i].content, samples.items[i].len, air, sizeof(air), &flags[i]);
+        }
+    }
+    double encode_ns = (now_ns() - start) / ((double) reps * samples.count);
+    for (size_t i = 0; i < samples.count; i++) {
+        compressed_len[i] = frame_compress(samples.items[i].content, samples.items[i].len,
+                                           compressed + i * LORA_MAX_PAYLOAD, LORA_MAX_PAYLOAD, &flags[i]);
+    }
+    char back[LORA_MAX_PAYLOAD + 1];
+    size_t decoded = 0;
+    start = now_ns();
+    for (int rep = 0; rep < reps; rep++) {
+        for (size_t i = 0; i < samples.count; i++) {
+            if (!compressed_len[i]) continue;
+            sink += frame_decompress(flags[i], compressed + i * LORA_MAX_PAYLOAD, compressed_len[i], back, sizeof(back));
+            decoded++;
+        }
+    }
+    double decode_ns = decoded ? (now_ns() - start) / decoded : 0;
+
+    printf("%-12s %7s %9s %7s %9s %9s %7s %9s\n",
+           "type", "frames", "squashed", "packed", "content", "on air", "ratio", "frame");
+    for (int t = 0; t <= TYPE_SLOTS; t++) {
+        const TypeStats *s = t < TYPE_SLOTS ? &stats[t] : &total;
+        if (!s->frames) continue;
+        // the frame ratio counts the header, which is what the airtime follows
+        uint64_t header = (uint64_t) s->frames * FRAME_HEADER_LEN;
+        printf("%-12s %7u %9u %7u %9llu %9llu %7.3f %9.3f\n",
+               t < TYPE_SLOTS ? (TYPE_NAMES[t] ? TYPE_NAMES[t] : "?") : "all",
+               s->frames, s->squashed, s->packed,
+               (unsigned long long) s->content_bytes, (unsigned long long) s->air_bytes,
+               s->content_bytes ? (double) s->air_bytes / s->content_bytes : 1.0,
+               (double)(header + s->air_bytes) / (header + s->content_bytes));
+    }
+    printf("encode %.0f ns/frame, decode %.0f ns/compressed frame, %zu frames round trip\n",
+           encode_ns, decode_ns, samples.count);
+
+    free(compressed);
+    free(compressed_len);
+    free(samples.items);
+    return sink == 0xFFFFFFFF;
+}
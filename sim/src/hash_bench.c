@@ -0,0 +1,250 @@
+// insert/find/remove throughput of the firmware's open addressing hash table against the
+// chained one it replaced (src/hash_chained.c). keys are 16-bit message ids like the
+// message table uses. before timing anything a random mix of operations runs against both
+// tables, with the open one growing mid way and being iterated while keys are removed,
+// and every answer has to agree.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "hash_chained.h"
+#include "hash_table.h"
+#include "sim_rng.h"
+
+typedef struct {
+    const char *name;
+    void *(*create)(size_t keys);
+    void (*destroy)(void *table);
+    int (*insert)(void *table, int key, void *value);
+    void *(*find)(void *table, int key);
+    void *(*remove)(void *table, int key);
+} Impl;
+
+static uint64_t g_rng;
+
+static uint64_t next_random(void) {
+    return sim_rng_next(&g_rng);
+}
+
+static void *chained_fixed_create(size_t keys) { (void) keys; return chained_create(100); }
+static void *chained_pool_create(size_t keys) { return chained_create_pooled(keys, keys); }
+static void chained_destroy(void *t) { ChainedTable *table = t; chained_delete(&table); }
+static int chained_insert_(void *t, int key, void *value) { return chained_insert(t, key, value); }
+static void *chained_find_(void *t, int key) { return chained_find(t, key); }
+static void *chained_remove_(void *t, int key) { return chained_remove(t, key); }
+
+static void *open_grow_create(size_t keys) { (void) keys; return create_hashtable(0); }
+static void *open_fixed_create(size_t keys) { return create_hashtable_fixed(keys); }
+static void open_destroy(void *t) { HashTable *table = t; delete_hashtable(&table); }
+static int open_insert(void *t, int key, void *value) { return hash_insert(t, key, value); }
+static void *open_find(void *t, int key) { return hash_find(t, key); }
+static void *open_remove(void *t, int key) { return hash_remove(t, key); }
+
+static const Impl g_impls[] = {
+    // what the firmware started with: 101 chains, malloc per insert
+    { "chained/101", chained_fixed_create, chained_destroy, chained_insert_, chained_find_, chained_remove_ },
+    { "chained/pool", chained_pool_create, chained_destroy, chained_insert_, chained_find_, chained_remove_ },
+    { "open/grow", open_grow_create, open_destroy, open_insert, open_find, open_remove },
+    { "open/fixed", open_fixed_create, open_destroy, open_insert, open_find, open_remove },
+};
+#define IMPL_COUNT ((int)(sizeof(g_impls) / sizeof(g_impls[0])))
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// n distinct non zero ids in random order
+static void shuffled_ids(int *out, int n) {
+    static int all[65535];
+    for (int i = 0; i < 65535; i++) all[i] = i + 1;
+    for (int i = 0; i < n; i++) {
+        int j = i + (int)(next_random() % (uint64_t)(65535 - i));
+        int tmp = all[i];
+        all[i] = all[j];
+        all[j] = tmp;
+        out[i] = all[i];
+    }
+}
+
+static int verify(int ops) {
+    ChainedTable *ref = chained_create(101);
+    HashTable *table = create_hashtable(0);
+    static char present[65536];
+    memset(present, 0, sizeof(present));
+    int errors = 0;
+
+    for (int op = 0; op < ops && errors < 10; op++) {
+        // small key range so inserts hit existing keys and removes hit something
+        int key = (int)(next_random() % 4096) + 1;
+        void *value = (void *)(uintptr_t)(next_random() | 1);
+        switch (next_random() % 4) {
+            case 0:
+            case 1:
+                if (present[key]) chained_remove(ref, key);
+                chained_insert(ref, key, value);
+                present[key] = 1;
+                hash_insert(table, key, value);
+                break;
+            case 2:
+                if (chained_remove(ref, key) != hash_remove(table, key)) {
+                    fprintf(stderr, "op %d: remove %d disagrees\n", op, key);
+                    errors++;
+                }
+                present[key] = 0;
+                break;
+            default:
+                if (chained_find(ref, key) != hash_find(table, key)) {
+                    fprintf(stderr, "op %d: find %d disagrees\n", op, key);
+                    errors++;
+                }
+                break;
+        }
+        if (ref->entries != table->entries) {
+            fprintf(stderr, "op %d: %d entries, reference has %d\n", op, table->entries, ref->entries);
+            errors++;
+        }
+
+        if (op % 10007 == 0) {
+            // every key comes out once, also while every third one is removed along the way
+            static char seen[65536];
+            memset(seen, 0, sizeof(seen));
+            int count = 0, k;
+            void *v;
+            HashIter it;
+            hash_iter_init(&it, table);
+            while (hash_iter_next(&it, &k, &v)) {
+                if (seen[k]++ || chained_find(ref, k) != v) {
+                    fprintf(stderr, "op %d: iteration returned %d twice or with the wrong value\n", op, k);
+                    errors++;
+                }
+                if (count++ % 3 == 0) {
+                    hash_remove(table, k);
+                    chained_remove(ref, k);
+                    present[k] = 0;
+                }
+            }
+            if (count != ref->entries + (count + 2) / 3) {
+                fprintf(stderr, "op %d: iteration saw %d keys\n", op, count);
+                errors++;
+            }
+        }
+    }
+
+    chained_delete(&ref);
+    delete_hashtable(&table);
+    return errors;
+}
+
+typedef struct {
+    double insert, hit, miss, remove, churn;
+} Result;
+
+static void run(const Impl *impl, const int *ids, int n, int rounds, Result *best) {
+    const int *missing = ids + n;   // never inserted
+    volatile uintptr_t sink = 0;
+
+    for (int r = 0; r < rounds; r++) {
+        void *table = impl->create((size_t) n);
+        double t0 = now_ns();
+        for (int i = 0; i < n; i++) impl->insert(table, ids[i], (void *)(uintptr_t) ids[i]);
+        double t1 = now_ns();
+        for (int i = 0; i < n; i++) sink += (uintptr_t) impl->find(table, ids[i]);
+        double t2 = now_ns();
+        for (int i = 0; i < n; i++) sink += (uintptr_t) impl->find(table, missing[i]);
+        double t3 = now_ns();
+        // a full message table: the oldest goes out, a new one comes in, then gets looked up
+        for (int i = 0; i < n; i++) {
+            impl->remove(table, ids[i]);
+            impl->insert(table, missing[i], (void *)(uintptr_t) missing[i]);
+            sink += (uintptr_t) impl->find(table, missing[i]);
+        }
+        double t4 = now_ns();
+        for (int i = 0; i < n; i++) impl->remove(table, missing[i]);
+        double t5 = now_ns();
+        impl->destroy(table);
+
+        Result res = { (t1 - t0) / n, (t2 - t1) / n, (t3 - t2) / n, (t5 - t4) / n, (t4 - t3) / n };
+        if (r == 0 || res.insert < best->insert) best->insert = res.insert;
+        if (r == 0 || res.hit < best->hit) best->hit = res.hit;
+        if (r == 0 || res.miss < best->miss) best->miss = res.miss;
+        if (r == 0 || res.remove < best->remove) best->remove = res.remove;
+        if (r == 0 || res.churn < best->churn) best->churn = res.churn;
+    }
+    (void) sink;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -k, --keys N      keys per table, repeat for more sizes (256 4096 30000)\n"
+        "  -r, --rounds N    timed rounds, the best one counts (5)\n"
+        "  -s, --seed S      rng seed (1)\n"
+        "  -V, --verify N    random operations checked against the chained table first (1000000)\n",
+        argv0);
+}
+
+int main(int argc, char **argv) {
+    int sizes[16];
+    int size_count = 0;
+    int rounds = 5;
+    int verify_ops = 1000000;
+    g_rng = 1;
+
+    static const struct option longopts[] = {
+        { "keys", required_argument, NULL, 'k' },
+        { "rounds", required_argument, NULL, 'r' },
+        { "seed", required_argument, NULL, 's' },
+        { "verify", required_argument, NULL, 'V' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "k:r:s:V:h", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'k':
+                if (size_count < 16) sizes[size_count++] = atoi(optarg);
+                break;
+            case 'r': rounds = atoi(optarg); break;
+            case 's': g_rng = strtoull(optarg, NULL, 10) | 1; break;
+            case 'V': verify_ops = atoi(optarg); break;
+            default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (size_count == 0) {
+        sizes[size_count++] = 256;
+        sizes[size_count++] = 4096;
+        sizes[size_count++] = 30000;
+    }
+    for (int i = 0; i < size_count; i++) {
+        // half the id space goes to keys that are never inserted
+        if (sizes[i] < 1 || sizes[i] > 65535 / 2) {
+            fprintf(stderr, "hash_bench: --keys must be 1..%d\n", 65535 / 2);
+            return 2;
+        }
+    }
+
+    int errors = verify(verify_ops);
+    fprintf(stderr, "%d random operations checked against the chained table, %d disagreements\n",
+            verify_ops, errors);
+    if (errors) return 1;
+
+    static int ids[65535];
+    printf("%-8s %-13s %8s %8s %8s %8s %8s   ns/op\n", "keys", "table", "insert", "hit", "miss", "churn", "remove");
+    for (int s = 0; s < size_count; s++) {
+        shuffled_ids(ids, sizes[s] * 2);
+        for (int i = 0; i < IMPL_COUNT; i++) {
+            Result best = { 0 };
+            run(&g_impls[i], ids, sizes[s], rounds, &best);
+            printf("%-8d %-13s %8.1f %8.1f %8.1f %8.1f %8.1f\n", sizes[s], g_impls[i].name,
+                   best.insert, best.hit, best.miss, best.churn, best.remove);
+        }
+    }
+    return 0;
+}
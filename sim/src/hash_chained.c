@@ -0,0 +1,177 @@
+// the chained table main/src/hash_table.c used before it moved to open addressing,
+// kept with its symbols renamed as the baseline for hash_bench
+#include "hash_chained.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+typedef struct chained_entry_struct {
+        int key;
+        void *value;
+        struct chained_entry_struct *next;
+} ChainedEntry;
+
+static inline uint32_t mix32(uint32_t x){
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static int isPrime(int n) {
+    if (n <= 1) return 0;
+    if (n <= 3) return 1;
+    if (n % 2 == 0 || n % 3 == 0) return 0;
+    for (int i = 5; i * i <= n; i = i + 6)
+        if (n % i == 0 || n % (i + 2) == 0) return 0;
+    return 1;
+}
+
+
+// create hash table
+ChainedTable *chained_create(size_t size) {
+	// move to next prime
+	size_t n = size;
+	while (!isPrime(n)) {
+		n++;
+	}
+	ChainedTable *new_table = malloc(sizeof(ChainedTable));
+	new_table->size = n;
+	new_table->entries = 0;
+	new_table->table = calloc(n, sizeof(ChainedEntry *));
+	new_table->pool = NULL;
+	new_table->free_list = NULL;
+
+	return new_table;
+}
+
+ChainedTable *chained_create_pooled(size_t size, size_t capacity) {
+	ChainedTable *new_table = chained_create(size);
+	new_table->pool = calloc(capacity, sizeof(ChainedEntry));
+	for (size_t i = 0; i < capacity; i++) {
+		new_table->pool[i].next = new_table->free_list;
+		new_table->free_list = &new_table->pool[i];
+	}
+	return new_table;
+}
+
+static ChainedEntry *entry_alloc(ChainedTable *table) {
+	if (!table->pool) return malloc(sizeof(ChainedEntry));
+	ChainedEntry *entry = table->free_list;
+	if (entry) table->free_list = entry->next;
+	return entry;
+}
+
+static void entry_free(ChainedTable *table, ChainedEntry *entry) {
+	if (!table->pool) {
+		free(entry);
+		return;
+	}
+	entry->next = table->free_list;
+	table->free_list = entry;
+}
+
+void chained_delete(ChainedTable **ptr) {
+	if (!ptr || !*ptr) return;
+	ChainedTable *table = *ptr;
+	for (int i = 0; table->pool == NULL && i < table->size; i++) {
+		ChainedEntry *temp;
+		ChainedEntry *head = table->table[i];
+		while (head) {
+			temp = head->next;
+			free(head);
+			head = temp;
+		}
+	}
+	free(table->pool);
+	free(table->table);
+	free(table);
+	*ptr = NULL;
+}
+
+
+int chained_insert(ChainedTable *table, int key, void *value) {
+	size_t idx = (size_t) mix32((uint32_t) key) % table->size;
+
+	ChainedEntry *new_entry = entry_alloc(table);
+	if (!new_entry) return -1;
+	new_entry->key = key;
+	new_entry->value = value;
+	new_entry->next = NULL;
+	table->entries++;
+
+	// if slot is empty
+	if (!table->table[idx]) {
+		table->table[idx] = new_entry;
+		return 1;
+	}
+
+	new_entry->next = table->table[idx];
+	table->table[idx] = new_entry;
+
+	return 0;
+}
+
+void *chained_find(ChainedTable *table, int key) {
+	size_t idx = (size_t ) mix32((uint32_t) key) % table->size;
+
+	ChainedEntry *walk = table->table[idx];
+
+	while (walk) {
+		if (walk->key == key) return walk->value;
+		walk = walk->next;
+	}
+
+	return NULL;
+}
+
+void *chained_remove(ChainedTable *table, int key) {
+    if (!table || table->size == 0) return NULL;
+
+    size_t idx = (size_t)(mix32((uint32_t)key) % (uint32_t)table->size);
+
+    ChainedEntry *cur  = table->table[idx];
+    ChainedEntry *prev = NULL;
+
+    while (cur) {
+        if (cur->key == key) {
+            void *val = cur->value;
+
+            // unlink
+            if (prev) prev->next = cur->next;
+            else      table->table[idx] = cur->next;
+
+            entry_free(table, cur);
+            table->entries--;
+            return val;
+        }
+        prev = cur;
+        cur  = cur->next;
+    }
+    return NULL;  // not found
+}
+
+void** chained_sort_to_array(ChainedTable *table, int (*cmp)(const void *, const void *)) {
+	if (!table) return NULL;
+	if (table->entries == 0) return NULL;
+
+	// create 1d array
+	void **entries = calloc(table->entries, sizeof(void *));
+
+	int c = 0;
+	for (int i = 0; i < table->size; i++) {
+		ChainedEntry *walk = table->table[i];
+		while (walk) {
+			entries[c++] = walk->value;
+			walk = walk->next;
+		}
+	}
+
+	qsort(entries, table->entries, sizeof(void *), cmp);
+
+	return entries;
+}
\ No newline at end of file
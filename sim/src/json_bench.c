@@ -0,0 +1,467 @@
+// what the http api puts on the wire for a full /api/messages and /api/nodes, written the
+// way the handlers used to (snprintf per entry into a buffer, one chunk per entry and one
+// per comma) against the streaming writer (json_writer.c, chunks of JSON_CHUNK_BYTES).
+// the entries are made up: chat lines, some with quotes, backslashes and line breaks in
+// them, a few reassembled messages, route adverts. both outputs go through a JSON checker
+// before anything is timed; the old one only passes when nothing needed escaping.
+//
+// the fields are the ones write_data_json() and write_node_json() write, in the same order
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "json_writer.h"
+#include "sim_rng.h"
+
+#define OLD_MSG_BUFFER  (2560)      // MSG_JSON_MAX the handler malloc'd
+#define OLD_NODE_BUFFER (1024)      // on the handler's stack
+
+typedef struct {
+    char *content;
+    int length;
+    int src, dst, origin, steps, id, rssi, snr, stage, transfer_status, ack_status, type, ack_for;
+    time_t timestamp;
+} Msg;
+
+typedef struct {
+    char name[32];
+    uint16_t address;
+    float avg_rssi, avg_snr;
+    int messages, status, link_enabled;
+    double since;
+} Node;
+
+// counts what an http response would send, keeps it when asked to
+typedef struct {
+    uint32_t chunks;
+    size_t payload;
+    size_t wire;                    // with the chunk size line and CRLF of each
+    char *keep;
+    size_t kept, keep_cap;
+} Sink;
+
+static uint64_t g_rng = 1;
+
+static uint32_t next_random(void) {
+    return (uint32_t)(sim_rng_next(&g_rng) >> 32);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static bool sink_chunk(void *ctx, const char *data, size_t len) {
+    Sink *sink = ctx;
+    if (!len) return true;
+    sink->chunks++;
+    sink->payload += len;
+    sink->wire += len + (size_t) snprintf(NULL, 0, "%zx", len) + 4;
+    if (sink->keep) {
+        if (sink->kept + len > sink->keep_cap) {
+            while (sink->kept + len > sink->keep_cap) sink->keep_cap *= 2;
+            sink->keep = realloc(sink->keep, sink->keep_cap);
+        }
+        memcpy(sink->keep + sink->kept, data, len);
+        sink->kept += len;
+    }
+    return true;
+}
+
+// httpd_resp_sendstr_chunk()
+static void sendstr(Sink *sink, const char *s) {
+    sink_chunk(sink, s, strlen(s));
+}
+
+// ---------------------------------------------------------------- made up tables
+
+static const char *const WORDS[] = {
+    "hey", "are", "you", "at", "the", "north", "camp", "yet", "battery", "low", "ok", "on",
+    "my", "way", "see", "you", "soon", "water", "needed", "trail", "closed", "meet", "at",
+    "ridge", "in", "10", "min", "copy", "that", "signal", "weak", "here", "\"quoted\"",
+    "C:\\path", "line\nbreak", "tab\there", "it's", "100%", "a+b",
+};
+#define WORD_COUNT ((int)(sizeof(WORDS) / sizeof(WORDS[0])))
+
+static char *make_text(int words) {
+    char *text = malloc((size_t) words * 16 + 1);
+    size_t len = 0;
+    for (int i = 0; i < words; i++) {
+        const char *word = WORDS[next_random() % WORD_COUNT];
+        if (i) text[len++] = ' ';
+        memcpy(text + len, word, strlen(word));
+        len += strlen(word);
+    }
+    text[len] = '\0';
+    return text;
+}
+
+static void make_messages(Msg *msgs, int count, bool plain) {
+    for (int i = 0; i < count; i++) {
+        Msg *m = &msgs[i];
+        memset(m, 0, sizeof(*m));
+        uint32_t kind = next_random() % 100;
+        if (kind < 60) {
+            m->content = make_text(2 + next_random() % 12);
+            m->type = 2;
+        } else if (kind < 95) {
+            // route adverts and the like, never anything to escape
+            m->content = malloc(64);
+            snprintf(m->content, 64, "r%u,%u,%u;%u,%u,%u", next_random() % 65536, next_random() % 8,
+                     next_random() % 100, next_random() % 65536, next_random() % 8, next_random() % 100);
+            m->type = 5;
+        } else {
+            m->content = make_text(150 + next_random() % 100);
+            m->type = 2;
+        }
+        if (plain) {
+            for (char *c = m->content; *c; c++) {
+                if (*c == '"' || *c == '\\' || (unsigned char) *c < 0x20) *c = '_';
+            }
+        }
+        m->length = (int) strlen(m->content);
+        if (m->length > 2048) m->content[m->length = 2048] = '\0';
+        m->src = next_random() % 65536;
+        m->dst = next_random() % 65536;
+        m->origin = next_random() % 65536;
+        m->steps = next_random() % 6;
+        m->id = 1 + next_random() % 65535;
+        m->rssi = -40 - (int)(next_random() % 80);
+        m->snr = (int)(next_random() % 20) - 5;
+        m->stage = next_random() % 3;
+        m->transfer_status = (int)(next_random() % 4) - 2;
+        m->ack_status = next_random() % 2;
+        m->ack_for = next_random() % 4 ? 0 : 1 + next_random() % 65535;
+        m->timestamp = 1760000000 + i;
+    }
+}
+
+static void make_nodes(Node *nodes, int count) {
+    for (int i = 0; i < count; i++) {
+        Node *n = &nodes[i];
+        n->address = (uint16_t)(1 + next_random() % 65535);
+        snprintf(n->name, sizeof n->name, i % 4 ? "Node %hu" : "Camp \"%hu\"", n->address);
+        n->avg_rssi = -40.0f - (float)(next_random() % 8000) / 100.0f;
+        n->avg_snr = (float)(next_random() % 2000) / 100.0f - 5.0f;
+        n->messages = next_random() % 5000;
+        n->status = next_random() % 3;
+        n->link_enabled = next_random() % 8 != 0;
+        n->since = next_random() % 3600;
+    }
+}
+
+// ---------------------------------------------------------------- before
+
+static void old_messages(Sink *sink, const Msg *msgs, int count, char *buffer) {
+    sendstr(sink, "[");
+    for (int i = 0; i < count; i++) {
+        const Msg *m = &msgs[i];
+        if (i) sendstr(sink, ",");
+        char time_buff[32];
+        struct tm tm;
+        gmtime_r(&m->timestamp, &tm);
+        strftime(time_buff, 32, "%Y-%m-%dT%H:%M:%SZ", &tm);
+        snprintf(buffer, OLD_MSG_BUFFER,
+            "{\"content\" : \"%s\", \"source\" : %d, \"destination\" : %d, \"origin\" : %d, \"steps\" : %d, \"timestamp\" : \"%s\", \"id\" : %d, \"length\" : %d, \"rssi\" : %d, \"snr\" : %d, \"stage\" : %d, \"transfer_status\" : %d, \"ack_status\" : %d, \"message_type\" : %d, \"ack_for\" : %d}",
+            m->content, m->src, m->dst, m->origin, m->steps,
+            time_buff, m->id, m->length, m->rssi, m->snr, m->stage, m->transfer_status, m->ack_status, m->type, m->ack_for);
+        buffer[OLD_MSG_BUFFER - 1] = '\0';
+        sendstr(sink, buffer);
+    }
+    sendstr(sink, "]");
+}
+
+static void old_nodes(Sink *sink, const Node *nodes, int count) {
+    char buffer[OLD_NODE_BUFFER];
+    sendstr(sink, "[");
+    for (int i = 0; i < count; i++) {
+        const Node *n = &nodes[i];
+        if (i) sendstr(sink, ",");
+        snprintf(buffer, sizeof buffer,
+            "{\"name\" : \"%s\", \"address\" : \"%hu\", \"avg_rssi\" : %.2f, \"avg_snr\" : %.2f, \"messages\" : %d, \"current_node\" : %d, \"last_connection\" : %.0f, \"status\" : %d, \"link_enabled\" : %d}",
+            n->name, n->address, n->avg_rssi, n->avg_snr, n->messages, i == 0, n->since, n->status, n->link_enabled);
+        sendstr(sink, buffer);
+    }
+    sendstr(sink, "]");
+}
+
+// ---------------------------------------------------------------- after
+
+static void new_messages(Sink *sink, const Msg *msgs, int count, char *chunk) {
+    JsonWriter w;
+    json_writer_init(&w, chunk, JSON_CHUNK_BYTES, sink_chunk, sink);
+    json_array_begin(&w);
+    for (int i = 0; i < count; i++) {
+        const Msg *m = &msgs[i];
+        char time_buff[32];
+        struct tm tm;
+        gmtime_r(&m->timestamp, &tm);
+        strftime(time_buff, 32, "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+        json_object_begin(&w);
+        json_key(&w, "content");         json_string_len(&w, m->content, m->length);
+        json_key(&w, "source");          json_int(&w, m->src);
+        json_key(&w, "destination");     json_int(&w, m->dst);
+        json_key(&w, "origin");          json_int(&w, m->origin);
+        json_key(&w, "steps");           json_int(&w, m->steps);
+        json_key(&w, "timestamp");       json_string(&w, time_buff);
+        json_key(&w, "id");              json_int(&w, m->id);
+        json_key(&w, "length");          json_int(&w, m->length);
+        json_key(&w, "rssi");            json_int(&w, m->rssi);
+        json_key(&w, "snr");             json_int(&w, m->snr);
+        json_key(&w, "stage");           json_int(&w, m->stage);
+        json_key(&w, "transfer_status"); json_int(&w, m->transfer_status);
+        json_key(&w, "ack_status");      json_int(&w, m->ack_status);
+        json_key(&w, "message_type");    json_int(&w, m->type);
+        json_key(&w, "ack_for");         json_int(&w, m->ack_for);
+        json_object_end(&w);
+    }
+    json_array_end(&w);
+    json_writer_finish(&w);
+}
+
+static void new_nodes(Sink *sink, const Node *nodes, int count, char *chunk) {
+    JsonWriter w;
+    json_writer_init(&w, chunk, JSON_CHUNK_BYTES, sink_chunk, sink);
+    json_array_begin(&w);
+    for (int i = 0; i < count; i++) {
+        const Node *n = &nodes[i];
+        char address[8];
+        snprintf(address, sizeof address, "%hu", n->address);
+
+        json_object_begin(&w);
+        json_key(&w, "name");            json_string(&w, n->name);
+        json_key(&w, "address");         json_string(&w, address);
+        json_key(&w, "avg_rssi");        json_double(&w, n->avg_rssi, 2);
+        json_key(&w, "avg_snr");         json_double(&w, n->avg_snr, 2);
+        json_key(&w, "messages");        json_int(&w, n->messages);
+        json_key(&w, "current_node");    json_int(&w, i == 0);
+        json_key(&w, "last_connection"); json_double(&w, n->since, 0);
+        json_key(&w, "status");          json_int(&w, n->status);
+        json_key(&w, "link_enabled");    json_int(&w, n->link_enabled);
+        json_object_end(&w);
+    }
+    json_array_end(&w);
+    json_writer_finish(&w);
+}
+
+// ---------------------------------------------------------------- checking
+
+typedef struct {
+    const char *p, *end;
+} Cursor;
+
+static bool parse_value(Cursor *c, int depth);
+
+static void skip_space(Cursor *c) {
+    while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\n' || *c->p == '\r')) c->p++;
+}
+
+static bool parse_string(Cursor *c) {
+    if (c->p >= c->end || *c->p != '"') return false;
+    for (c->p++; c->p < c->end; c->p++) {
+        unsigned char ch = (unsigned char) *c->p;
+        if (ch == '"') {
+            c->p++;
+            return true;
+        }
+        if (ch < 0x20) return false;
+        if (ch == '\\') {
+            if (++c->p >= c->end) return false;
+            if (*c->p == 'u') {
+                for (int i = 0; i < 4; i++) {
+                    if (++c->p >= c->end || !strchr("0123456789abcdefABCDEF", *c->p)) return false;
+                }
+            } else if (!strchr("\"\\/bfnrt", *c->p)) {
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+static bool parse_number(Cursor *c) {
+    const char *start = c->p;
+    if (c->p < c->end && *c->p == '-') c->p++;
+    while (c->p < c->end && strchr("0123456789.eE+-", *c->p)) c->p++;
+    return c->p > start;
+}
+
+static bool parse_list(Cursor *c, int depth, char close, bool keys) {
+    c->p++;
+    skip_space(c);
+    if (c->p < c->end && *c->p == close) {
+        c->p++;
+        return true;
+    }
+    for (;;) {
+        skip_space(c);
+        if (keys) {
+            if (!parse_string(c)) return false;
+            skip_space(c);
+            if (c->p >= c->end || *c->p++ != ':') return false;
+        }
+        if (!parse_value(c, depth + 1)) return false;
+        skip_space(c);
+        if (c->p >= c->end) return false;
+        if (*c->p == close) {
+            c->p++;
+            return true;
+        }
+        if (*c->p++ != ',') return false;
+    }
+}
+
+static bool parse_value(Cursor *c, int depth) {
+    skip_space(c);
+    if (c->p >= c->end || depth > 32) return false;
+    switch (*c->p) {
+        case '{': return parse_list(c, depth, '}', true);
+        case '[': return parse_list(c, depth, ']', false);
+        case '"': return parse_string(c);
+        case 't': c->p += 4; return c->p <= c->end && !memcmp(c->p - 4, "true", 4);
+        case 'f': c->p += 5; return c->p <= c->end && !memcmp(c->p - 5, "false", 5);
+        case 'n': c->p += 4; return c->p <= c->end && !memcmp(c->p - 4, "null", 4);
+        default: return parse_number(c);
+    }
+}
+
+static bool valid_json(const char *text, size_t len) {
+    Cursor c = { text, text + len };
+    if (!parse_value(&c, 0)) return false;
+    skip_space(&c);
+    return c.p == c.end;
+}
+
+// ---------------------------------------------------------------- main
+
+typedef struct {
+    const char *name;
+    Sink sink;
+    bool valid;
+    double ns;
+} Result;
+
+static void report(const char *what, const Result *results, int count) {
+    printf("%s\n", what);
+    printf("  %-8s %8s %10s %10s %6s %10s %12s\n", "", "chunks", "payload", "on wire", "valid", "MB/s", "us/response");
+    for (int i = 0; i < count; i++) {
+        const Result *r = &results[i];
+        printf("  %-8s %8u %10zu %10zu %6s %10.1f %12.1f\n", r->name, r->sink.chunks, r->sink.payload,
+               r->sink.wire, r->valid ? "yes" : "no", r->sink.payload / (r->ns / 1e9) / 1e6, r->ns / 1e3);
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -m, --messages N   entries in the message table (500)\n"
+        "  -n, --nodes N      entries in the node table (64)\n"
+        "      --plain        no quotes, backslashes or control characters in the content\n"
+        "  -r, --reps N       timed passes (200)\n"
+        "  -s, --seed S       rng seed (1)\n",
+        argv0);
+}
+
+int main(int argc, char **argv) {
+    int msg_count = 500, node_count = 64, reps = 200;
+    bool plain = false;
+    static const struct option longopts[] = {
+        { "messages", required_argument, NULL, 'm' },
+        { "nodes", required_argument, NULL, 'n' },
+        { "plain", no_argument, NULL, 'p' },
+        { "reps", required_argument, NULL, 'r' },
+        { "seed", required_argument, NULL, 's' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "m:n:r:s:h", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'm': msg_count = atoi(optarg); break;
+            case 'n': node_count = atoi(optarg); break;
+            case 'p': plain = true; break;
+            case 'r': reps = atoi(optarg); break;
+            case 's': g_rng = strtoull(optarg, NULL, 10) | 1; break;
+            default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (msg_count < 1 || node_count < 1 || reps < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    Msg *msgs = calloc(msg_count, sizeof(Msg));
+    Node *nodes = calloc(node_count, sizeof(Node));
+    make_messages(msgs, msg_count, plain);
+    make_nodes(nodes, node_count);
+    int escaped = 0;
+    for (int i = 0; i < msg_count; i++) {
+        escaped += strpbrk(msgs[i].content, "\"\\\n\t") != NULL;
+    }
+
+    char *old_buffer = malloc(OLD_MSG_BUFFER);
+    char *chunk = malloc(JSON_CHUNK_BYTES);
+    Result msg_results[2] = { { .name = "before" }, { .name = "after" } };
+    Result node_results[2] = { { .name = "before" }, { .name = "after" } };
+
+    // one pass that keeps the output, to check it and count the chunks
+    for (int i = 0; i < 2; i++) {
+        Sink sink = { .keep = malloc(1 << 16), .keep_cap = 1 << 16 };
+        if (i == 0) old_messages(&sink, msgs, msg_count, old_buffer);
+        else new_messages(&sink, msgs, msg_count, chunk);
+        msg_results[i].valid = valid_json(sink.keep, sink.kept);
+        free(sink.keep);
+        sink.keep = NULL;
+        msg_results[i].sink = sink;
+
+        Sink node_sink = { .keep = malloc(1 << 16), .keep_cap = 1 << 16 };
+        if (i == 0) old_nodes(&node_sink, nodes, node_count);
+        else new_nodes(&node_sink, nodes, node_count, chunk);
+        node_results[i].valid = valid_json(node_sink.keep, node_sink.kept);
+        free(node_sink.keep);
+        node_sink.keep = NULL;
+        node_results[i].sink = node_sink;
+    }
+    if (!msg_results[1].valid || !node_results[1].valid) {
+        fprintf(stderr, "json_bench: the writer's output doesn't parse\n");
+        return 1;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        double start = now_ns();
+        for (int rep = 0; rep < reps; rep++) {
+            Sink sink = { 0 };
+            if (i == 0) old_messages(&sink, msgs, msg_count, old_buffer);
+            else new_messages(&sink, msgs, msg_count, chunk);
+        }
+        msg_results[i].ns = (now_ns() - start) / reps;
+
+        start = now_ns();
+        for (int rep = 0; rep < reps; rep++) {
+            Sink sink = { 0 };
+            if (i == 0) old_nodes(&sink, nodes, node_count);
+            else new_nodes(&sink, nodes, node_count, chunk);
+        }
+        node_results[i].ns = (now_ns() - start) / reps;
+    }
+
+    char what[96];
+    snprintf(what, sizeof what, "/api/messages, %d entries, %d with something to escape", msg_count, escaped);
+    report(what, msg_results, 2);
+    snprintf(what, sizeof what, "/api/nodes, %d entries", node_count);
+    report(what, node_results, 2);
+
+    for (int i = 0; i < msg_count; i++) free(msgs[i].content);
+    free(msgs);
+    free(nodes);
+    free(old_buffer);
+    free(chunk);
+    return 0;
+}
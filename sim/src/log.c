@@ -0,0 +1,92 @@
+// output plumbing for the simulator. the firmware prints a lot, so printf/puts/
+// putchar are interposed here (the executable exports them ahead of libc) and
+// only reach stdout with -v, prefixed with virtual time and node address.
+// time() is interposed the same way so the firmware sees the virtual clock.
+
+#include "sim.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "esp_err.h"
+
+// virtual wall clock starts here so timestamps in the message table look sane
+#define SIM_EPOCH (1700000000)
+
+int g_sim_verbose = 0;
+
+static bool g_line_start = true;
+
+static void prefix(void) {
+    if (!g_line_start) return;
+    SimNode *node = sim_current_node();
+    uint64_t now = sim_now_ms();
+    fprintf(stdout, "[%7llu.%03llu %5u] ", (unsigned long long)(now / 1000),
+            (unsigned long long)(now % 1000), node ? node->address : 0);
+}
+
+static void track(const char *s, int n) {
+    if (n > 0) g_line_start = (s[n - 1] == '\n');
+}
+
+int printf(const char *fmt, ...) {
+    if (g_sim_verbose < 2) return 0;
+
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buffer, sizeof(buffer), fmt, ap);
+    va_end(ap);
+    if (n < 0) return n;
+    if (n >= (int) sizeof(buffer)) n = sizeof(buffer) - 1;
+
+    prefix();
+    fwrite(buffer, 1, n, stdout);
+    track(buffer, n);
+    return n;
+}
+
+int puts(const char *s) {
+    if (g_sim_verbose < 2) return 0;
+    prefix();
+    fputs(s, stdout);
+    fputc('\n', stdout);
+    g_line_start = true;
+    return 1;
+}
+
+int putchar(int c) {
+    if (g_sim_verbose < 2) return c;
+    prefix();
+    fputc(c, stdout);
+    g_line_start = (c == '\n');
+    return c;
+}
+
+void sim_log(char level, const char *tag, const char *fmt, ...) {
+    int needed = (level == 'E' || level == 'W') ? 1 : (level == 'I') ? 2 : 3;
+    if (g_sim_verbose < needed) return;
+
+    if (!g_line_start) fputc('\n', stdout);
+    g_line_start = true;
+    prefix();
+    fprintf(stdout, "%c (%s) ", level, tag);
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stdout, fmt, ap);
+    va_end(ap);
+    fputc('\n', stdout);
+}
+
+void sim_fatal(const char *file, int line, const char *expr, esp_err_t err) {
+    fprintf(stderr, "ESP_ERROR_CHECK failed: %s = %d at %s:%d\n", expr, err, file, line);
+    abort();
+}
+
+time_t time(time_t *out) {
+    time_t now = (time_t)(SIM_EPOCH + sim_now_ms() / 1000);
+    if (out) *out = now;
+    return now;
+}
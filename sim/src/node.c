@@ -0,0 +1,242 @@
+// every virtual node runs its own private copy of the firmware. the firmware
+// keeps its state in globals and file statics, so rather than touching it the
+// node library is loaded once per node from its own memfd: the dynamic loader
+// treats each as a different object and gives each copy its own data. calls
+// the firmware makes into FreeRTOS / uart / esp_random resolve to the stand-ins
+// exported by this executable, which look up the calling node from the task.
+
+#define _GNU_SOURCE
+#include "sim.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "driver/uart.h"
+#include "web_server.h"
+
+static void *read_file(const char *path, size_t *len_out) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    void *data = malloc(len > 0 ? len : 1);
+    if (data && fread(data, 1, len, f) != (size_t) len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *len_out = (size_t) len;
+    return data;
+}
+
+static void *load_copy(const void *image, size_t len, int index) {
+    char name[32];
+    snprintf(name, sizeof(name), "meshnode-%d", index);
+    int fd = memfd_create(name, MFD_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    const char *p = image;
+    size_t left = len;
+    while (left) {
+        ssize_t n = write(fd, p, left);
+        if (n <= 0) {
+            close(fd);
+            return NULL;
+        }
+        p += n;
+        left -= (size_t) n;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    // the fd stays open for good: once closed its number (and so the path) comes back for
+    // the next node and the loader would hand back this copy instead of loading a new one
+    void *lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!lib) {
+        fprintf(stderr, "sim: dlopen node %d: %s\n", index, dlerror());
+        close(fd);
+    }
+    return lib;
+}
+
+#define RESOLVE(node, sym) do {                                         \
+        *(void **) &(node)->fw.sym = dlsym((node)->lib, #sym);          \
+        if (!(node)->fw.sym) {                                          \
+            fprintf(stderr, "sim: firmware is missing %s\n", #sym);     \
+            return -1;                                                  \
+        }                                                               \
+    } while (0)
+
+int sim_nodes_load(SimNode *nodes, int count, const char *library_path) {
+    size_t len;
+    void *image = read_file(library_path, &len);
+    if (!image) {
+        fprintf(stderr, "sim: cannot read node library %s\n", library_path);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        SimNode *node = &nodes[i];
+        node->index = i;
+        node->address = (ID)(1000 + i);
+        rylr_init(&node->rylr);
+
+        node->lib = load_copy(image, len, i);
+        if (!node->lib) {
+            free(image);
+            return -1;
+        }
+        RESOLVE(node, app_main);
+        RESOLVE(node, msg_find);
+        RESOLVE(node, create_data_object);
+        RESOLVE(node, queue_send);
+        RESOLVE(node, router_query_intermediate);
+        RESOLVE(node, resolve_system_command);
+        RESOLVE(node, g_router);
+        // optional, so --lib still takes older builds to compare against
+        *(void **) &node->fw.hop_ack_stats = dlsym(node->lib, "hop_ack_stats");
+        *(void **) &node->fw.tx_sched_stats = dlsym(node->lib, "tx_sched_stats");
+        *(void **) &node->fw.tx_class_name = dlsym(node->lib, "tx_class_name");
+        *(void **) &node->fw.tx_wait_bucket_ms = dlsym(node->lib, "tx_wait_bucket_ms");
+        *(void **) &node->fw.airtime_stats = dlsym(node->lib, "airtime_stats");
+        *(void **) &node->fw.frag_send = dlsym(node->lib, "frag_send");
+        *(void **) &node->fw.frag_stats = dlsym(node->lib, "frag_stats");
+    }
+    free(image);
+    return 0;
+}
+
+static void boot_task(void *arg) {
+    SimNode *node = arg;
+    node->fw.app_main();
+}
+
+void sim_node_boot(SimNode *node) {
+    sim_task_create(node, "main", boot_task, node);
+}
+
+// ---------------------------------------------------------------- web_server.c stand-in
+
+int wifi_start_softap(void) {
+    // no wifi on the host, the address the firmware derives from the ssid suffix is assigned instead
+    SimNode *node = sim_current_node();
+    return node ? node->address : 0;
+}
+
+// ---------------------------------------------------------------- uart driver
+
+// like the idf driver: bytes land in the rx buffer and one event per chunk is posted,
+// dropped silently when the event queue is full
+static void post_uart_event(SimNode *node, uart_event_type_t type, size_t size) {
+    if (!node->uart_events) return;
+    uart_event_t event = { .type = type, .size = size, .timeout_flag = false };
+    xQueueSend(node->uart_events, &event, 0);
+}
+
+void sim_node_uart_rx(SimNode *node, const char *data, size_t len) {
+    if (node->uart_record) fwrite(data, 1, len, node->uart_record);
+
+    size_t stored = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (node->rx_len == sizeof(node->rx_buf)) {
+            node->rx_overflow++;
+            continue;
+        }
+        node->rx_buf[(node->rx_head + node->rx_len) % sizeof(node->rx_buf)] = (uint8_t) data[i];
+        node->rx_len++;
+        stored++;
+    }
+    if (stored) post_uart_event(node, UART_DATA, stored);
+    if (stored < len) post_uart_event(node, UART_BUFFER_FULL, 0);
+    sim_wake_all(&node->rx_waiters);
+}
+
+esp_err_t uart_driver_install(uart_port_t port, int rx_buffer_size, int tx_buffer_size,
+                              int queue_size, QueueHandle_t *uart_queue, int intr_alloc_flags) {
+    (void) port;
+    (void) rx_buffer_size;
+    (void) tx_buffer_size;
+    (void) intr_alloc_flags;
+    SimNode *node = sim_current_node();
+    if (!node) return ESP_FAIL;
+    node->uart_installed = true;
+    if (uart_queue && queue_size > 0) {
+        node->uart_events = xQueueCreate(queue_size, sizeof(uart_event_t));
+        *uart_queue = node->uart_events;
+    } else if (uart_queue) {
+        *uart_queue = NULL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config) {
+    (void) port;
+    SimNode *node = sim_current_node();
+    if (!node || !config) return ESP_FAIL;
+    // host side baud has to match what the module is set to, like on the bench
+    return config->baud_rate == node->rylr.baud ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts) {
+    (void) port;
+    (void) tx;
+    (void) rx;
+    (void) rts;
+    (void) cts;
+    return ESP_OK;
+}
+
+int uart_write_bytes(uart_port_t port, const void *src, size_t size) {
+    (void) port;
+    SimNode *node = sim_current_node();
+    if (!node || !node->uart_installed) return -1;
+    rylr_host_write(node, src, size);
+    return (int) size;
+}
+
+int uart_read_bytes(uart_port_t port, void *buf, uint32_t length, TickType_t ticks) {
+    (void) port;
+    SimNode *node = sim_current_node();
+    if (!node || !node->uart_installed) return -1;
+
+    uint8_t *out = buf;
+    uint32_t got = 0;
+    uint64_t deadline = ticks == portMAX_DELAY ? UINT64_MAX : sim_now_ms() + pdTICKS_TO_MS(ticks);
+
+    for (;;) {
+        while (got < length && node->rx_len) {
+            out[got++] = node->rx_buf[node->rx_head];
+            node->rx_head = (node->rx_head + 1) % sizeof(node->rx_buf);
+            node->rx_len--;
+        }
+        if (got == length) break;
+
+        uint64_t now = sim_now_ms();
+        if (now >= deadline) break;
+        TickType_t wait = deadline == UINT64_MAX ? portMAX_DELAY : pdMS_TO_TICKS(deadline - now);
+        sim_block(&node->rx_waiters, wait);
+    }
+    return (int) got;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t port, size_t *size) {
+    (void) port;
+    SimNode *node = sim_current_node();
+    if (!node) return ESP_FAIL;
+    *size = node->rx_len;
+    return ESP_OK;
+}
+
+esp_err_t uart_flush_input(uart_port_t port) {
+    (void) port;
+    SimNode *node = sim_current_node();
+    if (!node) return ESP_FAIL;
+    node->rx_head = 0;
+    node->rx_len = 0;
+    return ESP_OK;
+}
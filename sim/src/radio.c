@@ -0,0 +1,278 @@
+// shared LoRa channel. a frame keyed by one node reaches each linked neighbor
+// after its time on air unless the link drops it, the neighbor was itself on
+// the air at any point during the frame (half duplex), or, with collisions on,
+// another frame overlapped it at that neighbor (no capture effect).
+
+#include "sim.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_codec.h"
+
+typedef struct sim_transmission SimTransmission;
+
+typedef struct sim_reception {
+    SimTransmission *tx;
+    SimNode *node;
+    SimLink *link;
+    bool corrupt;
+    struct sim_reception *next;     // node->receiving list
+} SimReception;
+
+struct sim_transmission {
+    SimNode *from;
+    ID dest;
+    size_t len;
+    int reception_count;
+    SimReception *receptions;
+    char payload[];
+};
+
+static SimRadioStats g_stats;
+static SimNode *g_nodes;
+static int g_node_count;
+static bool g_collisions = true;
+
+const SimRadioStats *radio_stats(void) {
+    return &g_stats;
+}
+
+static int link_quality_snr(double loss) {
+    // strong links sit around +10 dB, links that drop most frames fall below the SF9 floor
+    return (int) lround(10.0 - 25.0 * loss);
+}
+
+static int link_quality_rssi(double loss) {
+    return (int) lround(-60.0 - 60.0 * loss);
+}
+
+static SimLink *find_link(SimNode *a, int to) {
+    for (int i = 0; i < a->link_count; i++) {
+        if (a->links[i].to == to) return &a->links[i];
+    }
+    return NULL;
+}
+
+static void add_directed(SimNode *a, int to, double loss, int snr) {
+    SimLink *link = find_link(a, to);
+    if (!link) {
+        if (a->link_count == a->link_cap) {
+            a->link_cap = a->link_cap ? a->link_cap * 2 : 8;
+            a->links = realloc(a->links, a->link_cap * sizeof(SimLink));
+        }
+        link = &a->links[a->link_count++];
+    }
+    if (loss < 0) loss = 0;
+    if (loss > 1) loss = 1;
+    link->to = to;
+    link->loss = (float) loss;
+    link->snr = snr;
+    link->rssi = link_quality_rssi(loss);
+}
+
+static void add_link(SimNode *nodes, int a, int b, double loss, int snr) {
+    if (a == b) return;
+    add_directed(&nodes[a], b, loss, snr);
+    add_directed(&nodes[b], a, loss, snr);
+}
+
+static int build_from_file(SimNode *nodes, const SimRadioConfig *config) {
+    FILE *f = fopen(config->topology, "r");
+    if (!f) {
+        fprintf(stderr, "sim: unknown topology or unreadable file \"%s\"\n", config->topology);
+        return -1;
+    }
+    char line[128];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        if (line[0] == '#' || line[0] == '\n') continue;
+        int a, b, snr;
+        double loss = config->loss;
+        int n = sscanf(line, "%d %d %lf %d", &a, &b, &loss, &snr);
+        if (n < 2 || a < 0 || b < 0 || a >= config->nodes || b >= config->nodes) {
+            fprintf(stderr, "sim: %s:%d: expected \"a b [loss] [snr]\" with 0 <= a,b < %d\n",
+                    config->topology, lineno, config->nodes);
+            fclose(f);
+            return -1;
+        }
+        add_link(nodes, a, b, loss, n == 4 ? snr : link_quality_snr(loss));
+    }
+    fclose(f);
+    return 0;
+}
+
+int radio_build(SimNode *nodes, const SimRadioConfig *config) {
+    g_nodes = nodes;
+    g_node_count = config->nodes;
+    g_collisions = config->collisions;
+    memset(&g_stats, 0, sizeof(g_stats));
+
+    int n = config->nodes;
+    double base = config->loss;
+    const char *topo = config->topology;
+
+    if (strcmp(topo, "line") == 0 || strcmp(topo, "ring") == 0) {
+        for (int i = 0; i + 1 < n; i++) add_link(nodes, i, i + 1, base, link_quality_snr(base));
+        if (topo[0] == 'r' && n > 2) add_link(nodes, n - 1, 0, base, link_quality_snr(base));
+    } else if (strcmp(topo, "grid") == 0) {
+        int w = (int) ceil(sqrt(n));
+        for (int i = 0; i < n; i++) {
+            if ((i % w) + 1 < w && i + 1 < n) add_link(nodes, i, i + 1, base, link_quality_snr(base));
+            if (i + w < n) add_link(nodes, i, i + w, base, link_quality_snr(base));
+        }
+    } else if (strcmp(topo, "random") == 0) {
+        // random geometric graph in the unit square, range picked for the target degree.
+        // links near the edge of range get worse, which is what makes hop count a poor metric
+        double *x = malloc(n * sizeof(double));
+        double *y = malloc(n * sizeof(double));
+        for (int i = 0; i < n; i++) {
+            x[i] = sim_random_unit();
+            y[i] = sim_random_unit();
+        }
+        double range = sqrt(config->degree / (M_PI * (n > 1 ? n - 1 : 1)));
+        for (int i = 0; i < n; i++) {
+            for (int j = i + 1; j < n; j++) {
+                double d = hypot(x[i] - x[j], y[i] - y[j]);
+                if (d > range) continue;
+                double frac = d / range;
+                double loss = base + config->edge_loss * frac * frac * frac * frac;
+                add_link(nodes, i, j, loss, link_quality_snr(loss));
+            }
+        }
+        free(x);
+        free(y);
+    } else if (build_from_file(nodes, config) != 0) {
+        return -1;
+    }
+
+    int links = 0;
+    for (int i = 0; i < n; i++) links += nodes[i].link_count;
+    return links / 2;
+}
+
+int radio_components(SimNode *nodes, int count, int *component_out) {
+    // links that drop everything do not connect anything
+    int components = 0;
+    int *stack = malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++) component_out[i] = -1;
+    for (int i = 0; i < count; i++) {
+        if (component_out[i] >= 0) continue;
+        int top = 0;
+        stack[top++] = i;
+        component_out[i] = components;
+        while (top) {
+            SimNode *node = &nodes[stack[--top]];
+            for (int l = 0; l < node->link_count; l++) {
+                int to = node->links[l].to;
+                if (node->links[l].loss >= 1.0f || component_out[to] >= 0) continue;
+                component_out[to] = components;
+                stack[top++] = to;
+            }
+        }
+        components++;
+    }
+    free(stack);
+    return components;
+}
+
+static void corrupt_receptions_at(SimNode *node) {
+    for (SimReception *r = node->receiving; r; r = r->next) {
+        r->corrupt = true;
+    }
+}
+
+static void unlink_reception(SimReception *rx) {
+    SimReception **walk = &rx->node->receiving;
+    while (*walk && *walk != rx) walk = &(*walk)->next;
+    if (*walk) *walk = rx->next;
+}
+
+static void transmission_done(void *arg, uint64_t tag) {
+    (void) tag;
+    SimTransmission *tx = arg;
+    for (int i = 0; i < tx->reception_count; i++) {
+        SimReception *rx = &tx->receptions[i];
+        unlink_reception(rx);
+
+        if (rx->corrupt) {
+            g_stats.frames_collided++;
+            continue;
+        }
+        if (sim_random_unit() < rx->link->loss) {
+            g_stats.frames_lost++;
+            continue;
+        }
+        // the module filters on its own address, 0 reaches everyone
+        if (tx->dest != BROADCAST_ID && tx->dest != rx->node->rylr.address) continue;
+
+        g_stats.frames_rx++;
+        rylr_radio_receive(rx->node, tx->from->rylr.address, tx->payload, tx->len, rx->link->rssi, rx->link->snr);
+    }
+    free(tx->receptions);
+    free(tx);
+}
+
+// key the radio of node, returns when the frame is off the air
+// frames one transmission carries, 1 unless it is a bundle
+static int frames_carried(const char *payload, size_t len) {
+    if (!len || (uint8_t) payload[0] != FRAME_BUNDLE) return 1;
+
+    uint8_t raw[LORA_MAX_PAYLOAD];
+    size_t raw_len = 0;
+    for (size_t i = 0; i < len && raw_len < sizeof(raw); i++) {
+        uint8_t b = (uint8_t) payload[i];
+        if (b == FRAME_ESC && ++i < len) b = (uint8_t) payload[i] ^ FRAME_ESC_XOR;
+        raw[raw_len++] = b;
+    }
+    int count = 0;
+    for (size_t at = 1; at < raw_len; at += 1 + raw[at]) count++;
+    return count;
+}
+
+uint64_t radio_transmit(SimNode *node, ID dest, const char *payload, size_t len) {
+    uint64_t now = sim_now_ms();
+    double airtime = rylr_airtime_ms(&node->rylr, len);
+    uint64_t end = now + (uint64_t) ceil(airtime);
+
+    g_stats.frames_tx++;
+    g_stats.frames_carried += frames_carried(payload, len);
+    g_stats.airtime_ms += airtime;
+    node->airtime_ms += airtime;
+
+    // half duplex, anything we were hearing is gone
+    corrupt_receptions_at(node);
+    node->tx_until_ms = end;
+
+    SimTransmission *tx = malloc(sizeof(SimTransmission) + len);
+    tx->from = node;
+    tx->dest = dest;
+    tx->len = len;
+    memcpy(tx->payload, payload, len);
+    tx->receptions = calloc(node->link_count ? node->link_count : 1, sizeof(SimReception));
+    tx->reception_count = 0;
+
+    for (int i = 0; i < node->link_count; i++) {
+        SimLink *link = &node->links[i];
+        SimNode *peer = &g_nodes[link->to];
+        if (peer->tx_until_ms > now) continue; // busy talking, cannot hear us
+
+        SimReception *rx = &tx->receptions[tx->reception_count++];
+        rx->tx = tx;
+        rx->node = peer;
+        rx->link = link;
+        rx->corrupt = false;
+        if (g_collisions && peer->receiving) {
+            corrupt_receptions_at(peer);
+            rx->corrupt = true;
+        }
+        rx->next = peer->receiving;
+        peer->receiving = rx;
+    }
+
+    sim_at(end, transmission_done, tx, 0);
+    return end;
+}
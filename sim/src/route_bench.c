@@ -0,0 +1,271 @@
+// router operations at mesh sizes far past what the sim runs, the firmware's indexed
+// router against the list based one it replaced (src/routing_list.c). a node with a few
+// neighbors learns routes to every destination through them, then updates, lookups and
+// link/unlink/bad intermediate on a neighbor are timed. a random mix of the same calls
+// runs against both routers first and every route lookup has to agree. last, (un)link is
+// timed with a set share of the destinations routing through the neighbor, the indexed
+// router's cost goes with that share, the list router's with the table.
+//
+// build with a ROUTER_MAX_DESTINATIONS big enough for --destinations (CMakeLists uses 4096)
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "routing.h"
+#include "routing_list.h"
+#include "sim_rng.h"
+
+#define MY_ADDRESS (0xFFFE)
+
+static uint64_t g_rng;
+
+static uint64_t next_random(void) {
+    return sim_rng_next(&g_rng);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// neighbors are addresses 1..neighbors, everything up to destinations is further away
+static ID random_neighbor(int neighbors) {
+    return (ID)(1 + next_random() % (uint64_t) neighbors);
+}
+
+static ID random_destination(int destinations) {
+    return (ID)(1 + next_random() % (uint64_t) destinations);
+}
+
+static int random_steps(void) {
+    return 2 + (int)(next_random() % 7);
+}
+
+static int verify(int destinations, int neighbors, int ops) {
+    Router *router = create_router(MY_ADDRESS);
+    ListRouter *list = list_create_router(MY_ADDRESS);
+    bool known[UINT16_MAX + 1] = { false };
+    int errors = 0;
+
+    for (int op = 0; op < ops && errors < 10; op++) {
+        ID via = random_neighbor(neighbors);
+        ID dest = random_destination(destinations);
+        switch (next_random() % 16) {
+            case 0:
+                router_unlink_node(router, via);
+                list_router_unlink_node(list, via);
+                break;
+            case 1:
+                router_link_node(router, via);
+                list_router_link_node(list, via);
+                break;
+            case 2:
+                router_bad_intermediate(router, via);
+                list_router_bad_intermediate(list, via);
+                break;
+            default: {
+                int steps = random_steps();
+                router_update(router, dest, MY_ADDRESS, via, steps);
+                list_router_update(list, dest, MY_ADDRESS, via, steps);
+                known[dest] = known[via] = true;
+                break;
+            }
+        }
+
+        if (op % 97 == 0) {
+            for (int d = 1; d <= destinations; d++) {
+                if (!known[d]) continue;
+                ID a = router_query_intermediate(router, (ID) d);
+                ID b = list_router_query_intermediate(list, (ID) d);
+                if (a != b) {
+                    fprintf(stderr, "op %d: route to %d goes via %hu, list router says %hu\n", op, d, a, b);
+                    errors++;
+                }
+            }
+        }
+    }
+
+    free(router);
+    return errors;
+}
+
+typedef struct {
+    Router *(*create)(ID for_node);
+    ID (*query)(Router *router, ID destination_node);
+    void (*update)(Router *router, ID origin_node, ID destination_node, ID from_node, int steps);
+    void (*bad_intermediate)(Router *router, ID intermediate_node);
+    void (*link)(Router *router, ID node);
+    void (*unlink)(Router *router, ID node);
+    const char *name;
+} Impl;
+
+static const Impl g_impls[] = {
+    { (Router *(*)(ID)) list_create_router, (ID (*)(Router *, ID)) list_router_query_intermediate,
+      (void (*)(Router *, ID, ID, ID, int)) list_router_update,
+      (void (*)(Router *, ID)) list_router_bad_intermediate,
+      (void (*)(Router *, ID)) list_router_link_node, (void (*)(Router *, ID)) list_router_unlink_node, "list" },
+    { create_router, router_query_intermediate, router_update, router_bad_intermediate,
+      router_link_node, router_unlink_node, "indexed" },
+};
+#define IMPL_COUNT ((int)(sizeof(g_impls) / sizeof(g_impls[0])))
+
+typedef struct {
+    double update, query, link, bad;
+} Result;
+
+static void fill(const Impl *impl, Router *router, int destinations, int neighbors) {
+    // every destination ends up with routes through a couple of neighbors
+    for (int round = 0; round < 3; round++) {
+        for (int d = 1; d <= destinations; d++) {
+            impl->update(router, (ID) d, MY_ADDRESS, random_neighbor(neighbors), random_steps());
+        }
+    }
+}
+
+static void run(const Impl *impl, int destinations, int neighbors, int ops, int rounds, Result *best) {
+    volatile unsigned sink = 0;
+
+    for (int r = 0; r < rounds; r++) {
+        Router *router = impl->create(MY_ADDRESS);
+        fill(impl, router, destinations, neighbors);
+
+        double t0 = now_ns();
+        for (int i = 0; i < ops; i++) {
+            impl->update(router, random_destination(destinations), MY_ADDRESS, random_neighbor(neighbors), random_steps());
+        }
+        double t1 = now_ns();
+        for (int i = 0; i < ops; i++) {
+            sink += impl->query(router, random_destination(destinations));
+        }
+        double t2 = now_ns();
+        int link_ops = ops / 16 + 1;
+        for (int i = 0; i < link_ops; i++) {
+            ID via = random_neighbor(neighbors);
+            impl->unlink(router, via);
+            impl->link(router, via);
+        }
+        double t3 = now_ns();
+        // every neighbor once, each takes its share of the routes with it
+        for (int n = 1; n <= neighbors; n++) {
+            impl->bad_intermediate(router, (ID) n);
+        }
+        double t4 = now_ns();
+        free(router);
+
+        Result res = { (t1 - t0) / ops, (t2 - t1) / ops, (t3 - t2) / (2.0 * link_ops), (t4 - t3) / neighbors };
+        if (r == 0 || res.update < best->update) best->update = res.update;
+        if (r == 0 || res.query < best->query) best->query = res.query;
+        if (r == 0 || res.link < best->link) best->link = res.link;
+        if (r == 0 || res.bad < best->bad) best->bad = res.bad;
+    }
+    (void) sink;
+}
+
+// (un)link of a neighbor that through of the destinations route by, the rest go another way.
+// the list router walks the whole table whatever through is, the indexed one only those routes
+static double run_link_scaling(const Impl *impl, int destinations, int through, int rounds) {
+    double best = 0;
+    int link_ops = 2000;
+
+    for (int r = 0; r < rounds; r++) {
+        Router *router = impl->create(MY_ADDRESS);
+        for (int d = 1; d <= destinations; d++) {
+            impl->update(router, (ID) d, MY_ADDRESS, 2, 3);
+        }
+        for (int d = 1; d <= through; d++) {
+            impl->update(router, (ID) d, MY_ADDRESS, 1, 2);
+        }
+
+        double t0 = now_ns();
+        for (int i = 0; i < link_ops; i++) {
+            impl->unlink(router, 1);
+            impl->link(router, 1);
+        }
+        double t1 = now_ns();
+        free(router);
+
+        double ns = (t1 - t0) / (2.0 * link_ops);
+        if (r == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -d, --destinations N  destinations the node knows routes to (1000)\n"
+        "  -n, --neighbors N     neighbors the routes go through (16)\n"
+        "  -o, --ops N           timed updates and lookups per round (200000)\n"
+        "  -r, --rounds N        timed rounds, the best one counts (5)\n"
+        "  -s, --seed S          rng seed (1)\n"
+        "  -V, --verify N        random operations checked against the list router first (200000)\n",
+        argv0);
+}
+
+int main(int argc, char **argv) {
+    int destinations = 1000;
+    int neighbors = 16;
+    int ops = 200000;
+    int rounds = 5;
+    int verify_ops = 200000;
+    g_rng = 1;
+
+    static const struct option longopts[] = {
+        { "destinations", required_argument, NULL, 'd' },
+        { "neighbors", required_argument, NULL, 'n' },
+        { "ops", required_argument, NULL, 'o' },
+        { "rounds", required_argument, NULL, 'r' },
+        { "seed", required_argument, NULL, 's' },
+        { "verify", required_argument, NULL, 'V' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "d:n:o:r:s:V:h", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'd': destinations = atoi(optarg); break;
+            case 'n': neighbors = atoi(optarg); break;
+            case 'o': ops = atoi(optarg); break;
+            case 'r': rounds = atoi(optarg); break;
+            case 's': g_rng = strtoull(optarg, NULL, 10) | 1; break;
+            case 'V': verify_ops = atoi(optarg); break;
+            default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (destinations < 1 || destinations > ROUTER_MAX_DESTINATIONS ||
+        neighbors < 1 || neighbors > destinations || ops < 1 || rounds < 1) {
+        fprintf(stderr, "route_bench: need 1 <= neighbors <= destinations <= %d\n", ROUTER_MAX_DESTINATIONS);
+        return 2;
+    }
+
+    int errors = verify(destinations, neighbors, verify_ops);
+    fprintf(stderr, "%d random operations checked against the list router, %d disagreements\n",
+            verify_ops, errors);
+    if (errors) return 1;
+
+    printf("%d destinations through %d neighbors\n", destinations, neighbors);
+    printf("%-8s %10s %10s %10s %12s   ns/op\n", "router", "update", "query", "(un)link", "bad_inter");
+    for (int i = 0; i < IMPL_COUNT; i++) {
+        Result best = { 0 };
+        run(&g_impls[i], destinations, neighbors, ops, rounds, &best);
+        printf("%-8s %10.1f %10.1f %10.1f %12.1f\n", g_impls[i].name, best.update, best.query, best.link, best.bad);
+    }
+
+    printf("\n(un)link by how many of the %d destinations route through the neighbor\n", destinations);
+    printf("%-8s %10s %10s   ns/op\n", "routes", "list", "indexed");
+    for (int through = destinations / 100 > 0 ? destinations / 100 : 1; ; through *= 10) {
+        if (through > destinations) through = destinations;
+        printf("%-8d", through);
+        for (int i = 0; i < IMPL_COUNT; i++) {
+            printf(" %10.1f", run_link_scaling(&g_impls[i], destinations, through, rounds));
+        }
+        printf("\n");
+        if (through == destinations) break;
+    }
+    return 0;
+}
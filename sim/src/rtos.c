@@ -0,0 +1,485 @@
+// cooperative, single threaded stand-in for FreeRTOS. every firmware task is a
+// ucontext coroutine that runs until it blocks (delay, queue, semaphore, uart
+// read); the scheduler then advances a virtual millisecond clock to the next
+// event. priorities are ignored, ready tasks run in FIFO order, so a run is
+// fully determined by its seed.
+
+#include "sim.h"
+#include "sim_rng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// host libc (printf with floats in particular) wants far more stack than the
+// firmware asks for, so every task gets the same lazily committed mapping
+#define TASK_STACK_SIZE (128 * 1024)
+
+typedef enum {
+    TASK_READY,
+    TASK_BLOCKED,
+    TASK_DEAD,
+} SimTaskState;
+
+struct sim_task {
+    ucontext_t ctx;
+    void *stack;
+    SimNode *node;
+    char name[24];
+    void (*fn)(void *);
+    void *arg;
+    SimTaskState state;
+
+    // timeouts carry the generation they were armed for so stale ones are ignored
+    uint64_t block_gen;
+    bool timed_out;
+    SimWaitList *waiting_on;
+    SimTask *wait_prev;
+    SimTask *wait_next;
+
+    SimTask *ready_next;
+    SimTask *free_next;
+};
+
+typedef struct {
+    uint64_t when;
+    uint64_t seq;
+    void (*fn)(void *arg, uint64_t tag);
+    void *arg;
+    uint64_t tag;
+} SimEvent;
+
+struct sim_queue {
+    uint8_t *buf;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    SimWaitList readers;
+    SimWaitList writers;
+};
+
+struct sim_semaphore {
+    UBaseType_t count;
+    UBaseType_t max;
+    SimWaitList waiters;
+};
+
+static uint64_t g_now;
+static uint64_t g_event_seq;
+static SimEvent *g_events;
+static size_t g_event_count, g_event_cap;
+
+static ucontext_t g_sched_ctx;
+static SimTask *g_current;
+static SimNode *g_context_node;
+static SimTask *g_ready_head, *g_ready_tail;
+static SimTask *g_free_tasks;
+static uint64_t g_switches;
+
+static uint64_t g_rng = 0x9E3779B97F4A7C15ULL;
+
+// ---------------------------------------------------------------- rng
+
+void sim_seed(uint64_t seed) {
+    g_rng = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+uint64_t sim_random(void) {
+    return sim_rng_next(&g_rng);
+}
+
+double sim_random_unit(void) {
+    return (double)(sim_random() >> 11) / (double)(1ULL << 53);
+}
+
+uint32_t esp_random(void) {
+    return (uint32_t)(sim_random() >> 32);
+}
+
+// ---------------------------------------------------------------- event heap
+
+static bool event_before(const SimEvent *a, const SimEvent *b) {
+    return a->when < b->when || (a->when == b->when && a->seq < b->seq);
+}
+
+void sim_at(uint64_t when_ms, void (*fn)(void *arg, uint64_t tag), void *arg, uint64_t tag) {
+    if (when_ms < g_now) when_ms = g_now;
+    if (g_event_count == g_event_cap) {
+        g_event_cap = g_event_cap ? g_event_cap * 2 : 1024;
+        g_events = realloc(g_events, g_event_cap * sizeof(SimEvent));
+        if (!g_events) {
+            fprintf(stderr, "sim: out of memory growing event heap\n");
+            exit(1);
+        }
+    }
+
+    size_t i = g_event_count++;
+    SimEvent ev = { .when = when_ms, .seq = g_event_seq++, .fn = fn, .arg = arg, .tag = tag };
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!event_before(&ev, &g_events[parent])) break;
+        g_events[i] = g_events[parent];
+        i = parent;
+    }
+    g_events[i] = ev;
+}
+
+static SimEvent event_pop(void) {
+    SimEvent top = g_events[0];
+    SimEvent last = g_events[--g_event_count];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= g_event_count) break;
+        if (child + 1 < g_event_count && event_before(&g_events[child + 1], &g_events[child])) child++;
+        if (!event_before(&g_events[child], &last)) break;
+        g_events[i] = g_events[child];
+        i = child;
+    }
+    if (g_event_count) g_events[i] = last;
+    return top;
+}
+
+// ---------------------------------------------------------------- tasks
+
+uint64_t sim_now_ms(void) {
+    return g_now;
+}
+
+uint64_t sim_context_switches(void) {
+    return g_switches;
+}
+
+SimNode *sim_current_node(void) {
+    return g_current ? g_current->node : g_context_node;
+}
+
+void sim_set_context_node(SimNode *node) {
+    g_context_node = node;
+}
+
+static void make_ready(SimTask *task) {
+    task->state = TASK_READY;
+    task->ready_next = NULL;
+    if (g_ready_tail) g_ready_tail->ready_next = task;
+    else g_ready_head = task;
+    g_ready_tail = task;
+}
+
+static void task_entry(void) {
+    SimTask *task = g_current;
+    task->fn(task->arg);
+    vTaskDelete(NULL);
+}
+
+SimTask *sim_task_create(SimNode *node, const char *name, void (*fn)(void *), void *arg) {
+    SimTask *task = g_free_tasks;
+    if (task) {
+        g_free_tasks = task->free_next;
+    } else {
+        task = calloc(1, sizeof(SimTask));
+        if (!task) return NULL;
+        task->stack = mmap(NULL, TASK_STACK_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (task->stack == MAP_FAILED) {
+            free(task);
+            return NULL;
+        }
+    }
+
+    task->node = node;
+    snprintf(task->name, sizeof(task->name), "%s", name ? name : "task");
+    task->fn = fn;
+    task->arg = arg;
+    task->waiting_on = NULL;
+    task->block_gen++;
+
+    getcontext(&task->ctx);
+    task->ctx.uc_stack.ss_sp = task->stack;
+    task->ctx.uc_stack.ss_size = TASK_STACK_SIZE;
+    task->ctx.uc_link = NULL;
+    makecontext(&task->ctx, task_entry, 0);
+
+    make_ready(task);
+    return task;
+}
+
+static void wait_unlink(SimTask *task) {
+    SimWaitList *list = task->waiting_on;
+    if (!list) return;
+    if (task->wait_prev) task->wait_prev->wait_next = task->wait_next;
+    else list->head = task->wait_next;
+    if (task->wait_next) task->wait_next->wait_prev = task->wait_prev;
+    else list->tail = task->wait_prev;
+    task->waiting_on = NULL;
+    task->wait_prev = task->wait_next = NULL;
+}
+
+static void block_timeout(void *arg, uint64_t gen) {
+    SimTask *task = arg;
+    if (task->state != TASK_BLOCKED || task->block_gen != gen) return;
+    wait_unlink(task);
+    task->timed_out = true;
+    make_ready(task);
+}
+
+static void switch_to_scheduler(void) {
+    SimTask *task = g_current;
+    swapcontext(&task->ctx, &g_sched_ctx);
+}
+
+// park the current task on list (or just sleep when list is NULL) until woken or ticks pass.
+// returns false on timeout. outside a task (scheduler callbacks) nothing can block
+bool sim_block(SimWaitList *list, TickType_t ticks) {
+    SimTask *task = g_current;
+    if (!task || ticks == 0) return false;
+
+    task->state = TASK_BLOCKED;
+    task->timed_out = false;
+    task->block_gen++;
+
+    if (list) {
+        task->waiting_on = list;
+        task->wait_next = NULL;
+        task->wait_prev = list->tail;
+        if (list->tail) list->tail->wait_next = task;
+        else list->head = task;
+        list->tail = task;
+    }
+    if (ticks != portMAX_DELAY) {
+        sim_at(g_now + pdTICKS_TO_MS(ticks), block_timeout, task, task->block_gen);
+    }
+
+    switch_to_scheduler();
+    return !task->timed_out;
+}
+
+void sim_wake_all(SimWaitList *list) {
+    while (list->head) {
+        SimTask *task = list->head;
+        wait_unlink(task);
+        task->block_gen++; // disarm the pending timeout
+        make_ready(task);
+    }
+}
+
+void sim_run_until(uint64_t end_ms) {
+    for (;;) {
+        while (g_ready_head) {
+            SimTask *task = g_ready_head;
+            g_ready_head = task->ready_next;
+            if (!g_ready_head) g_ready_tail = NULL;
+            if (task->state != TASK_READY) continue;
+
+            g_current = task;
+            g_switches++;
+            swapcontext(&g_sched_ctx, &task->ctx);
+            g_current = NULL;
+
+            if (task->state == TASK_DEAD) {
+                task->free_next = g_free_tasks;
+                g_free_tasks = task;
+            }
+        }
+
+        if (!g_event_count || g_events[0].when > end_ms) break;
+
+        SimEvent ev = event_pop();
+        g_now = ev.when;
+        ev.fn(ev.arg, ev.tag);
+    }
+    if (g_now < end_ms) g_now = end_ms;
+}
+
+// ---------------------------------------------------------------- FreeRTOS tasks
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                       void *arg, UBaseType_t priority, TaskHandle_t *handle) {
+    (void) stack_depth;
+    (void) priority;
+    SimTask *task = sim_task_create(sim_current_node(), name, fn, arg);
+    if (handle) *handle = task;
+    return task ? pdPASS : pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (!task || task == g_current) {
+        task = g_current;
+        if (!task) return;
+        task->state = TASK_DEAD;
+        switch_to_scheduler();
+        return; // not reached
+    }
+    // it may still sit in the ready list, so it is dropped rather than recycled
+    wait_unlink(task);
+    task->block_gen++;
+    task->state = TASK_DEAD;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    if (ticks == 0) ticks = 1;
+    sim_block(NULL, ticks);
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t period) {
+    TickType_t wake = *previous_wake + period;
+    *previous_wake = wake;
+    TickType_t now = xTaskGetTickCount();
+    if ((int32_t)(wake - now) > 0) {
+        sim_block(NULL, wake - now);
+    }
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t) pdMS_TO_TICKS(g_now);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return g_current;
+}
+
+// ---------------------------------------------------------------- queues
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct sim_queue *q = calloc(1, sizeof(*q));
+    if (!q) return NULL;
+    q->buf = calloc(length ? length : 1, item_size ? item_size : 1);
+    if (!q->buf) {
+        free(q);
+        return NULL;
+    }
+    q->length = length;
+    q->item_size = item_size;
+    return q;
+}
+
+// ticks left before deadline, portMAX_DELAY stays forever
+static TickType_t remaining(TickType_t ticks, uint64_t start) {
+    if (ticks == portMAX_DELAY) return ticks;
+    uint64_t deadline = start + pdTICKS_TO_MS(ticks);
+    return g_now >= deadline ? 0 : pdMS_TO_TICKS(deadline - g_now);
+}
+
+static BaseType_t queue_put(QueueHandle_t q, const void *item, TickType_t ticks, bool front) {
+    uint64_t start = g_now;
+    while (q->count == q->length) {
+        if (!sim_block(&q->writers, remaining(ticks, start))) {
+            if (q->count < q->length) break;
+            return errQUEUE_FULL;
+        }
+    }
+
+    UBaseType_t slot;
+    if (front) {
+        q->head = (q->head + q->length - 1) % q->length;
+        slot = q->head;
+    } else {
+        slot = (q->head + q->count) % q->length;
+    }
+    memcpy(q->buf + (size_t) slot * q->item_size, item, q->item_size);
+    q->count++;
+    sim_wake_all(&q->readers);
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks) {
+    return queue_put(q, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void *item, TickType_t ticks) {
+    return queue_put(q, item, ticks, true);
+}
+
+static BaseType_t queue_get(QueueHandle_t q, void *item, TickType_t ticks, bool remove) {
+    uint64_t start = g_now;
+    while (q->count == 0) {
+        if (!sim_block(&q->readers, remaining(ticks, start))) {
+            if (q->count) break;
+            return pdFALSE;
+        }
+    }
+
+    memcpy(item, q->buf + (size_t) q->head * q->item_size, q->item_size);
+    if (remove) {
+        q->head = (q->head + 1) % q->length;
+        q->count--;
+        sim_wake_all(&q->writers);
+    }
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+    return queue_get(q, item, ticks, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void *item, TickType_t ticks) {
+    return queue_get(q, item, ticks, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+    return q->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q) {
+    return q->length - q->count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t q) {
+    q->head = 0;
+    q->count = 0;
+    sim_wake_all(&q->writers);
+    return pdPASS;
+}
+
+// ---------------------------------------------------------------- semaphores
+
+static SemaphoreHandle_t semaphore_create(UBaseType_t max, UBaseType_t initial) {
+    struct sim_semaphore *sem = calloc(1, sizeof(*sem));
+    if (!sem) return NULL;
+    sem->max = max;
+    sem->count = initial;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return semaphore_create(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return semaphore_create(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count) {
+    return semaphore_create(max_count, initial_count);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    // the scheduler peeking at node state between events never holds anything
+    if (!g_current) return pdTRUE;
+
+    uint64_t start = g_now;
+    while (sem->count == 0) {
+        if (!sim_block(&sem->waiters, remaining(ticks, start))) {
+            if (sem->count) break;
+            return pdFALSE;
+        }
+    }
+    sem->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    if (!g_current) return pdTRUE;
+    if (sem->count >= sem->max) return pdFALSE;
+    sem->count++;
+    sim_wake_all(&sem->waiters);
+    return pdTRUE;
+}
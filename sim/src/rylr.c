@@ -0,0 +1,265 @@
+// model of the REYAX RYLR998 AT firmware sitting on the other end of each
+// node's uart. commands are taken one at a time in arrival order; AT+SEND keys
+// the radio and answers +OK once the frame is off the air, everything else
+// answers after a short processing delay. both directions of the serial link
+// are paced at the configured baud rate.
+
+#include "sim.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_codec.h"
+
+#define PROCESS_MS (2)
+
+static void process_next(SimNode *node);
+
+void rylr_init(SimRylr *rylr) {
+    memset(rylr, 0, sizeof(*rylr));
+    // factory defaults: AT+PARAMETER=9,7,1,12 at 9600 baud, address 0
+    rylr->sf = 9;
+    rylr->bw = 7;
+    rylr->cr = 1;
+    rylr->preamble = 12;
+    rylr->baud = BAUD;
+}
+
+static double bandwidth_hz(int code) {
+    switch (code) {
+        case 8: return 250000.0;
+        case 9: return 500000.0;
+        default: return 125000.0;
+    }
+}
+
+// semtech time on air (AN1200.13), explicit header, crc on
+double rylr_airtime_ms(const SimRylr *rylr, size_t payload_len) {
+    double t_sym = (double)(1 << rylr->sf) / bandwidth_hz(rylr->bw) * 1000.0;
+    int de = t_sym > 16.0 ? 1 : 0;
+    double t_preamble = (rylr->preamble + 4.25) * t_sym;
+    double num = 8.0 * payload_len - 4.0 * rylr->sf + 28 + 16;
+    double den = 4.0 * (rylr->sf - 2 * de);
+    double symbols = 8 + fmax(ceil(num / den) * (rylr->cr + 4), 0);
+    return t_preamble + symbols * t_sym;
+}
+
+static uint64_t serial_ms(const SimRylr *rylr, size_t bytes) {
+    // 8N1 is 10 bits on the wire per byte
+    return (uint64_t) ceil(bytes * 10.0 * 1000.0 / rylr->baud);
+}
+
+typedef struct {
+    SimNode *node;
+    size_t len;
+    char data[];
+} SerialChunk;
+
+static void deliver_to_host(void *arg, uint64_t tag) {
+    (void) tag;
+    SerialChunk *chunk = arg;
+    sim_node_uart_rx(chunk->node, chunk->data, chunk->len);
+    free(chunk);
+}
+
+static void emit(SimNode *node, const char *data, size_t len) {
+    SimRylr *rylr = &node->rylr;
+    SerialChunk *chunk = malloc(sizeof(SerialChunk) + len);
+    if (!chunk) return;
+    chunk->node = node;
+    chunk->len = len;
+    memcpy(chunk->data, data, len);
+
+    uint64_t start = sim_now_ms() > rylr->to_host_free_ms ? sim_now_ms() : rylr->to_host_free_ms;
+    rylr->to_host_free_ms = start + serial_ms(rylr, len);
+    sim_at(rylr->to_host_free_ms, deliver_to_host, chunk, 0);
+}
+
+static void emit_line(SimNode *node, const char *line) {
+    char buffer[64];
+    int n = snprintf(buffer, sizeof(buffer), "%s\r\n", line);
+    emit(node, buffer, (size_t) n);
+}
+
+static void finish_command(void *arg, uint64_t tag) {
+    (void) tag;
+    SimNode *node = arg;
+    node->rylr.busy = false;
+    process_next(node);
+}
+
+static void send_done(void *arg, uint64_t tag) {
+    (void) tag;
+    SimNode *node = arg;
+    emit_line(node, "+OK");
+    node->rylr.busy = false;
+    process_next(node);
+}
+
+static bool parse_uint(const char **p, long *out) {
+    char *end;
+    long v = strtol(*p, &end, 10);
+    if (end == *p) return false;
+    *p = end;
+    *out = v;
+    return true;
+}
+
+static void handle_send(SimNode *node, const char *args, size_t args_len) {
+    // AT+SEND=<address>,<length>,<data>
+    const char *p = args;
+    long dest, len;
+    if (!parse_uint(&p, &dest) || *p++ != ',' || !parse_uint(&p, &len) || *p++ != ',') {
+        emit_line(node, "+ERR=4");
+        return;
+    }
+    size_t have = args_len - (size_t)(p - args);
+    if (len > LORA_MAX_PAYLOAD) {
+        emit_line(node, "+ERR=13");
+        return;
+    }
+    if (len < 0 || (size_t) len != have) {
+        emit_line(node, "+ERR=5");
+        return;
+    }
+
+    node->rylr.busy = true;
+    uint64_t done = radio_transmit(node, (ID) dest, p, (size_t) len);
+    sim_at(done, send_done, node, 0);
+}
+
+static void handle_command(SimNode *node, const char *line, size_t len) {
+    SimRylr *rylr = &node->rylr;
+    char reply[64];
+    long v;
+
+    if (strncmp(line, "AT+SEND=", 8) == 0) {
+        handle_send(node, line + 8, len - 8);
+        return;
+    }
+
+    rylr->busy = true;
+    sim_at(sim_now_ms() + PROCESS_MS, finish_command, node, 0);
+
+    const char *p;
+    if (strcmp(line, "AT") == 0) {
+        emit_line(node, "+OK");
+    } else if (strcmp(line, "AT+ADDRESS?") == 0) {
+        snprintf(reply, sizeof(reply), "+ADDRESS=%u", rylr->address);
+        emit_line(node, reply);
+    } else if (strncmp(line, "AT+ADDRESS=", 11) == 0) {
+        p = line + 11;
+        if (parse_uint(&p, &v) && v >= 0 && v <= 65535) {
+            rylr->address = (ID) v;
+            emit_line(node, "+OK");
+        } else {
+            emit_line(node, "+ERR=4");
+        }
+    } else if (strcmp(line, "AT+PARAMETER?") == 0) {
+        snprintf(reply, sizeof(reply), "+PARAMETER=%d,%d,%d,%d", rylr->sf, rylr->bw, rylr->cr, rylr->preamble);
+        emit_line(node, reply);
+    } else if (strncmp(line, "AT+PARAMETER=", 13) == 0) {
+        int sf, bw, cr, pre;
+        if (sscanf(line + 13, "%d,%d,%d,%d", &sf, &bw, &cr, &pre) == 4 &&
+            sf >= 5 && sf <= 12 && bw >= 7 && bw <= 9 && cr >= 1 && cr <= 4 && pre >= 4) {
+            rylr->sf = sf;
+            rylr->bw = bw;
+            rylr->cr = cr;
+            rylr->preamble = pre;
+            emit_line(node, "+OK");
+        } else {
+            emit_line(node, "+ERR=4");
+        }
+    } else if (strcmp(line, "AT+IPR?") == 0) {
+        snprintf(reply, sizeof(reply), "+IPR=%d", rylr->baud);
+        emit_line(node, reply);
+    } else if (strcmp(line, "AT+NETWORKID?") == 0) {
+        emit_line(node, "+NETWORKID=18");
+    } else if (strcmp(line, "AT+BAND?") == 0) {
+        emit_line(node, "+BAND=915000000");
+    } else if (strcmp(line, "AT+CRFOP?") == 0) {
+        emit_line(node, "+CRFOP=22");
+    } else if (strcmp(line, "AT+RESET") == 0) {
+        emit_line(node, "+RESET");
+        emit_line(node, "+READY");
+    } else if (strncmp(line, "AT+", 3) == 0 && strchr(line, '=')) {
+        // settings we do not model are accepted and ignored
+        emit_line(node, "+OK");
+    } else if (strncmp(line, "AT", 2) != 0) {
+        emit_line(node, "+ERR=2");
+    } else {
+        emit_line(node, "+ERR=4");
+    }
+}
+
+static void process_next(SimNode *node) {
+    SimRylr *rylr = &node->rylr;
+    while (!rylr->busy && rylr->pending_count) {
+        char *line = rylr->pending[rylr->pending_head];
+        rylr->pending_head = (rylr->pending_head + 1) % (int)(sizeof(rylr->pending) / sizeof(rylr->pending[0]));
+        rylr->pending_count--;
+        handle_command(node, line, strlen(line));
+        free(line);
+    }
+}
+
+typedef struct {
+    SimNode *node;
+    size_t len;
+    char data[];
+} HostChunk;
+
+static void module_receive(void *arg, uint64_t tag) {
+    (void) tag;
+    HostChunk *chunk = arg;
+    SimNode *node = chunk->node;
+    SimRylr *rylr = &node->rylr;
+    const int depth = (int)(sizeof(rylr->pending) / sizeof(rylr->pending[0]));
+
+    for (size_t i = 0; i < chunk->len; i++) {
+        char ch = chunk->data[i];
+        if (ch == '\n' && rylr->cmd_len && rylr->cmd[rylr->cmd_len - 1] == '\r') {
+            rylr->cmd[rylr->cmd_len - 1] = '\0';
+            if (rylr->pending_count < depth) {
+                int slot = (rylr->pending_head + rylr->pending_count) % depth;
+                rylr->pending[slot] = strdup(rylr->cmd);
+                rylr->pending_count++;
+            }
+            // a full command buffer on the real module just loses the line
+            rylr->cmd_len = 0;
+            continue;
+        }
+        if (rylr->cmd_len < sizeof(rylr->cmd) - 1) {
+            rylr->cmd[rylr->cmd_len++] = ch;
+        } else {
+            rylr->cmd_len = 0;
+        }
+    }
+    free(chunk);
+    process_next(node);
+}
+
+void rylr_host_write(SimNode *node, const void *data, size_t len) {
+    SimRylr *rylr = &node->rylr;
+    HostChunk *chunk = malloc(sizeof(HostChunk) + len);
+    if (!chunk) return;
+    chunk->node = node;
+    chunk->len = len;
+    memcpy(chunk->data, data, len);
+
+    uint64_t start = sim_now_ms() > rylr->to_module_free_ms ? sim_now_ms() : rylr->to_module_free_ms;
+    rylr->to_module_free_ms = start + serial_ms(rylr, len);
+    sim_at(rylr->to_module_free_ms, module_receive, chunk, 0);
+}
+
+void rylr_radio_receive(SimNode *node, ID from, const char *payload, size_t len, int rssi, int snr) {
+    char line[UART_LINE_LEN + 32];
+    int n = snprintf(line, sizeof(line), "+RCV=%u,%zu,", from, len);
+    if (n < 0 || (size_t) n + len + 32 > sizeof(line)) return;
+    memcpy(line + n, payload, len);
+    n += (int) len;
+    n += snprintf(line + n, sizeof(line) - n, ",%d,%d\r\n", rssi, snr);
+    emit(node, line, (size_t) n);
+}
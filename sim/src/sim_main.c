@@ -0,0 +1,639 @@
+// meshsim: run N copies of the firmware over a simulated LoRa channel.
+//
+//   meshsim -n 100 -t random -d 6 -l 0.05 -T 1800 -m 200
+//
+// nodes boot at random times inside --boot-spread, routing is left to converge
+// on its own, then --messages user messages are sent between random pairs
+// (the same create_data_object + queue_send the web ui does) starting at
+// --traffic-start. the report covers convergence time, delivery ratio and
+// latency, and airtime spent per delivered message. with --size longer than a frame they
+// go in fragments (frag_send), like a long message typed into the web ui.
+
+#include "sim.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/task.h"
+
+#ifndef MESHNODE_LIBRARY
+#define MESHNODE_LIBRARY "libmeshnode.so"
+#endif
+
+#define DELIVERY_POLL_MS (50)
+
+typedef struct {
+    int src;
+    int dst;
+    ID id;
+    char *content;
+    uint64_t sent_ms;
+    uint64_t delivered_ms;
+    bool sent;
+    bool delivered;
+} SimMessage;
+
+typedef struct {
+    int nodes;
+    uint64_t seed;
+    double duration_s;
+    double boot_spread_s;
+    int messages;
+    double traffic_start_s;
+    double traffic_rate;
+    double sample_s;
+    const char *library;
+    const char *record_uart;
+    int burst;
+    bool replies;
+    int size;
+    const char *sys_commands[8];
+    int sys_command_count;
+    SimRadioConfig radio;
+} SimOptions;
+
+static SimNode *g_nodes;
+static SimOptions g_opt;
+static int *g_component;
+
+static SimMessage *g_msgs;
+static int g_msg_count;             // messages, and a reply slot for each with --replies
+static int g_msgs_sent;
+static int g_msgs_delivered;
+static double g_airtime_at_traffic_start = -1;
+static double g_airtime_at_last_delivery;
+
+static uint8_t *g_route_found;
+static long g_pairs_total;
+static long g_pairs_found;
+static uint64_t g_converged_ms;
+
+// ---------------------------------------------------------------- convergence
+
+static void sample_routes(void *arg, uint64_t tag) {
+    (void) arg;
+    (void) tag;
+    int n = g_opt.nodes;
+
+    for (int i = 0; i < n; i++) {
+        SimNode *node = &g_nodes[i];
+        if (!*node->fw.g_router) continue; // not booted yet
+        sim_set_context_node(node);
+        for (int j = 0; j < n; j++) {
+            long bit = (long) i * n + j;
+            if (i == j || g_component[i] != g_component[j] || g_route_found[bit]) continue;
+            if (node->fw.router_query_intermediate(*node->fw.g_router, g_nodes[j].address) != NO_ID) {
+                g_route_found[bit] = 1;
+                g_pairs_found++;
+            }
+        }
+    }
+    sim_set_context_node(NULL);
+
+    if (g_pairs_found == g_pairs_total) {
+        g_converged_ms = sim_now_ms();
+        return;
+    }
+    sim_at(sim_now_ms() + (uint64_t)(g_opt.sample_s * 1000), sample_routes, NULL, 0);
+}
+
+// ---------------------------------------------------------------- traffic
+
+static void inject_task(void *arg) {
+    SimMessage *m = arg;
+    SimNode *src = &g_nodes[m->src];
+    SimNode *dst = &g_nodes[m->dst];
+
+    m->sent_ms = sim_now_ms();
+    m->sent = true;
+    g_msgs_sent++;
+    if (g_airtime_at_traffic_start < 0) g_airtime_at_traffic_start = radio_stats()->airtime_ms;
+
+    size_t len = strlen(m->content);
+    if (len > FRAG_CHUNK_MAX && src->fw.frag_send) {
+        // queues its own fragments
+        m->id = src->fw.frag_send(dst->address, m->content, len);
+        return;
+    }
+    m->id = src->fw.create_data_object(NO_ID, NORMAL, m->content, src->address, dst->address,
+                                       src->address, 0, 0, 0, NO_ID);
+    src->fw.queue_send(m->id, dst->address, true);
+}
+
+// "sim msg <k>" or "sim reply <k>", padded out to --size
+static char *message_content(const char *what, int k) {
+    size_t size = g_opt.size > 32 ? (size_t) g_opt.size : 32;
+    char *content = malloc(size + 1);
+    int n = snprintf(content, size + 1, "sim %s %d", what, k);
+    for (size_t i = n; i < (size_t) g_opt.size; i++) content[i] = (char)('a' + (i + k) % 26);
+    if ((size_t) g_opt.size > (size_t) n) content[g_opt.size] = '\0';
+    return content;
+}
+
+static void inject(void *arg, uint64_t tag) {
+    (void) tag;
+    SimMessage *m = arg;
+    sim_task_create(&g_nodes[m->src], "sim inject", inject_task, m);
+}
+
+static void poll_delivery(void *arg, uint64_t tag) {
+    (void) arg;
+    (void) tag;
+    bool pending = false;
+
+    for (int k = 0; k < g_msg_count; k++) {
+        SimMessage *m = &g_msgs[k];
+        if (m->delivered) continue;
+        pending = true;
+        if (!m->sent) continue;
+
+        SimNode *dst = &g_nodes[m->dst];
+        sim_set_context_node(dst);
+        DataEntry *entry = dst->fw.msg_find(m->id);
+        sim_set_context_node(NULL);
+
+        // ids are only unique per origin so make sure it is really ours. one put together
+        // from fragments only matches once all of it is there
+        if (m->id != NO_ID && entry && entry->origin_node == g_nodes[m->src].address && strcmp(entry->content, m->content) == 0) {
+            m->delivered = true;
+            m->delivered_ms = sim_now_ms();
+            g_msgs_delivered++;
+            g_airtime_at_last_delivery = radio_stats()->airtime_ms;
+            if (k < g_opt.messages && g_opt.replies) {
+                // answered straight back, over the same hops the other way
+                SimMessage *reply = &g_msgs[g_opt.messages + k];
+                reply->src = m->dst;
+                reply->dst = m->src;
+                reply->content = message_content("reply", k);
+                sim_at(sim_now_ms(), inject, reply, 0);
+            }
+        }
+    }
+    if (pending) sim_at(sim_now_ms() + DELIVERY_POLL_MS, poll_delivery, NULL, 0);
+}
+
+static void schedule_traffic(void) {
+    g_msg_count = g_opt.replies ? 2 * g_opt.messages : g_opt.messages;
+    g_msgs = calloc(g_msg_count ? g_msg_count : 1, sizeof(SimMessage));
+    uint64_t t = (uint64_t)(g_opt.traffic_start_s * 1000);
+    uint64_t gap = g_opt.traffic_rate > 0 ? (uint64_t)(1000.0 / g_opt.traffic_rate) : 1000;
+
+    for (int k = 0; k < g_opt.messages; k++) {
+        SimMessage *m = &g_msgs[k];
+        // only pick pairs that can reach each other at all
+        int tries = 0;
+        do {
+            m->src = (int)(sim_random() % g_opt.nodes);
+            m->dst = (int)(sim_random() % g_opt.nodes);
+        } while ((m->src == m->dst || g_component[m->src] != g_component[m->dst]) && ++tries < 1000);
+        m->content = message_content("msg", k);
+        sim_at(t, inject, m, 0);
+        t += gap;
+    }
+    if (g_opt.messages) sim_at((uint64_t)(g_opt.traffic_start_s * 1000), poll_delivery, NULL, 0);
+}
+
+// ---------------------------------------------------------------- SYS+ commands
+
+// every node runs the --sys commands once they have all booted, like typing them into
+// each one's web ui
+static void sys_task(void *arg) {
+    SimNode *node = arg;
+    for (int k = 0; k < g_opt.sys_command_count; k++) {
+        char cmd[128];
+        snprintf(cmd, sizeof(cmd), "%s", g_opt.sys_commands[k]);
+        node->fw.resolve_system_command(cmd);
+    }
+}
+
+static void sys_commands(void *arg, uint64_t tag) {
+    (void) arg;
+    (void) tag;
+    for (int i = 0; i < g_opt.nodes; i++) {
+        sim_task_create(&g_nodes[i], "sim sys", sys_task, &g_nodes[i]);
+    }
+}
+
+// ---------------------------------------------------------------- burst
+
+// node 0 pushes a run of frames at node 1 as fast as its sender takes them. with -n 2 -l 0
+// this is a loopback through two modules and measures the uart/AT side of the send path
+
+static ID *g_burst_ids;
+static int g_burst_queued;
+static uint64_t g_burst_start_ms;
+static uint64_t g_burst_done_ms;
+static int g_burst_ok;
+
+static int burst_in_flight(SimNode *src) {
+    int waiting = 0;
+    for (int k = 0; k < g_burst_queued; k++) {
+        DataEntry *entry = src->fw.msg_find(g_burst_ids[k]);
+        if (entry && entry->transfer_status == QUEUED) waiting++;
+    }
+    return waiting;
+}
+
+static void burst_task(void *arg) {
+    SimNode *src = &g_nodes[0];
+    SimNode *dst = &g_nodes[1];
+    g_burst_start_ms = sim_now_ms();
+    for (int k = 0; k < g_opt.burst; k++) {
+        // the firmware send queue holds 16 per class and turns frames away past that, stay under it
+        while (burst_in_flight(src) >= 8) vTaskDelay(pdMS_TO_TICKS(5));
+
+        char content[32];
+        snprintf(content, sizeof(content), "burst %d", k);
+        g_burst_ids[k] = src->fw.create_data_object(NO_ID, NORMAL, content, src->address, dst->address,
+                                                    src->address, 0, 0, 0, NO_ID);
+        g_burst_queued++;
+        src->fw.queue_send(g_burst_ids[k], dst->address, false);
+    }
+}
+
+static void burst_start(void *arg, uint64_t tag) {
+    (void) tag;
+    sim_task_create(&g_nodes[0], "sim burst", burst_task, NULL);
+}
+
+static void burst_poll(void *arg, uint64_t tag) {
+    (void) tag;
+    SimNode *src = &g_nodes[0];
+    if (g_burst_queued == g_opt.burst) {
+        sim_set_context_node(src);
+        int waiting = burst_in_flight(src);
+        g_burst_ok = 0;
+        for (int k = 0; k < g_burst_queued && !waiting; k++) {
+            DataEntry *entry = src->fw.msg_find(g_burst_ids[k]);
+            if (entry && entry->transfer_status == OK) g_burst_ok++;
+        }
+        sim_set_context_node(NULL);
+        if (!waiting) {
+            g_burst_done_ms = sim_now_ms();
+            return;
+        }
+    }
+    sim_at(sim_now_ms() + 5, burst_poll, NULL, 0);
+}
+
+// ---------------------------------------------------------------- report
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// the bucket the p-th percentile falls in, as "<N ms"
+static const char *wait_percentile(const TxClassStats *stats, const SimNode *node, int p, char *out, size_t cap) {
+    uint32_t total = 0, seen = 0;
+    for (int b = 0; b < TX_WAIT_BUCKETS; b++) total += stats->wait[b];
+    for (int b = 0; b < TX_WAIT_BUCKETS; b++) {
+        seen += stats->wait[b];
+        if (total && seen * 100 >= total * (uint32_t) p) {
+            uint32_t bound = node->fw.tx_wait_bucket_ms(b);
+            if (bound) snprintf(out, cap, "<%u", bound);
+            else snprintf(out, cap, ">%u", node->fw.tx_wait_bucket_ms(b - 1));
+            return out;
+        }
+    }
+    snprintf(out, cap, "-");
+    return out;
+}
+
+// per class over every node: frames sent, turned away, how long they sat in the queue and
+// their time on air
+static void report_tx_classes(void) {
+    TxClassStats sum[TX_CLASS_COUNT];
+    memset(sum, 0, sizeof(sum));
+    AirtimeStats air;
+    memset(&air, 0, sizeof(air));
+    bool have_air = false;
+    const SimNode *with = NULL;
+    for (int i = 0; i < g_opt.nodes; i++) {
+        SimNode *node = &g_nodes[i];
+        if (!node->fw.tx_sched_stats) continue;
+        TxClassStats stats[TX_CLASS_COUNT];
+        sim_set_context_node(node);
+        node->fw.tx_sched_stats(stats);
+        for (int c = 0; c < TX_CLASS_COUNT; c++) {
+            sum[c].sent += stats[c].sent;
+            sum[c].rejected += stats[c].rejected;
+            if (stats[c].high_water > sum[c].high_water) sum[c].high_water = stats[c].high_water;
+            for (int b = 0; b < TX_WAIT_BUCKETS; b++) sum[c].wait[b] += stats[c].wait[b];
+        }
+        if (node->fw.airtime_stats) {
+            AirtimeStats node_air;
+            node->fw.airtime_stats(&node_air);
+            for (int c = 0; c < TX_CLASS_COUNT; c++) air.class_ms[c] += node_air.class_ms[c];
+            air.held += node_air.held;
+            have_air = true;
+        }
+        with = node;
+    }
+    sim_set_context_node(NULL);
+    if (!with) return;
+
+    for (int c = 0; c < TX_CLASS_COUNT; c++) {
+        char p50[16], p95[16];
+        fprintf(stdout, "tx %-18s %u sent, %u turned away, deepest %u, wait p50/p95 %s / %s ms",
+               with->fw.tx_class_name((TxClass) c), sum[c].sent, sum[c].rejected, sum[c].high_water,
+               wait_percentile(&sum[c], with, 50, p50, sizeof(p50)), wait_percentile(&sum[c], with, 95, p95, sizeof(p95)));
+        if (have_air) fprintf(stdout, ", %.1f s on air", air.class_ms[c] / 1000.0);
+        fprintf(stdout, "\n");
+    }
+    if (have_air) fprintf(stdout, "airtime budget        held the queue %u times\n", air.held);
+}
+
+// printf itself is the firmware's (see log.c), the report goes straight to stdout
+static void report(double wall_s) {
+    const SimRadioStats *radio = radio_stats();
+    int n = g_opt.nodes;
+    int components = 0;
+    for (int i = 0; i < n; i++) if (g_component[i] + 1 > components) components = g_component[i] + 1;
+    long links = 0;
+    for (int i = 0; i < n; i++) links += g_nodes[i].link_count;
+
+    fprintf(stdout, "nodes                 %d\n", n);
+    fprintf(stdout, "topology              %s (%ld links, avg degree %.2f, %d component%s)\n", g_opt.radio.topology,
+           links / 2, n ? (double) links / n : 0.0, components, components == 1 ? "" : "s");
+    fprintf(stdout, "seed                  %llu\n", (unsigned long long) g_opt.seed);
+    fprintf(stdout, "simulated             %.1f s (%.2f s wall, %llu task switches)\n", sim_now_ms() / 1000.0,
+           wall_s, (unsigned long long) sim_context_switches());
+
+    if (g_converged_ms) {
+        fprintf(stdout, "converged             %.1f s\n", g_converged_ms / 1000.0);
+    } else {
+        fprintf(stdout, "converged             no (%ld of %ld reachable pairs have a route)\n", g_pairs_found, g_pairs_total);
+    }
+    fprintf(stdout, "route coverage        %.3f\n", g_pairs_total ? (double) g_pairs_found / g_pairs_total : 1.0);
+
+    fprintf(stdout, "frames tx             %llu\n", (unsigned long long) radio->frames_tx);
+    fprintf(stdout, "frames rx             %llu\n", (unsigned long long) radio->frames_rx);
+    fprintf(stdout, "frames lost           %llu\n", (unsigned long long) radio->frames_lost);
+    fprintf(stdout, "frames collided       %llu\n", (unsigned long long) radio->frames_collided);
+    fprintf(stdout, "airtime total         %.1f s\n", radio->airtime_ms / 1000.0);
+    fprintf(stdout, "frames per airtime    %.3f frames/s (%llu frames carried, bundles count every one in them)\n",
+           radio->airtime_ms > 0 ? radio->frames_carried * 1000.0 / radio->airtime_ms : 0.0,
+           (unsigned long long) radio->frames_carried);
+
+    if (g_opt.messages) {
+        uint64_t *lat = malloc((g_msgs_delivered ? g_msgs_delivered : 1) * sizeof(uint64_t));
+        int c = 0;
+        double sum = 0;
+        for (int k = 0; k < g_msg_count; k++) {
+            if (!g_msgs[k].delivered) continue;
+            lat[c] = g_msgs[k].delivered_ms - g_msgs[k].sent_ms;
+            sum += lat[c++];
+        }
+        qsort(lat, c, sizeof(uint64_t), cmp_u64);
+
+        fprintf(stdout, "messages sent         %d\n", g_msgs_sent);
+        fprintf(stdout, "messages delivered    %d\n", g_msgs_delivered);
+        fprintf(stdout, "delivery ratio        %.3f\n", g_msgs_sent ? (double) g_msgs_delivered / g_msgs_sent : 0.0);
+        if (c) {
+            fprintf(stdout, "latency avg/p50/p95   %.0f / %llu / %llu ms\n", sum / c,
+                   (unsigned long long) lat[c / 2], (unsigned long long) lat[(c * 95) / 100 >= c ? c - 1 : (c * 95) / 100]);
+        }
+        if (g_msgs_delivered && g_airtime_at_traffic_start >= 0) {
+            double window = g_airtime_at_last_delivery - g_airtime_at_traffic_start;
+            fprintf(stdout, "airtime per delivered %.3f s (all traffic while messages were in flight)\n",
+                   window / 1000.0 / g_msgs_delivered);
+            fprintf(stdout, "delivered per airtime %.3f msgs/s\n", window > 0 ? g_msgs_delivered * 1000.0 / window : 0.0);
+        }
+        free(lat);
+    }
+
+    HopAckStats hops = { 0 };
+    bool have_hops = false;
+    for (int i = 0; i < n; i++) {
+        if (!g_nodes[i].fw.hop_ack_stats) continue;
+        // zeroed, older firmware fills in fewer of the fields
+        HopAckStats node_hops = { 0 };
+        sim_set_context_node(&g_nodes[i]);
+        g_nodes[i].fw.hop_ack_stats(&node_hops);
+        hops.tracked += node_hops.tracked;
+        hops.acked += node_hops.acked;
+        hops.retransmits += node_hops.retransmits;
+        hops.fallovers += node_hops.fallovers;
+        hops.given_up += node_hops.given_up;
+        hops.acks_sent += node_hops.acks_sent;
+        hops.acks_carried += node_hops.acks_carried;
+        have_hops = true;
+    }
+    sim_set_context_node(NULL);
+    if (have_hops && hops.tracked) {
+        fprintf(stdout, "hop acks              %u of %u frames acked, %u retransmits, %u fall overs, %u given up\n",
+               hops.acked, hops.tracked, hops.retransmits, hops.fallovers, hops.given_up);
+        if (hops.acks_sent || hops.acks_carried) {
+            fprintf(stdout, "acks answered         %u in frames of their own, %u carried by other frames\n",
+                   hops.acks_sent, hops.acks_carried);
+        }
+    }
+    FragStats frags = { 0 };
+    for (int i = 0; i < n; i++) {
+        if (!g_nodes[i].fw.frag_stats) continue;
+        FragStats node_frags;
+        sim_set_context_node(&g_nodes[i]);
+        g_nodes[i].fw.frag_stats(&node_frags);
+        frags.sent += node_frags.sent;
+        frags.delivered += node_frags.delivered;
+        frags.given_up += node_frags.given_up;
+        frags.fragments_sent += node_frags.fragments_sent;
+        frags.fragments_resent += node_frags.fragments_resent;
+        frags.received += node_frags.received;
+        frags.refused += node_frags.refused;
+        frags.timed_out += node_frags.timed_out;
+    }
+    sim_set_context_node(NULL);
+    if (frags.sent) {
+        fprintf(stdout, "fragmented            %u messages, %u reported whole, %u given up, %u fragments (%u again)\n",
+               frags.sent, frags.delivered, frags.given_up, frags.fragments_sent, frags.fragments_resent);
+        fprintf(stdout, "reassembly            %u put together, %u refused for room, %u timed out\n",
+               frags.received, frags.refused, frags.timed_out);
+    }
+    report_tx_classes();
+
+    if (g_opt.burst) {
+        if (g_burst_done_ms) {
+            double secs = (g_burst_done_ms - g_burst_start_ms) / 1000.0;
+            fprintf(stdout, "burst                 %d frames in %.2f s, %.2f frames/s (%d answered +OK)\n",
+                    g_opt.burst, secs, secs > 0 ? g_opt.burst / secs : 0.0, g_burst_ok);
+        } else {
+            fprintf(stdout, "burst                 %d of %d frames queued, not finished\n", g_burst_queued, g_opt.burst);
+        }
+    }
+
+    uint64_t overflow = 0;
+    for (int i = 0; i < n; i++) overflow += g_nodes[i].rx_overflow;
+    if (overflow) fprintf(stdout, "uart rx overflow      %llu bytes\n", (unsigned long long) overflow);
+}
+
+// ---------------------------------------------------------------- main
+
+static void boot(void *arg, uint64_t tag) {
+    (void) tag;
+    sim_node_boot(arg);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -n, --nodes N            virtual nodes (20)\n"
+        "  -t, --topology T         line | ring | grid | random | <file of \"a b [loss] [snr]\"> (random)\n"
+        "  -d, --degree D           average neighbors for random (6)\n"
+        "  -l, --loss P             frame loss on every link (0.05)\n"
+        "      --edge-loss P        extra loss at the edge of range for random (0.3)\n"
+        "      --no-collisions      overlapping frames do not destroy each other\n"
+        "  -s, --seed S             rng seed (1)\n"
+        "  -T, --duration SEC       simulated time (1800)\n"
+        "      --boot-spread SEC    nodes power up at random within this window (30)\n"
+        "  -m, --messages N         user messages to send (100)\n"
+        "      --traffic-start SEC  when user messages start (600)\n"
+        "      --traffic-rate R     user messages per second (0.2)\n"
+        "      --replies            every delivered message is answered by its destination\n"
+        "      --size BYTES         user message length, longer than %d goes in fragments (short)\n"
+        "      --sample SEC         route convergence sampling period (5)\n"
+        "      --lib PATH           node firmware library (%s)\n"
+        "      --record-uart FILE   save the raw bytes node 0's module sends up its uart\n"
+        "      --burst N            at --traffic-start node 0 sends N frames back to back to node 1\n"
+        "      --sys CMD            SYS+ command every node runs once booted, e.g. SYS+METRIC=etx (repeatable)\n"
+        "  -v                       firmware warnings, -vv everything it prints\n",
+        argv0, FRAG_CHUNK_MAX, MESHNODE_LIBRARY);
+}
+
+int main(int argc, char **argv) {
+    g_opt = (SimOptions) {
+        .nodes = 20,
+        .seed = 1,
+        .duration_s = 1800,
+        .boot_spread_s = 30,
+        .messages = 100,
+        .traffic_start_s = 600,
+        .traffic_rate = 0.2,
+        .sample_s = 5,
+        .library = MESHNODE_LIBRARY,
+        .radio = {
+            .topology = "random",
+            .degree = 6,
+            .loss = 0.05,
+            .edge_loss = 0.3,
+            .collisions = true,
+        },
+    };
+
+    enum { OPT_EDGE_LOSS = 256, OPT_NO_COLLISIONS, OPT_BOOT_SPREAD, OPT_TRAFFIC_START,
+           OPT_TRAFFIC_RATE, OPT_SAMPLE, OPT_LIB, OPT_RECORD_UART, OPT_BURST, OPT_SYS, OPT_REPLIES,
+           OPT_SIZE };
+    static const struct option longopts[] = {
+        { "nodes", required_argument, NULL, 'n' },
+        { "topology", required_argument, NULL, 't' },
+        { "degree", required_argument, NULL, 'd' },
+        { "loss", required_argument, NULL, 'l' },
+        { "edge-loss", required_argument, NULL, OPT_EDGE_LOSS },
+        { "no-collisions", no_argument, NULL, OPT_NO_COLLISIONS },
+        { "seed", required_argument, NULL, 's' },
+        { "duration", required_argument, NULL, 'T' },
+        { "boot-spread", required_argument, NULL, OPT_BOOT_SPREAD },
+        { "messages", required_argument, NULL, 'm' },
+        { "traffic-start", required_argument, NULL, OPT_TRAFFIC_START },
+        { "traffic-rate", required_argument, NULL, OPT_TRAFFIC_RATE },
+        { "replies", no_argument, NULL, OPT_REPLIES },
+        { "size", required_argument, NULL, OPT_SIZE },
+        { "sample", required_argument, NULL, OPT_SAMPLE },
+        { "lib", required_argument, NULL, OPT_LIB },
+        { "record-uart", required_argument, NULL, OPT_RECORD_UART },
+        { "burst", required_argument, NULL, OPT_BURST },
+        { "sys", required_argument, NULL, OPT_SYS },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:t:d:l:s:T:m:vh", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'n': g_opt.nodes = atoi(optarg); break;
+            case 't': g_opt.radio.topology = optarg; break;
+            case 'd': g_opt.radio.degree = atof(optarg); break;
+            case 'l': g_opt.radio.loss = atof(optarg); break;
+            case OPT_EDGE_LOSS: g_opt.radio.edge_loss = atof(optarg); break;
+            case OPT_NO_COLLISIONS: g_opt.radio.collisions = false; break;
+            case 's': g_opt.seed = strtoull(optarg, NULL, 10); break;
+            case 'T': g_opt.duration_s = atof(optarg); break;
+            case OPT_BOOT_SPREAD: g_opt.boot_spread_s = atof(optarg); break;
+            case 'm': g_opt.messages = atoi(optarg); break;
+            case OPT_TRAFFIC_START: g_opt.traffic_start_s = atof(optarg); break;
+            case OPT_TRAFFIC_RATE: g_opt.traffic_rate = atof(optarg); break;
+            case OPT_REPLIES: g_opt.replies = true; break;
+            case OPT_SIZE: g_opt.size = atoi(optarg); break;
+            case OPT_SAMPLE: g_opt.sample_s = atof(optarg); break;
+            case OPT_LIB: g_opt.library = optarg; break;
+            case OPT_RECORD_UART: g_opt.record_uart = optarg; break;
+            case OPT_BURST: g_opt.burst = atoi(optarg); break;
+            case OPT_SYS:
+                if (g_opt.sys_command_count == 8) {
+                    fprintf(stderr, "sim: at most 8 --sys commands\n");
+                    return 2;
+                }
+                g_opt.sys_commands[g_opt.sys_command_count++] = optarg;
+                break;
+            case 'v': g_sim_verbose++; break;
+            default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (g_opt.nodes < 2 || g_opt.nodes > 9000 || g_opt.sample_s <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (g_opt.nodes > SIM_MAX_NODES) {
+        // past that every node's tables overflow and the run measures that, not the protocol
+        fprintf(stderr, "meshsim: the node library has room for %d nodes, see SIM_MAX_NODES in CMakeLists.txt\n", SIM_MAX_NODES);
+        return 2;
+    }
+    g_opt.radio.nodes = g_opt.nodes;
+
+    sim_seed(g_opt.seed);
+    g_nodes = calloc(g_opt.nodes, sizeof(SimNode));
+    g_component = malloc(g_opt.nodes * sizeof(int));
+    if (!g_nodes || !g_component) return 1;
+
+    if (sim_nodes_load(g_nodes, g_opt.nodes, g_opt.library) != 0) return 1;
+    if (radio_build(g_nodes, &g_opt.radio) < 0) return 1;
+    if (g_opt.record_uart && !(g_nodes[0].uart_record = fopen(g_opt.record_uart, "wb"))) {
+        fprintf(stderr, "sim: cannot write %s\n", g_opt.record_uart);
+        return 1;
+    }
+    radio_components(g_nodes, g_opt.nodes, g_component);
+
+    int n = g_opt.nodes;
+    g_route_found = calloc((size_t) n * n, 1);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            if (i != j && g_component[i] == g_component[j]) g_pairs_total++;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        sim_at((uint64_t)(sim_random_unit() * g_opt.boot_spread_s * 1000), boot, &g_nodes[i], 0);
+    }
+    sim_at((uint64_t)(g_opt.sample_s * 1000), sample_routes, NULL, 0);
+    if (g_opt.sys_command_count) sim_at((uint64_t)(g_opt.boot_spread_s * 1000) + 1000, sys_commands, NULL, 0);
+    schedule_traffic();
+    if (g_opt.burst > 0) {
+        g_burst_ids = calloc(g_opt.burst, sizeof(ID));
+        sim_at((uint64_t)(g_opt.traffic_start_s * 1000), burst_start, NULL, 0);
+        sim_at((uint64_t)(g_opt.traffic_start_s * 1000), burst_poll, NULL, 0);
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    sim_run_until((uint64_t)(g_opt.duration_s * 1000));
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    fflush(stdout);
+    report((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    if (g_nodes[0].uart_record) fclose(g_nodes[0].uart_record);
+    return 0;
+}
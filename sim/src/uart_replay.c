@@ -0,0 +1,188 @@
+// feeds a recorded module -> host byte stream (meshsim --record-uart, or a capture off
+// a real board) through the firmware's line splitter. the first pass reads in big blocks
+// and releases every line straight away; the other passes cut the stream at random
+// points and hold on to lines for a while, releasing them out of order, to push the ring
+// through its wrap and slot exhaustion paths. every pass has to produce the same lines.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "line_ring.h"
+#include "sim_rng.h"
+
+typedef struct {
+    char **lines;
+    size_t count;
+    size_t cap;
+} LineList;
+
+static LineRing g_ring;
+static uint64_t g_rng;
+
+static uint64_t next_random(void) {
+    return sim_rng_next(&g_rng);
+}
+
+static void list_add(LineList *list, const LineSlice *slice) {
+    if (list->count == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 256;
+        list->lines = realloc(list->lines, list->cap * sizeof(char *));
+    }
+    char *copy = malloc(slice->len + 1);
+    memcpy(copy, slice->data, slice->len);
+    copy[slice->len] = '\0';
+    list->lines[list->count++] = copy;
+}
+
+static void list_free(LineList *list) {
+    for (size_t i = 0; i < list->count; i++) free(list->lines[i]);
+    free(list->lines);
+    memset(list, 0, sizeof(*list));
+}
+
+static void print_line(const char *line) {
+    for (const unsigned char *p = (const unsigned char *) line; *p; p++) {
+        if (*p >= 32 && *p < 127 && *p != '\\') putchar(*p);
+        else printf("\\x%02x", *p);
+    }
+    putchar('\n');
+}
+
+// max_chunk 0 reads as much as the ring takes, hold is how many lines stay out at once
+static int replay(const char *data, size_t len, size_t max_chunk, size_t hold, LineList *out) {
+    LineSlice held[LINE_RING_SLOTS];
+    size_t held_count = 0;
+    size_t pos = 0;
+    int stalls = 0;
+    LineSlice slice;
+
+    line_ring_init(&g_ring);
+    while (pos < len || held_count) {
+        char *dst;
+        size_t space = line_ring_reserve(&g_ring, &dst);
+        size_t n = len - pos < space ? len - pos : space;
+        if (max_chunk && n > 1) n = 1 + next_random() % (n < max_chunk ? n : max_chunk);
+        memcpy(dst, data + pos, n);
+        pos += n;
+        line_ring_commit(&g_ring, n);
+
+        bool got = false;
+        while (line_ring_next(&g_ring, &slice)) {
+            got = true;
+            list_add(out, &slice);
+            if (held_count < hold && held_count < LINE_RING_SLOTS) held[held_count++] = slice;
+            else line_ring_release(&g_ring, &slice);
+        }
+
+        // let some of the held lines go, in any order
+        if (held_count && (held_count >= hold || pos == len || (n == 0 && !got) || next_random() % 4 == 0)) {
+            size_t i = next_random() % held_count;
+            line_ring_release(&g_ring, &held[i]);
+            held[i] = held[--held_count];
+        } else if (n == 0 && !got) {
+            if (++stalls > 1000) {
+                fprintf(stderr, "uart_replay: ring stuck at byte %zu\n", pos);
+                return -1;
+            }
+            continue;
+        }
+        stalls = 0;
+    }
+
+    // an old held line holds up reclaiming every slot after it, so lines can still be
+    // waiting in the ring after the last one was let go
+    while (line_ring_next(&g_ring, &slice)) {
+        list_add(out, &slice);
+        line_ring_release(&g_ring, &slice);
+    }
+    // whatever trails the last terminator is a partial line and never comes out
+    return 0;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s [options] CAPTURE\n"
+        "  -r, --runs N   randomized passes to compare against the first (20)\n"
+        "  -s, --seed S   rng seed (1)\n"
+        "  -p, --print    print the lines, non printable bytes as \\xHH\n",
+        argv0);
+}
+
+int main(int argc, char **argv) {
+    int runs = 20;
+    bool print = false;
+    g_rng = 1;
+
+    static const struct option longopts[] = {
+        { "runs", required_argument, NULL, 'r' },
+        { "seed", required_argument, NULL, 's' },
+        { "print", no_argument, NULL, 'p' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "r:s:ph", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'r': runs = atoi(optarg); break;
+            case 's': g_rng = strtoull(optarg, NULL, 10) | 1; break;
+            case 'p': print = true; break;
+            default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FILE *f = fopen(argv[optind], "rb");
+    if (!f) {
+        fprintf(stderr, "uart_replay: cannot read %s\n", argv[optind]);
+        return 1;
+    }
+    size_t cap = 1 << 16, len = 0, n;
+    char *data = malloc(cap);
+    while ((n = fread(data + len, 1, cap - len, f)) > 0) {
+        len += n;
+        if (len == cap) data = realloc(data, cap *= 2);
+    }
+    fclose(f);
+
+    LineList reference = { 0 };
+    if (replay(data, len, 0, 0, &reference) != 0) return 1;
+    uint32_t dropped = g_ring.dropped_lines;
+    if (print) {
+        for (size_t i = 0; i < reference.count; i++) print_line(reference.lines[i]);
+    }
+
+    int failed = 0;
+    for (int run = 0; run < runs; run++) {
+        static const size_t chunks[] = { 1, 7, 64, 512 };
+        size_t chunk = chunks[run % 4];
+        size_t hold = (size_t)(next_random() % LINE_RING_SLOTS);
+        LineList lines = { 0 };
+        if (replay(data, len, chunk, hold, &lines) != 0) {
+            failed++;
+        } else if (lines.count != reference.count) {
+            fprintf(stderr, "run %d (chunk %zu, hold %zu): %zu lines, first pass had %zu\n",
+                    run, chunk, hold, lines.count, reference.count);
+            failed++;
+        } else {
+            for (size_t i = 0; i < lines.count; i++) {
+                if (strcmp(lines.lines[i], reference.lines[i]) != 0) {
+                    fprintf(stderr, "run %d (chunk %zu, hold %zu): line %zu differs\n", run, chunk, hold, i);
+                    failed++;
+                    break;
+                }
+            }
+        }
+        list_free(&lines);
+    }
+
+    fprintf(stderr, "%zu bytes, %zu lines, %u overlong dropped, %d/%d randomized passes matched\n",
+            len, reference.count, dropped, runs - failed, runs);
+    list_free(&reference);
+    free(data);
+    return failed ? 1 : 0;
+}